@@ -0,0 +1,43 @@
+#ifndef AUDIODEVICE_H
+#define AUDIODEVICE_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct AudioFormat
+{
+    uint32_t sampleRate = 44100;
+    uint16_t channelCount = 2;
+};
+
+// An audio output that pulls interleaved 32 bit float samples from a refill
+// function on its own thread. The device starts when it is constructed and
+// stops when it is destroyed.
+class AudioDevice
+{
+public:
+    // Gets the buffer, its size in frames and the format of the device.
+    // Returns false when the buffer is left silent.
+    using RefillFunc = std::function<bool(float *, uint32_t, const AudioFormat &)>;
+
+    virtual ~AudioDevice() = default;
+
+    virtual const AudioFormat &Format() const = 0;
+
+    // From refilling a buffer until it is played
+    virtual double LatencyMs() const = 0;
+
+    // The most frames the refill function is asked for at once
+    virtual uint32_t MaxFrameCount() const = 0;
+
+    virtual const std::wstring &CurrentDevice() const = 0;
+
+    virtual const std::vector<std::wstring> &Devices() const = 0;
+
+    virtual void SelectDevice(
+        uint32_t index) = 0;
+};
+
+#endif // AUDIODEVICE_H
@@ -0,0 +1,150 @@
+#ifndef AUDIOTELEMETRY_H
+#define AUDIOTELEMETRY_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Records how long every audio callback and every plugin in it took, in
+// ring buffers that the audio thread and the render workers write without
+// locks or allocations. The UI thread reads the latest records to show the
+// DSP load, and DumpTrace() writes them in the Chrome trace format, to be
+// opened in chrome://tracing or Perfetto.
+class AudioTelemetry
+{
+public:
+    static const size_t CallbackCapacity = 4096;
+    static const size_t PluginCapacity = 65536;
+
+    struct CallbackRecord
+    {
+        uint64_t index = 0;
+        int64_t startNs = 0;
+        int64_t durationNs = 0;
+        uint32_t frameCount = 0;
+        uint32_t sampleRate = 0;
+
+        // The time the device plays the buffer in
+        int64_t PeriodNs() const;
+
+        // The part of the period the callback took, above 1 it was too late
+        double Load() const;
+    };
+
+    struct PluginRecord
+    {
+        uint64_t callbackIndex = 0;
+        uintptr_t plugin = 0;
+        uint32_t thread = 0;
+        int64_t startNs = 0;
+        int64_t durationNs = 0;
+    };
+
+    struct Summary
+    {
+        size_t callbackCount = 0;
+        double averageLoad = 0.0;
+        double peakLoad = 0.0;
+        uint64_t deadlineMisses = 0;
+    };
+
+    // Times one audio callback, from construction to destruction
+    class CallbackScope
+    {
+    public:
+        CallbackScope(
+            AudioTelemetry *telemetry,
+            uint32_t frameCount,
+            uint32_t sampleRate);
+
+        ~CallbackScope();
+
+    private:
+        AudioTelemetry *_telemetry;
+        uint32_t _frameCount;
+        uint32_t _sampleRate;
+        int64_t _startNs = 0;
+    };
+
+    AudioTelemetry();
+
+    // Nanoseconds since the telemetry was created
+    int64_t Now() const;
+
+    // Called from the audio thread
+    void BeginCallback(
+        int64_t startNs);
+
+    void EndCallback(
+        int64_t startNs,
+        uint32_t frameCount,
+        uint32_t sampleRate);
+
+    // Called from any thread that runs a plugin during a callback
+    void RecordPlugin(
+        const void *plugin,
+        int64_t startNs,
+        int64_t endNs);
+
+    uint64_t DeadlineMissCount() const;
+
+    // The latest records, oldest first. Records that are overwritten while
+    // they are read are left out.
+    std::vector<CallbackRecord> Callbacks(
+        size_t maxCount = CallbackCapacity) const;
+
+    std::vector<PluginRecord> Plugins(
+        size_t maxCount = PluginCapacity) const;
+
+    static Summary Summarize(
+        const std::vector<CallbackRecord> &callbacks);
+
+    // The plugin names are looked up by the plugin pointers in the records
+    bool DumpTrace(
+        const std::string &filepath,
+        const std::map<uintptr_t, std::string> &pluginNames) const;
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    // Every slot has a sequence number that is odd while the slot is
+    // written, so a reader can tell when it copied a half written record
+    template <class T, size_t Capacity>
+    class Ring
+    {
+    public:
+        void Write(
+            const T &record);
+
+        std::vector<T> Read(
+            size_t maxCount) const;
+
+    private:
+        struct Slot
+        {
+            std::atomic<uint32_t> sequence = 0;
+            uint64_t index = 0;
+            T record;
+        };
+
+        std::array<Slot, Capacity> _slots;
+        std::atomic<uint64_t> _writeIndex = 0;
+    };
+
+    std::chrono::steady_clock::time_point _epoch;
+    std::atomic<uint64_t> _callbackIndex = 0;
+    std::atomic<uint64_t> _deadlineMisses = 0;
+    Ring<CallbackRecord, CallbackCapacity> _callbacks;
+    Ring<PluginRecord, PluginCapacity> _plugins;
+
+    static uint32_t ThreadNumber();
+};
+
+#endif // AUDIOTELEMETRY_H
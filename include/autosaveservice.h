@@ -0,0 +1,89 @@
+#ifndef AUTOSAVESERVICE_H
+#define AUTOSAVESERVICE_H
+
+#include <itracksmanager.h>
+#include <songsnapshot.h>
+#include <workerpool.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Saves the song in the binary format on a background thread. Only copying
+// the song happens on the calling thread. Asking the plugins for their
+// chunks, writing, syncing and renaming the file happen on the thread of the
+// service. A file is written next to
+// the target first and renamed over it when it is complete, so a crash while
+// saving leaves the previous save intact.
+class AutosaveService
+{
+public:
+    AutosaveService();
+
+    // Writes the saves that are still pending before returning
+    ~AutosaveService();
+
+    // A zero interval turns autosaving off
+    void SetInterval(
+        std::chrono::seconds interval);
+
+    std::chrono::seconds Interval() const { return _interval; }
+
+    void SetFilePath(
+        const std::string &filepath);
+
+    // Call this between two frames of the UI. Takes a snapshot when the
+    // interval has passed and the previous save is done.
+    void Tick(
+        ITracksManager *tracks);
+
+    // Takes a snapshot now and saves it in the background
+    void Save(
+        ITracksManager *tracks,
+        const std::string &filepath);
+
+    // Waits until all pending saves are written
+    void Flush();
+
+    bool LastSaveSucceeded() const { return _lastSaveSucceeded.load(); }
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    struct Job
+    {
+        std::unique_ptr<SongSnapshot> snapshot;
+        std::string filepath;
+    };
+
+    std::chrono::seconds _interval = std::chrono::seconds(60);
+    std::string _filepath;
+    std::chrono::steady_clock::time_point _lastSave = std::chrono::steady_clock::now();
+
+    std::mutex _mutex;
+    std::condition_variable _jobAdded;
+    std::condition_variable _jobsDone;
+    std::deque<Job> _jobs;
+    bool _writing = false;
+    bool _stopping = false;
+    std::atomic<bool> _lastSaveSucceeded = true;
+
+    // Only used by the thread of the service, to ask the plugins for their chunks
+    WorkerPool _chunkWorkerPool;
+    std::thread _thread;
+
+    void WriterLoop();
+
+    static bool WriteFile(
+        SongSnapshot &snapshot,
+        const std::string &filepath);
+};
+
+#endif // AUTOSAVESERVICE_H
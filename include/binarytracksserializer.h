@@ -0,0 +1,54 @@
+#ifndef BINARYTRACKSSERIALIZER_H
+#define BINARYTRACKSSERIALIZER_H
+
+#include <ipluginservice.h>
+#include <itracksmanager.h>
+#include <songsnapshot.h>
+#include <workerpool.h>
+
+// Saves and loads songs in a versioned binary file. The file starts with a
+// table of sections. Events are stored as packed arrays and plugin chunks as
+// raw bytes, and the file is memory mapped when it is loaded. The YAML
+// format of TracksSerializer stays for interchange.
+class BinaryTracksSerializer
+{
+public:
+    static constexpr uint32_t Version = 1;
+
+    BinaryTracksSerializer(
+        ITracksManager *tracks,
+        IPluginService *vstPluginService);
+
+    // When set, the plugins are loaded and asked for their chunks in
+    // parallel on the pool. Without a pool that happens one after another on
+    // the calling thread.
+    void SetWorkerPool(
+        WorkerPool *workerPool);
+
+    bool Serialize(
+        const std::string &filepath);
+
+    // Writes a snapshot without touching the tracks or plugins, so it can be
+    // called from any thread
+    static bool Serialize(
+        SongSnapshot &snapshot,
+        const std::string &filepath);
+
+    bool Deserialize(
+        const std::string &filepath);
+
+    // True when the file starts like a binary song file
+    static bool IsBinaryFile(
+        const std::string &filepath);
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    ITracksManager *_tracks = nullptr;
+    IPluginService *_vstPluginService = nullptr;
+    WorkerPool *_workerPool = nullptr;
+};
+
+#endif // BINARYTRACKSSERIALIZER_H
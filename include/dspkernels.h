@@ -0,0 +1,94 @@
+#ifndef DSPKERNELS_H
+#define DSPKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// The inner loops of the mixer and the processing graph. Every kernel has a scalar version and, on
+// x86, SSE2 and AVX versions where they are faster; the widest one the CPU
+// supports is picked at startup. Buffers do not have to be aligned.
+//
+// When a planar source has fewer channels than the interleaved buffer, the
+// destination channels wrap around the source channels, so a mono plugin
+// plays on both sides. When it has more, the extra channels are left out.
+class DspKernels
+{
+public:
+    enum class InstructionSets
+    {
+        Scalar,
+        Sse2,
+        Avx,
+    };
+
+    // The widest instruction set this CPU supports
+    static InstructionSets Available();
+
+    static InstructionSets Current();
+
+    // Limits the kernels to an instruction set, it is clamped to what is
+    // available. Not meant to be called while audio is rendered.
+    static void Use(
+        InstructionSets instructionSet);
+
+    static const char *Name(
+        InstructionSets instructionSet);
+
+    static void Clear(
+        float *data,
+        size_t sampleCount);
+
+    // data += source * gain
+    static void Accumulate(
+        float *data,
+        const float *source,
+        size_t sampleCount,
+        float gain = 1.0f);
+
+    // data += source * gain for interleaved buffers, where the gain of
+    // channel c at frame f is gains[c] + steps[c] * f. Used to ramp a gain
+    // change over many samples instead of jumping to it.
+    static void AccumulateRamp(
+        float *data,
+        const float *source,
+        uint32_t channelCount,
+        size_t frameCount,
+        const float *gains,
+        const float *steps);
+
+    // The largest absolute sample, to tell when a plugin is silent
+    static float Peak(
+        const float *data,
+        size_t sampleCount);
+
+    // Copies the planar source channels into an interleaved buffer
+    static void Interleave(
+        float *data,
+        uint32_t channelCount,
+        const float *const *source,
+        uint32_t sourceChannelCount,
+        size_t frameCount);
+
+    // data += source * gain, from planar channels into an interleaved buffer
+    static void InterleaveAccumulate(
+        float *data,
+        uint32_t channelCount,
+        const float *const *source,
+        uint32_t sourceChannelCount,
+        size_t frameCount,
+        float gain = 1.0f);
+
+    // Copies an interleaved buffer into planar channels
+    static void Deinterleave(
+        float *const *data,
+        uint32_t channelCount,
+        const float *source,
+        uint32_t sourceChannelCount,
+        size_t frameCount);
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+};
+
+#endif // DSPKERNELS_H
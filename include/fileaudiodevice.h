@@ -0,0 +1,58 @@
+#ifndef FILEAUDIODEVICE_H
+#define FILEAUDIODEVICE_H
+
+#include "nullaudiodevice.h"
+#include "wavwriter.h"
+
+#include <memory>
+#include <string>
+
+// A NullAudioDevice that writes every block it refills to a WAV file, so
+// what the refill loop produced at device pace can be listened to later.
+class FileAudioDevice :
+    public AudioDevice
+{
+public:
+    FileAudioDevice(
+        RefillFunc refillFunc,
+        const std::string &filepath,
+        const AudioFormat &format = AudioFormat(),
+        uint32_t blockFrameCount = 512);
+
+    virtual ~FileAudioDevice();
+
+    // False when the file could not be created, the device does not run
+    bool IsOpen() const;
+
+    virtual const AudioFormat &Format() const;
+
+    virtual double LatencyMs() const;
+
+    virtual uint32_t MaxFrameCount() const;
+
+    virtual const std::wstring &CurrentDevice() const;
+
+    virtual const std::vector<std::wstring> &Devices() const;
+
+    virtual void SelectDevice(
+        uint32_t index);
+
+    uint64_t BlockCount() const;
+
+    uint64_t LateBlockCount() const;
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    WavWriter _writer;
+    AudioFormat _format;
+    std::wstring _currentDevice;
+    std::vector<std::wstring> _devices;
+
+    // Declared last, its thread is stopped before the file is closed
+    std::unique_ptr<NullAudioDevice> _device;
+};
+
+#endif // FILEAUDIODEVICE_H
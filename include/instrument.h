@@ -1,11 +1,13 @@
 #ifndef INSTRUMENT_H
 #define INSTRUMENT_H
 
+#include "processinggraph.h"
 #include "vstplugin.h"
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <string>
-
-#define MAX_EFFECT_PLUGINS 4
+#include <vector>
 
 class Instrument
 {
@@ -28,13 +30,56 @@ public:
     void SetInstrumentPlugin(
         std::shared_ptr<VstPlugin> plugin);
 
+    // Sends midi to the instrument plugin without taking the lock, so the
+    // midi and ui threads never make the audio thread wait. Does nothing
+    // when there is no instrument plugin. Not for the audio thread, the
+    // reference it takes could be the last one to the plugin.
+    void SendMidiNote(
+        int midiChannel,
+        int noteNumber,
+        bool onOff,
+        int velocity);
+
+    void SendMidiController(
+        int midiChannel,
+        int controller,
+        int value);
+
+    // The effects are chained after the instrument plugin, there can be as
+    // many as needed. An index without an effect returns nullptr.
+    int EffectPluginCount() const;
+
     const std::shared_ptr<VstPlugin> EffectPlugin(
         int index) const;
 
+    // Setting an index past the last effect adds empty effects before it,
+    // the empty effects at the end are removed
     void SetEffectPlugin(
         int index,
         std::shared_ptr<VstPlugin> plugin);
 
+    // The graph the plugins are processed with, only use it between Lock()
+    // and Unlock(). It is rebuilt when a plugin is set, on the thread that
+    // sets it, and swapped in while the lock is held, so the audio thread
+    // never waits for a graph to be built.
+    ProcessingGraph *Graph() const;
+
+    // Hash of the chunk the plugin was last given or asked for, or 0 when
+    // that is not known. Used to skip sending a chunk the plugin already has.
+    // It is not known while the editor of the plugin is open, or when the
+    // editor was closed after the hash was set.
+    uint64_t InstrumentChunkHash() const;
+
+    void SetInstrumentChunkHash(
+        uint64_t hash);
+
+    uint64_t EffectChunkHash(
+        int index) const;
+
+    void SetEffectChunkHash(
+        int index,
+        uint64_t hash);
+
     void Lock();
 
     void Unlock();
@@ -43,8 +88,41 @@ private:
     std::string _name;
     int _midiChannel = 0;
     std::shared_ptr<VstPlugin> _plugin = nullptr;
-    std::shared_ptr<VstPlugin> _effectPlugins[MAX_EFFECT_PLUGINS] = {nullptr};
+    // The same plugin as _plugin, read by the senders that do not lock
+    std::atomic<std::shared_ptr<VstPlugin>> _midiPlugin;
+    std::vector<std::shared_ptr<VstPlugin>> _effectPlugins;
+    struct ChunkHash
+    {
+        uint64_t hash = 0;
+        uint64_t editorCloseCount = 0;
+    };
+
+    ChunkHash _pluginChunkHash;
+    std::vector<ChunkHash> _effectChunkHashes;
+    std::unique_ptr<ProcessingGraph> _graph;
+    uint64_t _pluginsVersion = 0;
+    uint64_t _graphVersion = 0;
     std::mutex _mutex;
+
+    // Builds a graph for the plugins as they are at pluginsVersion and swaps
+    // it in, unless a graph of a later version is already there. Returns
+    // whether it was swapped in.
+    bool RebuildGraph(
+        std::shared_ptr<VstPlugin> plugin,
+        std::vector<std::shared_ptr<VstPlugin>> effectPlugins,
+        uint64_t pluginsVersion);
+
+    // Closes the editor of a plugin that is no longer in the graph
+    static void ClosePlugin(
+        const std::shared_ptr<VstPlugin> &plugin);
+
+    static uint64_t KnownChunkHash(
+        const ChunkHash &chunkHash,
+        const std::shared_ptr<VstPlugin> &plugin);
+
+    static ChunkHash MakeChunkHash(
+        uint64_t hash,
+        const std::shared_ptr<VstPlugin> &plugin);
 };
 
 #endif // INSTRUMENT_H
@@ -1,6 +1,7 @@
 #ifndef IVSTPLUGINSERVICE_H
 #define IVSTPLUGINSERVICE_H
 
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
@@ -23,6 +24,26 @@ struct PluginDescription
     int outputCount;
     bool isSynth;
     bool hasEditor;
+    int64_t fileSize;
+    int64_t fileTime;
+};
+
+// Filters for QueryPlugins(), they are applied by the plugin library so
+// only the requested page of plugins is loaded
+struct PluginQuery
+{
+    enum class Kinds
+    {
+        All,
+        Instruments,
+        Effects,
+    };
+
+    Kinds kind = Kinds::All;
+    std::string vendorName; // exact match, empty for all vendors
+    std::string search;     // part of the effect or vendor name
+    int offset = 0;
+    int limit = -1; // -1 for no limit
 };
 
 class IPluginService
@@ -38,8 +59,18 @@ public:
 
     virtual std::shared_ptr<VstPlugin> LoadFromFileDialog() = 0;
 
+    // Loads the modules of plugins that are about to be created, so their
+    // instances do not wait on each other for it. The modules stay loaded
+    // as long as the result is kept.
+    virtual std::vector<std::shared_ptr<class PluginModule>> PrewarmModules(
+        const std::vector<std::string> &filenames) = 0;
+
     virtual std::vector<struct PluginDescription> ListPlugins(
         std::function<bool(const struct PluginDescription &)> filter = [](const struct PluginDescription &) { return true; }) = 0;
+
+    // Sorted on the effect name
+    virtual std::vector<struct PluginDescription> QueryPlugins(
+        const struct PluginQuery &query) = 0;
 };
 
 #endif // IVSTPLUGINSERVICE_H
@@ -39,17 +39,40 @@ public:
     virtual std::shared_ptr<Instrument> GetInstrument(
         uint32_t trackId) = 0;
 
+    // The group buses, the master bus is not one of them
+    virtual std::vector<MixerBus> &GetBuses() = 0;
+
+    virtual MixerBus &GetMasterBus() = 0;
+
+    // Also finds the master bus, nullptr when the bus does not exist
+    virtual MixerBus *GetBus(
+        uint32_t busId) = 0;
+
+    virtual uint32_t AddBus(
+        const std::string &name) = 0;
+
+    // The tracks and buses routed into the bus are routed to its output
+    virtual void RemoveBus(
+        uint32_t busId) = 0;
+
     virtual void RemoveActiveRegion() = 0;
 
     virtual void CleanupInstruments() = 0;
 
+    // Sends the events in [start, end) to the instruments. The time range is
+    // mapped onto frameCount frames of the next audio block, starting at
+    // firstFrame, to give each event its offset within the block.
     virtual void SendMidiNotesInSong(
         std::chrono::milliseconds::rep start,
-        std::chrono::milliseconds::rep end) = 0;
+        std::chrono::milliseconds::rep end,
+        uint32_t firstFrame = 0,
+        uint32_t frameCount = 0) = 0;
 
     virtual void SendMidiNotesInRegion(
         std::chrono::milliseconds::rep start,
-        std::chrono::milliseconds::rep end) = 0;
+        std::chrono::milliseconds::rep end,
+        uint32_t firstFrame = 0,
+        uint32_t frameCount = 0) = 0;
 };
 
 #endif // ITRACKSMANAGER_H
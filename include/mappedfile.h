@@ -0,0 +1,40 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Maps a whole file in memory for reading. The mapping is copy-on-write, so
+// the data can be handed to code that expects a writable pointer (like a
+// plugin chunk) without changing the file.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool Open(
+        const std::string &filepath);
+
+    void Close();
+
+    bool IsOpen() const { return _data != nullptr; }
+
+    uint8_t *Data() const { return _data; }
+
+    size_t Size() const { return _size; }
+
+private:
+    uint8_t *_data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    void *_file = nullptr;
+    void *_mapping = nullptr;
+#endif
+};
+
+#endif // MAPPEDFILE_H
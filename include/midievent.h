@@ -2,7 +2,8 @@
 #define MIDIEVENT_H
 
 #include <chrono>
-#include <map>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 struct MidiNoteState
@@ -29,7 +30,114 @@ struct MidiEvent
     uint32_t value;      // velocity or controller value
 
     typedef std::vector<MidiEvent> Collection;
-    typedef std::map<std::chrono::milliseconds::rep, Collection> CollectionInTime;
+};
+
+struct TimedMidiEvent : public MidiEvent
+{
+    TimedMidiEvent();
+    TimedMidiEvent(
+        std::chrono::milliseconds::rep time,
+        const MidiEvent &event);
+
+    std::chrono::milliseconds::rep time; // relative to the start of the region
+
+    typedef std::vector<TimedMidiEvent> Collection; // sorted on time
+};
+
+// A view on a sorted range of timed events that iterates them grouped on
+// time. Every group has a first (the time) and a second (the events at that
+// time), so it reads like a map from time to events.
+class MidiEventsInTime
+{
+public:
+    class Events
+    {
+    public:
+        Events(
+            const TimedMidiEvent *begin,
+            const TimedMidiEvent *end)
+            : _begin(begin), _end(end)
+        {}
+
+        const TimedMidiEvent *begin() const { return _begin; }
+        const TimedMidiEvent *end() const { return _end; }
+        size_t size() const { return size_t(_end - _begin); }
+        bool empty() const { return _begin == _end; }
+        const TimedMidiEvent &operator[](size_t i) const { return _begin[i]; }
+
+    private:
+        const TimedMidiEvent *_begin;
+        const TimedMidiEvent *_end;
+    };
+
+    struct Group
+    {
+        std::chrono::milliseconds::rep first;
+        Events second;
+    };
+
+    class iterator
+    {
+    public:
+        iterator(
+            const TimedMidiEvent *pos,
+            const TimedMidiEvent *end)
+            : _group{0, Events(pos, pos)}, _end(end)
+        {
+            FindGroupEnd();
+        }
+
+        const Group &operator*() const { return _group; }
+        const Group *operator->() const { return &_group; }
+
+        iterator &operator++()
+        {
+            _group.second = Events(_group.second.end(), _group.second.end());
+            FindGroupEnd();
+
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const { return _group.second.begin() == other._group.second.begin(); }
+        bool operator!=(const iterator &other) const { return !(*this == other); }
+
+    private:
+        Group _group;
+        const TimedMidiEvent *_end;
+
+        void FindGroupEnd()
+        {
+            auto groupEnd = _group.second.begin();
+            if (groupEnd == _end)
+            {
+                return;
+            }
+
+            _group.first = groupEnd->time;
+            while (groupEnd != _end && groupEnd->time == _group.first)
+            {
+                ++groupEnd;
+            }
+            _group.second = Events(_group.second.begin(), groupEnd);
+        }
+    };
+
+    MidiEventsInTime(
+        const TimedMidiEvent *begin,
+        const TimedMidiEvent *end)
+        : _begin(begin), _end(end)
+    {}
+
+    iterator begin() const { return iterator(_begin, _end); }
+    iterator end() const { return iterator(_end, _end); }
+    bool empty() const { return _begin == _end; }
+
+    // All events in this view, not grouped
+    Events All() const { return Events(_begin, _end); }
+
+private:
+    const TimedMidiEvent *_begin;
+    const TimedMidiEvent *_end;
 };
 
 #endif // MIDIEVENT_H
@@ -38,7 +38,7 @@ public:
     typedef std::map<unsigned char, CollectionInTime> CollectionInTimeByNote;
 
     static MidiNote::CollectionInTimeByNote ConvertMidiEventsToMidiNotes(
-        const MidiEvent::CollectionInTime &events);
+        const MidiEventsInTime &events);
 };
 
 #endif // MIDINOTE_H
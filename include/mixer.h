@@ -0,0 +1,125 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include "itracksmanager.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Sums the rendered tracks through their group buses into the master bus,
+// with the gain and pan of every track and bus. The routing is compiled into
+// a flat schedule, where every bus comes before the bus it outputs to, and
+// the bus buffers are allocated with it. Prepare() does that on the thread
+// that changes the routing and swaps the schedule in under a lock, like
+// Instrument does with its graph, so Mix() never compiles or allocates.
+//
+// Gain, pan, mute and solo changes are ramped over SmoothingMs so they do
+// not click.
+class Mixer
+{
+public:
+    static const uint32_t SmoothingMs = 20;
+
+    // Compiles the routing and allocates the bus buffers for blocks of up to
+    // sampleCount samples, when the routing changed or the buffers are too
+    // small. Called from the thread that changes the routing.
+    void Prepare(
+        ITracksManager *tracks,
+        size_t sampleCount,
+        uint32_t channelCount);
+
+    // The track buffers are interleaved and in the order of GetTracks(). A
+    // block larger than the prepared size is left silent. Until Prepare()
+    // sees a change in routing the block is mixed with the previous routing.
+    void Mix(
+        ITracksManager *tracks,
+        const std::vector<std::vector<float>> &trackBuffers,
+        float *data,
+        uint32_t frameCount,
+        uint32_t channelCount,
+        uint32_t sampleRate);
+
+    // How often the routing was compiled
+    uint64_t CompileCount() const { return _compileCount; }
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    // Ramps the left and right gain to their targets
+    struct Smoother
+    {
+        uint32_t id = 0;
+        bool started = false;
+        float gains[2] = {0.0f, 0.0f};
+        float targets[2] = {0.0f, 0.0f};
+        uint32_t remainingFrames = 0;
+
+        void SetTargets(
+            float left,
+            float right,
+            uint32_t rampFrames);
+
+        // data += source with the gains
+        void Apply(
+            float *data,
+            const float *source,
+            uint32_t frameCount,
+            uint32_t channelCount,
+            std::vector<float> &channelGains,
+            std::vector<float> &channelSteps);
+    };
+
+    struct TrackStep
+    {
+        size_t trackIndex;
+        size_t outputSlot;
+        Smoother smoother;
+    };
+
+    struct BusStep
+    {
+        size_t busIndex;
+        size_t slot;
+        size_t outputSlot;
+        Smoother smoother;
+    };
+
+    struct Schedule
+    {
+        // What the schedule was compiled from
+        std::vector<uint32_t> trackIds;
+        std::vector<uint32_t> trackOutputs;
+        std::vector<uint32_t> busIds;
+        std::vector<uint32_t> busOutputs;
+
+        // Slot 0 is the master bus, slot i + 1 is GetBuses()[i]
+        std::vector<TrackStep> trackSteps;
+        std::vector<BusStep> busSteps;
+        std::vector<std::vector<float>> slots;
+        size_t sampleCount = 0;
+        std::vector<float> channelGains;
+        std::vector<float> channelSteps;
+    };
+
+    // Only Prepare() replaces the schedule, Mix() uses it under the mutex
+    std::unique_ptr<Schedule> _schedule;
+    Smoother _masterSmoother;
+    std::mutex _mutex;
+    uint64_t _compileCount = 0;
+
+    bool IsCompiledFor(
+        ITracksManager *tracks,
+        size_t sampleCount,
+        uint32_t channelCount) const;
+
+    std::unique_ptr<Schedule> Compile(
+        ITracksManager *tracks,
+        size_t sampleCount,
+        uint32_t channelCount) const;
+};
+
+#endif // MIXER_H
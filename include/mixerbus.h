@@ -0,0 +1,49 @@
+#ifndef MIXERBUS_H
+#define MIXERBUS_H
+
+#include <cstdint>
+#include <string>
+
+// A submix that tracks and other buses are routed into. Its output goes to
+// another bus or to the master bus, which has the id Master.
+class MixerBus
+{
+public:
+    MixerBus();
+
+    uint32_t Id() const { return _id; }
+
+    const std::string &GetName() const { return _name; }
+    void SetName(
+        const std::string &name);
+
+    // Linear, 1.0 leaves the level as it is
+    float GetGain() const { return _gain; }
+    void SetGain(
+        float gain);
+
+    // From -1.0 (left) to 1.0 (right)
+    float GetPan() const { return _pan; }
+    void SetPan(
+        float pan);
+
+    uint32_t GetOutputBus() const { return _outputBus; }
+    void SetOutputBus(
+        uint32_t busId);
+
+    static MixerBus CreateMaster();
+
+    static const uint32_t Master = 0;
+
+private:
+    MixerBus(
+        uint32_t id);
+
+    uint32_t _id;
+    std::string _name = "bus";
+    float _gain = 1.0f;
+    float _pan = 0.0f;
+    uint32_t _outputBus = Master;
+};
+
+#endif // MIXERBUS_H
@@ -0,0 +1,115 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Fixed capacity ring buffer for any number of producer threads and exactly
+// one consumer thread. Push() and Pop() never block and never allocate, so the
+// audio thread can use it without risking a dropout, and the producers do not
+// need a lock the audio thread also takes.
+//
+// Every slot has a sequence number that tells whose turn it is. A producer
+// claims a slot by moving the head forward with a compare exchange, writes
+// the item and then publishes the slot by bumping its sequence.
+template <typename T, size_t Capacity>
+class MpscQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    static constexpr size_t capacity = Capacity;
+
+    MpscQueue()
+    {
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns false when the queue is full, the item is not added in that case.
+    bool Push(
+        const T &item)
+    {
+        auto head = _head.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            auto &slot = _slots[head & (Capacity - 1)];
+            const auto sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(head);
+
+            if (diff == 0)
+            {
+                if (_head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed))
+                {
+                    slot.item = item;
+                    slot.sequence.store(head + 1, std::memory_order_release);
+
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // The consumer did not free this slot yet
+                return false;
+            }
+            else
+            {
+                // Another producer claimed this slot
+                head = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns false when the queue is empty, or when the next item is claimed
+    // but not written yet. Only call this from the consumer thread.
+    bool Pop(
+        T &item)
+    {
+        const auto tail = _tail.load(std::memory_order_relaxed);
+        auto &slot = _slots[tail & (Capacity - 1)];
+
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1)
+        {
+            return false;
+        }
+
+        item = slot.item;
+        slot.sequence.store(tail + Capacity, std::memory_order_release);
+        _tail.store(tail + 1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    // Only an estimate while producers are pushing.
+    size_t Size() const
+    {
+        const auto head = _head.load(std::memory_order_acquire);
+        const auto tail = _tail.load(std::memory_order_acquire);
+
+        return head > tail ? head - tail : 0;
+    }
+
+    bool Empty() const
+    {
+        return Size() == 0;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence{0};
+        T item{};
+    };
+
+    // Head and tail live on their own cache line so the producers and the
+    // consumer do not keep invalidating each others cache.
+    alignas(64) std::atomic<size_t> _head{0};
+    alignas(64) std::atomic<size_t> _tail{0};
+    std::array<Slot, Capacity> _slots;
+};
+
+#endif // MPSCQUEUE_H
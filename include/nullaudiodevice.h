@@ -0,0 +1,65 @@
+#ifndef NULLAUDIODEVICE_H
+#define NULLAUDIODEVICE_H
+
+#include "audiodevice.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// An audio device without hardware. A high resolution timer asks for a block
+// every time the previous block would have been played, so the refill loop
+// runs at the same pace as on a sound card. The sink gets every block after
+// it is refilled.
+class NullAudioDevice :
+    public AudioDevice
+{
+public:
+    using SinkFunc = std::function<void(const float *, uint32_t, bool)>;
+
+    NullAudioDevice(
+        RefillFunc refillFunc,
+        const AudioFormat &format = AudioFormat(),
+        uint32_t blockFrameCount = 512,
+        SinkFunc sinkFunc = nullptr);
+
+    virtual ~NullAudioDevice();
+
+    virtual const AudioFormat &Format() const;
+
+    virtual double LatencyMs() const;
+
+    virtual uint32_t MaxFrameCount() const;
+
+    virtual const std::wstring &CurrentDevice() const;
+
+    virtual const std::vector<std::wstring> &Devices() const;
+
+    virtual void SelectDevice(
+        uint32_t index);
+
+    uint64_t BlockCount() const { return _blockCount; }
+
+    // Blocks that were refilled after they should have been played
+    uint64_t LateBlockCount() const { return _lateBlockCount; }
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    RefillFunc _refillFunc;
+    SinkFunc _sinkFunc;
+    AudioFormat _format;
+    uint32_t _blockFrameCount;
+    std::wstring _currentDevice;
+    std::vector<std::wstring> _devices;
+    std::atomic<bool> _stop = false;
+    std::atomic<uint64_t> _blockCount = 0;
+    std::atomic<uint64_t> _lateBlockCount = 0;
+    std::thread _thread;
+
+    void ThreadFunc();
+};
+
+#endif // NULLAUDIODEVICE_H
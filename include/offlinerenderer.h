@@ -0,0 +1,89 @@
+#ifndef OFFLINERENDERER_H
+#define OFFLINERENDERER_H
+
+#include "itracksmanager.h"
+#include "tracksrenderer.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Renders the song in the tracks manager block by block, as fast as the
+// plugins allow, and writes the result to a WAV file. It does not need an
+// audio device or a window.
+class OfflineRenderer
+{
+public:
+    OfflineRenderer(
+        ITracksManager *tracks);
+
+    void SetBpm(
+        uint32_t bpm);
+
+    void SetWorkerPool(
+        WorkerPool *workerPool);
+
+    void SetTelemetry(
+        AudioTelemetry *telemetry);
+
+    void SetBlockSize(
+        uint32_t blockSize);
+
+    void SetChannelCount(
+        uint16_t channelCount);
+
+    void SetTailLength(
+        std::chrono::milliseconds tailLength);
+
+    uint32_t SampleRate() const;
+
+    // The end of the last region in the song
+    std::chrono::milliseconds::rep SongLength() const;
+
+    bool Render(
+        const std::string &filepath);
+
+    bool Render(
+        const std::string &filepath,
+        std::chrono::milliseconds::rep start,
+        std::chrono::milliseconds::rep end);
+
+    // Renders block by block for a caller that decides the pace, like the
+    // refill function of an audio device. Begin() sets the range, then every
+    // RenderBlock() renders the next block until it returns false when the
+    // song and its tail are done.
+    bool Begin(
+        std::chrono::milliseconds::rep start,
+        std::chrono::milliseconds::rep end);
+
+    bool RenderBlock(
+        float *interleavedData,
+        uint32_t frameCount);
+
+    uint64_t RenderedFrameCount() const { return _renderedFrameCount; }
+
+    std::map<uintptr_t, std::string> PluginNames() const;
+
+private:
+    ITracksManager *_tracks = nullptr;
+    TracksRenderer _tracksRenderer;
+    uint32_t _bpm = 48;
+    uint32_t _blockSize = 1024;
+    uint16_t _channelCount = 2;
+    std::chrono::milliseconds _tailLength = std::chrono::milliseconds(1000);
+    uint64_t _renderedFrameCount = 0;
+    std::chrono::milliseconds::rep _start = 0;
+    std::chrono::milliseconds::rep _end = 0;
+    uint64_t _firstFrame = 0;
+    uint64_t _songFrames = 0;
+    uint64_t _totalFrames = 0;
+
+    std::chrono::milliseconds::rep FramesToSteps(
+        uint64_t frames) const;
+
+    uint64_t StepsToFrames(
+        std::chrono::milliseconds::rep steps) const;
+};
+
+#endif // OFFLINERENDERER_H
@@ -0,0 +1,75 @@
+#ifndef PLUGINLOADQUEUE_H
+#define PLUGINLOADQUEUE_H
+
+#include <instrument.h>
+#include <ipluginservice.h>
+#include <workerpool.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Collects the plugins of a song while it is read, and loads them all at
+// once on a pool of threads, or on the calling thread without a pool. Every module is loaded once up front, then
+// every plugin is created, hashed, opened and given its chunk on a worker.
+// Load() returns when all plugins are set on their instruments, so the
+// tracks are added after that.
+class PluginLoadQueue
+{
+public:
+    // Effect index of the instrument plugin itself
+    static const int InstrumentPluginIndex = -1;
+
+    PluginLoadQueue(
+        IPluginService *vstPluginService,
+        WorkerPool *workerPool = nullptr);
+
+    // The chunk is not copied, it must stay valid until Load() returns
+    void Add(
+        std::shared_ptr<Instrument> instrument,
+        int effectIndex,
+        const std::string &modulePath,
+        uint8_t *chunk,
+        size_t chunkSize,
+        bool sleepAllowed = true);
+
+    // The chunk is base64 decoded on the worker that loads the plugin
+    void AddEncoded(
+        std::shared_ptr<Instrument> instrument,
+        int effectIndex,
+        const std::string &modulePath,
+        std::string encodedChunk,
+        bool sleepAllowed = true);
+
+    size_t Count() const;
+
+    void Load();
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    struct Job
+    {
+        std::shared_ptr<Instrument> instrument;
+        int effectIndex = InstrumentPluginIndex;
+        std::string modulePath;
+        uint8_t *chunk = nullptr;
+        size_t chunkSize = 0;
+        std::string encodedChunk;
+        bool sleepAllowed = true;
+        std::shared_ptr<VstPlugin> plugin;
+    };
+
+    IPluginService *_vstPluginService = nullptr;
+    WorkerPool *_workerPool = nullptr;
+    std::vector<Job> _jobs;
+
+    void LoadJob(
+        Job &job);
+};
+
+#endif // PLUGINLOADQUEUE_H
@@ -0,0 +1,67 @@
+#ifndef PLUGINMODULE_H
+#define PLUGINMODULE_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A loaded plugin library and its resolved entry point. Modules are shared
+// through Load(), so all plugins of the same module use one library handle.
+// The library is unloaded when the last plugin that uses it is cleaned up.
+class PluginModule
+{
+public:
+    ~PluginModule();
+
+    // Returns the module when it is loaded already, can be called from
+    // several threads at once
+    static std::shared_ptr<PluginModule> Load(
+        const std::wstring &path);
+
+    // Loads the modules before their plugins are created. They stay loaded
+    // as long as the returned modules are kept.
+    static std::vector<std::shared_ptr<PluginModule>> Prewarm(
+        const std::vector<std::wstring> &paths);
+
+    // The number of modules that are loaded now
+    static size_t LoadedCount();
+
+    const std::wstring &Path() const;
+
+    // VSTPluginMain, or main for older plugins. Null when the library
+    // has neither.
+    void *EntryProc() const;
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    PluginModule(
+        const std::wstring &path,
+        void *handle);
+
+    std::wstring _path;
+    void *_handle = nullptr;
+    void *_entryProc = nullptr;
+
+    static std::mutex _registryMutex;
+    static std::map<std::wstring, std::weak_ptr<PluginModule>> _registry;
+
+    static std::wstring RegistryKey(
+        const std::wstring &path);
+
+    static void *OpenLibrary(
+        const std::wstring &path);
+
+    static void *FindSymbol(
+        void *handle,
+        const char *name);
+
+    static void CloseLibrary(
+        void *handle);
+};
+
+#endif // PLUGINMODULE_H
@@ -0,0 +1,82 @@
+#ifndef PLUGINSCANNER_H
+#define PLUGINSCANNER_H
+
+#include "ipluginservice.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Finds the plugin modules in a set of directories and probes each of them
+// in a plugin-probe child process, so a plugin that crashes or hangs while
+// loading does not take the host down. Several probes run at once.
+class PluginScanner
+{
+public:
+    struct ScannedModule
+    {
+        int64_t fileSize = -1;
+        int64_t fileTime = -1;
+    };
+
+    struct ProbeResult
+    {
+        std::string path;
+        int64_t fileSize = -1;
+        int64_t fileTime = -1;
+        bool isPlugin = false;
+        PluginDescription description = {};
+    };
+
+    PluginScanner(
+        const std::string &probePath);
+
+    void SetParallelProbes(
+        size_t count);
+
+    void SetProbeTimeout(
+        std::chrono::milliseconds timeout);
+
+    // Called on the probing threads for every module that was a plugin,
+    // the result is stored as the md5 of its description
+    void SetModuleHasher(
+        std::function<std::string(const std::string &)> hashModule);
+
+    // Probes the modules that are not in scannedModules, or whose size or
+    // write time changed since they were scanned
+    std::vector<ProbeResult> Scan(
+        const std::vector<std::string> &directories,
+        const std::map<std::string, ScannedModule> &scannedModules);
+
+    // Can be called from any thread, the probes that already run are
+    // finished first
+    void Cancel();
+
+    static std::vector<ProbeResult> FindModules(
+        const std::vector<std::string> &directories);
+
+    static bool ParseProbeOutput(
+        const std::string &output,
+        PluginDescription &description);
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    std::string _probePath;
+    size_t _parallelProbes = 4;
+    std::chrono::milliseconds _probeTimeout = std::chrono::seconds(30);
+    std::function<std::string(const std::string &)> _hashModule;
+    std::atomic<bool> _cancelled = false;
+
+    bool RunProbe(
+        const std::string &modulePath,
+        std::string &output);
+};
+
+#endif // PLUGINSCANNER_H
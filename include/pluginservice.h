@@ -2,10 +2,14 @@
 #define PLUGINSERVICE_H
 
 #include "ipluginservice.h"
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <sqlitelib.h>
 #include <string>
 
+// LoadPlugin() can be called from several threads at once, like when the
+// plugins of a song are loaded in parallel.
 class PluginService :
     public IPluginService
 {
@@ -21,16 +25,65 @@ public:
 
     virtual std::shared_ptr<class VstPlugin> LoadFromFileDialog();
 
+    virtual std::vector<std::shared_ptr<class PluginModule>> PrewarmModules(
+        const std::vector<std::string> &filenames);
+
     virtual std::vector<struct PluginDescription> ListPlugins(
         std::function<bool(const struct PluginDescription &)> filter = [](const struct PluginDescription &) { return true; });
 
+    virtual std::vector<struct PluginDescription> QueryPlugins(
+        const struct PluginQuery &query);
+
+    // Adds the plugins in the directories to the library. Only modules that
+    // are new or changed since the last scan are probed, this can take a
+    // while so call it from a background thread.
+    void ScanPlugins(
+        const std::vector<std::string> &directories);
+
+    // Lets a running ScanPlugins() return early
+    void CancelScan();
+
+    // The VST2 directories from the registry and VST_PATH, and the common
+    // install locations
+    static std::vector<std::string> DefaultPluginDirectories();
+
 private:
+    typedef sqlitelib::Statement<int, std::string, std::string, std::string, std::string, int, std::string, int, int, int, int, int, int, double, double> PluginStatement;
+
+    // The statements are prepared once and reused, they are declared after
+    // _db so they are finalized before it is closed
     std::unique_ptr<sqlitelib::Sqlite> _db;
+    std::unique_ptr<sqlitelib::Statement<int>> _selectPluginIdStatement;
+    std::unique_ptr<sqlitelib::Statement<void>> _insertPluginStatement;
+    std::unique_ptr<sqlitelib::Statement<void>> _updatePluginStatement;
+    std::unique_ptr<sqlitelib::Statement<std::string>> _selectModuleHashStatement;
+    std::map<int, std::unique_ptr<PluginStatement>> _queryStatements;
     void *_owner;
     std::map<std::wstring, struct PluginDescription> _loadedPlugins;
+    std::mutex _mutex;
+
+    struct ModuleFile
+    {
+        int64_t size = -1;
+        int64_t time = -1;
+        std::string md5;
+    };
+
+    std::map<std::wstring, ModuleFile> _moduleFiles;
+    class PluginScanner *_scanner = nullptr;
+    std::atomic<bool> _scanCancelled = false;
+
+    // Only hashes the module when its size or write time is not the same as
+    // when it was hashed before, in this or an earlier session
+    ModuleFile HashModule(
+        const std::wstring &filename);
 
     void EnsurePluginDescription(
         struct PluginDescription desc);
+
+    // Expects the lock to be taken
+    void StorePluginDescription(
+        const struct PluginDescription &desc);
 };
 
 #endif // PLUGINSERVICE_H
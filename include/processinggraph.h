@@ -0,0 +1,188 @@
+#ifndef PROCESSINGGRAPH_H
+#define PROCESSINGGRAPH_H
+
+#include "audiotelemetry.h"
+#include "vstplugin.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// The audio routing of an instrument, a directed acyclic graph of plugins,
+// sends, splitters and summers that ends in one output node. The input of a
+// node is the sum of the nodes connected to it.
+//
+// Compile() sorts the nodes so every node runs after its inputs and gives
+// every node its channels, Process() only runs that schedule and does not
+// allocate. A graph is built and compiled on the thread that changes it and
+// then handed to the audio thread as a whole, see Instrument.
+//
+// The channels are not owned by the graph, they are slots in a scratch
+// buffer that is passed to Process(). A slot is reused as soon as the last
+// node that reads it has run, like registers in a compiler, so a long chain
+// needs no more scratch than two plugins. The tracks that render on the same
+// thread can share one scratch buffer.
+//
+// A plugin whose input is silent, that has no midi events waiting and whose
+// output stayed below SilenceThreshold for longer than its tail is put to
+// sleep. It is not processed until midi arrives or its input is no longer
+// silent, its output is silence meanwhile. See VstPlugin::isSleepAllowed()
+// to opt out.
+class ProcessingGraph
+{
+public:
+    enum class NodeTypes
+    {
+        Plugin,
+        Send,     // its input times a gain
+        Splitter, // its input, to connect to more than one node
+        Summer,   // its inputs added up
+        Output,
+    };
+
+    typedef uint32_t NodeId;
+
+    // Nodes that are not connected to the output are left out
+    static constexpr NodeId OutputNode = 0;
+
+    // Samples below this, -100dB, are silence
+    static constexpr float SilenceThreshold = 1.0e-5f;
+
+    ProcessingGraph();
+
+    NodeId AddPlugin(
+        std::shared_ptr<VstPlugin> plugin);
+
+    NodeId AddSend(
+        float gain);
+
+    NodeId AddSplitter();
+
+    NodeId AddSummer();
+
+    NodeTypes NodeType(
+        NodeId node) const;
+
+    size_t NodeCount() const;
+
+    // Returns false when a node does not exist, when they are already
+    // connected or when the output would be an input
+    bool Connect(
+        NodeId from,
+        NodeId to);
+
+    // Returns false when the graph has a cycle, the graph cannot be processed
+    // then
+    bool Compile();
+
+    bool IsCompiled() const;
+
+    // The most frames Process() takes at once, the smallest block size of the
+    // plugins in the graph
+    size_t MaxFrameCount() const;
+
+    // The number of floats Process() needs in its scratch buffer
+    size_t ScratchSize() const;
+
+    // The largest ScratchSize() of all graphs compiled so far, so scratch
+    // buffers can be sized before a graph reaches the audio thread
+    static size_t LargestScratchSize();
+
+    // Processes at most MaxFrameCount() frames and returns the planar
+    // channels of the output node, or nullptr when nothing is connected to it.
+    // The channels are in the scratch buffer, which must have ScratchSize()
+    // floats. When a telemetry is given every plugin is timed into it.
+    // This function is called from the audio thread.
+    const float *const *Process(
+        float *scratch,
+        size_t frameCount,
+        uint32_t &channelCount,
+        AudioTelemetry *telemetry = nullptr);
+
+    // The instrument followed by the effects, where the effects that are
+    // nullptr are skipped. The graph is compiled.
+    static std::unique_ptr<ProcessingGraph> CreateChain(
+        const std::shared_ptr<VstPlugin> &instrument,
+        const std::vector<std::shared_ptr<VstPlugin>> &effects);
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    struct Node
+    {
+        NodeTypes type;
+        std::shared_ptr<VstPlugin> plugin;
+        float gain = 1.0f;
+        std::vector<NodeId> inputs;
+    };
+
+    struct Step
+    {
+        VstPlugin *plugin = nullptr;
+
+        // The slots that are cleared and then added up into, from source
+        // slot to sum slot times the gain, before the plugin runs
+        std::vector<uint32_t> sumSlots;
+        std::vector<std::pair<uint32_t, uint32_t>> sums;
+        float gain = 1.0f;
+
+        std::vector<uint32_t> pluginInputSlots;
+        std::vector<uint32_t> pluginOutputSlots;
+
+        // Pointed at the slots in the scratch buffer on every Process()
+        std::vector<float *> pluginInputs;
+        std::vector<float *> pluginOutputs;
+
+        // How long the plugin output was silent while nothing came in
+        size_t tailFrames = 0;
+        size_t silentFrames = 0;
+        bool sleeping = false;
+    };
+
+    // Without plugins in the graph
+    static constexpr size_t DefaultMaxFrameCount = 1024;
+
+    // Slot 0 is cleared on every Process(), for plugin inputs that are not
+    // connected
+    static constexpr uint32_t SilentSlot = 0;
+
+    std::vector<Node> _nodes;
+    bool _compiled = false;
+    size_t _maxFrameCount = 0;
+    std::vector<Step> _schedule;
+    size_t _slotCount = 0;
+    std::vector<uint32_t> _outputSlots;
+    std::vector<float *> _outputChannels;
+
+    // Whether the slot holds silence in the current Process()
+    std::vector<uint8_t> _silentSlots;
+
+    // Returns false when the plugin sleeps, its outputs are cleared then
+    bool WakeOrSleep(
+        Step &step,
+        bool inputSilent,
+        size_t frameCount,
+        float *scratch);
+
+    void UpdateSleep(
+        Step &step,
+        bool inputSilent,
+        bool outputSilent,
+        size_t frameCount);
+
+    NodeId AddNode(
+        NodeTypes type,
+        std::shared_ptr<VstPlugin> plugin,
+        float gain);
+
+    // Depth first from the output, so the inputs of a node end up before it
+    bool Sort(
+        NodeId node,
+        std::vector<uint8_t> &marks,
+        std::vector<NodeId> &order) const;
+};
+
+#endif // PROCESSINGGRAPH_H
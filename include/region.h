@@ -5,8 +5,9 @@
 
 #include <algorithm>
 #include <chrono>
+#include <functional>
 #include <limits>
-#include <map>
+#include <memory>
 #include <numeric>
 #include <string>
 #include <vector>
@@ -24,7 +25,15 @@ public:
     void SetLength(
         std::chrono::milliseconds::rep length);
 
-    const MidiEvent::CollectionInTime &Events() const;
+    // Iterates the events grouped on time
+    MidiEventsInTime Events() const;
+
+    // The events in [start, end), relative to the start of the region
+    MidiEventsInTime EventsInRange(
+        std::chrono::milliseconds::rep start,
+        std::chrono::milliseconds::rep end) const;
+
+    const TimedMidiEvent::Collection &SortedEvents() const;
 
     uint32_t GetMinNote() const;
 
@@ -36,26 +45,71 @@ public:
         bool onOff,
         int velocity);
 
+    // Adds the event as it is, with its channel and type
+    void AddEvent(
+        const TimedMidiEvent &event);
+
     void RemoveEvent(
         std::chrono::milliseconds::rep time,
         uint32_t noteNumber);
 
+    // Removes the first event at the time of the given event with the same
+    // channel, type, number and value
+    void RemoveEvent(
+        const TimedMidiEvent &event);
+
+    // Finds the note on at start and its note off at start + length as they
+    // are in the region, with their channel. Returns false when either is
+    // missing.
+    bool FindNote(
+        std::chrono::milliseconds::rep start,
+        std::chrono::milliseconds::rep length,
+        uint32_t noteNumber,
+        TimedMidiEvent &noteOn,
+        TimedMidiEvent &noteOff) const;
+
     void MoveEvent(
         const MidiEvent &e,
         std::chrono::milliseconds::rep from,
         std::chrono::milliseconds::rep to);
 
+    // Replaces all events at once, for loading a region without adding the
+    // events one by one
+    void SetEvents(
+        TimedMidiEvent::Collection events);
+
+    // Whether a copy of the region shares the events, changing them copies
+    // them first then
+    bool SharesEvents() const;
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
 private:
     std::string _name = "region";
     std::chrono::milliseconds::rep _length = 16000;
-    MidiEvent::CollectionInTime _events; // the long key of the map is the relaive start of the event from the beginning of the region
-    MidiEvent::CollectionInTime _selection;
+    // Sorted on the relative start of the event from the beginning of the region, events at the same
+    // time keep the order they were added in. Copies of a region share the events until one of them
+    // changes, see MutableEvents().
+    std::shared_ptr<TimedMidiEvent::Collection> _events = std::make_shared<TimedMidiEvent::Collection>();
 
     uint32_t _minNote = (std::numeric_limits<uint32_t>::max)();
     uint32_t _maxNote = 0;
 
     void UpdateLength(
         std::chrono::milliseconds::rep time);
+
+    TimedMidiEvent::Collection &MutableEvents();
+
+    void InsertEvent(
+        const TimedMidiEvent &event);
+
+    // The index of the first event at time that matches, or the number of
+    // events when none does. Finding does not detach the shared events.
+    size_t FindEvent(
+        std::chrono::milliseconds::rep time,
+        const std::function<bool(const MidiEvent &)> &match) const;
 };
 
 #endif // REGION_H
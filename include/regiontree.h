@@ -0,0 +1,296 @@
+#ifndef REGIONTREE_H
+#define REGIONTREE_H
+
+#include "region.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <utility>
+
+// The regions of a track, sorted on their start and read like a std::map,
+// that also finds the regions that overlap a range of time.
+//
+// It is a treap of which every node also holds the last end in its subtree,
+// so a search skips the subtrees that end before the range. The nodes are
+// shared by copies of the tree and are not changed once they are shared:
+// adding, removing or changing a region copies only the nodes on the path to
+// it. A copy of the tree costs nothing and a change costs O(log n).
+class RegionTree
+{
+    struct Node;
+
+public:
+    typedef std::chrono::milliseconds::rep key_type;
+    typedef std::pair<const std::chrono::milliseconds::rep, Region> value_type;
+
+    // Walks the regions in order of their start. Every step searches from the
+    // root, so it does not allocate. It is valid as long as the tree it came
+    // from is not changed.
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef RegionTree::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type *pointer;
+        typedef const value_type &reference;
+
+        const_iterator() = default;
+
+        reference operator*() const { return _node->value; }
+
+        pointer operator->() const { return &_node->value; }
+
+        const_iterator &operator++()
+        {
+            _node = Next(_root, _node->value.first);
+
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            auto result = *this;
+            ++*this;
+
+            return result;
+        }
+
+        const_iterator &operator--()
+        {
+            _node = _node == nullptr ? Last(_root) : Previous(_root, _node->value.first);
+
+            return *this;
+        }
+
+        const_iterator operator--(int)
+        {
+            auto result = *this;
+            --*this;
+
+            return result;
+        }
+
+        bool operator==(const const_iterator &other) const { return _node == other._node; }
+
+        bool operator!=(const const_iterator &other) const { return _node != other._node; }
+
+    private:
+        friend class RegionTree;
+
+        const_iterator(
+            const Node *root,
+            const Node *node)
+            : _root(root), _node(node)
+        {}
+
+        const Node *_root = nullptr;
+        const Node *_node = nullptr; // nullptr is the end
+    };
+
+    typedef const_iterator iterator;
+
+    RegionTree() = default;
+
+    // Builds the tree in O(n), the regions of a map are already sorted
+    explicit RegionTree(
+        const std::map<std::chrono::milliseconds::rep, Region> &regions);
+
+    size_t size() const { return _root == nullptr ? 0 : _root->size; }
+
+    bool empty() const { return _root == nullptr; }
+
+    const_iterator begin() const;
+
+    const_iterator end() const { return const_iterator(_root.get(), nullptr); }
+
+    const_iterator find(
+        std::chrono::milliseconds::rep start) const;
+
+    size_t count(
+        std::chrono::milliseconds::rep start) const { return find(start) == end() ? 0 : 1; }
+
+    // Throws std::out_of_range when no region starts there, like a std::map
+    const Region &at(
+        std::chrono::milliseconds::rep start) const;
+
+    void swap(
+        RegionTree &other) { _root.swap(other._root); }
+
+    // Adds the region, unless a region already starts there. Returns whether
+    // it was added.
+    bool Insert(
+        std::chrono::milliseconds::rep start,
+        const Region &region);
+
+    // Returns whether there was a region to remove
+    bool Erase(
+        std::chrono::milliseconds::rep start);
+
+    // Changes the region that starts at the given time with func(Region &),
+    // in a copy of it. Returns false when there is none.
+    bool Edit(
+        std::chrono::milliseconds::rep start,
+        const std::function<void(Region &)> &func);
+
+    // Changes the region that starts at the given time in place, for when
+    // this tree is the only one that holds the nodes on the path to it.
+    // Returns false without calling func when a copy of the tree shares any
+    // of them, or when there is no region.
+    template <typename Func>
+    bool EditUnshared(
+        std::chrono::milliseconds::rep start,
+        Func func)
+    {
+        return EditUnshared(_root, start, func);
+    }
+
+    // Calls func(regionStart, region) for every region that overlaps
+    // [start, end), in order of their start. The end of a region is included,
+    // a note off can sit on it. Finding the regions that start in the range
+    // is O(log n + k), every region that reaches into it from before adds
+    // O(log n). Nothing is allocated, so this can be called from the audio
+    // thread.
+    template <typename Func>
+    void ForEachOverlapping(
+        std::chrono::milliseconds::rep start,
+        std::chrono::milliseconds::rep end,
+        Func func) const
+    {
+        ForEachOverlapping(_root.get(), start, end, func);
+    }
+
+private:
+    struct Node
+    {
+        value_type value;
+        std::chrono::milliseconds::rep end;    // of the region, its start plus its length
+        std::chrono::milliseconds::rep maxEnd; // the last end in the subtree
+        size_t size;                           // the regions in the subtree
+        uint64_t priority;
+        std::shared_ptr<Node> left;
+        std::shared_ptr<Node> right;
+    };
+
+    std::shared_ptr<Node> _root;
+
+    template <typename Func>
+    static void ForEachOverlapping(
+        const Node *node,
+        std::chrono::milliseconds::rep start,
+        std::chrono::milliseconds::rep end,
+        Func &func)
+    {
+        // Nothing in the subtree reaches the range
+        if (node == nullptr || node->maxEnd < start)
+        {
+            return;
+        }
+
+        ForEachOverlapping(node->left.get(), start, end, func);
+
+        // The regions in the right subtree start later still
+        if (node->value.first >= end)
+        {
+            return;
+        }
+
+        if (node->end >= start)
+        {
+            func(node->value.first, node->value.second);
+        }
+
+        ForEachOverlapping(node->right.get(), start, end, func);
+    }
+
+    template <typename Func>
+    static bool EditUnshared(
+        std::shared_ptr<Node> &node,
+        std::chrono::milliseconds::rep start,
+        Func &func)
+    {
+        if (node == nullptr || node.use_count() != 1)
+        {
+            return false;
+        }
+
+        if (start < node->value.first)
+        {
+            if (!EditUnshared(node->left, start, func))
+            {
+                return false;
+            }
+        }
+        else if (node->value.first < start)
+        {
+            if (!EditUnshared(node->right, start, func))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            func(node->value.second);
+        }
+
+        // The region can be longer now
+        Update(*node);
+
+        return true;
+    }
+
+    static const Node *Next(
+        const Node *root,
+        std::chrono::milliseconds::rep start);
+
+    static const Node *Previous(
+        const Node *root,
+        std::chrono::milliseconds::rep start);
+
+    static const Node *Last(
+        const Node *root);
+
+    static std::shared_ptr<Node> MakeNode(
+        std::chrono::milliseconds::rep start,
+        const Region &region);
+
+    static std::shared_ptr<Node> CopyNode(
+        const std::shared_ptr<Node> &node);
+
+    // Sets the end, size and last end of the node from its region and children
+    static void Update(
+        Node &node);
+
+    // Splits the tree in the regions that start before the given time and
+    // the regions that start at or after it
+    static void Split(
+        const std::shared_ptr<Node> &node,
+        std::chrono::milliseconds::rep start,
+        std::shared_ptr<Node> &before,
+        std::shared_ptr<Node> &after);
+
+    // All regions of before start before the regions of after
+    static std::shared_ptr<Node> Merge(
+        const std::shared_ptr<Node> &before,
+        const std::shared_ptr<Node> &after);
+
+    static std::shared_ptr<Node> Insert(
+        const std::shared_ptr<Node> &node,
+        const std::shared_ptr<Node> &added);
+
+    static std::shared_ptr<Node> Erase(
+        const std::shared_ptr<Node> &node,
+        std::chrono::milliseconds::rep start);
+
+    static std::shared_ptr<Node> Edit(
+        const std::shared_ptr<Node> &node,
+        std::chrono::milliseconds::rep start,
+        const std::function<void(Region &)> &func);
+};
+
+#endif // REGIONTREE_H
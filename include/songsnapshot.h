@@ -0,0 +1,62 @@
+#ifndef SONGSNAPSHOT_H
+#define SONGSNAPSHOT_H
+
+#include <itracksmanager.h>
+#include <workerpool.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct PluginSnapshot
+{
+    std::string modulePath;
+    std::vector<uint8_t> chunk;
+    bool sleepAllowed = true;
+
+    // Kept until SongSnapshot::CaptureChunks() asked it for its chunk
+    std::shared_ptr<VstPlugin> plugin;
+};
+
+struct TrackSnapshot
+{
+    Track track;
+    bool hasInstrument = false;
+    std::string instrumentName{};
+    int midiChannel = 0;
+    std::unique_ptr<PluginSnapshot> instrumentPlugin{};
+    std::vector<std::unique_ptr<PluginSnapshot>> effectPlugins{};
+};
+
+// A copy of the song that can be saved on another thread without touching
+// the tracks or plugins. The tracks share their regions and events with the
+// song until either changes them, the plugin chunks are copied when the
+// snapshot is taken.
+struct SongSnapshot
+{
+    std::vector<TrackSnapshot> tracks;
+    std::vector<MixerBus> buses;
+    MixerBus masterBus = MixerBus::CreateMaster();
+
+    // Copies the song and asks the plugins for their chunks, call it where
+    // the song is not being changed, like between two frames of the UI
+    static std::unique_ptr<SongSnapshot> Take(
+        ITracksManager *tracksManager,
+        WorkerPool *workerPool = nullptr);
+
+    // Copies the song like Take(), but leaves asking the plugins for their
+    // chunks to CaptureChunks(). The copy is cheap, the chunks can take a
+    // while, so they are asked for on another thread.
+    static std::unique_ptr<SongSnapshot> TakeWithoutChunks(
+        ITracksManager *tracksManager);
+
+    // Asks the plugins for their chunks and lets go of the plugins. The
+    // instruments are not locked meanwhile, so the audio keeps playing. With
+    // a pool the chunks are asked for in parallel, without one they are
+    // asked for one after another on the calling thread.
+    void CaptureChunks(
+        WorkerPool *workerPool = nullptr);
+};
+
+#endif // SONGSNAPSHOT_H
@@ -0,0 +1,22 @@
+#ifndef TESTINSTRUMENT_H
+#define TESTINSTRUMENT_H
+
+#include "vstplugin.h"
+
+#include <memory>
+
+// A small polyphonic sine synthesizer that is compiled into the host. It
+// behaves like any other VST instrument, so songs can be rendered without
+// loading plugin modules, e.g. on build servers or in batch jobs.
+class TestInstrument
+{
+public:
+    static const char *ModuleName;
+
+    static AEffect *VSTPluginMain(
+        audioMasterCallback hostCallback);
+
+    static std::shared_ptr<VstPlugin> Create();
+};
+
+#endif // TESTINSTRUMENT_H
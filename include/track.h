@@ -2,16 +2,20 @@
 #define TRACK_H
 
 #include "instrument.h"
+#include "mixerbus.h"
 #include "region.h"
+#include "regiontree.h"
 
 #include <glm/glm.hpp>
 #include <map>
 #include <string>
+#include <vector>
 
 class Track
 {
 public:
-    typedef std::map<std::chrono::milliseconds::rep, Region> RegionCollection;
+    // The int key is the absolute start (in timestep=1000 per 1 bar) of the region from the beginning of the song
+    typedef RegionTree RegionCollection;
 
 public:
     Track();
@@ -40,6 +44,21 @@ public:
     void Unmute();
     void ToggleMuted();
 
+    // Linear, 1.0 leaves the level of the instrument as it is
+    float GetGain() const { return _gain; }
+    void SetGain(
+        float gain);
+
+    // From -1.0 (left) to 1.0 (right)
+    float GetPan() const { return _pan; }
+    void SetPan(
+        float pan);
+
+    // The id of the bus the track is mixed into, MixerBus::Master by default
+    uint32_t GetOutputBus() const { return _outputBus; }
+    void SetOutputBus(
+        uint32_t busId);
+
     void Idle();
 
     bool IsReadyForRecoding() { return _readyForRecord; }
@@ -63,11 +82,45 @@ public:
 
     RegionCollection const &Regions() const;
 
+    // Replaces all regions at once, for loading a track without adding the
+    // regions one by one
     void SetRegions(
-        RegionCollection const &regions);
-
-    Region &GetRegion(
-        std::chrono::milliseconds::rep at);
+        std::map<std::chrono::milliseconds::rep, Region> const &regions);
+
+    // The region that starts at the given time, or an empty region when
+    // there is none. Use EditRegion() to change it.
+    const Region &GetRegion(
+        std::chrono::milliseconds::rep at) const;
+
+    // Changes the region that starts at the given time with func(Region &),
+    // nothing happens when there is none. func changes a copy of the region,
+    // which replaces the current one when it is done.
+    template <typename Func>
+    void EditRegion(
+        std::chrono::milliseconds::rep at,
+        Func func)
+    {
+        auto regions = _regions;
+
+        if (!regions.Edit(at, func))
+        {
+            return;
+        }
+
+        PublishRegions(std::move(regions));
+    }
+
+    // Calls func(regionStart, region) for every region that overlaps
+    // [start, end), the regions that start before the range first. The end
+    // of a region is included, a note off can sit on it.
+    template <typename Func>
+    void ForEachRegionInRange(
+        std::chrono::milliseconds::rep start,
+        std::chrono::milliseconds::rep end,
+        Func func) const
+    {
+        _regions.ForEachOverlapping(start, end, func);
+    }
 
     void StartRecording();
 
@@ -87,15 +140,25 @@ public:
     void RemoveRegion(
         std::chrono::milliseconds::rep startAt);
 
-    static std::chrono::milliseconds::rep GetActiveRegionAt(
-        std::map<std::chrono::milliseconds::rep, Region> &regions,
+    std::chrono::milliseconds::rep GetActiveRegionAt(
         std::chrono::milliseconds::rep time,
-        std::chrono::milliseconds::rep margin = 4000);
+        std::chrono::milliseconds::rep margin = 4000) const;
 
     static const uint32_t Null = 0;
 
-    std::string _instrumentDataBase64;
-    std::string _effectsDataBase64[MAX_EFFECT_PLUGINS];
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+    // The plugin settings are not changed in place, only replaced, so copies
+    // of the track share them
+    std::shared_ptr<const std::string> _instrumentDataBase64;
+    std::vector<std::shared_ptr<const std::string>> _effectsDataBase64;
+
+    // Hashes of the chunks above, compared to the hash of the chunk the plugin
+    // has now so an upload is skipped when nothing changed
+    uint64_t _instrumentDataHash = 0;
+    std::vector<uint64_t> _effectsDataHash;
 
 private:
     Track(
@@ -105,11 +168,24 @@ private:
     std::string _name = "track";
     std::shared_ptr<Instrument> _instrument;
     bool _muted = false;
+    float _gain = 1.0f;
+    float _pan = 0.0f;
+    uint32_t _outputBus = MixerBus::Master;
     bool _readyForRecord = false;
     float _color[4];
-    std::map<std::chrono::milliseconds::rep, Region> _regions; // the int key of the map is the absolute start (in timestep=1000 per 1 bar) of the region from the beginning of the song
+
+    // The regions are shared by copies of the track, like the snapshots in
+    // the history, and read by the audio thread under the instrument lock.
+    // A change is made to a copy of the tree, which shares all regions but
+    // the ones on the path to the change, and PublishRegions() swaps it in.
+    RegionCollection _regions;
 
     std::chrono::milliseconds::rep _activeRegion = -1;
+
+    // Swaps the regions in under the instrument lock. The nodes they replace
+    // are let go of after the lock, so the audio thread never frees them.
+    void PublishRegions(
+        RegionCollection regions);
 };
 
 #endif // TRACK_H
@@ -44,25 +44,48 @@ public:
     virtual std::shared_ptr<Instrument> GetInstrument(
         uint32_t trackId);
 
+    virtual std::vector<MixerBus> &GetBuses() { return _buses; }
+
+    virtual MixerBus &GetMasterBus() { return _masterBus; }
+
+    virtual MixerBus *GetBus(
+        uint32_t busId);
+
+    virtual uint32_t AddBus(
+        const std::string &name);
+
+    virtual void RemoveBus(
+        uint32_t busId);
+
     virtual void RemoveActiveRegion();
 
     virtual void CleanupInstruments();
 
     virtual void SendMidiNotesInSong(
         std::chrono::milliseconds::rep start,
-        std::chrono::milliseconds::rep end);
+        std::chrono::milliseconds::rep end,
+        uint32_t firstFrame = 0,
+        uint32_t frameCount = 0);
     
     virtual void SendMidiNotesInRegion(
         std::chrono::milliseconds::rep start,
-        std::chrono::milliseconds::rep end);
+        std::chrono::milliseconds::rep end,
+        uint32_t firstFrame = 0,
+        uint32_t frameCount = 0);
 
 public:
     uint32_t AddVstTrack(
         const char *plugin = nullptr);
 
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
 private:
     std::vector<Track> _tracks;
     std::vector<std::shared_ptr<Instrument>> _instruments;
+    std::vector<MixerBus> _buses;
+    MixerBus _masterBus = MixerBus::CreateMaster();
     uint32_t _activeTrack = 0;
     uint32_t _soloTrack = 0;
     std::tuple<uint32_t, std::chrono::milliseconds::rep> activeRegion{Track::Null, -1};
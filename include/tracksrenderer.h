@@ -0,0 +1,86 @@
+#ifndef TRACKSRENDERER_H
+#define TRACKSRENDERER_H
+
+#include "audiotelemetry.h"
+#include "itracksmanager.h"
+#include "mixer.h"
+#include "workerpool.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Runs the processing graph of all tracks, each into its own buffer, and
+// mixes them into one interleaved buffer with the Mixer. Used by
+// the audio thread in the application and by the OfflineRenderer.
+class TracksRenderer
+{
+public:
+    TracksRenderer();
+
+    void SetTracksManager(
+        ITracksManager *tracks);
+
+    // When set, the tracks are rendered in parallel on the pool. Without a
+    // pool they are rendered one after another on the calling thread.
+    void SetWorkerPool(
+        WorkerPool *workerPool);
+
+    // When set, every plugin that processes audio is timed into it
+    void SetTelemetry(
+        AudioTelemetry *telemetry);
+
+    // The plugins of all tracks by their pointer, to name them in the
+    // telemetry. Called from the thread that changes the tracks.
+    std::map<uintptr_t, std::string> PluginNames() const;
+
+    // Sizes a buffer for every track, for blocks of up to maxFrameCount
+    // frames, and a scratch buffer for every thread that renders, for the
+    // largest graph compiled so far, and compiles the routing of the mixer.
+    // Called from the thread that changes the tracks, the routing, the
+    // plugins or the block size, so RenderTracks() does not allocate. It
+    // returns right away when nothing changed.
+    void Prepare(
+        uint32_t maxFrameCount,
+        uint32_t channelCount);
+
+    // This function is called from the audio thread or from the offline
+    // renderer. A block larger than the prepared size is rendered in parts,
+    // tracks without a prepared buffer or scratch buffer are left out.
+    void RenderTracks(
+        float *data,
+        uint32_t frameCount,
+        uint32_t channelCount,
+        uint32_t sampleRate);
+
+private:
+    ITracksManager *_tracks = nullptr;
+    WorkerPool *_workerPool = nullptr;
+    AudioTelemetry *_telemetry = nullptr;
+
+    // Sized by Prepare(), which swaps in larger buffers under the lock
+    std::vector<std::vector<float>> _trackBuffers;
+    size_t _bufferSampleCount = 0;
+    // The plugins of all tracks that render on a thread share its scratch
+    // buffer, by WorkerPool::WorkerIndex()
+    std::vector<std::vector<float>> _scratchBuffers;
+    size_t _scratchSize = 0;
+    std::mutex _buffersMutex;
+    Mixer _mixer;
+
+    void RenderPart(
+        float *data,
+        uint32_t frameCount,
+        uint32_t channelCount,
+        uint32_t sampleRate);
+
+    void RenderTrack(
+        Track &track,
+        float *data,
+        uint32_t frameCount,
+        uint32_t channelCount);
+};
+
+#endif // TRACKSRENDERER_H
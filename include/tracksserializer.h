@@ -1,8 +1,9 @@
 #ifndef TRACKSSERIALIZER_H
 #define TRACKSSERIALIZER_H
 
-#include <ITracksManager.h>
+#include <itracksmanager.h>
 #include <ipluginservice.h>
+#include <workerpool.h>
 
 class TracksSerializer
 {
@@ -11,15 +12,26 @@ public:
         ITracksManager *tracks,
         IPluginService *vstPluginService);
 
+    // When set, the plugins are loaded and asked for their chunks in
+    // parallel on the pool. Without a pool that happens one after another on
+    // the calling thread.
+    void SetWorkerPool(
+        WorkerPool *workerPool);
+
     void Serialize(
         const std::string &filepath);
 
     bool Deserialize(
         const std::string &filepath);
 
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
 private:
     ITracksManager *_tracks = nullptr;
     IPluginService *_vstPluginService = nullptr;
+    WorkerPool *_workerPool = nullptr;
 };
 
 #endif // TRACKSSERIALIZER_H
@@ -1,12 +1,20 @@
 #ifndef VSTPLUGIN_H
 #define VSTPLUGIN_H
 
+#include "pluginmodule.h"
+#include "mpscqueue.h"
+
 #include <atomic>
+#include <cstdint>
 #include <memory>
-#include <mutex>
 #include <string>
 #include <vector>
+
+#ifdef _WIN32
 #include <windows.h>
+#else
+typedef void *HWND;
+#endif
 
 #pragma warning(push)
 #pragma warning(disable : 4996)
@@ -14,9 +22,20 @@
 #include <public.sdk/source/vst2.x/audioeffect.h>
 #pragma warning(pop)
 
+// The maximum number of midi events that can wait for the next audio block
+#define MAX_PENDING_MIDI_EVENTS 1024
+
+// How long a plugin that does not report its tail may still sound after its
+// input and midi stopped. An instrument's release is in its own output, but
+// an effect like a delay can be silent between two echoes.
+#define UNKNOWN_INSTRUMENT_TAIL_MS 500
+#define UNKNOWN_EFFECT_TAIL_MS 5000
+
 class VstPlugin
 {
 public:
+    typedef AEffect *(VstEntryProc)(audioMasterCallback);
+
     VstPlugin();
 
     ~VstPlugin();
@@ -63,8 +82,10 @@ public:
         void *ptr = nullptr,
         float opt = 0.0f) const;
 
+#ifdef _WIN32
     void resizeEditor(
         const RECT &clientRc) const;
+#endif
 
     void openEditor(
         HWND hWndParent);
@@ -73,23 +94,74 @@ public:
 
     void closeEditor();
 
+    // Counts how often the editor was closed, by the host or by its window.
+    // The state of the plugin may have changed while it was open.
+    uint64_t getEditorCloseCount() const;
+
+    // This function can be called from any thread at the same time, without
+    // a lock. When the queue is full the event is dropped and counted in
+    // getMidiOverflowCount(). The deltaFrames is the offset of the event from
+    // the start of the next block passed to processEvents().
     void sendMidiNote(
         int midiChannel,
         int noteNumber,
         bool onOff,
-        int velocity);
+        int velocity,
+        int deltaFrames = 0);
+
+    // Queues a control change the same way sendMidiNote() queues a note.
+    void sendMidiController(
+        int midiChannel,
+        int controller,
+        int value,
+        int deltaFrames = 0);
 
-    // This function is called from refillCallback() which is running in audio thread.
+    uint32_t getMidiOverflowCount() const;
+
+    // This function is called from the audio thread. It moves the queued midi
+    // events to the pending list, processAudio() hands them to the plugin in
+    // the chunk their deltaFrames falls in.
     void processEvents();
 
-    // This function is called from refillCallback() which is running in audio thread.
-    float **processAudio(
-        size_t frameCount,
-        size_t &outputFrameCount);
+    // This function is called from the audio thread. Whether there are midi
+    // events for the next blocks after processEvents().
+    bool hasPendingMidiEvents() const;
+
+    // This function is called from the audio thread. The plugin reads
+    // getInputCount() channels from the inputs and writes getOutputCount()
+    // channels to the outputs. At most getBlockSize() frames are processed,
+    // the number of frames that were is returned.
+    size_t processAudio(
+        float **inputs,
+        float **outputs,
+        size_t frameCount);
+
+    // This function is called from the audio thread instead of
+    // processAudio() while the plugin sleeps, so the sample position keeps up.
+    void skipAudio(
+        size_t frameCount);
+
+    // Whether the ProcessingGraph may stop processing the plugin while it is
+    // silent. Plugins that change while they are silent, like an arpeggiator
+    // or a tempo synced LFO, need it off.
+    bool isSleepAllowed() const;
+
+    void setSleepAllowed(
+        bool allowed);
+
+    // How many frames the plugin can still sound after its input and midi
+    // stopped, what the plugin reports or the UNKNOWN_*_TAIL_MS when it does
+    // not. Not called from the audio thread.
+    size_t getTailFrames() const;
 
     bool init(
         const char *vstModulePath);
 
+    // Initializes an effect that is compiled into the host, like the TestInstrument.
+    bool init(
+        VstEntryProc *vstEntryProc,
+        const char *name);
+
     void cleanup();
 
     static const char *getVendorString();
@@ -100,8 +172,6 @@ public:
 
     static const char **getCapabilities();
 
-    std::vector<float *> _inputBufferHeads;
-
 private:
     static VstIntPtr hostCallback_static(
         AEffect *effect,
@@ -118,44 +188,49 @@ private:
         void *ptr,
         float);
 
+    bool initEffect(
+        VstEntryProc *vstEntryProc);
+
 protected:
     std::wstring _modulePath;
     std::string _moduleDirectory;
 
     HWND _editorHwnd = nullptr;
-    HMODULE _vstLibraryHandle = nullptr;
+    uint64_t _editorCloseCount = 0;
+    std::shared_ptr<PluginModule> _module;
     AEffect *_aEffect = nullptr;
     std::atomic<size_t> _samplePos;
     VstTimeInfo _timeinfo;
 
-    std::vector<float> _outputBuffer;
-    std::vector<float *> _outputBufferHeads;
-    std::vector<float> _inputBuffer;
 
-    std::vector<VstMidiEvent> _vstMidiEvents;
+    std::vector<VstMidiEvent> _vstMidiEvents; // pending events, sorted on deltaFrames
     std::vector<char> _vstEventBuffer;
     std::string _vstEffectName;
     std::string _vstVendorName;
 
-    struct
-    {
-        std::vector<VstMidiEvent> events;
-        std::unique_lock<std::mutex> lock() const
-        {
-            return std::unique_lock<std::mutex>(mutex);
-        }
-
-    private:
-        std::mutex mutable mutex;
-    } _vstMidi;
+    MpscQueue<VstMidiEvent, MAX_PENDING_MIDI_EVENTS> _vstMidi;
+    std::atomic<uint32_t> _vstMidiOverflowCount = 0;
+    std::atomic<bool> _sleepAllowed = true;
 
+#ifdef _WIN32
     friend LRESULT CALLBACK VstWindowProc(
         HWND hwnd,
         UINT message,
         WPARAM wParam,
         LPARAM lParam);
+#endif
 
     void closingEditorWindow();
+
+    // Hands the pending events of the next frameCount frames to the plugin
+    // and returns how many that were. They stay in the pending list until
+    // releaseDispatchedEvents(), the plugin may read them until then.
+    size_t dispatchPendingEvents(
+        size_t frameCount);
+
+    void releaseDispatchedEvents(
+        size_t dispatchedCount,
+        size_t frameCount);
 };
 
 #endif // VSTPLUGIN_H
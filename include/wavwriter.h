@@ -0,0 +1,41 @@
+#ifndef WAVWRITER_H
+#define WAVWRITER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Writes interleaved 32 bit float samples to a RIFF/WAVE file.
+class WavWriter
+{
+public:
+    WavWriter();
+    ~WavWriter();
+
+    bool Open(
+        const std::string &filepath,
+        uint32_t sampleRate,
+        uint16_t channelCount);
+
+    bool Write(
+        const float *interleavedData,
+        uint32_t frameCount);
+
+    bool Close();
+
+    bool IsOpen() const;
+
+    uint64_t FrameCount() const { return _frameCount; }
+
+private:
+    std::ofstream _file;
+    std::vector<char> _fileBuffer;
+    uint32_t _sampleRate = 0;
+    uint16_t _channelCount = 0;
+    uint64_t _frameCount = 0;
+
+    void WriteHeader();
+};
+
+#endif // WAVWRITER_H
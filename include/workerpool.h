@@ -0,0 +1,78 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that are started up front and sleep until there is
+// work. Run() hands out the tasks through an atomic counter, so no locks are
+// taken and nothing is allocated while the tasks run. The calling thread
+// works along with the pool until all tasks are done.
+//
+// Run() must only be called from one thread at a time, in the application
+// that is the audio thread.
+class WorkerPool
+{
+public:
+    typedef void (*TaskFunc)(void *context, size_t index);
+
+    // The calling thread of Run() works along, so by default the pool
+    // leaves one core for it. Pools that do not render audio, like the one
+    // that loads plugins, pass false for realtime so their threads do not
+    // preempt the audio workers.
+    WorkerPool(
+        size_t threadCount = DefaultThreadCount(),
+        bool realtime = true);
+
+    ~WorkerPool();
+
+    size_t ThreadCount() const;
+
+    // Calls func(context, i) for every i in [0, taskCount) and returns when
+    // all calls are done.
+    void Run(
+        size_t taskCount,
+        TaskFunc func,
+        void *context);
+
+    template <typename Func>
+    void ParallelFor(
+        size_t taskCount,
+        Func &func)
+    {
+        Run(
+            taskCount,
+            [](void *context, size_t index) { (*static_cast<Func *>(context))(index); },
+            &func);
+    }
+
+    static size_t DefaultThreadCount();
+
+    // The thread a task runs on, 0 for the thread that called Run() and 1 to
+    // ThreadCount() for the threads of the pool, so tasks can keep a buffer
+    // per thread
+    static size_t WorkerIndex();
+
+private:
+    std::vector<std::thread> _threads;
+    std::atomic<uint32_t> _generation = 0;
+    std::atomic<uint32_t> _busyWorkers = 0;
+    std::atomic<size_t> _nextTask = 0;
+    std::atomic<bool> _stopping = false;
+    bool _realtime = true;
+
+    // Written by Run() before the generation is increased
+    size_t _taskCount = 0;
+    TaskFunc _func = nullptr;
+    void *_context = nullptr;
+
+    void WorkerLoop(
+        size_t workerIndex);
+
+    void ExecuteTasks();
+};
+
+#endif // WORKERPOOL_H
@@ -1,10 +1,300 @@
 #include "historymanager.h"
 
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+static Track *FindTrack(
+    ITracksManager *tracksManager,
+    uint32_t trackId)
+{
+    auto &tracks = tracksManager->GetTracks();
+
+    auto found = std::find_if(
+        tracks.begin(),
+        tracks.end(),
+        [&](const Track &x) {
+            return x.Id() == trackId;
+        });
+
+    if (found == tracks.end())
+    {
+        spdlog::error("trackId {0} from history does not exist", trackId);
+
+        return nullptr;
+    }
+
+    return &(*found);
+}
+
+EditEventsCommand::EditEventsCommand(
+    uint32_t trackId,
+    std::chrono::milliseconds::rep regionStart)
+    : _trackId(trackId),
+      _regionStart(regionStart)
+{}
+
+void EditEventsCommand::AddEvent(
+    const TimedMidiEvent &event)
+{
+    _addedEvents.push_back(event);
+}
+
+void EditEventsCommand::RemoveEvent(
+    const TimedMidiEvent &event)
+{
+    _removedEvents.push_back(event);
+}
+
+bool EditEventsCommand::IsEmpty() const
+{
+    return _addedEvents.empty() && _removedEvents.empty();
+}
+
+void EditEventsCommand::Undo(
+    ITracksManager *tracksManager)
+{
+    auto track = FindTrack(tracksManager, _trackId);
+
+    if (track == nullptr || track->Regions().find(_regionStart) == track->Regions().end())
+    {
+        return;
+    }
+
+    track->EditRegion(_regionStart, [&](Region &region) {
+        Apply(region, _addedEvents, _removedEvents);
+
+        if (_lengthBefore >= 0)
+        {
+            region.SetLength(_lengthBefore);
+        }
+    });
+}
+
+void EditEventsCommand::Redo(
+    ITracksManager *tracksManager)
+{
+    auto track = FindTrack(tracksManager, _trackId);
+
+    if (track == nullptr || track->Regions().find(_regionStart) == track->Regions().end())
+    {
+        return;
+    }
+
+    track->EditRegion(_regionStart, [&](Region &region) {
+        // Adding events can make the region longer, the lengths are kept from
+        // the first time the command is applied to restore them exactly
+        if (_lengthBefore < 0)
+        {
+            _lengthBefore = region.Length();
+        }
+
+        Apply(region, _removedEvents, _addedEvents);
+
+        if (_lengthAfter < 0)
+        {
+            _lengthAfter = region.Length();
+        }
+        else
+        {
+            region.SetLength(_lengthAfter);
+        }
+    });
+}
+
+size_t EditEventsCommand::MemoryUsage() const
+{
+    return sizeof(*this) + (_addedEvents.capacity() + _removedEvents.capacity()) * sizeof(TimedMidiEvent);
+}
+
+void EditEventsCommand::Apply(
+    Region &region,
+    const TimedMidiEvent::Collection &eventsToRemove,
+    const TimedMidiEvent::Collection &eventsToAdd)
+{
+    // The events are matched and added as they are, with their channel,
+    // type and value, so a controller or a note on another channel survives
+    // an undo and redo
+    for (auto &e : eventsToRemove)
+    {
+        region.RemoveEvent(e);
+    }
+
+    for (auto &e : eventsToAdd)
+    {
+        region.AddEvent(e);
+    }
+}
+
+EditRegionsCommand::EditRegionsCommand(
+    uint32_t trackId)
+    : _trackId(trackId)
+{}
+
+void EditRegionsCommand::AddRegion(
+    std::chrono::milliseconds::rep start,
+    const Region &region)
+{
+    _addedRegions.push_back(std::make_pair(start, region));
+}
+
+void EditRegionsCommand::RemoveRegion(
+    std::chrono::milliseconds::rep start,
+    const Region &region)
+{
+    _removedRegions.push_back(std::make_pair(start, region));
+}
+
+void EditRegionsCommand::Undo(
+    ITracksManager *tracksManager)
+{
+    auto track = FindTrack(tracksManager, _trackId);
+
+    if (track == nullptr)
+    {
+        return;
+    }
+
+    Apply(*track, _addedRegions, _removedRegions);
+}
+
+void EditRegionsCommand::Redo(
+    ITracksManager *tracksManager)
+{
+    auto track = FindTrack(tracksManager, _trackId);
+
+    if (track == nullptr)
+    {
+        return;
+    }
+
+    Apply(*track, _removedRegions, _addedRegions);
+}
+
+size_t EditRegionsCommand::MemoryUsage() const
+{
+    size_t result = sizeof(*this);
+
+    // The events are counted even though they are usually shared with the song
+    for (auto &region : _addedRegions)
+    {
+        result += sizeof(region) + region.second.SortedEvents().size() * sizeof(TimedMidiEvent);
+    }
+
+    for (auto &region : _removedRegions)
+    {
+        result += sizeof(region) + region.second.SortedEvents().size() * sizeof(TimedMidiEvent);
+    }
+
+    return result;
+}
+
+void EditRegionsCommand::Apply(
+    Track &track,
+    const std::vector<std::pair<std::chrono::milliseconds::rep, Region>> &regionsToRemove,
+    const std::vector<std::pair<std::chrono::milliseconds::rep, Region>> &regionsToAdd)
+{
+    for (auto &region : regionsToRemove)
+    {
+        track.RemoveRegion(region.first);
+    }
+
+    for (auto &region : regionsToAdd)
+    {
+        track.AddRegion(region.first, region.second);
+    }
+}
+
+EditTracksCommand::EditTracksCommand(
+    const Track &track,
+    size_t index,
+    bool added)
+    : _track(track),
+      _index(index),
+      _added(added)
+{}
+
+void EditTracksCommand::Undo(
+    ITracksManager *tracksManager)
+{
+    if (_added)
+    {
+        EraseTrack(tracksManager);
+    }
+    else
+    {
+        InsertTrack(tracksManager);
+    }
+}
+
+void EditTracksCommand::Redo(
+    ITracksManager *tracksManager)
+{
+    if (_added)
+    {
+        InsertTrack(tracksManager);
+    }
+    else
+    {
+        EraseTrack(tracksManager);
+    }
+}
+
+size_t EditTracksCommand::MemoryUsage() const
+{
+    return sizeof(*this) + _track.Regions().size() * sizeof(Track::RegionCollection::value_type);
+}
+
+void EditTracksCommand::InsertTrack(
+    ITracksManager *tracksManager)
+{
+    auto &tracks = tracksManager->GetTracks();
+
+    auto index = std::min(_index, tracks.size());
+
+    tracks.insert(tracks.begin() + std::ptrdiff_t(index), _track);
+}
+
+void EditTracksCommand::EraseTrack(
+    ITracksManager *tracksManager)
+{
+    auto &tracks = tracksManager->GetTracks();
+
+    auto found = std::find_if(
+        tracks.begin(),
+        tracks.end(),
+        [&](const Track &x) {
+            return x.Id() == _track.Id();
+        });
+
+    if (found == tracks.end())
+    {
+        return;
+    }
+
+    // Keep the track as it is now, a redo or undo puts it back like this
+    _track = *found;
+
+    if (tracksManager->GetActiveTrackId() == _track.Id())
+    {
+        tracksManager->SetActiveTrack(Track::Null);
+    }
+
+    tracks.erase(found);
+}
+
 void HistoryEntry::Undo(
     ITracksManager *tracksManager)
 {
+    if (_command != nullptr)
+    {
+        _command->Undo(tracksManager);
+
+        return;
+    }
+
     tracksManager->SetTracks(this->_tracks);
 
+    // Only plugins that have a different chunk than the restored track are sent one
     for (auto &track : tracksManager->GetTracks())
     {
         track.UploadInstrumentSettings();
@@ -14,6 +304,13 @@ void HistoryEntry::Undo(
 void HistoryEntry::Redo(
     ITracksManager *tracksManager)
 {
+    if (_command != nullptr)
+    {
+        _command->Redo(tracksManager);
+
+        return;
+    }
+
     tracksManager->SetTracks(this->_tracksUnDone);
 
     for (auto &track : tracksManager->GetTracks())
@@ -44,11 +341,18 @@ void HistoryManager::SetTracksManager(
 void HistoryManager::Cleanup(
     HistoryEntry *from)
 {
+    if (from != nullptr && from->_prevEntry != nullptr)
+    {
+        from->_prevEntry->_nextEntry = nullptr;
+    }
+
     while (from != nullptr)
     {
         auto tmp = from;
         from = tmp->_nextEntry;
 
+        _memoryUsage -= tmp->_memoryUsage;
+
         delete tmp;
     }
 }
@@ -63,16 +367,46 @@ void HistoryManager::SetInitialState(
 
 void HistoryManager::AddEntry(
     const char *title)
+{
+    auto entry = new HistoryEntry();
+
+    entry->_title = title;
+    entry->_tracks = _tracks->GetTracks();
+    entry->_memoryUsage = sizeof(HistoryEntry) + MemoryUsage(entry->_tracks);
+
+    AppendEntry(entry);
+}
+
+void HistoryManager::Execute(
+    const char *title,
+    std::unique_ptr<HistoryCommand> command)
+{
+    command->Redo(_tracks);
+
+    AddCommand(title, std::move(command));
+}
+
+void HistoryManager::AddCommand(
+    const char *title,
+    std::unique_ptr<HistoryCommand> command)
+{
+    auto entry = new HistoryEntry();
+
+    entry->_title = title;
+    entry->_command = std::move(command);
+    entry->_memoryUsage = sizeof(HistoryEntry) + entry->_command->MemoryUsage();
+
+    AppendEntry(entry);
+}
+
+void HistoryManager::AppendEntry(
+    HistoryEntry *entry)
 {
     if (_currentEntryInHistoryTrack != nullptr)
     {
         Cleanup(_currentEntryInHistoryTrack->_nextEntry);
     }
 
-    auto entry = new HistoryEntry();
-
-    entry->_title = title;
-    entry->_tracks = _tracks->GetTracks();
     entry->_prevEntry = _currentEntryInHistoryTrack;
 
     if (_currentEntryInHistoryTrack != nullptr)
@@ -81,6 +415,10 @@ void HistoryManager::AddEntry(
     }
 
     _currentEntryInHistoryTrack = entry;
+
+    _memoryUsage += entry->_memoryUsage;
+
+    EnforceMemoryBudget();
 }
 
 bool HistoryManager::HasUndo(
@@ -100,7 +438,18 @@ void HistoryManager::Undo()
         return;
     }
 
-    _currentEntryInHistoryTrack->_tracksUnDone = _tracks->GetTracks();
+    if (_currentEntryInHistoryTrack->_command == nullptr)
+    {
+        auto entry = _currentEntryInHistoryTrack;
+
+        _memoryUsage -= entry->_memoryUsage;
+
+        entry->_tracksUnDone = _tracks->GetTracks();
+        entry->_memoryUsage = sizeof(HistoryEntry) + MemoryUsage(entry->_tracks) + MemoryUsage(entry->_tracksUnDone);
+
+        _memoryUsage += entry->_memoryUsage;
+    }
+
     _currentEntryInHistoryTrack->Undo(_tracks);
     _currentEntryInHistoryTrack = _currentEntryInHistoryTrack->_prevEntry;
 }
@@ -132,3 +481,275 @@ void HistoryManager::Redo()
     _currentEntryInHistoryTrack = _currentEntryInHistoryTrack->_nextEntry;
     _currentEntryInHistoryTrack->Redo(_tracks);
 }
+
+void HistoryManager::SetMemoryBudget(
+    size_t bytes)
+{
+    _memoryBudget = bytes;
+
+    EnforceMemoryBudget();
+}
+
+void HistoryManager::EnforceMemoryBudget()
+{
+    // The oldest entry is dropped by making the song after it the start of
+    // the history. That song is never restored from the first entry, undo
+    // stops there.
+    while (_memoryUsage > _memoryBudget)
+    {
+        auto oldest = _firstEntryInHistoryTrack._nextEntry;
+
+        // Only entries that can be undone are dropped, and never the last one
+        if (oldest == nullptr || oldest == _currentEntryInHistoryTrack || _currentEntryInHistoryTrack == &_firstEntryInHistoryTrack)
+        {
+            break;
+        }
+
+        _firstEntryInHistoryTrack._nextEntry = oldest->_nextEntry;
+        oldest->_nextEntry->_prevEntry = &_firstEntryInHistoryTrack;
+
+        _memoryUsage -= oldest->_memoryUsage;
+
+        delete oldest;
+    }
+}
+
+size_t HistoryManager::MemoryUsage(
+    const std::vector<Track> &tracks)
+{
+    size_t result = tracks.capacity() * sizeof(Track);
+
+    // The regions are shared with the song until either changes, count them
+    // once per copy to stay on the safe side
+    for (auto &track : tracks)
+    {
+        result += track.Regions().size() * sizeof(Track::RegionCollection::value_type);
+    }
+
+    return result;
+}
+
+#ifdef TEST_YOUR_CODE
+#include <iostream>
+#include <tracksmanager.h>
+
+void HistoryManager::Tests()
+{
+    TracksManager tracks;
+    HistoryManager sut;
+    sut.SetTracksManager(&tracks);
+
+    auto trackId = tracks.AddTrack("test", std::make_shared<Instrument>());
+    tracks.GetTrack(trackId).AddRegion(0, Region());
+
+    auto regionLength = tracks.GetTrack(trackId).Regions().at(0).Length();
+
+    MidiEvent note;
+    note.num = 60;
+    note.type = MidiEventTypes::M_NOTE;
+    note.value = 100;
+
+    auto edit = std::make_unique<EditEventsCommand>(trackId, 0);
+    edit->AddEvent(TimedMidiEvent(0, note));
+    edit->AddEvent(TimedMidiEvent(40000, note));
+    sut.Execute("Add note", std::move(edit));
+
+    auto eventCount = [&]() { return tracks.GetTrack(trackId).Regions().at(0).SortedEvents().size(); };
+
+    if (eventCount() != 2)
+    {
+        std::cout << "Execute did not apply the command, " << eventCount() << " events" << std::endl;
+    }
+
+    sut.Undo();
+
+    if (eventCount() != 0 || tracks.GetTrack(trackId).Regions().at(0).Length() != regionLength)
+    {
+        std::cout << "Undo did not revert the added events" << std::endl;
+    }
+
+    sut.Redo();
+
+    if (eventCount() != 2)
+    {
+        std::cout << "Redo did not add the events again" << std::endl;
+    }
+
+    // A controller with the number of a note is removed and put back as it was
+    MidiEvent controller;
+    controller.channel = 2;
+    controller.num = 60;
+    controller.type = MidiEventTypes::M_CONTROLLER;
+    controller.value = 64;
+
+    auto addController = std::make_unique<EditEventsCommand>(trackId, 0);
+    addController->AddEvent(TimedMidiEvent(0, controller));
+    sut.Execute("Add controller", std::move(addController));
+
+    auto removeController = std::make_unique<EditEventsCommand>(trackId, 0);
+    removeController->RemoveEvent(TimedMidiEvent(0, controller));
+    sut.Execute("Remove controller", std::move(removeController));
+
+    auto &eventsAtStart = tracks.GetTrack(trackId).Regions().at(0).SortedEvents();
+    if (eventCount() != 2 || eventsAtStart[0].type != MidiEventTypes::M_NOTE)
+    {
+        std::cout << "Removing a controller removed a note with the same number" << std::endl;
+    }
+
+    sut.Undo();
+
+    auto &eventsAfterUndo = tracks.GetTrack(trackId).Regions().at(0).SortedEvents();
+    if (eventCount() != 3 || eventsAfterUndo[1].type != MidiEventTypes::M_CONTROLLER || eventsAfterUndo[1].channel != 2 || eventsAfterUndo[1].value != 64)
+    {
+        std::cout << "Undo did not put the controller back as it was" << std::endl;
+    }
+
+    sut.Undo();
+
+    // A note on another channel is removed and moved as it is in the region
+    MidiEvent channelNote;
+    channelNote.channel = 3;
+    channelNote.num = 64;
+    channelNote.type = MidiEventTypes::M_NOTE;
+    channelNote.value = 90;
+
+    auto addChannelNote = std::make_unique<EditEventsCommand>(trackId, 0);
+    addChannelNote->AddEvent(TimedMidiEvent(1000, channelNote));
+    channelNote.value = 0;
+    addChannelNote->AddEvent(TimedMidiEvent(2000, channelNote));
+    sut.Execute("Add note", std::move(addChannelNote));
+
+    TimedMidiEvent noteOn, noteOff;
+    if (!tracks.GetTrack(trackId).Regions().at(0).FindNote(1000, 1000, 64, noteOn, noteOff) || noteOn.channel != 3 || noteOff.channel != 3)
+    {
+        std::cout << "FindNote did not find the note on channel 3" << std::endl;
+    }
+
+    auto removeChannelNote = std::make_unique<EditEventsCommand>(trackId, 0);
+    removeChannelNote->RemoveEvent(noteOn);
+    removeChannelNote->RemoveEvent(noteOff);
+    sut.Execute("Remove note", std::move(removeChannelNote));
+
+    if (eventCount() != 2)
+    {
+        std::cout << "Remove note did not remove the note on channel 3, " << eventCount() << " events" << std::endl;
+    }
+
+    sut.Undo();
+
+    auto moveChannelNote = std::make_unique<EditEventsCommand>(trackId, 0);
+    moveChannelNote->RemoveEvent(noteOn);
+    moveChannelNote->RemoveEvent(noteOff);
+    noteOn.time = 3000;
+    noteOn.num = 65;
+    noteOff.time = 4000;
+    noteOff.num = 65;
+    moveChannelNote->AddEvent(noteOn);
+    moveChannelNote->AddEvent(noteOff);
+    sut.Execute("Move note", std::move(moveChannelNote));
+
+    TimedMidiEvent movedOn, movedOff;
+    auto &movedRegion = tracks.GetTrack(trackId).Regions().at(0);
+    if (eventCount() != 4 || movedRegion.FindNote(1000, 1000, 64, movedOn, movedOff) || !movedRegion.FindNote(3000, 1000, 65, movedOn, movedOff) || movedOn.channel != 3 || movedOn.value != 90)
+    {
+        std::cout << "Move note did not move the note on channel 3" << std::endl;
+    }
+
+    sut.Undo();
+
+    if (eventCount() != 4 || !tracks.GetTrack(trackId).Regions().at(0).FindNote(1000, 1000, 64, movedOn, movedOff) || movedOff.channel != 3)
+    {
+        std::cout << "Undo did not move the note on channel 3 back" << std::endl;
+    }
+
+    sut.Undo();
+
+    auto move = std::make_unique<EditRegionsCommand>(trackId);
+    move->RemoveRegion(0, tracks.GetTrack(trackId).Regions().at(0));
+    move->AddRegion(8000, tracks.GetTrack(trackId).Regions().at(0));
+    sut.Execute("Move region", std::move(move));
+
+    auto &regions = tracks.GetTrack(trackId).Regions();
+    if (regions.size() != 1 || regions.begin()->first != 8000 || regions.begin()->second.SortedEvents().size() != 2)
+    {
+        std::cout << "Move region did not move the region with its events" << std::endl;
+    }
+
+    sut.Undo();
+
+    if (tracks.GetTrack(trackId).Regions().size() != 1 || tracks.GetTrack(trackId).Regions().begin()->first != 0)
+    {
+        std::cout << "Undo did not move the region back" << std::endl;
+    }
+
+    sut.Redo();
+
+    auto secondTrackId = tracks.AddTrack("second", std::make_shared<Instrument>());
+    sut.AddCommand("Add Track", std::make_unique<EditTracksCommand>(tracks.GetTracks().back(), 1, true));
+    sut.Execute("Remove Track", std::make_unique<EditTracksCommand>(tracks.GetTrack(trackId), 0, false));
+
+    if (tracks.GetTracks().size() != 1 || tracks.GetTracks()[0].Id() != secondTrackId)
+    {
+        std::cout << "Remove Track did not remove the track" << std::endl;
+    }
+
+    sut.Undo();
+
+    if (tracks.GetTracks().size() != 2 || tracks.GetTracks()[0].Id() != trackId || tracks.GetTrack(trackId).Regions().begin()->first != 8000)
+    {
+        std::cout << "Undo did not put the removed track back in its place" << std::endl;
+    }
+
+    sut.Undo();
+
+    if (tracks.GetTracks().size() != 1)
+    {
+        std::cout << "Undo did not remove the added track" << std::endl;
+    }
+
+    // Entries without a command restore a copy of all tracks
+    sut.AddEntry("Rename track");
+    tracks.GetTrack(trackId).SetName("renamed");
+    sut.Undo();
+
+    if (tracks.GetTrack(trackId).GetName() != "test")
+    {
+        std::cout << "Undo of an entry without a command did not restore the tracks" << std::endl;
+    }
+
+    sut.Redo();
+
+    if (tracks.GetTrack(trackId).GetName() != "renamed")
+    {
+        std::cout << "Redo of an entry without a command did not restore the tracks" << std::endl;
+    }
+
+    // The oldest entries are dropped to stay within the budget
+    sut.SetMemoryBudget(4096);
+    for (int i = 0; i < 1000; i++)
+    {
+        auto add = std::make_unique<EditEventsCommand>(trackId, 8000);
+        add->AddEvent(TimedMidiEvent(i * 10, note));
+        sut.Execute("Add note", std::move(add));
+    }
+
+    if (sut.MemoryUsage() > sut.MemoryBudget())
+    {
+        std::cout << "History uses " << sut.MemoryUsage() << " bytes, more than the budget of " << sut.MemoryBudget() << std::endl;
+    }
+
+    int undoCount = 0;
+    std::string title;
+    while (sut.HasUndo(title))
+    {
+        sut.Undo();
+        undoCount++;
+    }
+
+    auto remaining = tracks.GetTrack(trackId).Regions().at(8000).SortedEvents().size();
+    if (undoCount == 0 || undoCount >= 1000 || remaining != size_t(1002 - undoCount))
+    {
+        std::cout << "Undo after dropping entries ended with " << remaining << " events after " << undoCount << " undos" << std::endl;
+    }
+}
+#endif
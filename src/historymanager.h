@@ -4,12 +4,144 @@
 #include <itracksmanager.h>
 #include <track.h>
 
+#include <memory>
+#include <utility>
+#include <vector>
+
+// A reversible edit. Redo() applies the edit to the tracks, Undo() reverts
+// it. Both only touch what the edit changed, so their cost does not depend
+// on the size of the song.
+class HistoryCommand
+{
+public:
+    virtual ~HistoryCommand() = default;
+
+    virtual void Undo(
+        ITracksManager *tracksManager) = 0;
+
+    virtual void Redo(
+        ITracksManager *tracksManager) = 0;
+
+    // Estimate of the bytes this command keeps alive
+    virtual size_t MemoryUsage() const = 0;
+};
+
+// Adds and removes events in one region
+class EditEventsCommand : public HistoryCommand
+{
+public:
+    EditEventsCommand(
+        uint32_t trackId,
+        std::chrono::milliseconds::rep regionStart);
+
+    void AddEvent(
+        const TimedMidiEvent &event);
+
+    void RemoveEvent(
+        const TimedMidiEvent &event);
+
+    bool IsEmpty() const;
+
+    virtual void Undo(
+        ITracksManager *tracksManager);
+
+    virtual void Redo(
+        ITracksManager *tracksManager);
+
+    virtual size_t MemoryUsage() const;
+
+private:
+    uint32_t _trackId;
+    std::chrono::milliseconds::rep _regionStart;
+    TimedMidiEvent::Collection _addedEvents;
+    TimedMidiEvent::Collection _removedEvents;
+    std::chrono::milliseconds::rep _lengthBefore = -1;
+    std::chrono::milliseconds::rep _lengthAfter = -1;
+
+    static void Apply(
+        Region &region,
+        const TimedMidiEvent::Collection &eventsToRemove,
+        const TimedMidiEvent::Collection &eventsToAdd);
+};
+
+// Adds and removes regions on one track. A resized, renamed or moved region
+// is removed as it was and added as it is now, the copies share their
+// events with the region in the song.
+class EditRegionsCommand : public HistoryCommand
+{
+public:
+    EditRegionsCommand(
+        uint32_t trackId);
+
+    void AddRegion(
+        std::chrono::milliseconds::rep start,
+        const Region &region);
+
+    void RemoveRegion(
+        std::chrono::milliseconds::rep start,
+        const Region &region);
+
+    virtual void Undo(
+        ITracksManager *tracksManager);
+
+    virtual void Redo(
+        ITracksManager *tracksManager);
+
+    virtual size_t MemoryUsage() const;
+
+private:
+    uint32_t _trackId;
+    std::vector<std::pair<std::chrono::milliseconds::rep, Region>> _addedRegions;
+    std::vector<std::pair<std::chrono::milliseconds::rep, Region>> _removedRegions;
+
+    static void Apply(
+        Track &track,
+        const std::vector<std::pair<std::chrono::milliseconds::rep, Region>> &regionsToRemove,
+        const std::vector<std::pair<std::chrono::milliseconds::rep, Region>> &regionsToAdd);
+};
+
+// Adds or removes a whole track at a position in the track list
+class EditTracksCommand : public HistoryCommand
+{
+public:
+    EditTracksCommand(
+        const Track &track,
+        size_t index,
+        bool added);
+
+    virtual void Undo(
+        ITracksManager *tracksManager);
+
+    virtual void Redo(
+        ITracksManager *tracksManager);
+
+    virtual size_t MemoryUsage() const;
+
+private:
+    Track _track;
+    size_t _index;
+    bool _added;
+
+    void InsertTrack(
+        ITracksManager *tracksManager);
+
+    void EraseTrack(
+        ITracksManager *tracksManager);
+};
+
+// An entry holds either a command, or a copy of all tracks from before the
+// change for edits that have no command. The tracks in a copy share their
+// regions, events and plugin settings with the tracks they are copied from.
+// Only what is changed afterwards is copied, so an entry costs little more
+// than the tracks it holds.
 class HistoryEntry
 {
 public:
     const char *_title;
+    std::unique_ptr<HistoryCommand> _command;
     std::vector<Track> _tracks;
     std::vector<Track> _tracksUnDone;
+    size_t _memoryUsage = 0;
 
     HistoryEntry *_prevEntry = nullptr;
     HistoryEntry *_nextEntry = nullptr;
@@ -24,6 +156,8 @@ public:
 class HistoryManager
 {
 public:
+    static const size_t DefaultMemoryBudget = 64 * 1024 * 1024;
+
     HistoryManager();
 
     ~HistoryManager();
@@ -38,9 +172,20 @@ public:
         const char *title,
         const std::vector<Track> &tracks);
 
+    // Stores a copy of all tracks before an edit that has no command
     void AddEntry(
         const char *title);
 
+    // Applies the command and adds it to the history
+    void Execute(
+        const char *title,
+        std::unique_ptr<HistoryCommand> command);
+
+    // Adds a command that is already applied to the history
+    void AddCommand(
+        const char *title,
+        std::unique_ptr<HistoryCommand> command);
+
     bool HasUndo(
         std::string&titleOfUndoAction);
 
@@ -51,15 +196,39 @@ public:
 
     void Redo();
 
+    // The oldest entries are dropped when the history grows beyond this
+    // amount of bytes, the last entry is always kept
+    void SetMemoryBudget(
+        size_t bytes);
+
+    size_t MemoryBudget() const { return _memoryBudget; }
+
+    size_t MemoryUsage() const { return _memoryUsage; }
+
     const HistoryEntry *FirstEntryInHistoryTrack() const { return &_firstEntryInHistoryTrack; }
 
     const HistoryEntry *CurrentEntryInHistoryTrack() const { return _currentEntryInHistoryTrack; }
 
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
 private:
     ITracksManager *_tracks = nullptr;
 
     HistoryEntry _firstEntryInHistoryTrack;
     HistoryEntry *_currentEntryInHistoryTrack = nullptr;
+
+    size_t _memoryBudget = DefaultMemoryBudget;
+    size_t _memoryUsage = 0;
+
+    void AppendEntry(
+        HistoryEntry *entry);
+
+    void EnforceMemoryBudget();
+
+    static size_t MemoryUsage(
+        const std::vector<Track> &tracks);
 };
 
 #endif // HISTORYMANAGER_H
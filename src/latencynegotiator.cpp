@@ -0,0 +1,368 @@
+#include "latencynegotiator.h"
+
+#include <spdlog/spdlog.h>
+
+double NegotiatedLatency::LatencyMs(
+    uint32_t sampleRate) const
+{
+    if (sampleRate == 0)
+    {
+        return 0.0;
+    }
+
+    return bufferFrames * 1000.0 / sampleRate;
+}
+
+bool LatencyNegotiator::Negotiate(
+    IAudioEndpoint &endpoint,
+    LatencyModes requestedMode,
+    int64_t sharedBufferDuration,
+    NegotiatedLatency &result)
+{
+    if (requestedMode == LatencyModes::Exclusive)
+    {
+        if (NegotiateExclusive(endpoint, result))
+        {
+            return true;
+        }
+
+        spdlog::warn("exclusive mode is not available, trying low latency shared mode");
+
+        requestedMode = LatencyModes::LowLatencyShared;
+    }
+
+    if (requestedMode == LatencyModes::LowLatencyShared)
+    {
+        if (NegotiateLowLatencyShared(endpoint, result))
+        {
+            return true;
+        }
+
+        spdlog::warn("low latency shared mode is not available, using shared mode");
+    }
+
+    return NegotiateShared(endpoint, sharedBufferDuration, result);
+}
+
+bool LatencyNegotiator::NegotiateExclusive(
+    IAudioEndpoint &endpoint,
+    NegotiatedLatency &result)
+{
+    int64_t defaultPeriod = 0;
+    int64_t minimumPeriod = 0;
+
+    if (!endpoint.FindExclusiveFormat() || !endpoint.GetDevicePeriod(defaultPeriod, minimumPeriod))
+    {
+        return false;
+    }
+
+    auto initialized = endpoint.InitializeExclusive(minimumPeriod);
+
+    if (initialized == IAudioEndpoint::Results::BufferSizeNotAligned)
+    {
+        // The device told how many frames it can do, the period is asked
+        // for again in that many frames
+        auto alignedFrames = endpoint.BufferFrameCount();
+        auto alignedPeriod = int64_t(10000000.0 * alignedFrames / endpoint.SampleRate() + 0.5);
+
+        if (alignedFrames == 0 || !endpoint.Reset())
+        {
+            return false;
+        }
+
+        initialized = endpoint.InitializeExclusive(alignedPeriod);
+    }
+
+    if (initialized != IAudioEndpoint::Results::Ok)
+    {
+        endpoint.Reset();
+
+        return false;
+    }
+
+    // In exclusive mode the buffer is one period, the device plays the
+    // other half of its double buffer meanwhile
+    result.mode = LatencyModes::Exclusive;
+    result.bufferFrames = endpoint.BufferFrameCount();
+    result.periodFrames = result.bufferFrames;
+
+    return true;
+}
+
+bool LatencyNegotiator::NegotiateLowLatencyShared(
+    IAudioEndpoint &endpoint,
+    NegotiatedLatency &result)
+{
+    uint32_t defaultFrames = 0;
+    uint32_t fundamentalFrames = 0;
+    uint32_t minimumFrames = 0;
+    uint32_t maximumFrames = 0;
+
+    if (!endpoint.GetSharedModeEnginePeriod(defaultFrames, fundamentalFrames, minimumFrames, maximumFrames) || minimumFrames == 0)
+    {
+        return false;
+    }
+
+    if (endpoint.InitializeLowLatencyShared(minimumFrames) != IAudioEndpoint::Results::Ok)
+    {
+        endpoint.Reset();
+
+        return false;
+    }
+
+    result.mode = LatencyModes::LowLatencyShared;
+    result.periodFrames = minimumFrames;
+    result.bufferFrames = endpoint.BufferFrameCount();
+
+    return true;
+}
+
+bool LatencyNegotiator::NegotiateShared(
+    IAudioEndpoint &endpoint,
+    int64_t sharedBufferDuration,
+    NegotiatedLatency &result)
+{
+    if (endpoint.InitializeShared(sharedBufferDuration) != IAudioEndpoint::Results::Ok)
+    {
+        spdlog::error("failed to initialize the audio device in shared mode");
+
+        return false;
+    }
+
+    int64_t defaultPeriod = 0;
+    int64_t minimumPeriod = 0;
+    endpoint.GetDevicePeriod(defaultPeriod, minimumPeriod);
+
+    result.mode = LatencyModes::Shared;
+    result.bufferFrames = endpoint.BufferFrameCount();
+    result.periodFrames = uint32_t(defaultPeriod * endpoint.SampleRate() / 10000000);
+
+    return true;
+}
+
+const char *LatencyNegotiator::ModeName(
+    LatencyModes mode)
+{
+    switch (mode)
+    {
+        case LatencyModes::Shared:
+            return "shared";
+        case LatencyModes::LowLatencyShared:
+            return "low";
+        case LatencyModes::Exclusive:
+            return "exclusive";
+    }
+
+    return "";
+}
+
+bool LatencyNegotiator::ParseMode(
+    const std::string &name,
+    LatencyModes &mode)
+{
+    for (auto candidate : {LatencyModes::Shared, LatencyModes::LowLatencyShared, LatencyModes::Exclusive})
+    {
+        if (name == ModeName(candidate))
+        {
+            mode = candidate;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#ifdef TEST_YOUR_CODE
+#include <iostream>
+#include <vector>
+
+class MockEndpoint : public IAudioEndpoint
+{
+public:
+    // What the device supports
+    bool exclusiveFormat = true;
+    bool audioClient3 = true;
+    uint32_t alignedFrames = 0; // the exclusive buffer size when the minimum period is not aligned
+    bool sharedFails = false;
+
+    // What the negotiation did
+    std::vector<std::string> calls;
+    int64_t lastExclusivePeriod = 0;
+
+    virtual uint32_t SampleRate() const
+    {
+        return 48000;
+    }
+
+    virtual bool GetDevicePeriod(
+        int64_t &defaultPeriod,
+        int64_t &minimumPeriod)
+    {
+        defaultPeriod = 100000; // 10ms
+        minimumPeriod = 30000;  // 3ms
+
+        return true;
+    }
+
+    virtual bool GetSharedModeEnginePeriod(
+        uint32_t &defaultFrames,
+        uint32_t &fundamentalFrames,
+        uint32_t &minimumFrames,
+        uint32_t &maximumFrames)
+    {
+        defaultFrames = 480;
+        fundamentalFrames = 32;
+        minimumFrames = 128;
+        maximumFrames = 480;
+
+        return audioClient3;
+    }
+
+    virtual bool FindExclusiveFormat()
+    {
+        return exclusiveFormat;
+    }
+
+    virtual Results InitializeExclusive(
+        int64_t period)
+    {
+        calls.push_back("exclusive");
+        lastExclusivePeriod = period;
+
+        if (alignedFrames != 0 && period == 30000)
+        {
+            _bufferFrameCount = alignedFrames;
+
+            return Results::BufferSizeNotAligned;
+        }
+
+        _bufferFrameCount = uint32_t((period * SampleRate() + 5000000) / 10000000);
+
+        return Results::Ok;
+    }
+
+    virtual Results InitializeLowLatencyShared(
+        uint32_t periodFrames)
+    {
+        calls.push_back("low");
+        _bufferFrameCount = periodFrames * 2;
+
+        return Results::Ok;
+    }
+
+    virtual Results InitializeShared(
+        int64_t bufferDuration)
+    {
+        calls.push_back("shared");
+
+        if (sharedFails)
+        {
+            return Results::Failed;
+        }
+
+        _bufferFrameCount = uint32_t(bufferDuration * SampleRate() / 10000000);
+
+        return Results::Ok;
+    }
+
+    virtual uint32_t BufferFrameCount()
+    {
+        return _bufferFrameCount;
+    }
+
+    virtual bool Reset()
+    {
+        calls.push_back("reset");
+
+        return true;
+    }
+
+private:
+    uint32_t _bufferFrameCount = 0;
+};
+
+static void ExpectNegotiation(
+    const char *name,
+    MockEndpoint &endpoint,
+    LatencyModes requestedMode,
+    LatencyModes expectedMode,
+    uint32_t expectedBufferFrames,
+    std::vector<std::string> expectedCalls)
+{
+    NegotiatedLatency result;
+
+    if (!LatencyNegotiator::Negotiate(endpoint, requestedMode, 300000, result))
+    {
+        std::cout << "LatencyNegotiator failed to negotiate " << name << std::endl;
+
+        return;
+    }
+
+    if (result.mode != expectedMode || result.bufferFrames != expectedBufferFrames)
+    {
+        std::cout << "LatencyNegotiator negotiated " << LatencyNegotiator::ModeName(result.mode) << " with " << result.bufferFrames
+                  << " frames for " << name << ", expected " << LatencyNegotiator::ModeName(expectedMode) << " with " << expectedBufferFrames << std::endl;
+    }
+
+    if (endpoint.calls != expectedCalls)
+    {
+        std::cout << "LatencyNegotiator made unexpected calls for " << name << std::endl;
+    }
+}
+
+void LatencyNegotiator::Tests()
+{
+    {
+        MockEndpoint endpoint;
+        ExpectNegotiation("exclusive", endpoint, LatencyModes::Exclusive, LatencyModes::Exclusive, 144, {"exclusive"});
+    }
+
+    {
+        // 3ms is 144 frames, the device wants 160 frames instead
+        MockEndpoint endpoint;
+        endpoint.alignedFrames = 160;
+        ExpectNegotiation("an unaligned exclusive period", endpoint, LatencyModes::Exclusive, LatencyModes::Exclusive, 160, {"exclusive", "reset", "exclusive"});
+
+        if (endpoint.lastExclusivePeriod != 33333)
+        {
+            std::cout << "LatencyNegotiator asked for an aligned period of " << endpoint.lastExclusivePeriod << ", expected 33333" << std::endl;
+        }
+    }
+
+    {
+        MockEndpoint endpoint;
+        endpoint.exclusiveFormat = false;
+        ExpectNegotiation("exclusive without a format", endpoint, LatencyModes::Exclusive, LatencyModes::LowLatencyShared, 256, {"low"});
+    }
+
+    {
+        MockEndpoint endpoint;
+        endpoint.exclusiveFormat = false;
+        endpoint.audioClient3 = false;
+        ExpectNegotiation("exclusive on an old device", endpoint, LatencyModes::Exclusive, LatencyModes::Shared, 1440, {"shared"});
+    }
+
+    {
+        MockEndpoint endpoint;
+        ExpectNegotiation("shared", endpoint, LatencyModes::Shared, LatencyModes::Shared, 1440, {"shared"});
+    }
+
+    {
+        MockEndpoint endpoint;
+        endpoint.sharedFails = true;
+        NegotiatedLatency result;
+
+        if (Negotiate(endpoint, LatencyModes::Shared, 300000, result))
+        {
+            std::cout << "LatencyNegotiator negotiated on a device that failed to initialize" << std::endl;
+        }
+    }
+
+    LatencyModes mode = LatencyModes::Shared;
+    if (!ParseMode("exclusive", mode) || mode != LatencyModes::Exclusive || ParseMode("fast", mode))
+    {
+        std::cout << "LatencyNegotiator did not parse the latency modes" << std::endl;
+    }
+}
+#endif
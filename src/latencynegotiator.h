@@ -0,0 +1,115 @@
+#ifndef LATENCYNEGOTIATOR_H
+#define LATENCYNEGOTIATOR_H
+
+#include <cstdint>
+#include <string>
+
+enum class LatencyModes
+{
+    Shared,           // the buffer duration that was asked for, through the mixer
+    LowLatencyShared, // the smallest period of the mixer, needs IAudioClient3
+    Exclusive,        // the smallest period of the device, bypasses the mixer
+};
+
+// The calls the negotiation makes on an audio client. Wasapi implements them
+// on IAudioClient, the tests on a mock device. Periods and durations are in
+// 100ns units, like WASAPI uses them.
+class IAudioEndpoint
+{
+public:
+    enum class Results
+    {
+        Ok,
+        BufferSizeNotAligned,
+        Failed,
+    };
+
+    virtual ~IAudioEndpoint() = default;
+
+    virtual uint32_t SampleRate() const = 0;
+
+    virtual bool GetDevicePeriod(
+        int64_t &defaultPeriod,
+        int64_t &minimumPeriod) = 0;
+
+    // False when the device has no IAudioClient3
+    virtual bool GetSharedModeEnginePeriod(
+        uint32_t &defaultFrames,
+        uint32_t &fundamentalFrames,
+        uint32_t &minimumFrames,
+        uint32_t &maximumFrames) = 0;
+
+    // Picks the format for exclusive mode, false when the device supports
+    // none of the formats the host can write
+    virtual bool FindExclusiveFormat() = 0;
+
+    virtual Results InitializeExclusive(
+        int64_t period) = 0;
+
+    virtual Results InitializeLowLatencyShared(
+        uint32_t periodFrames) = 0;
+
+    virtual Results InitializeShared(
+        int64_t bufferDuration) = 0;
+
+    // The size of the buffer of the last Initialize call, also when it
+    // failed because the buffer size was not aligned
+    virtual uint32_t BufferFrameCount() = 0;
+
+    // A client can only be initialized once, after a failed attempt it is
+    // activated again
+    virtual bool Reset() = 0;
+};
+
+struct NegotiatedLatency
+{
+    LatencyModes mode = LatencyModes::Shared;
+    uint32_t periodFrames = 0;
+    uint32_t bufferFrames = 0;
+
+    // The time from refilling a buffer until it is played, without the
+    // latency of the device itself
+    double LatencyMs(
+        uint32_t sampleRate) const;
+};
+
+// Initializes the endpoint in the requested latency mode. When the device
+// does not support it, the next mode down is tried: exclusive falls back to
+// low latency shared mode, and that falls back to shared mode.
+class LatencyNegotiator
+{
+public:
+    static bool Negotiate(
+        IAudioEndpoint &endpoint,
+        LatencyModes requestedMode,
+        int64_t sharedBufferDuration,
+        NegotiatedLatency &result);
+
+    static const char *ModeName(
+        LatencyModes mode);
+
+    // Parses "shared", "low" or "exclusive"
+    static bool ParseMode(
+        const std::string &name,
+        LatencyModes &mode);
+
+#ifdef TEST_YOUR_CODE
+    static void Tests();
+#endif
+
+private:
+    static bool NegotiateExclusive(
+        IAudioEndpoint &endpoint,
+        NegotiatedLatency &result);
+
+    static bool NegotiateLowLatencyShared(
+        IAudioEndpoint &endpoint,
+        NegotiatedLatency &result);
+
+    static bool NegotiateShared(
+        IAudioEndpoint &endpoint,
+        int64_t sharedBufferDuration,
+        NegotiatedLatency &result);
+};
+
+#endif // LATENCYNEGOTIATOR_H
@@ -4,6 +4,8 @@
 #include <algorithm>
 #include <chrono>
 #include <commdlg.h>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -22,16 +24,29 @@
 #include "IconsForkAwesome.h"
 #include "RtMidi.h"
 // #include "arpeggiatorpreviewservice.h"
+#include "audiotelemetry.h"
+#include "autosaveservice.h"
+#include "binarytracksserializer.h"
+#include "dspkernels.h"
+#include "fileaudiodevice.h"
 #include "imguiutils.h"
 #include "instrument.h"
+#include "latencynegotiator.h"
+#include "mixer.h"
 #include "midicontrollers.h"
 #include "midievent.h"
 #include "notepreviewservice.h"
+#include "nullaudiodevice.h"
+#include "pluginloadqueue.h"
+#include "pluginmodule.h"
+#include "pluginscanner.h"
 #include "pluginservice.h"
+#include "processinggraph.h"
 #include "region.h"
 #include "state.h"
 #include "track.h"
 #include "tracksmanager.h"
+#include "tracksrenderer.h"
 #include "tracksserializer.h"
 #include "ui/inspectorwindow.h"
 #include "ui/noteseditor.h"
@@ -39,6 +54,7 @@
 #include "ui/trackseditor.h"
 #include "vstplugin.h"
 #include "wasapi.h"
+#include "workerpool.h"
 
 static std::map<int, bool> _noteStates;
 static std::map<int, struct MidiNoteState> _keyboardToNoteMap{
@@ -83,6 +99,10 @@ static TracksEditor _tracksEditor;
 static NotesEditor _notesEditor;
 static InspectorWindow _inspectorWindow;
 static PianoWindow _pianoWindow;
+static TracksRenderer _tracksRenderer;
+static AudioTelemetry _audioTelemetry;
+static AutosaveService _autosaveService;
+static WorkerPool *_pluginWorkerPool = nullptr; // loads and saves the plugins of a song on the UI thread
 static bool _showInspectorWindow = true;
 static bool _showPianoWindow = true;
 // ArpeggiatorPreviewService _arpeggiatorPreviewService;
@@ -94,20 +114,19 @@ void KillAllNotes()
 {
     for (auto &instrument : state._tracks->GetInstruments())
     {
-        instrument->Lock();
+        // Two controllers per channel instead of a note off for every
+        // note, which would not fit in the plugin's midi queue
         for (int channel = 0; channel < 16; channel++)
         {
-            for (int note = 0; note < 128; note++)
-            {
-                instrument->InstrumentPlugin()
-                    ->sendMidiNote(
-                        channel,
-                        note,
-                        false,
-                        0);
-            }
+            instrument->SendMidiController(
+                channel,
+                C_allnotesoff,
+                0);
+            instrument->SendMidiController(
+                channel,
+                C_allsoundsoff,
+                0);
         }
-        instrument->Unlock();
     }
 }
 
@@ -117,140 +136,79 @@ void HandleIncomingMidiEvent(
     bool onOff,
     int velocity);
 
-// This function is called from Wasapi::threadFunc() which is running in audio thread.
+// This function is called from the thread of the audio device.
 bool refillCallback(
     float *const data,
     uint32_t sampleCount,
-    const WAVEFORMATEX *const mixFormat)
+    const AudioFormat &format)
 {
+    AudioTelemetry::CallbackScope telemetryScope(&_audioTelemetry, sampleCount, format.sampleRate);
+
     auto start = state._cursor;
-    long long diff = (long long)(sampleCount * (1000.0 / mixFormat->nSamplesPerSec));
+    long long diff = (long long)(sampleCount * (1000.0 / format.sampleRate));
     state.UpdateByDiff(diff);
     auto end = state._cursor;
 
+    bool sent = false;
+
     if (state.ui._activeCenterScreen == 1 && state._tracks->GetActiveTrackId() > 0)
     {
         auto &activeTrack = state._tracks->GetTrack(state._tracks->GetActiveTrackId());
         auto regionStart = std::get<std::chrono::milliseconds::rep>(state._tracks->GetActiveRegion());
-        auto &region = activeTrack.GetRegion(regionStart);
+        auto regionEnd = end;
+
+        // The ui swaps in new regions under the instrument lock
+        auto instrument = activeTrack.GetInstrument();
+        if (instrument != nullptr)
+        {
+            instrument->Lock();
+
+            auto region = activeTrack.Regions().find(regionStart);
+            if (region != activeTrack.Regions().end())
+            {
+                regionEnd = regionStart + region->second.Length();
+            }
+
+            instrument->Unlock();
+        }
 
-        if (end > (regionStart + region.Length()))
+        if (end > regionEnd)
         {
-            state._tracks->SendMidiNotesInSong(start, regionStart + region.Length());
-            state._cursor = regionStart + (end - (regionStart + region.Length()));
+            // Split the block at the frame where the region ends
+            auto splitFrame = end > start && regionEnd > start
+                                  ? uint32_t(sampleCount * (regionEnd - start) / (end - start))
+                                  : 0;
+
+            state._tracks->SendMidiNotesInRegion(start, regionEnd, 0, splitFrame);
+            state._cursor = regionStart + (end - regionEnd);
             if (state._loop)
             {
-                state._tracks->SendMidiNotesInSong(regionStart, state._cursor);
+                state._tracks->SendMidiNotesInRegion(regionStart, state._cursor, splitFrame, sampleCount - splitFrame);
             }
             else
             {
                 state.StopPlaying();
                 state._cursor = regionStart;
             }
+            sent = true;
         }
     }
 
-    if (state.IsPlaying())
+    if (state.IsPlaying() && !sent)
     {
         if (state.ui._activeCenterScreen == 0)
         {
-            state._tracks->SendMidiNotesInSong(start, end);
+            state._tracks->SendMidiNotesInSong(start, end, 0, sampleCount);
         }
         else
         {
-            state._tracks->SendMidiNotesInRegion(start, end);
+            state._tracks->SendMidiNotesInRegion(start, end, 0, sampleCount);
         }
     }
 
     _notePreviewService.HandleMidiEventsInTimeRange(diff);
 
-    const auto nDstChannels = mixFormat->nChannels;
-
-    for (size_t iFrame = 0; iFrame < sampleCount; ++iFrame)
-    {
-        for (size_t iChannel = 0; iChannel < nDstChannels; ++iChannel)
-        {
-            const size_t wasapiWriteIndex = iFrame * nDstChannels + iChannel;
-            *(data + wasapiWriteIndex) = 0;
-        }
-    }
-
-    for (auto &track : state._tracks->GetTracks())
-    {
-        auto instrument = track.GetInstrument();
-        if (instrument == nullptr)
-        {
-            continue;
-        }
-
-        instrument->Lock();
-
-        auto &vstPlugin = instrument->InstrumentPlugin();
-        if (vstPlugin == nullptr)
-        {
-            instrument->Unlock();
-
-            continue;
-        }
-
-        vstPlugin->processEvents();
-
-        size_t tmpsampleCount = sampleCount;
-        const auto nSrcChannels = vstPlugin->getChannelCount();
-        const auto vstSamplesPerBlock = vstPlugin->getBlockSize();
-
-        size_t ofs = 0;
-        while (tmpsampleCount > 0)
-        {
-            size_t outputFrameCount = 0;
-            float **vstOutput = vstPlugin->processAudio(tmpsampleCount, outputFrameCount);
-
-            if (vstOutput == nullptr)
-            {
-                break;
-            }
-
-            for (int i = 0; i < MAX_EFFECT_PLUGINS; i++)
-            {
-                auto effect = instrument->EffectPlugin(i);
-
-                if (effect == nullptr)
-                {
-                    continue;
-                }
-
-                effect->_inputBufferHeads.clear();
-                for (size_t i = 0; i < vstPlugin->getChannelCount(); i++)
-                {
-                    effect->_inputBufferHeads.push_back(vstOutput[i]);
-                }
-                vstOutput = effect->processAudio(tmpsampleCount, outputFrameCount);
-            }
-
-            const auto nFrame = outputFrameCount;
-            for (size_t iFrame = 0; iFrame < nFrame; ++iFrame)
-            {
-                for (size_t iChannel = 0; iChannel < nDstChannels; ++iChannel)
-                {
-                    if (track.IsMuted()) continue;
-                    if (data == nullptr) continue;
-                    if (state._tracks->GetSoloTrack() != track.Id() && state._tracks->GetSoloTrack() != Track::Null) continue;
-
-                    const size_t sChannel = iChannel % nSrcChannels;
-                    const size_t vstOutputPage = (iFrame / vstSamplesPerBlock) * sChannel + sChannel;
-                    const size_t vstOutputIndex = (iFrame % vstSamplesPerBlock);
-                    const size_t wasapiWriteIndex = iFrame * nDstChannels + iChannel;
-
-                    *(data + ofs + wasapiWriteIndex) += vstOutput[vstOutputPage][vstOutputIndex];
-                }
-            }
-
-            tmpsampleCount -= nFrame;
-            ofs += nFrame * nDstChannels;
-        }
-
-        instrument->Unlock();
-    }
+    _tracksRenderer.RenderTracks(data, sampleCount, format.channelCount, format.sampleRate);
 
     return true;
 }
@@ -298,23 +256,18 @@ void HandleIncomingMidiEvent(
 
     auto instrument = activeTrack.GetInstrument();
 
-    instrument->Lock();
-
-    if (instrument->InstrumentPlugin() == nullptr)
+    if (instrument == nullptr)
     {
-        instrument->Unlock();
-
         return;
     }
 
-    instrument->InstrumentPlugin()
-        ->sendMidiNote(
-            midiChannel,
-            noteNumber,
-            onOff,
-            velocity);
-
-    instrument->Unlock();
+    // This runs on the midi and the ui thread, the instrument sends the note
+    // without taking the lock the audio thread renders with
+    instrument->SendMidiNote(
+        midiChannel,
+        noteNumber,
+        onOff,
+        velocity);
 }
 
 void HandleKeyUpDown(
@@ -619,7 +572,7 @@ void MainMenu()
                 state.StopPlaying();
                 state.StopRecording();
 
-                ImGuiFileDialog::Instance()->OpenDialog("OpenFileDlgKey", "Choose File", ".yaml", ".");
+                ImGuiFileDialog::Instance()->OpenDialog("OpenFileDlgKey", "Choose File", ".song,.yaml", ".");
             }
 
             if (ImGui::MenuItem("Save", "CTRL+S"))
@@ -628,6 +581,7 @@ void MainMenu()
                 state.StopRecording();
 
                 TracksSerializer serializer(state._tracks, vstPluginService.get());
+                serializer.SetWorkerPool(_pluginWorkerPool);
 
                 serializer.Serialize("c:\\temp\\file.yaml");
             }
@@ -637,7 +591,7 @@ void MainMenu()
                 state.StopPlaying();
                 state.StopRecording();
 
-                ImGuiFileDialog::Instance()->OpenDialog("SaveFileDlgKey", "Choose File", ".yaml", ".");
+                ImGuiFileDialog::Instance()->OpenDialog("SaveFileDlgKey", "Choose File", ".song,.yaml", ".");
             }
 
             ImGui::Separator();
@@ -715,9 +669,20 @@ void MainMenu()
             std::string filePath = ImGuiFileDialog::Instance()->GetCurrentPath();
             // action
 
-            TracksSerializer serializer(state._tracks, vstPluginService.get());
+            if (BinaryTracksSerializer::IsBinaryFile(filePathName))
+            {
+                BinaryTracksSerializer serializer(state._tracks, vstPluginService.get());
+                serializer.SetWorkerPool(_pluginWorkerPool);
 
-            serializer.Deserialize(filePathName);
+                serializer.Deserialize(filePathName);
+            }
+            else
+            {
+                TracksSerializer serializer(state._tracks, vstPluginService.get());
+                serializer.SetWorkerPool(_pluginWorkerPool);
+
+                serializer.Deserialize(filePathName);
+            }
         }
         // close
         ImGuiFileDialog::Instance()->Close();
@@ -732,9 +697,17 @@ void MainMenu()
             std::string filePath = ImGuiFileDialog::Instance()->GetCurrentPath();
             // action
 
-            TracksSerializer serializer(state._tracks, vstPluginService.get());
+            if (std::filesystem::path(filePathName).extension() == ".song")
+            {
+                _autosaveService.Save(state._tracks, filePathName);
+            }
+            else
+            {
+                TracksSerializer serializer(state._tracks, vstPluginService.get());
+                serializer.SetWorkerPool(_pluginWorkerPool);
 
-            serializer.Serialize(filePathName);
+                serializer.Serialize(filePathName);
+            }
         }
         // close
         ImGuiFileDialog::Instance()->Close();
@@ -759,18 +732,21 @@ void HandleKeyboardToMidiEvents()
     }
 }
 
-void MainLoop()
+void MainLoop(
+    LatencyModes latencyMode)
 {
     Wasapi wasapi(
         [&](
             float *const data,
             uint32_t availableFrameCount,
-            const WAVEFORMATEX *const mixFormat) {
+            const AudioFormat &format) {
             return refillCallback(
                 data,
                 availableFrameCount,
-                mixFormat);
-        });
+                format);
+        },
+        30 * 10000,
+        latencyMode);
 
     _inspectorWindow.SetAudioOut(&wasapi);
 
@@ -784,6 +760,10 @@ void MainLoop()
             break;
         }
 
+        // Sizes the track buffers for tracks that were added and for the
+        // buffer of a device that was selected, before the audio thread needs them
+        _tracksRenderer.Prepare(wasapi.MaxFrameCount(), wasapi.Format().channelCount);
+
         if (glfwGetWindowAttrib(window, GLFW_FOCUSED))
         {
             HandleKeyboardToMidiEvents();
@@ -853,6 +833,9 @@ void MainLoop()
             track.Idle();
         }
 
+        // Between frames nothing changes the song, a safe point for the snapshot
+        _autosaveService.Tick(state._tracks);
+
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
 
@@ -889,15 +872,40 @@ int main(
     int argc,
     char **argv)
 {
-    (void)argc;
-    (void)argv;
-
     ComInit comInit{};
 
     spdlog::set_level(spdlog::level::debug);
 
+    // --latency exclusive gives the lowest latency for live playing, but
+    // no other application can play audio meanwhile
+    auto latencyMode = LatencyModes::Shared;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc && !LatencyNegotiator::ParseMode(argv[++i], latencyMode))
+        {
+            spdlog::error("unknown latency mode {0}, use shared, low or exclusive", argv[i]);
+        }
+    }
+
 #ifdef TEST_YOUR_CODE
     State::Tests();
+    BinaryTracksSerializer::Tests();
+    TracksSerializer::Tests();
+    AudioTelemetry::Tests();
+    AutosaveService::Tests();
+    DspKernels::Tests();
+    FileAudioDevice::Tests();
+    HistoryManager::Tests();
+    LatencyNegotiator::Tests();
+    Mixer::Tests();
+    NullAudioDevice::Tests();
+    PluginLoadQueue::Tests();
+    PluginModule::Tests();
+    PluginScanner::Tests();
+    ProcessingGraph::Tests();
+    Region::Tests();
+    Track::Tests();
+    TracksManager::Tests();
 #endif
 
     if (!glfwInit())
@@ -924,6 +932,12 @@ int main(
 
     vstPluginService = std::make_unique<PluginService>(window->hwnd);
 
+    // Fills the plugin library with the plugins installed on this machine,
+    // later runs only probe the plugins that are new or changed
+    std::thread pluginScanThread([]() {
+        vstPluginService->ScanPlugins(PluginService::DefaultPluginDirectories());
+    });
+
     // Setup ImGui binding
     ImGui::CreateContext();
 
@@ -946,9 +960,22 @@ int main(
 
     SetupFonts();
 
-    TracksSerializer serializer(state._tracks, vstPluginService.get());
+    WorkerPool pluginWorkerPool(WorkerPool::DefaultThreadCount(), false);
+    _pluginWorkerPool = &pluginWorkerPool;
 
-    serializer.Deserialize("c:\\temp\\tracks.state");
+    // The state is saved in the binary format, older states are still in YAML
+    if (BinaryTracksSerializer::IsBinaryFile("c:\\temp\\tracks.state"))
+    {
+        BinaryTracksSerializer serializer(state._tracks, vstPluginService.get());
+        serializer.SetWorkerPool(_pluginWorkerPool);
+        serializer.Deserialize("c:\\temp\\tracks.state");
+    }
+    else
+    {
+        TracksSerializer serializer(state._tracks, vstPluginService.get());
+        serializer.SetWorkerPool(_pluginWorkerPool);
+        serializer.Deserialize("c:\\temp\\tracks.state");
+    }
 
     _tracksEditor.SetState(&state);
     _tracksEditor.SetTracksManager(&_tracks);
@@ -972,9 +999,25 @@ int main(
 
     state._historyManager.SetTracksManager(&_tracks);
 
-    MainLoop();
+    _autosaveService.SetFilePath("c:\\temp\\tracks.state");
+    _autosaveService.SetInterval(std::chrono::seconds(60));
+
+    WorkerPool workerPool;
+
+    _tracksRenderer.SetTracksManager(&_tracks);
+    _tracksRenderer.SetWorkerPool(&workerPool);
+    _tracksRenderer.SetTelemetry(&_audioTelemetry);
+
+    _inspectorWindow.SetAudioTelemetry(&_audioTelemetry);
+    _inspectorWindow.SetTracksRenderer(&_tracksRenderer);
+
+    MainLoop(latencyMode);
+
+    _autosaveService.Save(state._tracks, "c:\\temp\\tracks.state");
+    _autosaveService.Flush();
 
-    serializer.Serialize("c:\\temp\\tracks.state");
+    vstPluginService->CancelScan();
+    pluginScanThread.join();
 
     state._tracks->CleanupInstruments();
 
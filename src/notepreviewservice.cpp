@@ -55,32 +55,25 @@ void NotePreviewService::PreviewNote(
         length = 100;
     }
 
-    instument->Lock();
-    if (instument->InstrumentPlugin() == nullptr)
+    // The audio thread may end the previous note meanwhile, the exchange
+    // makes sure only one of the two sends its note off
+    auto previousNote = _activePreviewNote.exchange(0);
+    if (previousNote > 0)
     {
-        spdlog::error("missing plugin");
-        instument->Unlock();
-
-        return;
+        instument->SendMidiNote(1, int(previousNote), false, 0);
     }
 
-    if (_activePreviewNote > 0)
-    {
-        instument->InstrumentPlugin()->sendMidiNote(1, _activePreviewNote, false, 0);
-    }
-    
-    instument->InstrumentPlugin()->sendMidiNote(1, note, true, velocity);
+    instument->SendMidiNote(1, int(note), true, int(velocity));
 
-    _activePreviewNote = note;
     _activePreviewNoteTimeLeft = _state->StepsToMs(length);
-
-    instument->Unlock();
+    _activePreviewNote = note;
 }
 
 void NotePreviewService::HandleMidiEventsInTimeRange(
     std::chrono::milliseconds::rep diff)
 {
-    if (_activePreviewNote <= 0)
+    auto note = _activePreviewNote.load();
+    if (note <= 0)
     {
         return;
     }
@@ -92,23 +85,23 @@ void NotePreviewService::HandleMidiEventsInTimeRange(
         return;
     }
 
-    instument->Lock();
-    
-    if (instument->InstrumentPlugin() == nullptr)
+    if (_activePreviewNoteTimeLeft.fetch_sub(diff) < diff)
     {
-        instument->Unlock();
-        return;
-    }
-
-    if (_activePreviewNoteTimeLeft < diff && _activePreviewNote > 0)
-    {
-        instument->InstrumentPlugin()->sendMidiNote(1, _activePreviewNote, false, 0);
-        _activePreviewNote = 0;
+        // Only end the note when the ui did not start another one meanwhile
+        if (_activePreviewNote.compare_exchange_strong(note, 0))
+        {
+            // This is the audio thread, it uses the plugin under the lock it
+            // renders with instead of taking its own reference, which could
+            // be the last one and close the plugin here
+            instument->Lock();
+
+            auto &plugin = instument->InstrumentPlugin();
+            if (plugin != nullptr)
+            {
+                plugin->sendMidiNote(1, int(note), false, 0);
+            }
+
+            instument->Unlock();
+        }
     }
-    else
-    {
-        _activePreviewNoteTimeLeft -= diff;
-    }
-
-    instument->Unlock();
 }
@@ -3,6 +3,7 @@
 
 #include "itracksmanager.h"
 #include "state.h"
+#include <atomic>
 #include <chrono>
 #include <memory>
 
@@ -28,8 +29,9 @@ public:
 private:
     State *_state = nullptr;
     ITracksManager *_tracks = nullptr;
-    uint32_t _activePreviewNote = 0;
-    std::chrono::milliseconds::rep _activePreviewNoteTimeLeft = 0;
+    // Written by the ui thread and read by the audio thread
+    std::atomic<uint32_t> _activePreviewNote = 0;
+    std::atomic<std::chrono::milliseconds::rep> _activePreviewNoteTimeLeft = 0;
 
     std::shared_ptr<Instrument> GetActiveInstrument();
 };
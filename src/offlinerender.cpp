@@ -0,0 +1,288 @@
+#include "audiotelemetry.h"
+#include "binarytracksserializer.h"
+#include "dspkernels.h"
+#include "fileaudiodevice.h"
+#include "instrument.h"
+#include "ipluginservice.h"
+#include "offlinerenderer.h"
+#include "testinstrument.h"
+#include "tracksmanager.h"
+#include "tracksserializer.h"
+#include "workerpool.h"
+
+#ifdef _WIN32
+#include "pluginservice.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <thread>
+
+// Replaces every plugin in the song with the built-in TestInstrument, so a
+// song can be rendered on machines without the VST modules it was made with.
+class TestPluginService : public IPluginService
+{
+public:
+    virtual std::shared_ptr<VstPlugin> LoadPlugin(
+        const std::wstring &filename)
+    {
+        (void)filename;
+
+        return TestInstrument::Create();
+    }
+
+    virtual std::shared_ptr<VstPlugin> LoadPlugin(
+        const std::string &filename)
+    {
+        (void)filename;
+
+        return TestInstrument::Create();
+    }
+
+    virtual std::shared_ptr<VstPlugin> LoadFromFileDialog()
+    {
+        return nullptr;
+    }
+
+    virtual std::vector<std::shared_ptr<PluginModule>> PrewarmModules(
+        const std::vector<std::string> &filenames)
+    {
+        (void)filenames;
+
+        return {};
+    }
+
+    virtual std::vector<PluginDescription> ListPlugins(
+        std::function<bool(const PluginDescription &)> filter)
+    {
+        (void)filter;
+
+        return {};
+    }
+
+    virtual std::vector<PluginDescription> QueryPlugins(
+        const PluginQuery &query)
+    {
+        (void)query;
+
+        return {};
+    }
+};
+
+static void PrintUsage()
+{
+    spdlog::info("usage: offline-render <song> <output.wav> [--bpm <bpm>] [--tail <ms>] [--threads <count>] [--block <frames>] [--realtime] [--trace <file>] [--test-instrument]");
+}
+
+int main(
+    int argc,
+    char **argv)
+{
+    if (argc < 3)
+    {
+        PrintUsage();
+
+        return 1;
+    }
+
+    std::string songPath = argv[1];
+    std::string outputPath = argv[2];
+    uint32_t bpm = 48;
+    long tail = 1000;
+    size_t threadCount = WorkerPool::DefaultThreadCount();
+    uint32_t blockSize = 1024;
+    bool realtime = false;
+    std::string tracePath;
+    bool useTestInstrument = false;
+
+#ifndef _WIN32
+    // Loading VST modules is only supported on Windows
+    useTestInstrument = true;
+#endif
+
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bpm") == 0 && i + 1 < argc)
+        {
+            bpm = uint32_t(std::atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--tail") == 0 && i + 1 < argc)
+        {
+            tail = std::atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threadCount = size_t(std::max(0, std::atoi(argv[++i])));
+        }
+        else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc)
+        {
+            blockSize = uint32_t(std::max(1, std::atoi(argv[++i])));
+        }
+        else if (strcmp(argv[i], "--realtime") == 0)
+        {
+            realtime = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--test-instrument") == 0)
+        {
+            useTestInstrument = true;
+        }
+        else
+        {
+            PrintUsage();
+
+            return 1;
+        }
+    }
+
+    std::unique_ptr<IPluginService> pluginService;
+
+    if (useTestInstrument)
+    {
+        pluginService = std::make_unique<TestPluginService>();
+    }
+#ifdef _WIN32
+    else
+    {
+        pluginService = std::make_unique<PluginService>(nullptr);
+    }
+#endif
+
+    TracksManager tracks;
+    bool loaded = false;
+    {
+        // Plugins are loaded once, the rendering pool keeps its realtime threads
+        WorkerPool loadWorkerPool(threadCount, false);
+
+        if (BinaryTracksSerializer::IsBinaryFile(songPath))
+        {
+            BinaryTracksSerializer serializer(&tracks, pluginService.get());
+            serializer.SetWorkerPool(&loadWorkerPool);
+            loaded = serializer.Deserialize(songPath);
+        }
+        else
+        {
+            TracksSerializer serializer(&tracks, pluginService.get());
+            serializer.SetWorkerPool(&loadWorkerPool);
+            loaded = serializer.Deserialize(songPath);
+        }
+    }
+
+    if (!loaded)
+    {
+        spdlog::error("failed to load song from {0}", songPath);
+
+        return 1;
+    }
+
+    if (useTestInstrument)
+    {
+        // The test instrument is a synth, it would silence the effect chain
+        for (auto &track : tracks.GetTracks())
+        {
+            auto instrument = track.GetInstrument();
+            if (instrument == nullptr)
+            {
+                continue;
+            }
+
+            for (int i = instrument->EffectPluginCount() - 1; i >= 0; i--)
+            {
+                instrument->SetEffectPlugin(i, nullptr);
+            }
+        }
+    }
+
+    WorkerPool workerPool(threadCount);
+
+    OfflineRenderer renderer(&tracks);
+    renderer.SetBpm(bpm);
+    renderer.SetWorkerPool(&workerPool);
+    renderer.SetTailLength(std::chrono::milliseconds(tail));
+    renderer.SetBlockSize(blockSize);
+
+    // The rings are too large for the stack
+    auto telemetry = std::make_unique<AudioTelemetry>();
+    renderer.SetTelemetry(telemetry.get());
+
+    spdlog::info("mixing with {0} kernels", DspKernels::Name(DspKernels::Current()));
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (realtime)
+    {
+        // The song plays through a device that asks for blocks at the pace
+        // of a sound card, so the refill path can be measured without one
+        AudioFormat format;
+        format.sampleRate = renderer.SampleRate();
+        format.channelCount = 2;
+
+        std::atomic<bool> done = false;
+        renderer.Begin(0, renderer.SongLength());
+
+        FileAudioDevice device(
+            [&](float *data, uint32_t frameCount, const AudioFormat &format) {
+                AudioTelemetry::CallbackScope telemetryScope(telemetry.get(), frameCount, format.sampleRate);
+
+                if (!renderer.RenderBlock(data, frameCount))
+                {
+                    done = true;
+
+                    return false;
+                }
+
+                return true;
+            },
+            outputPath,
+            format,
+            blockSize);
+
+        if (!device.IsOpen())
+        {
+            tracks.CleanupInstruments();
+
+            return 1;
+        }
+
+        while (!done)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        auto summary = AudioTelemetry::Summarize(telemetry->Callbacks());
+
+        spdlog::info("played {0} blocks of {1} frames, {2} were late", device.BlockCount(), blockSize, device.LateBlockCount());
+        spdlog::info("dsp load {0:.0f}% average, {1:.0f}% peak, {2} deadline misses", summary.averageLoad * 100.0, summary.peakLoad * 100.0, telemetry->DeadlineMissCount());
+    }
+    else if (!renderer.Render(outputPath))
+    {
+        spdlog::error("failed to render song to {0}", outputPath);
+
+        tracks.CleanupInstruments();
+
+        return 1;
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto rendered = double(renderer.RenderedFrameCount()) / renderer.SampleRate();
+
+    if (!tracePath.empty() && !telemetry->DumpTrace(tracePath, renderer.PluginNames()))
+    {
+        spdlog::error("failed to write the trace to {0}", tracePath);
+    }
+
+    spdlog::info("rendered {0:.2f}s of audio in {1:.2f}s ({2:.1f}x realtime)", rendered, elapsed, elapsed > 0 ? rendered / elapsed : 0.0);
+
+    tracks.CleanupInstruments();
+
+    return 0;
+}
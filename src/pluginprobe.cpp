@@ -0,0 +1,60 @@
+#include "ipluginservice.h"
+#include "vstplugin.h"
+
+#include <iostream>
+#include <memory>
+#include <spdlog/spdlog.h>
+
+// Loads one plugin module and prints its description, one "key=value" per
+// line. The PluginScanner runs this in a child process for every module it
+// finds, so a plugin that crashes or hangs while loading only takes this
+// process down.
+int main(
+    int argc,
+    char **argv)
+{
+    if (argc != 2)
+    {
+        spdlog::info("usage: plugin-probe <module>");
+
+        return 2;
+    }
+
+    // The plugin prints to stdout while it loads, the description is
+    // collected first and written after the plugin is closed
+    auto plugin = std::make_shared<VstPlugin>();
+
+    if (!plugin->init(argv[1]))
+    {
+        return 1;
+    }
+
+    PluginDescription description;
+    description.type = "VST2";
+    description.vendorName = plugin->getVendorName();
+    description.vendorVersion = plugin->getVendorVersion();
+    description.effectName = plugin->getEffectName();
+    description.programCount = plugin->getProgramCount();
+    description.paramCount = plugin->getParamCount();
+    description.inputCount = plugin->getInputCount();
+    description.outputCount = plugin->getOutputCount();
+    description.isSynth = plugin->flagsIsSynth();
+    description.hasEditor = plugin->flagsHasEditor();
+
+    plugin->cleanup();
+
+    std::cout << "probe=begin" << std::endl
+              << "type=" << description.type << std::endl
+              << "vendorName=" << description.vendorName << std::endl
+              << "vendorVersion=" << description.vendorVersion << std::endl
+              << "effectName=" << description.effectName << std::endl
+              << "programCount=" << description.programCount << std::endl
+              << "paramCount=" << description.paramCount << std::endl
+              << "inputCount=" << description.inputCount << std::endl
+              << "outputCount=" << description.outputCount << std::endl
+              << "isSynth=" << (description.isSynth ? 1 : 0) << std::endl
+              << "hasEditor=" << (description.hasEditor ? 1 : 0) << std::endl
+              << "probe=end" << std::endl;
+
+    return 0;
+}
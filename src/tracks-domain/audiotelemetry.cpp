@@ -0,0 +1,394 @@
+#include "audiotelemetry.h"
+
+#include <algorithm>
+#include <fstream>
+#include <spdlog/spdlog.h>
+
+int64_t AudioTelemetry::CallbackRecord::PeriodNs() const
+{
+    if (sampleRate == 0)
+    {
+        return 0;
+    }
+
+    return int64_t(frameCount) * 1000000000 / sampleRate;
+}
+
+double AudioTelemetry::CallbackRecord::Load() const
+{
+    auto periodNs = PeriodNs();
+
+    if (periodNs == 0)
+    {
+        return 0.0;
+    }
+
+    return double(durationNs) / double(periodNs);
+}
+
+AudioTelemetry::CallbackScope::CallbackScope(
+    AudioTelemetry *telemetry,
+    uint32_t frameCount,
+    uint32_t sampleRate)
+    : _telemetry(telemetry),
+      _frameCount(frameCount),
+      _sampleRate(sampleRate)
+{
+    if (_telemetry != nullptr)
+    {
+        _startNs = _telemetry->Now();
+        _telemetry->BeginCallback(_startNs);
+    }
+}
+
+AudioTelemetry::CallbackScope::~CallbackScope()
+{
+    if (_telemetry != nullptr)
+    {
+        _telemetry->EndCallback(_startNs, _frameCount, _sampleRate);
+    }
+}
+
+AudioTelemetry::AudioTelemetry()
+    : _epoch(std::chrono::steady_clock::now())
+{}
+
+int64_t AudioTelemetry::Now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _epoch).count();
+}
+
+void AudioTelemetry::BeginCallback(
+    int64_t startNs)
+{
+    (void)startNs;
+
+    _callbackIndex.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AudioTelemetry::EndCallback(
+    int64_t startNs,
+    uint32_t frameCount,
+    uint32_t sampleRate)
+{
+    CallbackRecord record;
+    record.index = _callbackIndex.load(std::memory_order_relaxed);
+    record.startNs = startNs;
+    record.durationNs = Now() - startNs;
+    record.frameCount = frameCount;
+    record.sampleRate = sampleRate;
+
+    if (record.durationNs > record.PeriodNs())
+    {
+        _deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    _callbacks.Write(record);
+}
+
+void AudioTelemetry::RecordPlugin(
+    const void *plugin,
+    int64_t startNs,
+    int64_t endNs)
+{
+    PluginRecord record;
+    record.callbackIndex = _callbackIndex.load(std::memory_order_relaxed);
+    record.plugin = reinterpret_cast<uintptr_t>(plugin);
+    record.thread = ThreadNumber();
+    record.startNs = startNs;
+    record.durationNs = endNs - startNs;
+
+    _plugins.Write(record);
+}
+
+uint64_t AudioTelemetry::DeadlineMissCount() const
+{
+    return _deadlineMisses.load(std::memory_order_relaxed);
+}
+
+std::vector<AudioTelemetry::CallbackRecord> AudioTelemetry::Callbacks(
+    size_t maxCount) const
+{
+    return _callbacks.Read(maxCount);
+}
+
+std::vector<AudioTelemetry::PluginRecord> AudioTelemetry::Plugins(
+    size_t maxCount) const
+{
+    return _plugins.Read(maxCount);
+}
+
+AudioTelemetry::Summary AudioTelemetry::Summarize(
+    const std::vector<CallbackRecord> &callbacks)
+{
+    Summary summary;
+    summary.callbackCount = callbacks.size();
+
+    if (callbacks.empty())
+    {
+        return summary;
+    }
+
+    double totalLoad = 0.0;
+
+    for (auto &callback : callbacks)
+    {
+        auto load = callback.Load();
+
+        totalLoad += load;
+        summary.peakLoad = std::max(summary.peakLoad, load);
+
+        if (load > 1.0)
+        {
+            summary.deadlineMisses++;
+        }
+    }
+
+    summary.averageLoad = totalLoad / callbacks.size();
+
+    return summary;
+}
+
+static std::string EscapeJson(
+    const std::string &text)
+{
+    std::string result;
+    result.reserve(text.size());
+
+    for (auto c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            result += ' ';
+        }
+        else
+        {
+            result += c;
+        }
+    }
+
+    return result;
+}
+
+bool AudioTelemetry::DumpTrace(
+    const std::string &filepath,
+    const std::map<uintptr_t, std::string> &pluginNames) const
+{
+    std::ofstream file(filepath, std::ios::trunc);
+
+    if (!file.is_open())
+    {
+        spdlog::error("failed to open {0} for writing", filepath);
+
+        return false;
+    }
+
+    // The trace format counts in microseconds
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"audio callback\"}}";
+
+    for (auto &callback : Callbacks())
+    {
+        file << "," << std::endl
+             << "{\"name\":\"callback " << callback.index << "\",\"ph\":\"X\",\"pid\":1,\"tid\":0"
+             << ",\"ts\":" << callback.startNs / 1000.0
+             << ",\"dur\":" << callback.durationNs / 1000.0
+             << ",\"args\":{\"frames\":" << callback.frameCount
+             << ",\"periodUs\":" << callback.PeriodNs() / 1000.0
+             << ",\"load\":" << callback.Load() << "}}";
+
+        if (callback.Load() > 1.0)
+        {
+            file << "," << std::endl
+                 << "{\"name\":\"deadline miss\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0"
+                 << ",\"ts\":" << (callback.startNs + callback.PeriodNs()) / 1000.0 << "}";
+        }
+    }
+
+    for (auto &plugin : Plugins())
+    {
+        auto name = pluginNames.find(plugin.plugin);
+
+        file << "," << std::endl
+             << "{\"name\":\"" << (name != pluginNames.end() ? EscapeJson(name->second) : std::string("plugin")) << "\""
+             << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << (plugin.thread + 1)
+             << ",\"ts\":" << plugin.startNs / 1000.0
+             << ",\"dur\":" << plugin.durationNs / 1000.0
+             << ",\"args\":{\"callback\":" << plugin.callbackIndex << "}}";
+    }
+
+    file << std::endl
+         << "]}" << std::endl;
+
+    return file.good();
+}
+
+uint32_t AudioTelemetry::ThreadNumber()
+{
+    static std::atomic<uint32_t> nextThreadNumber = 0;
+    thread_local uint32_t threadNumber = nextThreadNumber.fetch_add(1, std::memory_order_relaxed);
+
+    return threadNumber;
+}
+
+template <class T, size_t Capacity>
+void AudioTelemetry::Ring<T, Capacity>::Write(
+    const T &record)
+{
+    auto index = _writeIndex.fetch_add(1, std::memory_order_relaxed);
+    auto &slot = _slots[index % Capacity];
+
+    auto sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.index = index;
+    slot.record = record;
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+template <class T, size_t Capacity>
+std::vector<T> AudioTelemetry::Ring<T, Capacity>::Read(
+    size_t maxCount) const
+{
+    auto end = _writeIndex.load(std::memory_order_acquire);
+    auto count = std::min<uint64_t>(std::min<uint64_t>(maxCount, Capacity), end);
+
+    std::vector<T> result;
+    result.reserve(size_t(count));
+
+    for (auto index = end - count; index < end; index++)
+    {
+        auto &slot = _slots[index % Capacity];
+
+        auto sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence & 1)
+        {
+            continue;
+        }
+
+        auto slotIndex = slot.index;
+        auto record = slot.record;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // Skipped when it was written meanwhile, or when the writer that
+        // took this index did not get to it yet
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence || slotIndex != index)
+        {
+            continue;
+        }
+
+        result.push_back(record);
+    }
+
+    return result;
+}
+
+#ifdef TEST_YOUR_CODE
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <thread>
+
+void AudioTelemetry::Tests()
+{
+    // The rings are too large for the stack
+    auto telemetry = std::make_unique<AudioTelemetry>();
+    int pluginA = 0;
+    int pluginB = 0;
+
+    // 512 frames at 48kHz is a period of 10.67ms
+    for (int i = 0; i < 3; i++)
+    {
+        auto start = telemetry->Now();
+        telemetry->BeginCallback(start);
+        telemetry->RecordPlugin(&pluginA, start, start + 1000000);
+        telemetry->RecordPlugin(&pluginB, start + 1000000, start + 3000000);
+        telemetry->EndCallback(start - (i == 2 ? 20000000 : 0), 512, 48000);
+    }
+
+    auto callbacks = telemetry->Callbacks();
+    auto summary = Summarize(callbacks);
+
+    if (callbacks.size() != 3 || callbacks[0].index != 1 || callbacks[2].index != 3)
+    {
+        std::cout << "AudioTelemetry recorded " << callbacks.size() << " callbacks, expected 3" << std::endl;
+    }
+
+    if (telemetry->DeadlineMissCount() != 1 || summary.deadlineMisses != 1 || summary.peakLoad < 1.8)
+    {
+        std::cout << "AudioTelemetry counted " << telemetry->DeadlineMissCount() << " deadline misses with a peak load of " << summary.peakLoad << ", expected 1 above 1.8" << std::endl;
+    }
+
+    auto plugins = telemetry->Plugins();
+
+    if (plugins.size() != 6 || plugins[1].plugin != reinterpret_cast<uintptr_t>(&pluginB) || plugins[1].durationNs != 2000000 || plugins[5].callbackIndex != 3)
+    {
+        std::cout << "AudioTelemetry did not record the plugins of every callback" << std::endl;
+    }
+
+    // The ring keeps the latest records when it wraps around
+    for (size_t i = 0; i < CallbackCapacity; i++)
+    {
+        telemetry->BeginCallback(0);
+        telemetry->EndCallback(0, 512, 48000);
+    }
+
+    callbacks = telemetry->Callbacks(10);
+    if (callbacks.size() != 10 || callbacks.back().index != CallbackCapacity + 3)
+    {
+        std::cout << "AudioTelemetry did not keep the latest callbacks" << std::endl;
+    }
+
+    // Writers on several threads, like the render workers, until the ring
+    // wrapped around
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 20000; i++)
+            {
+                telemetry->RecordPlugin(&pluginA, i, i + 1);
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    plugins = telemetry->Plugins();
+    if (plugins.size() != PluginCapacity)
+    {
+        std::cout << "AudioTelemetry read " << plugins.size() << " plugin records after the threads were done, expected " << PluginCapacity << std::endl;
+    }
+
+    auto filepath = (std::filesystem::temp_directory_path() / "vsthost-audiotelemetry-test.json").string();
+
+    if (!telemetry->DumpTrace(filepath, {{reinterpret_cast<uintptr_t>(&pluginA), "Synth \"A\""}}))
+    {
+        std::cout << "AudioTelemetry failed to dump the trace" << std::endl;
+    }
+
+    // The callback that missed its deadline was overwritten by now
+    std::ifstream file(filepath);
+    std::string trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+
+    if (trace.find("\"name\":\"Synth \\\"A\\\"\"") == std::string::npos || trace.find("\"deadline miss\"") != std::string::npos || trace.substr(trace.size() - 3) != "]}\n")
+    {
+        std::cout << "AudioTelemetry wrote an unexpected trace" << std::endl;
+    }
+
+    std::filesystem::remove(filepath);
+}
+#endif
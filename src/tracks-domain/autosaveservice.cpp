@@ -0,0 +1,357 @@
+#include "autosaveservice.h"
+
+#include "binarytracksserializer.h"
+#include "widestringconversions.hpp"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <unistd.h>
+#endif
+
+AutosaveService::AutosaveService()
+    : _chunkWorkerPool(WorkerPool::DefaultThreadCount(), false)
+{
+    _thread = std::thread(&AutosaveService::WriterLoop, this);
+}
+
+AutosaveService::~AutosaveService()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+
+    _jobAdded.notify_one();
+
+    _thread.join();
+}
+
+void AutosaveService::SetInterval(
+    std::chrono::seconds interval)
+{
+    _interval = interval;
+}
+
+void AutosaveService::SetFilePath(
+    const std::string &filepath)
+{
+    _filepath = filepath;
+}
+
+void AutosaveService::Tick(
+    ITracksManager *tracks)
+{
+    if (_interval.count() <= 0 || _filepath.empty())
+    {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+
+    if (now - _lastSave < _interval)
+    {
+        return;
+    }
+
+    {
+        // Try again next frame, the disk is slower than the interval
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_writing || !_jobs.empty())
+        {
+            return;
+        }
+    }
+
+    _lastSave = now;
+
+    Save(tracks, _filepath);
+}
+
+void AutosaveService::Save(
+    ITracksManager *tracks,
+    const std::string &filepath)
+{
+    Job job;
+    // The chunks are asked for on the thread of the service
+    job.snapshot = SongSnapshot::TakeWithoutChunks(tracks);
+    job.filepath = filepath;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        // A newer snapshot replaces one for the same file that is not being written yet
+        auto found = std::find_if(_jobs.begin(), _jobs.end(), [&](const Job &j) { return j.filepath == filepath; });
+        if (found != _jobs.end())
+        {
+            *found = std::move(job);
+        }
+        else
+        {
+            _jobs.push_back(std::move(job));
+        }
+    }
+
+    _jobAdded.notify_one();
+}
+
+void AutosaveService::Flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _jobsDone.wait(lock, [this]() { return _jobs.empty() && !_writing; });
+}
+
+void AutosaveService::WriterLoop()
+{
+#ifdef _WIN32
+    // Saving should never take time from the UI or the audio
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#endif
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true)
+    {
+        _jobAdded.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+
+        if (_jobs.empty())
+        {
+            // Only stops when all pending saves are written
+            return;
+        }
+
+        auto job = std::move(_jobs.front());
+        _jobs.pop_front();
+        _writing = true;
+
+        lock.unlock();
+
+        job.snapshot->CaptureChunks(&_chunkWorkerPool);
+
+        auto succeeded = WriteFile(*job.snapshot, job.filepath);
+        _lastSaveSucceeded = succeeded;
+
+        // The snapshot holds on to regions of the song, release them before
+        // the song changes them again
+        job.snapshot = nullptr;
+
+        lock.lock();
+
+        _writing = false;
+
+        if (_jobs.empty())
+        {
+            _jobsDone.notify_all();
+        }
+    }
+}
+
+#ifdef _WIN32
+static bool SyncFile(
+    const std::string &filepath)
+{
+    auto file = CreateFileW(
+        ConvertUtf8ToWide(filepath).c_str(),
+        GENERIC_WRITE,
+        0,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    auto result = FlushFileBuffers(file) != 0;
+
+    CloseHandle(file);
+
+    return result;
+}
+
+static bool ReplaceFile(
+    const std::string &from,
+    const std::string &to)
+{
+    return MoveFileExW(
+               ConvertUtf8ToWide(from).c_str(),
+               ConvertUtf8ToWide(to).c_str(),
+               MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+#else
+static bool SyncFile(
+    const std::string &filepath)
+{
+    auto file = open(filepath.c_str(), O_RDONLY);
+
+    if (file < 0)
+    {
+        return false;
+    }
+
+    auto result = fsync(file) == 0;
+
+    close(file);
+
+    return result;
+}
+
+static bool ReplaceFile(
+    const std::string &from,
+    const std::string &to)
+{
+    if (std::rename(from.c_str(), to.c_str()) != 0)
+    {
+        return false;
+    }
+
+    // Makes the rename itself durable
+    auto directory = std::filesystem::path(to).parent_path();
+    SyncFile(directory.empty() ? std::string(".") : directory.string());
+
+    return true;
+}
+#endif
+
+bool AutosaveService::WriteFile(
+    SongSnapshot &snapshot,
+    const std::string &filepath)
+{
+    auto temporaryFilepath = filepath + ".tmp";
+
+    if (!BinaryTracksSerializer::Serialize(snapshot, temporaryFilepath))
+    {
+        return false;
+    }
+
+    if (!SyncFile(temporaryFilepath))
+    {
+        spdlog::error("failed to sync {0} to disk", temporaryFilepath);
+
+        return false;
+    }
+
+    if (!ReplaceFile(temporaryFilepath, filepath))
+    {
+        spdlog::error("failed to replace {0} with {1}", filepath, temporaryFilepath);
+
+        return false;
+    }
+
+    return true;
+}
+
+#ifdef TEST_YOUR_CODE
+#include "tracksmanager.h"
+#include <filesystem>
+#include <iostream>
+
+static std::thread::id _chunkThread;
+
+static VstIntPtr ChunkThreadDispatcher(
+    AEffect *effect,
+    VstInt32 opcode,
+    VstInt32 index,
+    VstIntPtr value,
+    void *ptr,
+    float opt)
+{
+    (void)index;
+    (void)value;
+    (void)opt;
+
+    static char chunk[] = "chunk";
+
+    if (opcode == effClose)
+    {
+        delete effect;
+    }
+    else if (opcode == effGetChunk)
+    {
+        _chunkThread = std::this_thread::get_id();
+        *reinterpret_cast<void **>(ptr) = chunk;
+
+        return VstIntPtr(sizeof(chunk));
+    }
+
+    return 0;
+}
+
+static AEffect *ChunkThreadMain(
+    audioMasterCallback callback)
+{
+    (void)callback;
+
+    auto effect = new AEffect();
+    effect->magic = kEffectMagic;
+    effect->dispatcher = ChunkThreadDispatcher;
+
+    return effect;
+}
+
+void AutosaveService::Tests()
+{
+    auto filepath = (std::filesystem::temp_directory_path() / "vsthost-autosaveservice-test.song").string();
+
+    auto plugin = std::make_shared<VstPlugin>();
+    plugin->init(ChunkThreadMain, "test:ChunkThread");
+
+    auto instrument = std::make_shared<Instrument>();
+    instrument->SetInstrumentPlugin(plugin);
+
+    TracksManager tracks;
+    auto trackId = tracks.AddTrack("saved", instrument);
+    tracks.GetTrack(trackId).AddRegion(0, Region());
+
+    {
+        AutosaveService sut;
+        sut.SetFilePath(filepath);
+        sut.SetInterval(std::chrono::seconds(0));
+
+        sut.Tick(&tracks);
+        sut.Flush();
+
+        if (std::filesystem::exists(filepath))
+        {
+            std::cout << "Autosave saved while it is turned off" << std::endl;
+        }
+
+        sut.Save(&tracks, filepath);
+
+        // Changes after the snapshot are not in the save
+        tracks.GetTrack(trackId).SetName("changed");
+        tracks.GetTrack(trackId).EditRegion(0, [](Region &region) { region.SetName("changed"); });
+
+        sut.Flush();
+
+        if (!sut.LastSaveSucceeded() || std::filesystem::exists(filepath + ".tmp"))
+        {
+            std::cout << "Save did not replace " << filepath << std::endl;
+        }
+
+        if (_chunkThread == std::thread::id() || _chunkThread == std::this_thread::get_id())
+        {
+            std::cout << "Save did not ask the plugin for its chunk on the thread of the service" << std::endl;
+        }
+    }
+
+    TracksManager loaded;
+    BinaryTracksSerializer(&loaded, nullptr).Deserialize(filepath);
+
+    auto &loadedTracks = loaded.GetTracks();
+    if (loadedTracks.size() != 1 || loadedTracks[0].GetName() != "saved" || loadedTracks[0].Regions().size() != 1 || loadedTracks[0].Regions().begin()->second.GetName() != "region")
+    {
+        std::cout << "Save did not write the song as it was when the snapshot was taken" << std::endl;
+    }
+
+    std::filesystem::remove(filepath);
+}
+#endif
@@ -0,0 +1,1069 @@
+#include "binarytracksserializer.h"
+
+#include "mappedfile.h"
+#include "pluginloadqueue.h"
+#include "track.h"
+#include <cstring>
+#include <fstream>
+#include <spdlog/spdlog.h>
+
+// The file starts with a FileHeader and a table of SectionEntry's. All
+// numbers are little endian and every section starts at a multiple of 8
+// bytes. Records refer to each other by index, and to strings and plugin
+// chunks by offset into the strings and chunks sections.
+
+static const char fileMagic[8] = {'V', 'S', 'T', 'H', 'S', 'O', 'N', 'G'};
+
+enum class SectionTypes : uint32_t
+{
+    Song = 1,         // one SongRecord
+    Tracks = 2,       // TrackRecord's
+    Regions = 3,      // RegionRecord's, the regions of a track are consecutive
+    Events = 4,       // EventRecord's, the events of a region are consecutive and sorted on time
+    Plugins = 5,      // PluginRecord's
+    Strings = 6,      // utf-8 bytes
+    Chunks = 7,       // raw plugin chunks
+    Buses = 8,        // BusRecord's, the master bus first
+    Mixer = 9,        // MixerRecord's, one for every TrackRecord
+    Effects = 10,     // EffectRecord's, the effects after the ones in the TrackRecord
+    PluginFlags = 11, // uint32_t's, one for every PluginRecord
+};
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t sectionCount;
+};
+
+struct SectionEntry
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct StringRef
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SongRecord
+{
+    StringRef name;
+};
+
+const uint32_t trackIsMuted = 1;
+const uint32_t trackIsReadyForRecording = 2;
+const uint32_t trackHasInstrument = 4;
+const int32_t noPlugin = -1;
+
+// The first effects are in the TrackRecord, the rest in the Effects section
+const int trackRecordEffectCount = 4;
+
+// Effect slots can be empty, so an effect index is only checked against a
+// limit no song gets near
+const uint32_t maxEffectIndex = 4096;
+
+struct TrackRecord
+{
+    StringRef name;
+    float color[4];
+    uint32_t flags;
+    StringRef instrumentName;
+    int32_t midiChannel;
+    int32_t instrumentPlugin;
+    int32_t effectPlugins[trackRecordEffectCount];
+    uint32_t firstRegion;
+    uint32_t regionCount;
+};
+
+struct RegionRecord
+{
+    int64_t start;
+    int64_t length;
+    StringRef name;
+    uint64_t firstEvent;
+    uint64_t eventCount;
+};
+
+struct EventRecord
+{
+    int64_t time;
+    uint32_t num;
+    uint32_t value;
+    uint32_t channel;
+    uint32_t type;
+};
+
+const uint32_t pluginSleepNotAllowed = 1;
+
+struct PluginRecord
+{
+    StringRef modulePath;
+    uint64_t chunkOffset;
+    uint64_t chunkSize;
+};
+
+// Outputs are indices of group buses, the master bus is -1
+const int32_t masterBus = -1;
+
+struct BusRecord
+{
+    StringRef name;
+    float gain;
+    float pan;
+    int32_t output;
+    uint32_t reserved;
+};
+
+struct MixerRecord
+{
+    float gain;
+    float pan;
+    int32_t output;
+    uint32_t reserved;
+};
+
+struct EffectRecord
+{
+    uint32_t track;
+    uint32_t index;
+    int32_t plugin;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(FileHeader) == 16, "FileHeader is part of the file format");
+static_assert(sizeof(SectionEntry) == 24, "SectionEntry is part of the file format");
+static_assert(sizeof(TrackRecord) == 68, "TrackRecord is part of the file format");
+static_assert(sizeof(EventRecord) == 24, "EventRecord is part of the file format");
+static_assert(sizeof(RegionRecord) == 40, "RegionRecord is part of the file format");
+static_assert(sizeof(PluginRecord) == 24, "PluginRecord is part of the file format");
+static_assert(sizeof(BusRecord) == 24, "BusRecord is part of the file format");
+static_assert(sizeof(MixerRecord) == 16, "MixerRecord is part of the file format");
+static_assert(sizeof(EffectRecord) == 16, "EffectRecord is part of the file format");
+
+BinaryTracksSerializer::BinaryTracksSerializer(
+    ITracksManager *tracks,
+    IPluginService *vstPluginService)
+    : _tracks(tracks), _vstPluginService(vstPluginService)
+{}
+
+void BinaryTracksSerializer::SetWorkerPool(
+    WorkerPool *workerPool)
+{
+    _workerPool = workerPool;
+}
+
+class SongWriter
+{
+public:
+    SongRecord _song;
+    std::vector<TrackRecord> _tracks;
+    std::vector<RegionRecord> _regions;
+    std::vector<EventRecord> _events;
+    std::vector<PluginRecord> _plugins;
+    std::vector<BusRecord> _buses;
+    std::vector<MixerRecord> _mixer;
+    std::vector<EffectRecord> _effects;
+    std::vector<uint32_t> _pluginFlags;
+    std::string _strings;
+    std::vector<uint8_t> _chunks;
+    std::vector<MixerBus> _groupBuses;
+
+    int32_t BusIndex(
+        uint32_t busId) const
+    {
+        for (size_t i = 0; i < _groupBuses.size(); i++)
+        {
+            if (_groupBuses[i].Id() == busId)
+            {
+                return int32_t(i);
+            }
+        }
+
+        return masterBus;
+    }
+
+    void AddBuses(
+        const MixerBus &master,
+        const std::vector<MixerBus> &buses)
+    {
+        _groupBuses = buses;
+
+        AddBus(master);
+        for (auto &bus : buses)
+        {
+            AddBus(bus);
+        }
+    }
+
+    void AddBus(
+        const MixerBus &bus)
+    {
+        BusRecord record = {};
+        record.name = AddString(bus.GetName());
+        record.gain = bus.GetGain();
+        record.pan = bus.GetPan();
+        record.output = BusIndex(bus.GetOutputBus());
+
+        _buses.push_back(record);
+    }
+
+    StringRef AddString(
+        const std::string &str)
+    {
+        StringRef ref;
+        ref.offset = uint32_t(_strings.size());
+        ref.length = uint32_t(str.size());
+
+        _strings.append(str);
+
+        return ref;
+    }
+
+    int32_t AddPlugin(
+        const std::unique_ptr<PluginSnapshot> &plugin)
+    {
+        if (plugin == nullptr)
+        {
+            return noPlugin;
+        }
+
+        PluginRecord record;
+        record.modulePath = AddString(plugin->modulePath);
+        record.chunkOffset = _chunks.size();
+        record.chunkSize = plugin->chunk.size();
+
+        _chunks.insert(_chunks.end(), plugin->chunk.begin(), plugin->chunk.end());
+
+        _plugins.push_back(record);
+        _pluginFlags.push_back(plugin->sleepAllowed ? 0 : pluginSleepNotAllowed);
+
+        return int32_t(_plugins.size() - 1);
+    }
+
+    void AddTrack(
+        TrackSnapshot &snapshot)
+    {
+        auto &track = snapshot.track;
+
+        TrackRecord record = {};
+        record.name = AddString(track.GetName());
+        std::memcpy(record.color, track.GetColor(), sizeof(record.color));
+        record.flags = (track.IsMuted() ? trackIsMuted : 0) | (track.IsReadyForRecoding() ? trackIsReadyForRecording : 0);
+        record.instrumentPlugin = noPlugin;
+        for (int i = 0; i < trackRecordEffectCount; i++)
+        {
+            record.effectPlugins[i] = noPlugin;
+        }
+
+        if (snapshot.hasInstrument)
+        {
+            record.flags |= trackHasInstrument;
+            record.instrumentName = AddString(snapshot.instrumentName);
+            record.midiChannel = snapshot.midiChannel;
+
+            for (size_t i = 0; i < snapshot.effectPlugins.size(); i++)
+            {
+                auto plugin = AddPlugin(snapshot.effectPlugins[i]);
+
+                if (i < trackRecordEffectCount)
+                {
+                    record.effectPlugins[i] = plugin;
+                }
+                else if (plugin != noPlugin)
+                {
+                    _effects.push_back(EffectRecord{uint32_t(_tracks.size()), uint32_t(i), plugin, 0});
+                }
+            }
+
+            record.instrumentPlugin = AddPlugin(snapshot.instrumentPlugin);
+        }
+
+        record.firstRegion = uint32_t(_regions.size());
+        record.regionCount = uint32_t(track.Regions().size());
+
+        MixerRecord mixerRecord = {};
+        mixerRecord.gain = track.GetGain();
+        mixerRecord.pan = track.GetPan();
+        mixerRecord.output = BusIndex(track.GetOutputBus());
+        _mixer.push_back(mixerRecord);
+
+        for (auto &region : track.Regions())
+        {
+            AddRegion(region.first, region.second);
+        }
+
+        _tracks.push_back(record);
+    }
+
+    void AddRegion(
+        std::chrono::milliseconds::rep start,
+        const Region &region)
+    {
+        auto &events = region.SortedEvents();
+
+        RegionRecord record;
+        record.start = start;
+        record.length = region.Length();
+        record.name = AddString(region.GetName());
+        record.firstEvent = _events.size();
+        record.eventCount = events.size();
+
+        for (auto &e : events)
+        {
+            EventRecord event;
+            event.time = e.time;
+            event.num = e.num;
+            event.value = e.value;
+            event.channel = e.channel;
+            event.type = uint32_t(e.type);
+
+            _events.push_back(event);
+        }
+
+        _regions.push_back(record);
+    }
+
+    bool Write(
+        const std::string &filepath)
+    {
+        struct Section
+        {
+            SectionTypes type;
+            const void *data;
+            size_t size;
+        };
+
+        const Section sections[] = {
+            {SectionTypes::Song, &_song, sizeof(_song)},
+            {SectionTypes::Tracks, _tracks.data(), _tracks.size() * sizeof(TrackRecord)},
+            {SectionTypes::Regions, _regions.data(), _regions.size() * sizeof(RegionRecord)},
+            {SectionTypes::Events, _events.data(), _events.size() * sizeof(EventRecord)},
+            {SectionTypes::Plugins, _plugins.data(), _plugins.size() * sizeof(PluginRecord)},
+            {SectionTypes::Strings, _strings.data(), _strings.size()},
+            {SectionTypes::Chunks, _chunks.data(), _chunks.size()},
+            {SectionTypes::Buses, _buses.data(), _buses.size() * sizeof(BusRecord)},
+            {SectionTypes::Mixer, _mixer.data(), _mixer.size() * sizeof(MixerRecord)},
+            {SectionTypes::Effects, _effects.data(), _effects.size() * sizeof(EffectRecord)},
+            {SectionTypes::PluginFlags, _pluginFlags.data(), _pluginFlags.size() * sizeof(uint32_t)},
+        };
+        const auto sectionCount = sizeof(sections) / sizeof(Section);
+
+        FileHeader header;
+        std::memcpy(header.magic, fileMagic, sizeof(header.magic));
+        header.version = BinaryTracksSerializer::Version;
+        header.sectionCount = uint32_t(sectionCount);
+
+        std::vector<SectionEntry> table(sectionCount);
+        uint64_t offset = sizeof(FileHeader) + sizeof(SectionEntry) * sectionCount;
+        for (size_t i = 0; i < sectionCount; i++)
+        {
+            offset = (offset + 7) & ~uint64_t(7);
+
+            table[i].type = uint32_t(sections[i].type);
+            table[i].reserved = 0;
+            table[i].offset = offset;
+            table[i].size = sections[i].size;
+
+            offset += sections[i].size;
+        }
+
+        std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            spdlog::error("failed to open {0} for writing", filepath);
+
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(table.data()), std::streamsize(table.size() * sizeof(SectionEntry)));
+
+        const char padding[8] = {0};
+        for (size_t i = 0; i < sectionCount; i++)
+        {
+            auto position = uint64_t(file.tellp());
+            file.write(padding, std::streamsize(table[i].offset - position));
+
+            if (sections[i].size > 0)
+            {
+                file.write(reinterpret_cast<const char *>(sections[i].data), std::streamsize(sections[i].size));
+            }
+        }
+
+        file.close();
+
+        if (!file)
+        {
+            spdlog::error("failed to write {0}", filepath);
+
+            return false;
+        }
+
+        return true;
+    }
+};
+
+bool BinaryTracksSerializer::Serialize(
+    const std::string &filepath)
+{
+    auto snapshot = SongSnapshot::Take(_tracks, _workerPool);
+
+    return Serialize(*snapshot, filepath);
+}
+
+bool BinaryTracksSerializer::Serialize(
+    SongSnapshot &snapshot,
+    const std::string &filepath)
+{
+    SongWriter writer;
+
+    writer._song.name = writer.AddString("Untitled");
+    writer.AddBuses(snapshot.masterBus, snapshot.buses);
+
+    for (auto &track : snapshot.tracks)
+    {
+        writer.AddTrack(track);
+    }
+
+    return writer.Write(filepath);
+}
+
+class SongReader
+{
+public:
+    SongReader(
+        const MappedFile &file)
+        : _file(file)
+    {}
+
+    bool ReadSectionTable()
+    {
+        FileHeader header;
+        if (_file.Size() < sizeof(header))
+        {
+            return false;
+        }
+
+        std::memcpy(&header, _file.Data(), sizeof(header));
+
+        if (std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0)
+        {
+            spdlog::error("not a binary song file");
+
+            return false;
+        }
+
+        if (header.version > BinaryTracksSerializer::Version)
+        {
+            spdlog::error("binary song file version {0} is newer than {1}", header.version, BinaryTracksSerializer::Version);
+
+            return false;
+        }
+
+        if (uint64_t(header.sectionCount) * sizeof(SectionEntry) > _file.Size() - sizeof(header))
+        {
+            spdlog::error("binary song file is truncated");
+
+            return false;
+        }
+
+        _sections.resize(header.sectionCount);
+        std::memcpy(_sections.data(), _file.Data() + sizeof(header), _sections.size() * sizeof(SectionEntry));
+
+        for (auto &section : _sections)
+        {
+            if (section.offset > _file.Size() || section.size > _file.Size() - section.offset)
+            {
+                spdlog::error("section {0} is outside of the binary song file", section.type);
+
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Sections this version does not know are skipped, missing sections are empty
+    const SectionEntry *FindSection(
+        SectionTypes type) const
+    {
+        for (auto &section : _sections)
+        {
+            if (section.type == uint32_t(type))
+            {
+                return &section;
+            }
+        }
+
+        return nullptr;
+    }
+
+    template <typename T>
+    size_t RecordCount(
+        SectionTypes type) const
+    {
+        auto section = FindSection(type);
+
+        return section == nullptr ? 0 : size_t(section->size / sizeof(T));
+    }
+
+    template <typename T>
+    bool ReadRecord(
+        SectionTypes type,
+        uint64_t index,
+        T &record) const
+    {
+        if (index >= RecordCount<T>(type))
+        {
+            spdlog::error("record {0} is missing in section {1}", index, uint32_t(type));
+
+            return false;
+        }
+
+        // Copied because the records in the file do not have to be aligned
+        std::memcpy(&record, _file.Data() + FindSection(type)->offset + index * sizeof(T), sizeof(T));
+
+        return true;
+    }
+
+    std::string ReadString(
+        const StringRef &ref) const
+    {
+        auto section = FindSection(SectionTypes::Strings);
+
+        if (section == nullptr || ref.offset > section->size || ref.length > section->size - ref.offset)
+        {
+            spdlog::error("string is outside of the strings section");
+
+            return "";
+        }
+
+        return std::string(reinterpret_cast<const char *>(_file.Data() + section->offset + ref.offset), ref.length);
+    }
+
+    // Points in the mapped file, valid until it is closed
+    uint8_t *Chunk(
+        const PluginRecord &record) const
+    {
+        auto section = FindSection(SectionTypes::Chunks);
+
+        if (section == nullptr || record.chunkOffset > section->size || record.chunkSize > section->size - record.chunkOffset)
+        {
+            spdlog::error("plugin chunk is outside of the chunks section");
+
+            return nullptr;
+        }
+
+        return _file.Data() + section->offset + record.chunkOffset;
+    }
+
+private:
+    const MappedFile &_file;
+    std::vector<SectionEntry> _sections;
+};
+
+static void DeserializePlugin(
+    const SongReader &reader,
+    int32_t index,
+    std::shared_ptr<Instrument> instrument,
+    int effectIndex,
+    PluginLoadQueue &pluginLoadQueue)
+{
+    if (index == noPlugin)
+    {
+        return;
+    }
+
+    PluginRecord record;
+    if (!reader.ReadRecord(SectionTypes::Plugins, uint64_t(index), record))
+    {
+        return;
+    }
+
+    // Files without the section have the default flags
+    uint32_t flags = 0;
+    if (uint64_t(index) < reader.RecordCount<uint32_t>(SectionTypes::PluginFlags))
+    {
+        reader.ReadRecord(SectionTypes::PluginFlags, uint64_t(index), flags);
+    }
+
+    // The chunk is handed to the plugin straight from the mapped file
+    auto chunk = reader.Chunk(record);
+
+    pluginLoadQueue.Add(
+        instrument,
+        effectIndex,
+        reader.ReadString(record.modulePath),
+        chunk,
+        chunk != nullptr ? size_t(record.chunkSize) : 0,
+        (flags & pluginSleepNotAllowed) == 0);
+}
+
+static std::shared_ptr<Instrument> DeserializeInstrument(
+    const SongReader &reader,
+    uint64_t trackIndex,
+    const TrackRecord &trackRecord,
+    PluginLoadQueue &pluginLoadQueue)
+{
+    if ((trackRecord.flags & trackHasInstrument) == 0)
+    {
+        return nullptr;
+    }
+
+    auto instrument = std::make_shared<Instrument>();
+    instrument->SetName(reader.ReadString(trackRecord.instrumentName));
+    instrument->SetMidiChannel(trackRecord.midiChannel);
+
+    for (int i = 0; i < trackRecordEffectCount; i++)
+    {
+        DeserializePlugin(reader, trackRecord.effectPlugins[i], instrument, i, pluginLoadQueue);
+    }
+
+    // Files without the section have no more effects than fit in the track record
+    auto effectCount = reader.RecordCount<EffectRecord>(SectionTypes::Effects);
+
+    for (uint64_t e = 0; e < effectCount; e++)
+    {
+        EffectRecord effectRecord;
+        if (!reader.ReadRecord(SectionTypes::Effects, e, effectRecord) || effectRecord.track != trackIndex)
+        {
+            continue;
+        }
+
+        if (effectRecord.index < uint32_t(trackRecordEffectCount) || effectRecord.index >= maxEffectIndex)
+        {
+            spdlog::error("effect record {0} has an invalid index {1}", e, effectRecord.index);
+
+            continue;
+        }
+
+        DeserializePlugin(reader, effectRecord.plugin, instrument, int(effectRecord.index), pluginLoadQueue);
+    }
+
+    DeserializePlugin(reader, trackRecord.instrumentPlugin, instrument, PluginLoadQueue::InstrumentPluginIndex, pluginLoadQueue);
+
+    return instrument;
+}
+
+static bool DeserializeRegion(
+    const SongReader &reader,
+    uint64_t index,
+    std::map<std::chrono::milliseconds::rep, Region> &regions)
+{
+    RegionRecord record;
+    if (!reader.ReadRecord(SectionTypes::Regions, index, record))
+    {
+        return false;
+    }
+
+    if (record.firstEvent > reader.RecordCount<EventRecord>(SectionTypes::Events) ||
+        record.eventCount > reader.RecordCount<EventRecord>(SectionTypes::Events) - record.firstEvent)
+    {
+        spdlog::error("events of region {0} are outside of the events section", index);
+
+        return false;
+    }
+
+    TimedMidiEvent::Collection events;
+    events.reserve(size_t(record.eventCount));
+
+    for (uint64_t i = 0; i < record.eventCount; i++)
+    {
+        EventRecord eventRecord;
+        reader.ReadRecord(SectionTypes::Events, record.firstEvent + i, eventRecord);
+
+        MidiEvent event;
+        event.num = eventRecord.num;
+        event.value = eventRecord.value;
+        event.channel = eventRecord.channel;
+        event.type = MidiEventTypes(eventRecord.type);
+
+        events.push_back(TimedMidiEvent(eventRecord.time, event));
+    }
+
+    Region region;
+    region.SetName(reader.ReadString(record.name));
+    region.SetEvents(std::move(events));
+    region.SetLength(record.length);
+
+    regions.insert(std::make_pair(record.start, std::move(region)));
+
+    return true;
+}
+
+bool BinaryTracksSerializer::Deserialize(
+    const std::string &filepath)
+{
+    MappedFile file;
+
+    if (!file.Open(filepath))
+    {
+        return false;
+    }
+
+    SongReader reader(file);
+
+    if (!reader.ReadSectionTable())
+    {
+        spdlog::error("no song data found in {0}", filepath);
+
+        return false;
+    }
+
+    auto trackCount = reader.RecordCount<TrackRecord>(SectionTypes::Tracks);
+
+    struct LoadedTrack
+    {
+        TrackRecord record;
+        std::map<std::chrono::milliseconds::rep, Region> regions;
+        std::shared_ptr<Instrument> instrument;
+    };
+
+    // All regions are read before anything is added to the song, a bad record
+    // leaves the song as it was
+    std::vector<LoadedTrack> loadedTracks(trackCount);
+
+    for (size_t t = 0; t < trackCount; t++)
+    {
+        auto &loadedTrack = loadedTracks[t];
+        reader.ReadRecord(SectionTypes::Tracks, t, loadedTrack.record);
+
+        for (uint32_t r = 0; r < loadedTrack.record.regionCount; r++)
+        {
+            if (!DeserializeRegion(reader, uint64_t(loadedTrack.record.firstRegion) + r, loadedTrack.regions))
+            {
+                return false;
+            }
+        }
+    }
+
+    // All plugins of the song are loaded together before the tracks are added
+    PluginLoadQueue pluginLoadQueue(_vstPluginService, _workerPool);
+
+    for (size_t t = 0; t < trackCount; t++)
+    {
+        loadedTracks[t].instrument = DeserializeInstrument(reader, t, loadedTracks[t].record, pluginLoadQueue);
+    }
+
+    pluginLoadQueue.Load();
+
+    // Files without buses mix every track straight into the master bus
+    std::vector<uint32_t> busIds;
+    auto busCount = reader.RecordCount<BusRecord>(SectionTypes::Buses);
+
+    for (size_t b = 1; b < busCount; b++)
+    {
+        BusRecord busRecord;
+        reader.ReadRecord(SectionTypes::Buses, b, busRecord);
+
+        busIds.push_back(_tracks->AddBus(reader.ReadString(busRecord.name)));
+    }
+
+    auto busId = [&](int32_t index) {
+        return index >= 0 && size_t(index) < busIds.size() ? busIds[size_t(index)] : MixerBus::Master;
+    };
+
+    for (size_t b = 0; b < busCount; b++)
+    {
+        BusRecord busRecord;
+        reader.ReadRecord(SectionTypes::Buses, b, busRecord);
+
+        auto bus = b == 0 ? &_tracks->GetMasterBus() : _tracks->GetBus(busIds[b - 1]);
+        bus->SetGain(busRecord.gain);
+        bus->SetPan(busRecord.pan);
+        if (b > 0)
+        {
+            bus->SetOutputBus(busId(busRecord.output));
+        }
+    }
+
+    for (size_t t = 0; t < loadedTracks.size(); t++)
+    {
+        auto &[trackRecord, regions, instrument] = loadedTracks[t];
+
+        auto trackId = _tracks->AddTrack(
+            reader.ReadString(trackRecord.name),
+            instrument);
+
+        if (trackId == Track::Null)
+        {
+            continue;
+        }
+
+        auto &track = _tracks->GetTrack(trackId);
+        track.SetColor(trackRecord.color[0], trackRecord.color[1], trackRecord.color[2], trackRecord.color[3]);
+        (trackRecord.flags & trackIsMuted) != 0 ? track.Mute() : track.Unmute();
+        track.SetReadyForRecording((trackRecord.flags & trackIsReadyForRecording) != 0);
+
+        MixerRecord mixerRecord;
+        if (t < reader.RecordCount<MixerRecord>(SectionTypes::Mixer) && reader.ReadRecord(SectionTypes::Mixer, t, mixerRecord))
+        {
+            track.SetGain(mixerRecord.gain);
+            track.SetPan(mixerRecord.pan);
+            track.SetOutputBus(busId(mixerRecord.output));
+        }
+
+        // The regions are added at once, adding them one by one copies a
+        // path in the tree of regions for every region
+        track.SetRegions(regions);
+    }
+
+    return true;
+}
+
+bool BinaryTracksSerializer::IsBinaryFile(
+    const std::string &filepath)
+{
+    std::ifstream file(filepath, std::ios::binary);
+
+    char magic[sizeof(fileMagic)] = {0};
+    file.read(magic, sizeof(magic));
+
+    return file.gcount() == sizeof(magic) && std::memcmp(magic, fileMagic, sizeof(magic)) == 0;
+}
+
+#ifdef TEST_YOUR_CODE
+#include "testinstrument.h"
+#include "tracksmanager.h"
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+
+class TestInstrumentPluginService : public IPluginService
+{
+public:
+    virtual std::shared_ptr<VstPlugin> LoadPlugin(
+        const std::wstring &filename)
+    {
+        (void)filename;
+
+        return nullptr;
+    }
+
+    virtual std::shared_ptr<VstPlugin> LoadPlugin(
+        const std::string &filename)
+    {
+        if (filename != TestInstrument::ModuleName)
+        {
+            return nullptr;
+        }
+
+        return TestInstrument::Create();
+    }
+
+    virtual std::shared_ptr<VstPlugin> LoadFromFileDialog()
+    {
+        return nullptr;
+    }
+
+    virtual std::vector<std::shared_ptr<PluginModule>> PrewarmModules(
+        const std::vector<std::string> &filenames)
+    {
+        (void)filenames;
+
+        return {};
+    }
+
+    virtual std::vector<PluginDescription> ListPlugins(
+        std::function<bool(const PluginDescription &)> filter)
+    {
+        (void)filter;
+
+        return {};
+    }
+
+    virtual std::vector<PluginDescription> QueryPlugins(
+        const PluginQuery &query)
+    {
+        (void)query;
+
+        return {};
+    }
+};
+
+static void EffectsTests(
+    const std::string &filepath)
+{
+    // More effects than fit in the track record, with an empty slot between
+    // the ones in the track record and the one in the effects section
+    auto instrument = std::make_shared<Instrument>();
+    for (int i = 0; i < 6; i++)
+    {
+        if (i != 4)
+        {
+            instrument->SetEffectPlugin(i, TestInstrument::Create());
+        }
+    }
+
+    TracksManager source;
+    source.AddTrack("effects", instrument);
+
+    if (!BinaryTracksSerializer(&source, nullptr).Serialize(filepath))
+    {
+        std::cout << "Serialize failed to write " << filepath << std::endl;
+    }
+
+    TestInstrumentPluginService service;
+    TracksManager target;
+    if (!BinaryTracksSerializer(&target, &service).Deserialize(filepath))
+    {
+        std::cout << "Deserialize failed to read " << filepath << std::endl;
+    }
+
+    auto &tracks = target.GetTracks();
+    if (tracks.size() != 1 || tracks[0].GetInstrument() == nullptr)
+    {
+        std::cout << "Deserialize did not restore the instrument with effects" << std::endl;
+
+        return;
+    }
+
+    auto loaded = tracks[0].GetInstrument();
+    for (int i = 0; i < 6; i++)
+    {
+        if ((loaded->EffectPlugin(i) != nullptr) != (i != 4))
+        {
+            std::cout << "Deserialize did not restore effect slot " << i << std::endl;
+        }
+    }
+
+    if (loaded->EffectPluginCount() != 6)
+    {
+        std::cout << "Deserialize loaded " << loaded->EffectPluginCount() << " effect slots, expected 6" << std::endl;
+    }
+}
+
+void BinaryTracksSerializer::Tests()
+{
+    auto filepath = (std::filesystem::temp_directory_path() / "vsthost-binarytracksserializer-test.song").string();
+
+    TracksManager source;
+    auto trackId = source.AddTrack("first", std::make_shared<Instrument>());
+    source.GetTrack(trackId).Mute();
+    auto secondId = source.AddTrack("second", nullptr);
+
+    auto group = source.AddBus("group");
+    source.GetBus(group)->SetPan(0.5f);
+    source.GetMasterBus().SetGain(0.25f);
+    source.GetTrack(secondId).SetGain(2.0f);
+    source.GetTrack(secondId).SetOutputBus(group);
+
+    Region region;
+    region.SetName("intro");
+    region.AddEvent(0, 60, true, 100);
+    region.AddEvent(1000, 60, false, 0);
+    region.AddEvent(1000, 64, true, 90);
+    region.SetLength(32000);
+    source.GetTrack(trackId).AddRegion(4000, region);
+    source.GetTrack(trackId).AddRegion(64000, Region());
+
+    if (!BinaryTracksSerializer(&source, nullptr).Serialize(filepath))
+    {
+        std::cout << "Serialize failed to write " << filepath << std::endl;
+    }
+
+    if (!IsBinaryFile(filepath))
+    {
+        std::cout << filepath << " is not recognized as a binary song file" << std::endl;
+    }
+
+    TracksManager target;
+    if (!BinaryTracksSerializer(&target, nullptr).Deserialize(filepath))
+    {
+        std::cout << "Deserialize failed to read " << filepath << std::endl;
+    }
+
+    auto &tracks = target.GetTracks();
+    if (tracks.size() != 2 || tracks[0].GetName() != "first" || tracks[1].GetName() != "second")
+    {
+        std::cout << "Deserialize loaded " << tracks.size() << " tracks, expected first and second" << std::endl;
+
+        return;
+    }
+
+    if (!tracks[0].IsMuted() || tracks[1].IsMuted() || tracks[1].GetInstrument() != nullptr)
+    {
+        std::cout << "Deserialize did not restore the track settings" << std::endl;
+    }
+
+    auto &buses = target.GetBuses();
+    if (buses.size() != 1 || buses[0].GetName() != "group" || buses[0].GetPan() != 0.5f || target.GetMasterBus().GetGain() != 0.25f ||
+        tracks[1].GetGain() != 2.0f || tracks[1].GetOutputBus() != buses[0].Id() || tracks[0].GetOutputBus() != MixerBus::Master)
+    {
+        std::cout << "Deserialize did not restore the mixer" << std::endl;
+    }
+
+    auto &regions = tracks[0].Regions();
+    if (regions.size() != 2 || regions.count(4000) == 0 || regions.count(64000) == 0)
+    {
+        std::cout << "Deserialize loaded " << regions.size() << " regions, expected 2" << std::endl;
+
+        return;
+    }
+
+    auto &loaded = regions.at(4000);
+    auto &expected = region.SortedEvents();
+    auto &actual = loaded.SortedEvents();
+
+    bool same = expected.size() == actual.size();
+    for (size_t i = 0; same && i < expected.size(); i++)
+    {
+        same = expected[i].time == actual[i].time && expected[i].num == actual[i].num && expected[i].value == actual[i].value;
+    }
+
+    if (!same || loaded.GetName() != "intro" || loaded.Length() != 32000 || loaded.GetMinNote() != 60 || loaded.GetMaxNote() != 64)
+    {
+        std::cout << "Deserialize did not restore the region" << std::endl;
+    }
+
+    // A region with events outside of the events section fails the load
+    // before any track or bus is added
+    std::vector<char> bytes;
+    {
+        std::ifstream file(filepath, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    FileHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    for (uint32_t i = 0; i < header.sectionCount; i++)
+    {
+        SectionEntry entry;
+        std::memcpy(&entry, bytes.data() + sizeof(header) + i * sizeof(entry), sizeof(entry));
+
+        if (entry.type == uint32_t(SectionTypes::Regions))
+        {
+            RegionRecord record;
+            auto lastRegion = bytes.data() + entry.offset + entry.size - sizeof(record);
+            std::memcpy(&record, lastRegion, sizeof(record));
+            record.eventCount = 1000;
+            std::memcpy(lastRegion, &record, sizeof(record));
+        }
+    }
+
+    {
+        std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), std::streamsize(bytes.size()));
+    }
+
+    TracksManager halfLoaded;
+    if (BinaryTracksSerializer(&halfLoaded, nullptr).Deserialize(filepath))
+    {
+        std::cout << "Deserialize loaded a region with events outside of the events section" << std::endl;
+    }
+
+    if (!halfLoaded.GetTracks().empty() || !halfLoaded.GetBuses().empty())
+    {
+        std::cout << "Deserialize left " << halfLoaded.GetTracks().size() << " tracks of a song it failed to load" << std::endl;
+    }
+
+    EffectsTests(filepath);
+
+    std::filesystem::remove(filepath);
+}
+#endif
@@ -0,0 +1,673 @@
+#include "dspkernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DSPKERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DSPKERNELS_AVX
+#else
+#define DSPKERNELS_AVX __attribute__((target("avx")))
+#endif
+#endif
+
+static std::atomic<DspKernels::InstructionSets> &CurrentInstructionSet()
+{
+    static std::atomic<DspKernels::InstructionSets> instructionSet = DspKernels::Available();
+
+    return instructionSet;
+}
+
+DspKernels::InstructionSets DspKernels::Available()
+{
+#ifdef DSPKERNELS_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+
+    // The OS has to save the AVX registers on a context switch too
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+
+    if (osxsave && avx && (_xgetbv(0) & 6) == 6)
+    {
+        return InstructionSets::Avx;
+    }
+#else
+    if (__builtin_cpu_supports("avx"))
+    {
+        return InstructionSets::Avx;
+    }
+#endif
+
+    // Every x64 CPU has SSE2
+    return InstructionSets::Sse2;
+#else
+    return InstructionSets::Scalar;
+#endif
+}
+
+DspKernels::InstructionSets DspKernels::Current()
+{
+    return CurrentInstructionSet().load(std::memory_order_relaxed);
+}
+
+void DspKernels::Use(
+    InstructionSets instructionSet)
+{
+    if (instructionSet > Available())
+    {
+        instructionSet = Available();
+    }
+
+    CurrentInstructionSet().store(instructionSet, std::memory_order_relaxed);
+}
+
+const char *DspKernels::Name(
+    InstructionSets instructionSet)
+{
+    switch (instructionSet)
+    {
+        case InstructionSets::Scalar:
+            return "scalar";
+        case InstructionSets::Sse2:
+            return "sse2";
+        case InstructionSets::Avx:
+            return "avx";
+    }
+
+    return "";
+}
+
+static void AccumulateScalar(
+    float *data,
+    const float *source,
+    size_t sampleCount,
+    float gain)
+{
+    for (size_t i = 0; i < sampleCount; i++)
+    {
+        data[i] += source[i] * gain;
+    }
+}
+
+static void AccumulateRampScalar(
+    float *data,
+    const float *source,
+    uint32_t channelCount,
+    size_t frameCount,
+    const float *gains,
+    const float *steps)
+{
+    for (uint32_t c = 0; c < channelCount; c++)
+    {
+        for (size_t f = 0; f < frameCount; f++)
+        {
+            auto i = f * channelCount + c;
+            data[i] += source[i] * (gains[c] + steps[c] * float(f));
+        }
+    }
+}
+
+static float PeakScalar(
+    const float *data,
+    size_t sampleCount)
+{
+    float peak = 0.0f;
+
+    for (size_t i = 0; i < sampleCount; i++)
+    {
+        peak = std::max(peak, std::fabs(data[i]));
+    }
+
+    return peak;
+}
+
+template <bool Accumulate>
+static void InterleaveScalar(
+    float *data,
+    uint32_t channelCount,
+    const float *const *source,
+    uint32_t sourceChannelCount,
+    size_t frameCount,
+    float gain)
+{
+    for (uint32_t c = 0; c < channelCount; c++)
+    {
+        const float *channel = source[c % sourceChannelCount];
+        float *out = data + c;
+
+        for (size_t f = 0; f < frameCount; f++, out += channelCount)
+        {
+            if constexpr (Accumulate)
+            {
+                *out += channel[f] * gain;
+            }
+            else
+            {
+                *out = channel[f] * gain;
+            }
+        }
+    }
+}
+
+static void DeinterleaveScalar(
+    float *const *data,
+    uint32_t channelCount,
+    const float *source,
+    uint32_t sourceChannelCount,
+    size_t frameCount)
+{
+    for (uint32_t c = 0; c < channelCount; c++)
+    {
+        float *channel = data[c];
+        const float *in = source + (c % sourceChannelCount);
+
+        for (size_t f = 0; f < frameCount; f++, in += sourceChannelCount)
+        {
+            channel[f] = *in;
+        }
+    }
+}
+
+#ifdef DSPKERNELS_X86
+static void AccumulateSse2(
+    float *data,
+    const float *source,
+    size_t sampleCount,
+    float gain)
+{
+    const auto g = _mm_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 4 <= sampleCount; i += 4)
+    {
+        auto sum = _mm_add_ps(_mm_loadu_ps(data + i), _mm_mul_ps(_mm_loadu_ps(source + i), g));
+        _mm_storeu_ps(data + i, sum);
+    }
+
+    AccumulateScalar(data + i, source + i, sampleCount - i, gain);
+}
+
+DSPKERNELS_AVX static void AccumulateAvx(
+    float *data,
+    const float *source,
+    size_t sampleCount,
+    float gain)
+{
+    const auto g = _mm256_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 8 <= sampleCount; i += 8)
+    {
+        auto sum = _mm256_add_ps(_mm256_loadu_ps(data + i), _mm256_mul_ps(_mm256_loadu_ps(source + i), g));
+        _mm256_storeu_ps(data + i, sum);
+    }
+
+    AccumulateScalar(data + i, source + i, sampleCount - i, gain);
+}
+
+// The sign bit is masked off for the absolute value
+static float PeakSse2(
+    const float *data,
+    size_t sampleCount)
+{
+    const auto signBit = _mm_set1_ps(-0.0f);
+    auto peak = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 4 <= sampleCount; i += 4)
+    {
+        peak = _mm_max_ps(peak, _mm_andnot_ps(signBit, _mm_loadu_ps(data + i)));
+    }
+
+    peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+    peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    return std::max(_mm_cvtss_f32(peak), PeakScalar(data + i, sampleCount - i));
+}
+
+DSPKERNELS_AVX static float PeakAvx(
+    const float *data,
+    size_t sampleCount)
+{
+    const auto signBit = _mm256_set1_ps(-0.0f);
+    auto peak = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 8 <= sampleCount; i += 8)
+    {
+        peak = _mm256_max_ps(peak, _mm256_andnot_ps(signBit, _mm256_loadu_ps(data + i)));
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, peak);
+
+    return std::max(PeakScalar(lanes, 8), PeakSse2(data + i, sampleCount - i));
+}
+
+// Only stereo is vectorized, the other layouts take the scalar path
+static void AccumulateRampStereoSse2(
+    float *data,
+    const float *source,
+    size_t frameCount,
+    const float *gains,
+    const float *steps)
+{
+    // Two frames per vector: l0 r0 l1 r1. The gain is computed from the
+    // frame number every time, adding up the steps would drift.
+    const auto base = _mm_setr_ps(gains[0], gains[1], gains[0], gains[1]);
+    const auto step = _mm_setr_ps(steps[0], steps[1], steps[0], steps[1]);
+    auto frame = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+    const auto two = _mm_set1_ps(2.0f);
+
+    size_t f = 0;
+    for (; f + 2 <= frameCount; f += 2)
+    {
+        auto g = _mm_add_ps(base, _mm_mul_ps(step, frame));
+        auto sum = _mm_add_ps(_mm_loadu_ps(data + 2 * f), _mm_mul_ps(_mm_loadu_ps(source + 2 * f), g));
+        _mm_storeu_ps(data + 2 * f, sum);
+
+        frame = _mm_add_ps(frame, two);
+    }
+
+    const float rest[] = {gains[0] + steps[0] * float(f), gains[1] + steps[1] * float(f)};
+    AccumulateRampScalar(data + 2 * f, source + 2 * f, 2, frameCount - f, rest, steps);
+}
+
+DSPKERNELS_AVX static void AccumulateRampStereoAvx(
+    float *data,
+    const float *source,
+    size_t frameCount,
+    const float *gains,
+    const float *steps)
+{
+    // Four frames per vector
+    const auto base = _mm256_setr_ps(gains[0], gains[1], gains[0], gains[1], gains[0], gains[1], gains[0], gains[1]);
+    const auto step = _mm256_setr_ps(steps[0], steps[1], steps[0], steps[1], steps[0], steps[1], steps[0], steps[1]);
+    auto frame = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+    const auto four = _mm256_set1_ps(4.0f);
+
+    size_t f = 0;
+    for (; f + 4 <= frameCount; f += 4)
+    {
+        auto g = _mm256_add_ps(base, _mm256_mul_ps(step, frame));
+        auto sum = _mm256_add_ps(_mm256_loadu_ps(data + 2 * f), _mm256_mul_ps(_mm256_loadu_ps(source + 2 * f), g));
+        _mm256_storeu_ps(data + 2 * f, sum);
+
+        frame = _mm256_add_ps(frame, four);
+    }
+
+    const float rest[] = {gains[0] + steps[0] * float(f), gains[1] + steps[1] * float(f)};
+    AccumulateRampStereoSse2(data + 2 * f, source + 2 * f, frameCount - f, rest, steps);
+}
+
+// Only stereo output is vectorized, the other layouts take the scalar path.
+// There is no AVX version: the shuffles across the 128 bit lanes it needs
+// made it slower than this one.
+template <bool Accumulate>
+static void InterleaveStereoSse2(
+    float *data,
+    const float *left,
+    const float *right,
+    size_t frameCount,
+    float gain)
+{
+    const auto g = _mm_set1_ps(gain);
+
+    size_t f = 0;
+    for (; f + 4 <= frameCount; f += 4)
+    {
+        auto l = _mm_mul_ps(_mm_loadu_ps(left + f), g);
+        auto r = _mm_mul_ps(_mm_loadu_ps(right + f), g);
+
+        // l0 r0 l1 r1 and l2 r2 l3 r3
+        auto first = _mm_unpacklo_ps(l, r);
+        auto second = _mm_unpackhi_ps(l, r);
+
+        if constexpr (Accumulate)
+        {
+            first = _mm_add_ps(_mm_loadu_ps(data + 2 * f), first);
+            second = _mm_add_ps(_mm_loadu_ps(data + 2 * f + 4), second);
+        }
+
+        _mm_storeu_ps(data + 2 * f, first);
+        _mm_storeu_ps(data + 2 * f + 4, second);
+    }
+
+    const float *rest[] = {left + f, right + f};
+    InterleaveScalar<Accumulate>(data + 2 * f, 2, rest, 2, frameCount - f, gain);
+}
+
+static void DeinterleaveStereoSse2(
+    float *left,
+    float *right,
+    const float *source,
+    size_t frameCount)
+{
+    size_t f = 0;
+    for (; f + 4 <= frameCount; f += 4)
+    {
+        auto first = _mm_loadu_ps(source + 2 * f);
+        auto second = _mm_loadu_ps(source + 2 * f + 4);
+
+        _mm_storeu_ps(left + f, _mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(right + f, _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+
+    float *rest[] = {left + f, right + f};
+    DeinterleaveScalar(rest, 2, source + 2 * f, 2, frameCount - f);
+}
+#endif
+
+void DspKernels::Clear(
+    float *data,
+    size_t sampleCount)
+{
+    // All bits zero is 0.0f, the C library has the fastest loop for that
+    std::memset(data, 0, sampleCount * sizeof(float));
+}
+
+void DspKernels::Accumulate(
+    float *data,
+    const float *source,
+    size_t sampleCount,
+    float gain)
+{
+#ifdef DSPKERNELS_X86
+    switch (Current())
+    {
+        case InstructionSets::Avx:
+            AccumulateAvx(data, source, sampleCount, gain);
+            return;
+        case InstructionSets::Sse2:
+            AccumulateSse2(data, source, sampleCount, gain);
+            return;
+        default:
+            break;
+    }
+#endif
+
+    AccumulateScalar(data, source, sampleCount, gain);
+}
+
+float DspKernels::Peak(
+    const float *data,
+    size_t sampleCount)
+{
+#ifdef DSPKERNELS_X86
+    switch (Current())
+    {
+        case InstructionSets::Avx:
+            return PeakAvx(data, sampleCount);
+        case InstructionSets::Sse2:
+            return PeakSse2(data, sampleCount);
+        default:
+            break;
+    }
+#endif
+
+    return PeakScalar(data, sampleCount);
+}
+
+void DspKernels::AccumulateRamp(
+    float *data,
+    const float *source,
+    uint32_t channelCount,
+    size_t frameCount,
+    const float *gains,
+    const float *steps)
+{
+#ifdef DSPKERNELS_X86
+    if (channelCount == 2)
+    {
+        switch (Current())
+        {
+            case InstructionSets::Avx:
+                AccumulateRampStereoAvx(data, source, frameCount, gains, steps);
+                return;
+            case InstructionSets::Sse2:
+                AccumulateRampStereoSse2(data, source, frameCount, gains, steps);
+                return;
+            default:
+                break;
+        }
+    }
+#endif
+
+    AccumulateRampScalar(data, source, channelCount, frameCount, gains, steps);
+}
+
+template <bool Accumulate>
+static void InterleaveWith(
+    float *data,
+    uint32_t channelCount,
+    const float *const *source,
+    uint32_t sourceChannelCount,
+    size_t frameCount,
+    float gain)
+{
+    if (channelCount == 0 || sourceChannelCount == 0)
+    {
+        return;
+    }
+
+#ifdef DSPKERNELS_X86
+    if (channelCount == 2)
+    {
+        auto left = source[0];
+        auto right = source[sourceChannelCount > 1 ? 1 : 0];
+
+        if (DspKernels::Current() != DspKernels::InstructionSets::Scalar)
+        {
+            InterleaveStereoSse2<Accumulate>(data, left, right, frameCount, gain);
+
+            return;
+        }
+    }
+#endif
+
+    InterleaveScalar<Accumulate>(data, channelCount, source, sourceChannelCount, frameCount, gain);
+}
+
+void DspKernels::Interleave(
+    float *data,
+    uint32_t channelCount,
+    const float *const *source,
+    uint32_t sourceChannelCount,
+    size_t frameCount)
+{
+    InterleaveWith<false>(data, channelCount, source, sourceChannelCount, frameCount, 1.0f);
+}
+
+void DspKernels::InterleaveAccumulate(
+    float *data,
+    uint32_t channelCount,
+    const float *const *source,
+    uint32_t sourceChannelCount,
+    size_t frameCount,
+    float gain)
+{
+    InterleaveWith<true>(data, channelCount, source, sourceChannelCount, frameCount, gain);
+}
+
+void DspKernels::Deinterleave(
+    float *const *data,
+    uint32_t channelCount,
+    const float *source,
+    uint32_t sourceChannelCount,
+    size_t frameCount)
+{
+    if (channelCount == 0 || sourceChannelCount == 0)
+    {
+        return;
+    }
+
+#ifdef DSPKERNELS_X86
+    if (channelCount == 2 && sourceChannelCount == 2 && Current() != InstructionSets::Scalar)
+    {
+        DeinterleaveStereoSse2(data[0], data[1], source, frameCount);
+
+        return;
+    }
+#endif
+
+    DeinterleaveScalar(data, channelCount, source, sourceChannelCount, frameCount);
+}
+
+#ifdef TEST_YOUR_CODE
+#include <iostream>
+#include <vector>
+
+static bool SameSamples(
+    const std::vector<float> &a,
+    const std::vector<float> &b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (std::fabs(a[i] - b[i]) > 1e-6f)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void DspKernels::Tests()
+{
+    // Not a multiple of the vector widths, so the tails are tested too
+    const size_t frameCount = 37;
+
+    std::vector<std::vector<float>> planar(3, std::vector<float>(frameCount));
+    for (size_t c = 0; c < planar.size(); c++)
+    {
+        for (size_t f = 0; f < frameCount; f++)
+        {
+            planar[c][f] = float(c + 1) + float(f) / 64.0f;
+        }
+    }
+
+    const float *channels[] = {planar[0].data(), planar[1].data(), planar[2].data()};
+
+    auto available = Available();
+
+    for (auto instructionSet : {InstructionSets::Scalar, InstructionSets::Sse2, InstructionSets::Avx})
+    {
+        if (instructionSet > available)
+        {
+            continue;
+        }
+
+        Use(instructionSet);
+
+        std::vector<float> data(frameCount, 1.0f);
+        std::vector<float> expected(frameCount);
+        for (size_t f = 0; f < frameCount; f++)
+        {
+            expected[f] = 1.0f + planar[1][f] * 0.5f;
+        }
+
+        Accumulate(data.data(), planar[1].data(), frameCount, 0.5f);
+        if (!SameSamples(data, expected))
+        {
+            std::cout << "DspKernels::Accumulate failed with " << Name(instructionSet) << std::endl;
+        }
+
+        // The peak is in the tail that does not fill a vector
+        std::vector<float> peakData(frameCount, -0.25f);
+        peakData[frameCount - 1] = -0.75f;
+        peakData[3] = 0.5f;
+        if (Peak(peakData.data(), frameCount) != 0.75f || Peak(peakData.data(), 8) != 0.5f || Peak(peakData.data(), 0) != 0.0f)
+        {
+            std::cout << "DspKernels::Peak failed with " << Name(instructionSet) << std::endl;
+        }
+
+        // A stereo ramp from 0.5 to 1.0 on the left and from 1.0 to 0.0 on the right
+        std::vector<float> stereo(frameCount * 2, 0.5f);
+        std::vector<float> source(frameCount * 2);
+        std::vector<float> expectedRamp(frameCount * 2);
+        const float gains[] = {0.5f, 1.0f};
+        const float steps[] = {0.5f / frameCount, -1.0f / frameCount};
+        for (size_t i = 0; i < source.size(); i++)
+        {
+            source[i] = float(i) / 16.0f;
+            expectedRamp[i] = 0.5f + source[i] * (gains[i % 2] + steps[i % 2] * float(i / 2));
+        }
+
+        AccumulateRamp(stereo.data(), source.data(), 2, frameCount, gains, steps);
+        if (!SameSamples(stereo, expectedRamp))
+        {
+            std::cout << "DspKernels::AccumulateRamp failed with " << Name(instructionSet) << std::endl;
+        }
+
+        // From 1, 2 and 3 planar channels into 1, 2 and 3 interleaved channels
+        for (uint32_t channelCount = 1; channelCount <= 3; channelCount++)
+        {
+            for (uint32_t sourceChannelCount = 1; sourceChannelCount <= 3; sourceChannelCount++)
+            {
+                std::vector<float> interleaved(frameCount * channelCount, 0.25f);
+                std::vector<float> accumulated(frameCount * channelCount, 0.25f);
+                std::vector<float> expectedCopy(frameCount * channelCount);
+                std::vector<float> expectedSum(frameCount * channelCount);
+
+                for (size_t f = 0; f < frameCount; f++)
+                {
+                    for (uint32_t c = 0; c < channelCount; c++)
+                    {
+                        auto sample = planar[c % sourceChannelCount][f];
+                        expectedCopy[f * channelCount + c] = sample;
+                        expectedSum[f * channelCount + c] = 0.25f + sample * 2.0f;
+                    }
+                }
+
+                Interleave(interleaved.data(), channelCount, channels, sourceChannelCount, frameCount);
+                InterleaveAccumulate(accumulated.data(), channelCount, channels, sourceChannelCount, frameCount, 2.0f);
+
+                if (!SameSamples(interleaved, expectedCopy) || !SameSamples(accumulated, expectedSum))
+                {
+                    std::cout << "DspKernels interleaved " << sourceChannelCount << " into " << channelCount << " channels wrong with " << Name(instructionSet) << std::endl;
+                }
+
+                std::vector<std::vector<float>> deinterleaved(sourceChannelCount, std::vector<float>(frameCount));
+                float *outputs[] = {deinterleaved[0].data(), sourceChannelCount > 1 ? deinterleaved[1].data() : nullptr, sourceChannelCount > 2 ? deinterleaved[2].data() : nullptr};
+
+                Deinterleave(outputs, sourceChannelCount, expectedCopy.data(), channelCount, frameCount);
+
+                for (uint32_t c = 0; c < sourceChannelCount; c++)
+                {
+                    std::vector<float> expectedChannel(frameCount);
+                    for (size_t f = 0; f < frameCount; f++)
+                    {
+                        expectedChannel[f] = expectedCopy[f * channelCount + (c % channelCount)];
+                    }
+
+                    if (!SameSamples(deinterleaved[c], expectedChannel))
+                    {
+                        std::cout << "DspKernels deinterleaved " << channelCount << " into " << sourceChannelCount << " channels wrong with " << Name(instructionSet) << std::endl;
+                    }
+                }
+            }
+        }
+    }
+
+    Use(available);
+
+    std::vector<float> cleared(frameCount, 1.0f);
+    Clear(cleared.data(), cleared.size());
+    if (!SameSamples(cleared, std::vector<float>(frameCount, 0.0f)))
+    {
+        std::cout << "DspKernels::Clear left samples behind" << std::endl;
+    }
+}
+#endif
@@ -0,0 +1,155 @@
+#include "fileaudiodevice.h"
+
+#include <widestringconversions.hpp>
+
+FileAudioDevice::FileAudioDevice(
+    RefillFunc refillFunc,
+    const std::string &filepath,
+    const AudioFormat &format,
+    uint32_t blockFrameCount)
+    : _format(format),
+      _currentDevice(ConvertFromBytes(filepath))
+{
+    _devices.push_back(_currentDevice);
+
+    if (!_writer.Open(filepath, _format.sampleRate, _format.channelCount))
+    {
+        return;
+    }
+
+    // Silent blocks are written too, the file has the same timing as what
+    // a sound card would have played
+    _device = std::make_unique<NullAudioDevice>(
+        refillFunc,
+        _format,
+        blockFrameCount,
+        [this](const float *data, uint32_t frameCount, bool filled) {
+            (void)filled;
+
+            _writer.Write(data, frameCount);
+        });
+}
+
+FileAudioDevice::~FileAudioDevice()
+{
+    _device = nullptr;
+
+    _writer.Close();
+}
+
+bool FileAudioDevice::IsOpen() const
+{
+    return _device != nullptr;
+}
+
+const AudioFormat &FileAudioDevice::Format() const
+{
+    return _device != nullptr ? _device->Format() : _format;
+}
+
+double FileAudioDevice::LatencyMs() const
+{
+    return _device != nullptr ? _device->LatencyMs() : 0.0;
+}
+
+uint32_t FileAudioDevice::MaxFrameCount() const
+{
+    return _device != nullptr ? _device->MaxFrameCount() : 0;
+}
+
+const std::wstring &FileAudioDevice::CurrentDevice() const
+{
+    return _currentDevice;
+}
+
+const std::vector<std::wstring> &FileAudioDevice::Devices() const
+{
+    return _devices;
+}
+
+void FileAudioDevice::SelectDevice(
+    uint32_t index)
+{
+    (void)index;
+}
+
+uint64_t FileAudioDevice::BlockCount() const
+{
+    return _device != nullptr ? _device->BlockCount() : 0;
+}
+
+uint64_t FileAudioDevice::LateBlockCount() const
+{
+    return _device != nullptr ? _device->LateBlockCount() : 0;
+}
+
+#ifdef TEST_YOUR_CODE
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+void FileAudioDevice::Tests()
+{
+    auto filepath = (std::filesystem::temp_directory_path() / "vsthost-fileaudiodevice-test.wav").string();
+
+    AudioFormat format;
+    format.sampleRate = 44100;
+    format.channelCount = 2;
+
+    const uint32_t blockFrameCount = 441;
+
+    {
+        FileAudioDevice device(
+            [](float *data, uint32_t frameCount, const AudioFormat &deviceFormat) {
+                for (uint32_t i = 0; i < frameCount * deviceFormat.channelCount; i++)
+                {
+                    data[i] = 0.5f;
+                }
+
+                return true;
+            },
+            filepath,
+            format,
+            blockFrameCount);
+
+        if (!device.IsOpen())
+        {
+            std::cout << "FileAudioDevice could not open " << filepath << std::endl;
+
+            return;
+        }
+
+        while (device.BlockCount() < 5)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // The RIFF, fmt, fact and data headers take 56 bytes, then whole blocks
+    // of interleaved floats follow
+    const uint64_t headerSize = 56;
+    auto dataSize = std::filesystem::file_size(filepath) - headerSize;
+    auto blockSize = uint64_t(blockFrameCount) * format.channelCount * sizeof(float);
+
+    if (dataSize < 5 * blockSize || dataSize % blockSize != 0)
+    {
+        std::cout << "FileAudioDevice wrote " << dataSize << " bytes of samples, expected whole blocks of " << blockSize << std::endl;
+    }
+
+    std::ifstream file(filepath, std::ios::binary);
+    file.seekg(std::streamoff(headerSize));
+
+    float sample = 0.0f;
+    file.read(reinterpret_cast<char *>(&sample), sizeof(sample));
+
+    if (sample != 0.5f)
+    {
+        std::cout << "FileAudioDevice wrote " << sample << " as the first sample, expected 0.5" << std::endl;
+    }
+
+    file.close();
+
+    std::filesystem::remove(filepath);
+}
+#endif
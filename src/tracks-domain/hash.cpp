@@ -0,0 +1,17 @@
+#include "hash.h"
+
+uint64_t fnv1a_hash(
+    const void *data,
+    size_t length)
+{
+    auto bytes = static_cast<const uint8_t *>(data);
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
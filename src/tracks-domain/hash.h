@@ -0,0 +1,13 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 64 bit FNV-1a hash, fast enough to compare plugin chunks of several
+// megabytes. It is not meant to be collision resistant against attacks.
+uint64_t fnv1a_hash(
+    const void *data,
+    size_t length);
+
+#endif // HASH_H
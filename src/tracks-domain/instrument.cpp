@@ -1,6 +1,8 @@
 #include "instrument.h"
 
-Instrument::Instrument() = default;
+Instrument::Instrument()
+    : _graph(ProcessingGraph::CreateChain(nullptr, {}))
+{}
 
 Instrument::~Instrument() = default;
 
@@ -36,15 +38,57 @@ void Instrument::SetInstrumentPlugin(
 {
     Lock();
 
-    if (_plugin != nullptr)
+    auto previous = _plugin;
+    _plugin = plugin;
+    _midiPlugin.store(plugin);
+    _pluginChunkHash = ChunkHash();
+
+    auto pluginsVersion = ++_pluginsVersion;
+    auto effectPlugins = _effectPlugins;
+
+    Unlock();
+
+    if (RebuildGraph(plugin, effectPlugins, pluginsVersion) && previous != plugin)
     {
-        _plugin->closeEditor();
-        _plugin->cleanup();
+        ClosePlugin(previous);
     }
+}
 
-    _plugin = plugin;
+void Instrument::SendMidiNote(
+    int midiChannel,
+    int noteNumber,
+    bool onOff,
+    int velocity)
+{
+    // The copy keeps the plugin alive when another thread replaces it meanwhile
+    auto plugin = _midiPlugin.load();
 
-    Unlock();
+    if (plugin == nullptr)
+    {
+        return;
+    }
+
+    plugin->sendMidiNote(midiChannel, noteNumber, onOff, velocity);
+}
+
+void Instrument::SendMidiController(
+    int midiChannel,
+    int controller,
+    int value)
+{
+    auto plugin = _midiPlugin.load();
+
+    if (plugin == nullptr)
+    {
+        return;
+    }
+
+    plugin->sendMidiController(midiChannel, controller, value);
+}
+
+int Instrument::EffectPluginCount() const
+{
+    return int(_effectPlugins.size());
 }
 
 const std::shared_ptr<VstPlugin> Instrument::EffectPlugin(
@@ -55,12 +99,12 @@ const std::shared_ptr<VstPlugin> Instrument::EffectPlugin(
         return nullptr;
     }
 
-    if (index >= MAX_EFFECT_PLUGINS)
+    if (size_t(index) >= _effectPlugins.size())
     {
         return nullptr;
     }
 
-    return _effectPlugins[index];
+    return _effectPlugins[size_t(index)];
 }
 
 void Instrument::SetEffectPlugin(
@@ -72,22 +116,147 @@ void Instrument::SetEffectPlugin(
         return;
     }
 
-    if (index >= MAX_EFFECT_PLUGINS)
+    Lock();
+
+    if (size_t(index) >= _effectPlugins.size())
     {
-        return;
+        if (plugin == nullptr)
+        {
+            Unlock();
+
+            return;
+        }
+
+        _effectPlugins.resize(size_t(index) + 1);
+        _effectChunkHashes.resize(size_t(index) + 1);
     }
 
-    Lock();
+    auto previous = _effectPlugins[size_t(index)];
+    _effectPlugins[size_t(index)] = plugin;
+    _effectChunkHashes[size_t(index)] = ChunkHash();
+
+    while (!_effectPlugins.empty() && _effectPlugins.back() == nullptr)
+    {
+        _effectPlugins.pop_back();
+        _effectChunkHashes.pop_back();
+    }
 
-    if (_effectPlugins[index] != nullptr)
+    auto pluginsVersion = ++_pluginsVersion;
+    auto instrumentPlugin = _plugin;
+    auto effectPlugins = _effectPlugins;
+
+    Unlock();
+
+    if (RebuildGraph(instrumentPlugin, effectPlugins, pluginsVersion) && previous != plugin)
     {
-        _effectPlugins[index]->closeEditor();
-        _effectPlugins[index]->cleanup();
+        ClosePlugin(previous);
     }
+}
+
+ProcessingGraph *Instrument::Graph() const
+{
+    return _graph.get();
+}
+
+bool Instrument::RebuildGraph(
+    std::shared_ptr<VstPlugin> plugin,
+    std::vector<std::shared_ptr<VstPlugin>> effectPlugins,
+    uint64_t pluginsVersion)
+{
+    auto graph = ProcessingGraph::CreateChain(plugin, effectPlugins);
+    bool swapped = false;
+
+    Lock();
 
-    _effectPlugins[index] = plugin;
+    // Another thread may have set a plugin meanwhile and swapped in a newer graph
+    if (pluginsVersion > _graphVersion)
+    {
+        std::swap(_graph, graph);
+        _graphVersion = pluginsVersion;
+        swapped = true;
+    }
 
     Unlock();
+
+    // The graph that was replaced is freed here instead of on the audio thread
+    return swapped;
+}
+
+void Instrument::ClosePlugin(
+    const std::shared_ptr<VstPlugin> &plugin)
+{
+    // Only called after the graph without the plugin is swapped in, so the
+    // audio thread is done with it. The plugin itself is closed when its last
+    // reference is released, a song snapshot may still ask it for its chunk.
+    if (plugin == nullptr)
+    {
+        return;
+    }
+
+    plugin->closeEditor();
+}
+
+uint64_t Instrument::KnownChunkHash(
+    const ChunkHash &chunkHash,
+    const std::shared_ptr<VstPlugin> &plugin)
+{
+    if (plugin == nullptr || plugin->isEditorOpen())
+    {
+        return 0;
+    }
+
+    // The editor may have changed the plugin without a download after it
+    if (chunkHash.editorCloseCount != plugin->getEditorCloseCount())
+    {
+        return 0;
+    }
+
+    return chunkHash.hash;
+}
+
+Instrument::ChunkHash Instrument::MakeChunkHash(
+    uint64_t hash,
+    const std::shared_ptr<VstPlugin> &plugin)
+{
+    ChunkHash chunkHash;
+    chunkHash.hash = hash;
+    chunkHash.editorCloseCount = plugin == nullptr ? 0 : plugin->getEditorCloseCount();
+
+    return chunkHash;
+}
+
+uint64_t Instrument::InstrumentChunkHash() const
+{
+    return KnownChunkHash(_pluginChunkHash, _plugin);
+}
+
+void Instrument::SetInstrumentChunkHash(
+    uint64_t hash)
+{
+    _pluginChunkHash = MakeChunkHash(hash, _plugin);
+}
+
+uint64_t Instrument::EffectChunkHash(
+    int index) const
+{
+    if (index < 0 || size_t(index) >= _effectChunkHashes.size())
+    {
+        return 0;
+    }
+
+    return KnownChunkHash(_effectChunkHashes[size_t(index)], _effectPlugins[size_t(index)]);
+}
+
+void Instrument::SetEffectChunkHash(
+    int index,
+    uint64_t hash)
+{
+    if (index < 0 || size_t(index) >= _effectChunkHashes.size())
+    {
+        return;
+    }
+
+    _effectChunkHashes[size_t(index)] = MakeChunkHash(hash, _effectPlugins[size_t(index)]);
 }
 
 void Instrument::Lock()
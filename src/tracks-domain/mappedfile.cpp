@@ -0,0 +1,158 @@
+#include "mappedfile.h"
+
+#include "widestringconversions.hpp"
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() = default;
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(
+    const std::string &filepath)
+{
+    Close();
+
+    auto file = CreateFileW(
+        ConvertUtf8ToWide(filepath).c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        spdlog::error("failed to open {0}", filepath);
+
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        spdlog::error("failed to map empty file {0}", filepath);
+
+        CloseHandle(file);
+
+        return false;
+    }
+
+    auto mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        spdlog::error("failed to map {0}", filepath);
+
+        CloseHandle(file);
+
+        return false;
+    }
+
+    auto data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (data == nullptr)
+    {
+        spdlog::error("failed to map {0}", filepath);
+
+        CloseHandle(mapping);
+        CloseHandle(file);
+
+        return false;
+    }
+
+    _file = file;
+    _mapping = mapping;
+    _data = reinterpret_cast<uint8_t *>(data);
+    _size = size_t(size.QuadPart);
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (_data != nullptr)
+    {
+        UnmapViewOfFile(_data);
+        _data = nullptr;
+    }
+
+    if (_mapping != nullptr)
+    {
+        CloseHandle(_mapping);
+        _mapping = nullptr;
+    }
+
+    if (_file != nullptr)
+    {
+        CloseHandle(_file);
+        _file = nullptr;
+    }
+
+    _size = 0;
+}
+#else
+bool MappedFile::Open(
+    const std::string &filepath)
+{
+    Close();
+
+    auto file = open(filepath.c_str(), O_RDONLY);
+
+    if (file < 0)
+    {
+        spdlog::error("failed to open {0}", filepath);
+
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        spdlog::error("failed to map empty file {0}", filepath);
+
+        close(file);
+
+        return false;
+    }
+
+    auto data = mmap(nullptr, size_t(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+
+    // The mapping stays valid after the file is closed
+    close(file);
+
+    if (data == MAP_FAILED)
+    {
+        spdlog::error("failed to map {0}", filepath);
+
+        return false;
+    }
+
+    _data = reinterpret_cast<uint8_t *>(data);
+    _size = size_t(info.st_size);
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (_data != nullptr)
+    {
+        munmap(_data, _size);
+        _data = nullptr;
+    }
+
+    _size = 0;
+}
+#endif
@@ -12,3 +12,14 @@ MidiEvent::MidiEvent()
       num(0),
       value(0)
 {}
+
+TimedMidiEvent::TimedMidiEvent()
+    : time(0)
+{}
+
+TimedMidiEvent::TimedMidiEvent(
+    std::chrono::milliseconds::rep time,
+    const MidiEvent &event)
+    : MidiEvent(event),
+      time(time)
+{}
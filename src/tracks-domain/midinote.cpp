@@ -13,7 +13,7 @@ MidiNote::MidiNote(
 }
 
 MidiNote::CollectionInTimeByNote MidiNote::ConvertMidiEventsToMidiNotes(
-    const MidiEvent::CollectionInTime &events)
+    const MidiEventsInTime &events)
 {
     MidiNote::CollectionInTimeByNote result;
 
@@ -25,9 +25,9 @@ MidiNote::CollectionInTimeByNote MidiNote::ConvertMidiEventsToMidiNotes(
 
     std::map<uint32_t, ActiveNote> activeNotes;
 
-    for (auto eventsAtTime : events)
+    for (const auto &eventsAtTime : events)
     {
-        for (auto event : eventsAtTime.second)
+        for (const auto &event : eventsAtTime.second)
         {
             auto activeNoteByEvent = activeNotes.find(event.num);
 
@@ -0,0 +1,477 @@
+#include "mixer.h"
+
+#include "dspkernels.h"
+
+#include <algorithm>
+
+// Balance for stereo: the center leaves both sides as they are, panning
+// turns the other side down. Other layouts only get the gain.
+static void PanGains(
+    float gain,
+    float pan,
+    uint32_t channelCount,
+    float &left,
+    float &right)
+{
+    if (channelCount != 2)
+    {
+        left = right = gain;
+
+        return;
+    }
+
+    left = gain * std::min(1.0f, 1.0f - pan);
+    right = gain * std::min(1.0f, 1.0f + pan);
+}
+
+void Mixer::Smoother::SetTargets(
+    float left,
+    float right,
+    uint32_t rampFrames)
+{
+    if (!started)
+    {
+        // A new track or bus starts at its level
+        gains[0] = targets[0] = left;
+        gains[1] = targets[1] = right;
+        started = true;
+
+        return;
+    }
+
+    if (targets[0] == left && targets[1] == right)
+    {
+        return;
+    }
+
+    targets[0] = left;
+    targets[1] = right;
+    remainingFrames = rampFrames;
+}
+
+void Mixer::Smoother::Apply(
+    float *data,
+    const float *source,
+    uint32_t frameCount,
+    uint32_t channelCount,
+    std::vector<float> &channelGains,
+    std::vector<float> &channelSteps)
+{
+    uint32_t done = 0;
+
+    if (remainingFrames > 0)
+    {
+        auto rampFrames = std::min(remainingFrames, frameCount);
+        const float steps[] = {
+            (targets[0] - gains[0]) / float(remainingFrames),
+            (targets[1] - gains[1]) / float(remainingFrames),
+        };
+
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            channelGains[c] = gains[c % 2] + steps[c % 2];
+            channelSteps[c] = steps[c % 2];
+        }
+
+        DspKernels::AccumulateRamp(data, source, channelCount, rampFrames, channelGains.data(), channelSteps.data());
+
+        remainingFrames -= rampFrames;
+        for (int i = 0; i < 2; i++)
+        {
+            gains[i] = remainingFrames == 0 ? targets[i] : gains[i] + steps[i] * float(rampFrames);
+        }
+
+        done = rampFrames;
+    }
+
+    if (done == frameCount || (gains[0] == 0.0f && gains[1] == 0.0f))
+    {
+        return;
+    }
+
+    data += size_t(done) * channelCount;
+    source += size_t(done) * channelCount;
+    auto restFrames = frameCount - done;
+
+    if (gains[0] == gains[1])
+    {
+        DspKernels::Accumulate(data, source, size_t(restFrames) * channelCount, gains[0]);
+
+        return;
+    }
+
+    for (uint32_t c = 0; c < channelCount; c++)
+    {
+        channelGains[c] = gains[c % 2];
+        channelSteps[c] = 0.0f;
+    }
+
+    DspKernels::AccumulateRamp(data, source, channelCount, restFrames, channelGains.data(), channelSteps.data());
+}
+
+bool Mixer::IsCompiledFor(
+    ITracksManager *tracks,
+    size_t sampleCount,
+    uint32_t channelCount) const
+{
+    if (_schedule == nullptr || _schedule->sampleCount < sampleCount || _schedule->channelGains.size() < channelCount)
+    {
+        return false;
+    }
+
+    auto &trackList = tracks->GetTracks();
+    auto &buses = tracks->GetBuses();
+
+    if (trackList.size() != _schedule->trackIds.size() || buses.size() != _schedule->busIds.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < trackList.size(); i++)
+    {
+        if (trackList[i].Id() != _schedule->trackIds[i] || trackList[i].GetOutputBus() != _schedule->trackOutputs[i])
+        {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < buses.size(); i++)
+    {
+        if (buses[i].Id() != _schedule->busIds[i] || buses[i].GetOutputBus() != _schedule->busOutputs[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::unique_ptr<Mixer::Schedule> Mixer::Compile(
+    ITracksManager *tracks,
+    size_t sampleCount,
+    uint32_t channelCount) const
+{
+    auto &trackList = tracks->GetTracks();
+    auto &buses = tracks->GetBuses();
+
+    auto slotOf = [&](uint32_t busId) -> size_t {
+        for (size_t i = 0; i < buses.size(); i++)
+        {
+            if (buses[i].Id() == busId)
+            {
+                return i + 1;
+            }
+        }
+
+        // The master bus, or a bus that was removed
+        return 0;
+    };
+
+    std::vector<size_t> outputs(buses.size());
+    for (size_t i = 0; i < buses.size(); i++)
+    {
+        outputs[i] = slotOf(buses[i].GetOutputBus());
+    }
+
+    // A bus that ends up in its own input is routed to the master bus
+    for (size_t i = 0; i < buses.size(); i++)
+    {
+        auto slot = outputs[i];
+        for (size_t hop = 0; slot != 0 && hop < buses.size(); hop++)
+        {
+            if (slot == i + 1)
+            {
+                outputs[i] = 0;
+                break;
+            }
+
+            slot = outputs[slot - 1];
+        }
+    }
+
+    // Every bus is mixed into its output before that output is mixed, so
+    // the buses furthest from the master bus go first
+    std::vector<size_t> depths(buses.size());
+    for (size_t i = 0; i < buses.size(); i++)
+    {
+        for (auto slot = i + 1; slot != 0; slot = outputs[slot - 1])
+        {
+            depths[i]++;
+        }
+    }
+
+    std::vector<size_t> order(buses.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return depths[a] > depths[b];
+    });
+
+    // The smoothers only get their id here, Prepare() takes over the state
+    // of the running ones when the schedule is swapped in
+    auto newSmoother = [](uint32_t id) {
+        Smoother smoother;
+        smoother.id = id;
+
+        return smoother;
+    };
+
+    auto schedule = std::make_unique<Schedule>();
+
+    schedule->trackSteps.reserve(trackList.size());
+    for (size_t i = 0; i < trackList.size(); i++)
+    {
+        schedule->trackSteps.push_back(TrackStep{i, slotOf(trackList[i].GetOutputBus()), newSmoother(trackList[i].Id())});
+    }
+
+    schedule->busSteps.reserve(buses.size());
+    for (auto i : order)
+    {
+        schedule->busSteps.push_back(BusStep{i, i + 1, outputs[i], newSmoother(buses[i].Id())});
+    }
+
+    for (auto &track : trackList)
+    {
+        schedule->trackIds.push_back(track.Id());
+        schedule->trackOutputs.push_back(track.GetOutputBus());
+    }
+
+    for (auto &bus : buses)
+    {
+        schedule->busIds.push_back(bus.Id());
+        schedule->busOutputs.push_back(bus.GetOutputBus());
+    }
+
+    schedule->slots.assign(buses.size() + 1, std::vector<float>(sampleCount));
+    schedule->sampleCount = sampleCount;
+    schedule->channelGains.resize(channelCount);
+    schedule->channelSteps.resize(channelCount);
+
+    return schedule;
+}
+
+// The smoothers are kept, so a change in routing does not restart ramps
+template <typename Steps>
+static void KeepSmoothers(
+    Steps &steps,
+    const Steps &previousSteps)
+{
+    for (auto &step : steps)
+    {
+        for (auto &previous : previousSteps)
+        {
+            if (previous.smoother.id == step.smoother.id)
+            {
+                step.smoother = previous.smoother;
+                break;
+            }
+        }
+    }
+}
+
+void Mixer::Prepare(
+    ITracksManager *tracks,
+    size_t sampleCount,
+    uint32_t channelCount)
+{
+    // The buffers only grow
+    if (_schedule != nullptr)
+    {
+        sampleCount = std::max(sampleCount, _schedule->sampleCount);
+        channelCount = std::max(channelCount, uint32_t(_schedule->channelGains.size()));
+    }
+
+    if (IsCompiledFor(tracks, sampleCount, channelCount))
+    {
+        return;
+    }
+
+    auto schedule = Compile(tracks, sampleCount, channelCount);
+
+    _mutex.lock();
+
+    if (_schedule != nullptr)
+    {
+        KeepSmoothers(schedule->trackSteps, _schedule->trackSteps);
+        KeepSmoothers(schedule->busSteps, _schedule->busSteps);
+    }
+
+    _schedule.swap(schedule);
+    _compileCount++;
+
+    _mutex.unlock();
+}
+
+void Mixer::Mix(
+    ITracksManager *tracks,
+    const std::vector<std::vector<float>> &trackBuffers,
+    float *data,
+    uint32_t frameCount,
+    uint32_t channelCount,
+    uint32_t sampleRate)
+{
+    const auto sampleCount = size_t(frameCount) * channelCount;
+
+    DspKernels::Clear(data, sampleCount);
+
+    _mutex.lock();
+
+    auto schedule = _schedule.get();
+
+    if (schedule == nullptr || schedule->sampleCount < sampleCount || schedule->channelGains.size() < channelCount)
+    {
+        _mutex.unlock();
+
+        return;
+    }
+
+    for (auto &slot : schedule->slots)
+    {
+        DspKernels::Clear(slot.data(), sampleCount);
+    }
+
+    const auto rampFrames = std::max<uint32_t>(1, sampleRate * SmoothingMs / 1000);
+    const auto soloTrack = tracks->GetSoloTrack();
+    auto &trackList = tracks->GetTracks();
+    auto &buses = tracks->GetBuses();
+    auto &channelGains = schedule->channelGains;
+    auto &channelSteps = schedule->channelSteps;
+    float left = 0.0f;
+    float right = 0.0f;
+
+    for (auto &step : schedule->trackSteps)
+    {
+        if (step.trackIndex >= trackList.size() || step.trackIndex >= trackBuffers.size() || trackBuffers[step.trackIndex].size() < sampleCount)
+        {
+            continue;
+        }
+
+        auto &track = trackList[step.trackIndex];
+        auto audible = !track.IsMuted() && (soloTrack == Track::Null || soloTrack == track.Id());
+
+        PanGains(audible ? track.GetGain() : 0.0f, track.GetPan(), channelCount, left, right);
+        step.smoother.SetTargets(left, right, rampFrames);
+        step.smoother.Apply(schedule->slots[step.outputSlot].data(), trackBuffers[step.trackIndex].data(), frameCount, channelCount, channelGains, channelSteps);
+    }
+
+    for (auto &step : schedule->busSteps)
+    {
+        if (step.busIndex >= buses.size())
+        {
+            continue;
+        }
+
+        auto &bus = buses[step.busIndex];
+
+        PanGains(bus.GetGain(), bus.GetPan(), channelCount, left, right);
+        step.smoother.SetTargets(left, right, rampFrames);
+        step.smoother.Apply(schedule->slots[step.outputSlot].data(), schedule->slots[step.slot].data(), frameCount, channelCount, channelGains, channelSteps);
+    }
+
+    auto &master = tracks->GetMasterBus();
+
+    PanGains(master.GetGain(), master.GetPan(), channelCount, left, right);
+    _masterSmoother.SetTargets(left, right, rampFrames);
+    _masterSmoother.Apply(data, schedule->slots[0].data(), frameCount, channelCount, channelGains, channelSteps);
+
+    _mutex.unlock();
+}
+
+#ifdef TEST_YOUR_CODE
+#include "tracksmanager.h"
+#include <cmath>
+#include <iostream>
+
+static bool Near(
+    float a,
+    float b)
+{
+    return std::fabs(a - b) < 1e-5f;
+}
+
+void Mixer::Tests()
+{
+    const uint32_t frameCount = 64;
+    const uint32_t sampleRate = 1000; // ramps take 20 frames
+
+    TracksManager tracks;
+    auto first = tracks.AddTrack("first", nullptr);
+    auto second = tracks.AddTrack("second", nullptr);
+    auto group = tracks.AddBus("group");
+
+    tracks.GetTrack(first).SetGain(0.5f);
+    tracks.GetTrack(second).SetPan(-1.0f);
+    tracks.GetTrack(second).SetOutputBus(group);
+    tracks.GetBus(group)->SetGain(2.0f);
+    tracks.GetMasterBus().SetGain(0.5f);
+
+    // Every sample is 1.0 on both sides
+    std::vector<std::vector<float>> trackBuffers(2, std::vector<float>(frameCount * 2, 1.0f));
+    std::vector<float> data(frameCount * 2);
+
+    Mixer sut;
+    sut.Mix(&tracks, trackBuffers, data.data(), frameCount, 2, sampleRate);
+
+    if (sut.CompileCount() != 0)
+    {
+        std::cout << "Mixer compiled the routing while mixing" << std::endl;
+    }
+
+    sut.Prepare(&tracks, frameCount * 2, 2);
+    sut.Mix(&tracks, trackBuffers, data.data(), frameCount, 2, sampleRate);
+
+    // first: 0.5 * 0.5, second: panned left, 2.0 * 0.5
+    if (!Near(data[0], 0.25f + 1.0f) || !Near(data[1], 0.25f))
+    {
+        std::cout << "Mixer mixed " << data[0] << ", " << data[1] << ", expected 1.25, 0.25" << std::endl;
+    }
+
+    sut.Prepare(&tracks, frameCount * 2, 2);
+    sut.Mix(&tracks, trackBuffers, data.data(), frameCount, 2, sampleRate);
+    if (sut.CompileCount() != 1)
+    {
+        std::cout << "Mixer compiled " << sut.CompileCount() << " times for the same routing" << std::endl;
+    }
+
+    // Muting ramps down over 20 frames instead of jumping
+    tracks.GetTrack(second).Mute();
+    sut.Mix(&tracks, trackBuffers, data.data(), frameCount, 2, sampleRate);
+
+    if (!(data[0] < 1.25f && data[0] > 1.0f) || !Near(data[2 * 19], 0.25f) || !Near(data[2 * 63], 0.25f))
+    {
+        std::cout << "Mixer did not ramp the mute, " << data[0] << " then " << data[2 * 19] << std::endl;
+    }
+
+    // Routing the group into itself through another bus cannot hang
+    tracks.GetTrack(second).Unmute();
+    auto other = tracks.AddBus("other");
+    tracks.GetBus(group)->SetOutputBus(other);
+    tracks.GetBus(other)->SetOutputBus(group);
+
+    sut.Mix(&tracks, trackBuffers, data.data(), frameCount, 2, sampleRate);
+
+    if (sut.CompileCount() != 1)
+    {
+        std::cout << "Mixer compiled the changed routing while mixing" << std::endl;
+    }
+
+    sut.Prepare(&tracks, frameCount * 2, 2);
+    sut.Mix(&tracks, trackBuffers, data.data(), frameCount, 2, sampleRate);
+    sut.Mix(&tracks, trackBuffers, data.data(), frameCount, 2, sampleRate);
+
+    if (sut.CompileCount() != 2 || !Near(data[2 * 63], 1.25f))
+    {
+        std::cout << "Mixer mixed " << data[2 * 63] << " with a cycle in the routing, expected 1.25" << std::endl;
+    }
+
+    // Tracks in a removed bus go to the output of that bus
+    tracks.RemoveBus(group);
+    if (tracks.GetTrack(second).GetOutputBus() != other)
+    {
+        std::cout << "Mixer did not reroute the track of a removed bus" << std::endl;
+    }
+}
+#endif
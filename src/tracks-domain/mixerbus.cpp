@@ -0,0 +1,46 @@
+#include "mixerbus.h"
+
+#include <algorithm>
+
+static uint32_t s_BusCounter = 1;
+
+MixerBus::MixerBus(
+    uint32_t id)
+    : _id(id)
+{}
+
+MixerBus::MixerBus()
+    : MixerBus(s_BusCounter++)
+{}
+
+void MixerBus::SetName(
+    const std::string &name)
+{
+    _name = name;
+}
+
+void MixerBus::SetGain(
+    float gain)
+{
+    _gain = std::max(0.0f, gain);
+}
+
+void MixerBus::SetPan(
+    float pan)
+{
+    _pan = std::clamp(pan, -1.0f, 1.0f);
+}
+
+void MixerBus::SetOutputBus(
+    uint32_t busId)
+{
+    _outputBus = busId == _id ? Master : busId;
+}
+
+MixerBus MixerBus::CreateMaster()
+{
+    MixerBus master(Master);
+    master.SetName("Master");
+
+    return master;
+}
@@ -0,0 +1,222 @@
+#include "nullaudiodevice.h"
+
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+NullAudioDevice::NullAudioDevice(
+    RefillFunc refillFunc,
+    const AudioFormat &format,
+    uint32_t blockFrameCount,
+    SinkFunc sinkFunc)
+    : _refillFunc(refillFunc),
+      _sinkFunc(sinkFunc),
+      _format(format),
+      _blockFrameCount(std::max(1u, blockFrameCount)),
+      _currentDevice(L"Null device")
+{
+    _format.sampleRate = std::max(1u, _format.sampleRate);
+    _format.channelCount = std::max<uint16_t>(1, _format.channelCount);
+    _devices.push_back(_currentDevice);
+
+    _thread = std::thread([this]() { ThreadFunc(); });
+}
+
+NullAudioDevice::~NullAudioDevice()
+{
+    _stop = true;
+
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+}
+
+const AudioFormat &NullAudioDevice::Format() const
+{
+    return _format;
+}
+
+double NullAudioDevice::LatencyMs() const
+{
+    return _blockFrameCount * 1000.0 / _format.sampleRate;
+}
+
+uint32_t NullAudioDevice::MaxFrameCount() const
+{
+    return _blockFrameCount;
+}
+
+const std::wstring &NullAudioDevice::CurrentDevice() const
+{
+    return _currentDevice;
+}
+
+const std::vector<std::wstring> &NullAudioDevice::Devices() const
+{
+    return _devices;
+}
+
+void NullAudioDevice::SelectDevice(
+    uint32_t index)
+{
+    (void)index;
+}
+
+void NullAudioDevice::ThreadFunc()
+{
+    using Clock = std::chrono::steady_clock;
+
+#ifdef _WIN32
+    // Sleep() only wakes up every 15.6ms by default, that is longer than
+    // most blocks last
+    auto timer = CreateWaitableTimerExW(
+        nullptr,
+        nullptr,
+        CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+        TIMER_ALL_ACCESS);
+#endif
+
+    std::vector<float> buffer(size_t(_blockFrameCount) * _format.channelCount);
+
+    const auto blockDuration = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(double(_blockFrameCount) / _format.sampleRate));
+
+    auto deadline = Clock::now();
+
+    while (!_stop)
+    {
+        std::fill(buffer.begin(), buffer.end(), 0.0f);
+
+        auto filled = _refillFunc(buffer.data(), _blockFrameCount, _format);
+
+        if (_sinkFunc)
+        {
+            _sinkFunc(buffer.data(), _blockFrameCount, filled);
+        }
+
+        _blockCount++;
+
+        deadline += blockDuration;
+
+        auto now = Clock::now();
+
+        if (now > deadline)
+        {
+            // A sound card would have played silence, it does not catch up
+            // by asking for the missed blocks in a burst
+            _lateBlockCount++;
+            deadline = now;
+
+            continue;
+        }
+
+#ifdef _WIN32
+        if (timer != nullptr)
+        {
+            LARGE_INTEGER dueTime;
+            dueTime.QuadPart = -std::chrono::duration_cast<std::chrono::duration<LONGLONG, std::ratio<1, 10000000>>>(deadline - now).count();
+
+            if (SetWaitableTimer(timer, &dueTime, 0, nullptr, nullptr, FALSE))
+            {
+                WaitForSingleObject(timer, INFINITE);
+
+                continue;
+            }
+        }
+#endif
+
+        std::this_thread::sleep_until(deadline);
+    }
+
+#ifdef _WIN32
+    if (timer != nullptr)
+    {
+        CloseHandle(timer);
+    }
+#endif
+}
+
+#ifdef TEST_YOUR_CODE
+#include <iostream>
+#include <mutex>
+
+void NullAudioDevice::Tests()
+{
+    AudioFormat format;
+    format.sampleRate = 48000;
+    format.channelCount = 2;
+
+    // 5ms blocks, the first block is refilled right away so 20 blocks take
+    // at least 95ms
+    const uint32_t blockFrameCount = 240;
+    const uint64_t expectedBlocks = 20;
+
+    std::mutex mutex;
+    std::vector<float> sinkSamples;
+    std::atomic<uint64_t> refills = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    uint64_t blockCount = 0;
+    {
+        NullAudioDevice device(
+            [&](float *data, uint32_t frameCount, const AudioFormat &deviceFormat) {
+                if (refills >= expectedBlocks)
+                {
+                    return false;
+                }
+
+                for (uint32_t i = 0; i < frameCount * deviceFormat.channelCount; i++)
+                {
+                    data[i] = float(refills + 1);
+                }
+
+                refills++;
+
+                return true;
+            },
+            format,
+            blockFrameCount,
+            [&](const float *data, uint32_t frameCount, bool filled) {
+                if (filled)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    sinkSamples.insert(sinkSamples.end(), data, data + frameCount * 2);
+                }
+            });
+
+        while (device.BlockCount() < expectedBlocks)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        blockCount = device.BlockCount();
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    if (elapsed < std::chrono::milliseconds(90))
+    {
+        std::cout << "NullAudioDevice refilled " << expectedBlocks << " blocks in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms, faster than they would play" << std::endl;
+    }
+
+    if (blockCount < expectedBlocks)
+    {
+        std::cout << "NullAudioDevice counted " << blockCount << " blocks, expected at least " << expectedBlocks << std::endl;
+    }
+
+    if (sinkSamples.size() != expectedBlocks * blockFrameCount * 2 || sinkSamples.front() != 1.0f || sinkSamples.back() != float(expectedBlocks))
+    {
+        std::cout << "NullAudioDevice passed " << sinkSamples.size() << " samples to its sink, expected " << (expectedBlocks * blockFrameCount * 2) << std::endl;
+    }
+}
+#endif
@@ -0,0 +1,194 @@
+#include "offlinerenderer.h"
+
+#include "track.h"
+#include "wavwriter.h"
+
+#include <algorithm>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+OfflineRenderer::OfflineRenderer(
+    ITracksManager *tracks)
+    : _tracks(tracks)
+{
+    _tracksRenderer.SetTracksManager(tracks);
+}
+
+void OfflineRenderer::SetBpm(
+    uint32_t bpm)
+{
+    _bpm = std::max(1u, bpm);
+}
+
+void OfflineRenderer::SetWorkerPool(
+    WorkerPool *workerPool)
+{
+    _tracksRenderer.SetWorkerPool(workerPool);
+}
+
+void OfflineRenderer::SetTelemetry(
+    AudioTelemetry *telemetry)
+{
+    _tracksRenderer.SetTelemetry(telemetry);
+}
+
+std::map<uintptr_t, std::string> OfflineRenderer::PluginNames() const
+{
+    return _tracksRenderer.PluginNames();
+}
+
+void OfflineRenderer::SetBlockSize(
+    uint32_t blockSize)
+{
+    _blockSize = std::max(1u, blockSize);
+}
+
+void OfflineRenderer::SetChannelCount(
+    uint16_t channelCount)
+{
+    _channelCount = std::max<uint16_t>(1, channelCount);
+}
+
+void OfflineRenderer::SetTailLength(
+    std::chrono::milliseconds tailLength)
+{
+    _tailLength = tailLength;
+}
+
+uint32_t OfflineRenderer::SampleRate() const
+{
+    // All plugins are initialized at this rate, see VstPlugin::getSampleRate()
+    return 44100;
+}
+
+std::chrono::milliseconds::rep OfflineRenderer::SongLength() const
+{
+    std::chrono::milliseconds::rep length = 0;
+
+    for (auto &track : _tracks->GetTracks())
+    {
+        for (auto &region : track.Regions())
+        {
+            length = std::max(length, region.first + region.second.Length());
+        }
+    }
+
+    return length;
+}
+
+std::chrono::milliseconds::rep OfflineRenderer::FramesToSteps(
+    uint64_t frames) const
+{
+    // Same conversion as State::MsToSteps(), but from the absolute frame
+    // position so rounding errors do not add up over the song
+    auto seconds = double(frames) / SampleRate();
+    auto beats = seconds / (60.0 / _bpm);
+
+    return std::chrono::milliseconds::rep(beats * 4000);
+}
+
+uint64_t OfflineRenderer::StepsToFrames(
+    std::chrono::milliseconds::rep steps) const
+{
+    auto seconds = (steps / 4000.0) * (60.0 / _bpm);
+
+    return uint64_t(seconds * SampleRate());
+}
+
+bool OfflineRenderer::Render(
+    const std::string &filepath)
+{
+    return Render(filepath, 0, SongLength());
+}
+
+bool OfflineRenderer::Render(
+    const std::string &filepath,
+    std::chrono::milliseconds::rep start,
+    std::chrono::milliseconds::rep end)
+{
+    if (!Begin(start, end))
+    {
+        return false;
+    }
+
+    WavWriter writer;
+    if (!writer.Open(filepath, SampleRate(), _channelCount))
+    {
+        return false;
+    }
+
+    std::vector<float> buffer(size_t(_blockSize) * _channelCount);
+
+    while (_renderedFrameCount < _totalFrames)
+    {
+        auto frameCount = uint32_t(std::min<uint64_t>(_blockSize, _totalFrames - _renderedFrameCount));
+
+        RenderBlock(buffer.data(), frameCount);
+
+        if (!writer.Write(buffer.data(), frameCount))
+        {
+            spdlog::error("failed to write to {0}", filepath);
+
+            return false;
+        }
+    }
+
+    return writer.Close();
+}
+
+bool OfflineRenderer::Begin(
+    std::chrono::milliseconds::rep start,
+    std::chrono::milliseconds::rep end)
+{
+    _renderedFrameCount = 0;
+    _totalFrames = 0;
+
+    if (_tracks == nullptr || end < start)
+    {
+        return false;
+    }
+
+    const auto tailFrames = uint64_t(_tailLength.count() / 1000.0 * SampleRate());
+
+    _start = start;
+    _end = end;
+    _firstFrame = StepsToFrames(start);
+    _songFrames = StepsToFrames(end) - _firstFrame;
+    _totalFrames = _songFrames + tailFrames;
+
+    _tracksRenderer.Prepare(_blockSize, _channelCount);
+
+    return true;
+}
+
+bool OfflineRenderer::RenderBlock(
+    float *interleavedData,
+    uint32_t frameCount)
+{
+    if (_renderedFrameCount >= _totalFrames)
+    {
+        return false;
+    }
+
+    const auto frame = _renderedFrameCount;
+
+    if (frame < _songFrames)
+    {
+        auto songFrameCount = uint32_t(std::min<uint64_t>(frameCount, _songFrames - frame));
+        auto blockStart = frame == 0 ? _start : FramesToSteps(_firstFrame + frame);
+        auto blockEnd = FramesToSteps(_firstFrame + frame + songFrameCount);
+
+        if (frame + songFrameCount == _songFrames)
+        {
+            blockEnd = _end;
+        }
+
+        _tracks->SendMidiNotesInSong(blockStart, blockEnd, 0, songFrameCount);
+    }
+
+    _tracksRenderer.RenderTracks(interleavedData, frameCount, _channelCount, SampleRate());
+
+    _renderedFrameCount += frameCount;
+
+    return true;
+}
@@ -0,0 +1,366 @@
+#include "pluginloadqueue.h"
+
+#include "base64.h"
+#include "pluginmodule.h"
+#include "workerpool.h"
+#include <algorithm>
+#include <set>
+#include <spdlog/spdlog.h>
+
+PluginLoadQueue::PluginLoadQueue(
+    IPluginService *vstPluginService,
+    WorkerPool *workerPool)
+    : _vstPluginService(vstPluginService),
+      _workerPool(workerPool)
+{}
+
+void PluginLoadQueue::Add(
+    std::shared_ptr<Instrument> instrument,
+    int effectIndex,
+    const std::string &modulePath,
+    uint8_t *chunk,
+    size_t chunkSize,
+    bool sleepAllowed)
+{
+    Job job;
+    job.instrument = instrument;
+    job.effectIndex = effectIndex;
+    job.modulePath = modulePath;
+    job.chunk = chunk;
+    job.chunkSize = chunkSize;
+    job.sleepAllowed = sleepAllowed;
+
+    _jobs.push_back(std::move(job));
+}
+
+void PluginLoadQueue::AddEncoded(
+    std::shared_ptr<Instrument> instrument,
+    int effectIndex,
+    const std::string &modulePath,
+    std::string encodedChunk,
+    bool sleepAllowed)
+{
+    Job job;
+    job.instrument = instrument;
+    job.effectIndex = effectIndex;
+    job.modulePath = modulePath;
+    job.encodedChunk = std::move(encodedChunk);
+    job.sleepAllowed = sleepAllowed;
+
+    _jobs.push_back(std::move(job));
+}
+
+size_t PluginLoadQueue::Count() const
+{
+    return _jobs.size();
+}
+
+void PluginLoadQueue::Load()
+{
+    if (_jobs.empty())
+    {
+        return;
+    }
+
+    if (_vstPluginService == nullptr)
+    {
+        spdlog::error("no plugin service to load plugins with");
+
+        _jobs.clear();
+
+        return;
+    }
+
+    // Not every plugin survives its first instance being created on two
+    // threads at once. So the first instance of every module is created in
+    // a first pass, the other instances in a second pass.
+    std::vector<size_t> firstInstances;
+    std::vector<size_t> otherInstances;
+    std::set<std::string> modules;
+
+    for (size_t i = 0; i < _jobs.size(); i++)
+    {
+        if (modules.insert(_jobs[i].modulePath).second)
+        {
+            firstInstances.push_back(i);
+        }
+        else
+        {
+            otherInstances.push_back(i);
+        }
+    }
+
+    // Every module is loaded once up front, the instances share it
+    auto prewarmedModules = _vstPluginService->PrewarmModules(std::vector<std::string>(modules.begin(), modules.end()));
+
+    for (auto pass : {&firstInstances, &otherInstances})
+    {
+        auto task = [&](size_t index) { LoadJob(_jobs[(*pass)[index]]); };
+
+        if (_workerPool == nullptr)
+        {
+            for (size_t i = 0; i < pass->size(); i++)
+            {
+                task(i);
+            }
+        }
+        else
+        {
+            _workerPool->ParallelFor(pass->size(), task);
+        }
+    }
+
+    for (auto &job : _jobs)
+    {
+        if (job.plugin == nullptr || job.instrument == nullptr)
+        {
+            continue;
+        }
+
+        if (job.effectIndex == InstrumentPluginIndex)
+        {
+            job.instrument->SetInstrumentPlugin(job.plugin);
+        }
+        else
+        {
+            job.instrument->SetEffectPlugin(job.effectIndex, job.plugin);
+        }
+    }
+
+    _jobs.clear();
+}
+
+void PluginLoadQueue::LoadJob(
+    Job &job)
+{
+    auto plugin = _vstPluginService->LoadPlugin(job.modulePath);
+
+    if (plugin == nullptr)
+    {
+        spdlog::error("failed to load module {0}", job.modulePath);
+
+        return;
+    }
+
+    /* Load plugin data*/
+    if (!job.encodedChunk.empty())
+    {
+        auto data = base64_decode(job.encodedChunk);
+        job.encodedChunk = std::string();
+
+        plugin->dispatcher(effSetChunk, 0, (VstInt32)data.size(), data.data(), 0);
+    }
+    else if (job.chunk != nullptr && job.chunkSize > 0)
+    {
+        plugin->dispatcher(effSetChunk, 0, (VstInt32)job.chunkSize, job.chunk, 0);
+    }
+
+    plugin->setSleepAllowed(job.sleepAllowed);
+
+    job.plugin = plugin;
+}
+
+#ifdef TEST_YOUR_CODE
+#include <iostream>
+#include <mutex>
+
+static VstIntPtr ChunkDispatcher(
+    AEffect *effect,
+    VstInt32 opcode,
+    VstInt32 index,
+    VstIntPtr value,
+    void *ptr,
+    float opt)
+{
+    (void)index;
+    (void)opt;
+
+    auto chunk = static_cast<std::string *>(effect->object);
+
+    if (opcode == effClose)
+    {
+        delete chunk;
+        delete effect;
+    }
+    else if (opcode == effGetChunk)
+    {
+        *reinterpret_cast<void **>(ptr) = chunk->data();
+
+        return VstIntPtr(chunk->size());
+    }
+    else if (opcode == effSetChunk)
+    {
+        *chunk = std::string(reinterpret_cast<char *>(ptr), size_t(value));
+    }
+
+    return 0;
+}
+
+static AEffect *ChunkMain(
+    audioMasterCallback callback)
+{
+    (void)callback;
+
+    auto effect = new AEffect();
+    effect->magic = kEffectMagic;
+    effect->dispatcher = ChunkDispatcher;
+    effect->object = new std::string();
+
+    return effect;
+}
+
+class ChunkPluginService : public IPluginService
+{
+public:
+    std::mutex mutex;
+    std::vector<std::string> loadedModules;
+    std::vector<std::string> prewarmedModules;
+
+    virtual std::shared_ptr<VstPlugin> LoadPlugin(
+        const std::wstring &filename)
+    {
+        (void)filename;
+
+        return nullptr;
+    }
+
+    virtual std::shared_ptr<VstPlugin> LoadPlugin(
+        const std::string &filename)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loadedModules.push_back(filename);
+        }
+
+        if (filename == "missing")
+        {
+            return nullptr;
+        }
+
+        auto plugin = std::make_shared<VstPlugin>();
+        plugin->init(ChunkMain, filename.c_str());
+
+        return plugin;
+    }
+
+    virtual std::shared_ptr<VstPlugin> LoadFromFileDialog()
+    {
+        return nullptr;
+    }
+
+    virtual std::vector<std::shared_ptr<PluginModule>> PrewarmModules(
+        const std::vector<std::string> &filenames)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        prewarmedModules = filenames;
+
+        return {};
+    }
+
+    virtual std::vector<PluginDescription> ListPlugins(
+        std::function<bool(const PluginDescription &)> filter)
+    {
+        (void)filter;
+
+        return {};
+    }
+
+    virtual std::vector<PluginDescription> QueryPlugins(
+        const PluginQuery &query)
+    {
+        (void)query;
+
+        return {};
+    }
+};
+
+static std::string PluginChunk(
+    const std::shared_ptr<VstPlugin> &plugin)
+{
+    if (plugin == nullptr)
+    {
+        return "<no plugin>";
+    }
+
+    void *chunk = nullptr;
+    auto length = plugin->dispatcher(effGetChunk, 0, 0, &chunk, 0.0f);
+
+    return std::string(reinterpret_cast<char *>(chunk), size_t(length));
+}
+
+void PluginLoadQueue::Tests()
+{
+    ChunkPluginService service;
+    WorkerPool workerPool(3, false);
+    PluginLoadQueue queue(&service, &workerPool);
+
+    std::string effectChunk = "effect";
+    std::vector<std::shared_ptr<Instrument>> instruments;
+
+    for (int i = 0; i < 8; i++)
+    {
+        auto instrument = std::make_shared<Instrument>();
+        auto chunk = "instrument " + std::to_string(i);
+
+        queue.AddEncoded(instrument, InstrumentPluginIndex, "synth", base64_encode(reinterpret_cast<const BYTE *>(chunk.data()), intptr_t(chunk.size())));
+        // Only the first delay may not sleep
+        queue.Add(instrument, 1, "delay", reinterpret_cast<uint8_t *>(effectChunk.data()), effectChunk.size(), i != 0);
+
+        instruments.push_back(instrument);
+    }
+
+    queue.AddEncoded(instruments[0], 2, "missing", "");
+
+    if (queue.Count() != 17)
+    {
+        std::cout << "PluginLoadQueue queued " << queue.Count() << " plugins, expected 17" << std::endl;
+    }
+
+    queue.Load();
+
+    if (queue.Count() != 0 || service.loadedModules.size() != 17)
+    {
+        std::cout << "PluginLoadQueue loaded " << service.loadedModules.size() << " plugins, expected 17" << std::endl;
+    }
+
+    if (service.prewarmedModules != std::vector<std::string>{"delay", "missing", "synth"})
+    {
+        std::cout << "PluginLoadQueue did not prewarm every module once" << std::endl;
+    }
+
+    // The first instance of every module is created before any other
+    std::set<std::string> firstModules(service.loadedModules.begin(), service.loadedModules.begin() + 3);
+    if (firstModules != std::set<std::string>{"synth", "delay", "missing"})
+    {
+        std::cout << "PluginLoadQueue did not create the first instance of every module first" << std::endl;
+    }
+
+    for (size_t i = 0; i < instruments.size(); i++)
+    {
+        auto expected = "instrument " + std::to_string(i);
+        auto actual = PluginChunk(instruments[i]->InstrumentPlugin());
+
+        if (actual != expected)
+        {
+            std::cout << "PluginLoadQueue restored \"" << actual << "\" on instrument " << i << ", expected \"" << expected << "\"" << std::endl;
+        }
+
+        if (PluginChunk(instruments[i]->EffectPlugin(1)) != effectChunk)
+        {
+            std::cout << "PluginLoadQueue did not restore the effect on instrument " << i << std::endl;
+        }
+
+        auto instrumentPlugin = instruments[i]->InstrumentPlugin();
+        auto effectPlugin = instruments[i]->EffectPlugin(1);
+        if (instrumentPlugin != nullptr && effectPlugin != nullptr && (!instrumentPlugin->isSleepAllowed() || effectPlugin->isSleepAllowed() != (i != 0)))
+        {
+            std::cout << "PluginLoadQueue did not restore whether the plugins on instrument " << i << " may sleep" << std::endl;
+        }
+
+        if (instruments[i]->EffectPlugin(2) != nullptr)
+        {
+            std::cout << "PluginLoadQueue set a plugin that failed to load" << std::endl;
+        }
+    }
+}
+#endif
@@ -0,0 +1,246 @@
+#include "pluginmodule.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <filesystem>
+#include <spdlog/spdlog.h>
+#include <widestringconversions.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+std::mutex PluginModule::_registryMutex;
+std::map<std::wstring, std::weak_ptr<PluginModule>> PluginModule::_registry;
+
+PluginModule::PluginModule(
+    const std::wstring &path,
+    void *handle)
+    : _path(path),
+      _handle(handle)
+{
+    _entryProc = FindSymbol(_handle, "VSTPluginMain");
+
+    if (_entryProc == nullptr)
+    {
+        _entryProc = FindSymbol(_handle, "main");
+    }
+}
+
+PluginModule::~PluginModule()
+{
+    {
+        std::lock_guard<std::mutex> lock(_registryMutex);
+
+        // The module can be loaded again already, while this one was on
+        // its way out
+        auto found = _registry.find(RegistryKey(_path));
+        if (found != _registry.end() && found->second.expired())
+        {
+            _registry.erase(found);
+        }
+    }
+
+    CloseLibrary(_handle);
+}
+
+std::shared_ptr<PluginModule> PluginModule::Load(
+    const std::wstring &path)
+{
+    auto key = RegistryKey(path);
+
+    // The lock is held while the library loads, so two plugins of the same
+    // module never both load it. The OS loader serializes loading anyway.
+    std::lock_guard<std::mutex> lock(_registryMutex);
+
+    auto found = _registry.find(key);
+    if (found != _registry.end())
+    {
+        auto module = found->second.lock();
+        if (module != nullptr)
+        {
+            return module;
+        }
+    }
+
+    auto handle = OpenLibrary(path);
+
+    if (handle == nullptr)
+    {
+        spdlog::error("failed to load module {0}", ConvertWideToBytes(path));
+
+        return nullptr;
+    }
+
+    auto module = std::shared_ptr<PluginModule>(new PluginModule(path, handle));
+
+    _registry[key] = module;
+
+    return module;
+}
+
+std::vector<std::shared_ptr<PluginModule>> PluginModule::Prewarm(
+    const std::vector<std::wstring> &paths)
+{
+    std::vector<std::shared_ptr<PluginModule>> result;
+
+    for (auto &path : paths)
+    {
+        auto module = Load(path);
+
+        if (module != nullptr && std::find(result.begin(), result.end(), module) == result.end())
+        {
+            result.push_back(module);
+        }
+    }
+
+    return result;
+}
+
+size_t PluginModule::LoadedCount()
+{
+    std::lock_guard<std::mutex> lock(_registryMutex);
+
+    return size_t(std::count_if(_registry.begin(), _registry.end(), [](auto &entry) { return !entry.second.expired(); }));
+}
+
+const std::wstring &PluginModule::Path() const
+{
+    return _path;
+}
+
+void *PluginModule::EntryProc() const
+{
+    return _entryProc;
+}
+
+std::wstring PluginModule::RegistryKey(
+    const std::wstring &path)
+{
+    std::error_code error;
+    std::filesystem::path fullPath(path);
+
+    // Names without a directory are found by the loader, they are kept as
+    // they are
+    if (fullPath.has_parent_path())
+    {
+        auto canonicalPath = std::filesystem::weakly_canonical(fullPath, error);
+
+        if (!error)
+        {
+            fullPath = canonicalPath;
+        }
+    }
+
+    auto key = fullPath.wstring();
+
+#ifdef _WIN32
+    std::transform(key.begin(), key.end(), key.begin(), [](wchar_t c) { return wchar_t(std::towlower(c)); });
+#endif
+
+    return key;
+}
+
+#ifdef _WIN32
+void *PluginModule::OpenLibrary(
+    const std::wstring &path)
+{
+    return LoadLibraryW(path.c_str());
+}
+
+void *PluginModule::FindSymbol(
+    void *handle,
+    const char *name)
+{
+    return reinterpret_cast<void *>(GetProcAddress(static_cast<HMODULE>(handle), name));
+}
+
+void PluginModule::CloseLibrary(
+    void *handle)
+{
+    if (handle != nullptr)
+    {
+        FreeLibrary(static_cast<HMODULE>(handle));
+    }
+}
+#else
+void *PluginModule::OpenLibrary(
+    const std::wstring &path)
+{
+    auto handle = dlopen(ConvertWideToBytes(path).c_str(), RTLD_NOW | RTLD_LOCAL);
+
+    if (handle == nullptr)
+    {
+        spdlog::debug("dlopen: {0}", dlerror());
+    }
+
+    return handle;
+}
+
+void *PluginModule::FindSymbol(
+    void *handle,
+    const char *name)
+{
+    return dlsym(handle, name);
+}
+
+void PluginModule::CloseLibrary(
+    void *handle)
+{
+    if (handle != nullptr)
+    {
+        dlclose(handle);
+    }
+}
+#endif
+
+#ifdef TEST_YOUR_CODE
+#include <iostream>
+
+void PluginModule::Tests()
+{
+    // Any library that is always there will do, it does not need to be a
+    // plugin to be shared
+#ifdef _WIN32
+    const std::wstring systemLibrary = L"kernel32.dll";
+#else
+    const std::wstring systemLibrary = L"libm.so.6";
+#endif
+
+    auto loadedBefore = LoadedCount();
+
+    {
+        auto first = Load(systemLibrary);
+        auto second = Load(systemLibrary);
+
+        if (first == nullptr || first != second)
+        {
+            std::cout << "PluginModule loaded the same module twice" << std::endl;
+        }
+
+        if (first != nullptr && first->EntryProc() != nullptr)
+        {
+            std::cout << "PluginModule found an entry point in a library that is not a plugin" << std::endl;
+        }
+
+        if (LoadedCount() != loadedBefore + 1)
+        {
+            std::cout << "PluginModule has " << LoadedCount() << " modules loaded, expected " << (loadedBefore + 1) << std::endl;
+        }
+
+        auto prewarmed = Prewarm({systemLibrary, systemLibrary, L"missing-module"});
+
+        if (prewarmed.size() != 1 || prewarmed[0] != first)
+        {
+            std::cout << "PluginModule prewarmed " << prewarmed.size() << " modules, expected the one that was loaded" << std::endl;
+        }
+    }
+
+    if (LoadedCount() != loadedBefore)
+    {
+        std::cout << "PluginModule kept a module loaded after its last user was gone" << std::endl;
+    }
+}
+#endif
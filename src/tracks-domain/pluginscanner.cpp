@@ -0,0 +1,528 @@
+#include "pluginscanner.h"
+
+#include "widestringconversions.hpp"
+#include "workerpool.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <spdlog/spdlog.h>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static const char *moduleExtension = ".dll";
+#else
+static const char *moduleExtension = ".so";
+#endif
+
+PluginScanner::PluginScanner(
+    const std::string &probePath)
+    : _probePath(probePath)
+{}
+
+void PluginScanner::SetParallelProbes(
+    size_t count)
+{
+    _parallelProbes = std::max<size_t>(count, 1);
+}
+
+void PluginScanner::SetProbeTimeout(
+    std::chrono::milliseconds timeout)
+{
+    _probeTimeout = timeout;
+}
+
+void PluginScanner::SetModuleHasher(
+    std::function<std::string(const std::string &)> hashModule)
+{
+    _hashModule = hashModule;
+}
+
+void PluginScanner::Cancel()
+{
+    _cancelled.store(true);
+}
+
+static std::filesystem::path PathFromUtf8(
+    const std::string &path)
+{
+    return std::filesystem::path(std::u8string(path.begin(), path.end()));
+}
+
+static std::string PathToUtf8(
+    const std::filesystem::path &path)
+{
+    auto result = path.u8string();
+
+    return std::string(result.begin(), result.end());
+}
+
+static bool IsModule(
+    const std::filesystem::path &path)
+{
+    auto extension = path.extension().string();
+
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+
+    return extension == moduleExtension;
+}
+
+std::vector<PluginScanner::ProbeResult> PluginScanner::FindModules(
+    const std::vector<std::string> &directories)
+{
+    std::vector<ProbeResult> result;
+
+    for (auto &directory : directories)
+    {
+        std::error_code error;
+        std::filesystem::recursive_directory_iterator it(
+            PathFromUtf8(directory),
+            std::filesystem::directory_options::skip_permission_denied,
+            error);
+
+        if (error)
+        {
+            spdlog::error("failed to scan {0} for plugins: {1}", directory, error.message());
+
+            continue;
+        }
+
+        for (; it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+        {
+            if (error)
+            {
+                break;
+            }
+
+            std::error_code fileError;
+            if (!it->is_regular_file(fileError) || !IsModule(it->path()))
+            {
+                continue;
+            }
+
+            auto size = it->file_size(fileError);
+            auto time = it->last_write_time(fileError);
+            if (fileError)
+            {
+                continue;
+            }
+
+            ProbeResult module;
+            module.path = PathToUtf8(it->path());
+            module.fileSize = int64_t(size);
+            module.fileTime = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+
+            result.push_back(module);
+        }
+    }
+
+    return result;
+}
+
+std::vector<PluginScanner::ProbeResult> PluginScanner::Scan(
+    const std::vector<std::string> &directories,
+    const std::map<std::string, ScannedModule> &scannedModules)
+{
+    auto modules = FindModules(directories);
+
+    std::vector<ProbeResult> result;
+
+    for (auto &module : modules)
+    {
+        auto found = scannedModules.find(module.path);
+        if (found != scannedModules.end() && found->second.fileSize == module.fileSize && found->second.fileTime == module.fileTime)
+        {
+            continue;
+        }
+
+        result.push_back(module);
+    }
+
+    spdlog::info("probing {0} of {1} plugin modules", result.size(), modules.size());
+
+    auto task = [&](size_t index) {
+        if (_cancelled.load())
+        {
+            return;
+        }
+
+        auto &module = result[index];
+
+        std::string output;
+        if (!RunProbe(module.path, output))
+        {
+            return;
+        }
+
+        module.isPlugin = ParseProbeOutput(output, module.description);
+
+        if (!module.isPlugin)
+        {
+            return;
+        }
+
+        module.description.path = module.path;
+        module.description.fileSize = module.fileSize;
+        module.description.fileTime = module.fileTime;
+
+        if (_hashModule != nullptr)
+        {
+            module.description.md5 = _hashModule(module.path);
+        }
+    };
+
+    // The probes mostly wait for their child processes, the pool does not
+    // need to match the number of cores
+    WorkerPool workerPool(std::min<size_t>(_parallelProbes - 1, result.size()), false);
+    workerPool.ParallelFor(result.size(), task);
+
+    if (_cancelled.load())
+    {
+        // Modules that were not probed are not reported, so they are
+        // probed on the next scan
+        result.erase(
+            std::remove_if(result.begin(), result.end(), [](const ProbeResult &module) { return !module.isPlugin; }),
+            result.end());
+    }
+
+    return result;
+}
+
+bool PluginScanner::ParseProbeOutput(
+    const std::string &output,
+    PluginDescription &description)
+{
+    std::istringstream stream(output);
+    std::string line;
+    bool inProbe = false;
+    bool complete = false;
+
+    // The plugin can print anything while it loads, only the lines between
+    // the markers are from the probe
+    while (std::getline(stream, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        if (line == "probe=begin")
+        {
+            inProbe = true;
+            continue;
+        }
+
+        if (!inProbe)
+        {
+            continue;
+        }
+
+        if (line == "probe=end")
+        {
+            complete = true;
+            break;
+        }
+
+        auto separator = line.find('=');
+        if (separator == std::string::npos)
+        {
+            continue;
+        }
+
+        auto key = line.substr(0, separator);
+        auto value = line.substr(separator + 1);
+
+        if (key == "type")
+        {
+            description.type = value;
+        }
+        else if (key == "vendorName")
+        {
+            description.vendorName = value;
+        }
+        else if (key == "vendorVersion")
+        {
+            description.vendorVersion = std::atoi(value.c_str());
+        }
+        else if (key == "effectName")
+        {
+            description.effectName = value;
+        }
+        else if (key == "programCount")
+        {
+            description.programCount = std::atoi(value.c_str());
+        }
+        else if (key == "paramCount")
+        {
+            description.paramCount = std::atoi(value.c_str());
+        }
+        else if (key == "inputCount")
+        {
+            description.inputCount = std::atoi(value.c_str());
+        }
+        else if (key == "outputCount")
+        {
+            description.outputCount = std::atoi(value.c_str());
+        }
+        else if (key == "isSynth")
+        {
+            description.isSynth = value == "1";
+        }
+        else if (key == "hasEditor")
+        {
+            description.hasEditor = value == "1";
+        }
+    }
+
+    return complete;
+}
+
+#ifdef _WIN32
+bool PluginScanner::RunProbe(
+    const std::string &modulePath,
+    std::string &output)
+{
+    SECURITY_ATTRIBUTES securityAttributes = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    HANDLE readPipe = nullptr;
+    HANDLE writePipe = nullptr;
+
+    if (!CreatePipe(&readPipe, &writePipe, &securityAttributes, 0))
+    {
+        spdlog::error("failed to create a pipe for plugin-probe");
+
+        return false;
+    }
+
+    SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+
+    STARTUPINFOW startupInfo = {};
+    startupInfo.cb = sizeof(startupInfo);
+    startupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startupInfo.hStdInput = nullptr;
+    startupInfo.hStdOutput = writePipe;
+    startupInfo.hStdError = writePipe;
+
+    PROCESS_INFORMATION processInfo = {};
+
+    auto commandLine = L"\"" + ConvertUtf8ToWide(_probePath) + L"\" \"" + ConvertUtf8ToWide(modulePath) + L"\"";
+
+    if (!CreateProcessW(nullptr, commandLine.data(), nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr, &startupInfo, &processInfo))
+    {
+        spdlog::error("failed to start {0}", _probePath);
+
+        CloseHandle(readPipe);
+        CloseHandle(writePipe);
+
+        return false;
+    }
+
+    // Only the child holds the write end now, so reading ends when it exits
+    CloseHandle(writePipe);
+
+    auto deadline = std::chrono::steady_clock::now() + _probeTimeout;
+    bool exited = false;
+    char buffer[4096];
+
+    while (true)
+    {
+        DWORD available = 0;
+        while (PeekNamedPipe(readPipe, nullptr, 0, nullptr, &available, nullptr) && available > 0)
+        {
+            DWORD read = 0;
+            if (!ReadFile(readPipe, buffer, std::min<DWORD>(available, sizeof(buffer)), &read, nullptr) || read == 0)
+            {
+                break;
+            }
+
+            output.append(buffer, read);
+        }
+
+        if (exited)
+        {
+            break;
+        }
+
+        exited = WaitForSingleObject(processInfo.hProcess, 10) == WAIT_OBJECT_0;
+
+        if (!exited && std::chrono::steady_clock::now() > deadline)
+        {
+            spdlog::error("plugin-probe timed out on {0}", modulePath);
+
+            TerminateProcess(processInfo.hProcess, 1);
+            WaitForSingleObject(processInfo.hProcess, INFINITE);
+
+            break;
+        }
+    }
+
+    DWORD exitCode = 1;
+    GetExitCodeProcess(processInfo.hProcess, &exitCode);
+
+    CloseHandle(processInfo.hProcess);
+    CloseHandle(processInfo.hThread);
+    CloseHandle(readPipe);
+
+    return exited && exitCode == 0;
+}
+#else
+bool PluginScanner::RunProbe(
+    const std::string &modulePath,
+    std::string &output)
+{
+    int pipeEnds[2];
+
+    if (pipe(pipeEnds) != 0)
+    {
+        spdlog::error("failed to create a pipe for plugin-probe");
+
+        return false;
+    }
+
+    auto pid = fork();
+
+    if (pid < 0)
+    {
+        spdlog::error("failed to start {0}", _probePath);
+
+        close(pipeEnds[0]);
+        close(pipeEnds[1]);
+
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        dup2(pipeEnds[1], STDOUT_FILENO);
+        dup2(pipeEnds[1], STDERR_FILENO);
+        close(pipeEnds[0]);
+        close(pipeEnds[1]);
+
+        execl(_probePath.c_str(), _probePath.c_str(), modulePath.c_str(), nullptr);
+
+        _exit(127);
+    }
+
+    // Only the child holds the write end now, so reading ends when it exits
+    close(pipeEnds[1]);
+
+    auto deadline = std::chrono::steady_clock::now() + _probeTimeout;
+    int status = 0;
+    bool exited = false;
+    char buffer[4096];
+
+    while (true)
+    {
+        pollfd readable = {pipeEnds[0], POLLIN, 0};
+
+        if (poll(&readable, 1, 10) > 0)
+        {
+            auto read = ::read(pipeEnds[0], buffer, sizeof(buffer));
+            if (read > 0)
+            {
+                output.append(buffer, size_t(read));
+
+                continue;
+            }
+        }
+
+        if (exited)
+        {
+            break;
+        }
+
+        exited = waitpid(pid, &status, WNOHANG) == pid;
+
+        if (!exited && std::chrono::steady_clock::now() > deadline)
+        {
+            spdlog::error("plugin-probe timed out on {0}", modulePath);
+
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+
+            break;
+        }
+    }
+
+    close(pipeEnds[0]);
+
+    return exited && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+#endif
+
+#ifdef TEST_YOUR_CODE
+#include <fstream>
+#include <iostream>
+
+void PluginScanner::Tests()
+{
+    PluginDescription description = {};
+
+    auto parsed = ParseProbeOutput(
+        "_aEffect->numInputs : 0\r\n"
+        "probe=begin\r\n"
+        "type=VST2\r\n"
+        "vendorName=Vendor=Name\r\n"
+        "effectName=Synth\r\n"
+        "outputCount=2\r\n"
+        "isSynth=1\r\n"
+        "hasEditor=0\r\n"
+        "probe=end\r\n",
+        description);
+
+    if (!parsed || description.vendorName != "Vendor=Name" || description.effectName != "Synth" || description.outputCount != 2 || !description.isSynth || description.hasEditor)
+    {
+        std::cout << "ParseProbeOutput did not read the probe output" << std::endl;
+    }
+
+    if (ParseProbeOutput("probe=begin\ntype=VST2\n", description))
+    {
+        std::cout << "ParseProbeOutput accepted the output of a probe that did not finish" << std::endl;
+    }
+
+    auto directory = std::filesystem::temp_directory_path() / "vsthost-pluginscanner-test";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory / "vendor");
+
+    std::ofstream(directory / ("first" + std::string(moduleExtension))) << "first";
+    std::ofstream(directory / "vendor" / ("second" + std::string(moduleExtension))) << "second";
+    std::ofstream(directory / "readme.txt") << "readme";
+
+    auto modules = FindModules({PathToUtf8(directory), PathToUtf8(directory / "missing")});
+    if (modules.size() != 2)
+    {
+        std::cout << "FindModules found " << modules.size() << " modules, expected 2" << std::endl;
+    }
+
+    // A module that was scanned before is only probed again when it changed,
+    // the probe does not exist so every probe fails
+    std::map<std::string, ScannedModule> scannedModules;
+    for (auto &module : modules)
+    {
+        scannedModules[module.path] = ScannedModule{module.fileSize, module.fileTime};
+    }
+
+    if (!modules.empty())
+    {
+        scannedModules[modules[0].path].fileSize++;
+    }
+
+    PluginScanner scanner(PathToUtf8(directory / "missing-probe"));
+    auto results = scanner.Scan({PathToUtf8(directory)}, scannedModules);
+
+    if (results.size() != 1 || results[0].path != modules[0].path || results[0].isPlugin)
+    {
+        std::cout << "Scan probed " << results.size() << " modules, expected only the changed one" << std::endl;
+    }
+
+    std::filesystem::remove_all(directory);
+}
+#endif
@@ -5,46 +5,44 @@
 
 #include <Windows.h>
 
+#include "mappedfile.h"
+#include "pluginmodule.h"
+#include "pluginscanner.h"
 #include "vstplugin.h"
 #include <Wincrypt.h>
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <spdlog/spdlog.h>
+#include <thread>
 #include <sstream>
 #include <widestringconversions.hpp>
 
-#define BUFSIZE 1024
 #define MD5LEN 16
 
+// Rows written by the scanner per sqlite transaction
+const size_t scanBatchSize = 100;
+
+// CryptHashData takes at most 4GB at a time
+const size_t hashSliceSize = 64 * 1024 * 1024;
+
 std::string md5(
     const std::wstring &filename)
 {
     DWORD dwStatus = 0;
-    BOOL bResult = FALSE;
     HCRYPTPROV hProv = 0;
     HCRYPTHASH hHash = 0;
-    HANDLE hFile = NULL;
-    BYTE rgbFile[BUFSIZE];
-    DWORD cbRead = 0;
     BYTE rgbHash[MD5LEN];
     DWORD cbHash = 0;
     CHAR rgbDigits[] = "0123456789abcdef";
 
-    // Logic to check usage goes here.
-
-    hFile = CreateFile(
-        filename.c_str(),
-        GENERIC_READ,
-        FILE_SHARE_READ,
-        NULL,
-        OPEN_EXISTING,
-        FILE_FLAG_SEQUENTIAL_SCAN,
-        NULL);
+    // The module is mapped instead of read, so the hash is computed
+    // straight from the file cache
+    MappedFile file;
 
-    if (INVALID_HANDLE_VALUE == hFile)
+    if (!file.Open(ConvertWideToUtf8(filename)))
     {
-        dwStatus = GetLastError();
-        std::wcerr << L"Error opening file " << filename << std::endl
-                   << L"Error: " << dwStatus << std::endl;
-
         return std::string();
     }
 
@@ -58,7 +56,6 @@ std::string md5(
     {
         dwStatus = GetLastError();
         std::wcerr << L"CryptAcquireContext failed:" << dwStatus << std::endl;
-        CloseHandle(hFile);
 
         return std::string();
     }
@@ -67,44 +64,24 @@ std::string md5(
     {
         dwStatus = GetLastError();
         std::wcerr << L"CryptAcquireContext failed:" << dwStatus << std::endl;
-        CloseHandle(hFile);
         CryptReleaseContext(hProv, 0);
 
         return std::string();
     }
 
-    bResult = ReadFile(hFile, rgbFile, BUFSIZE, &cbRead, NULL);
-
-    while (bResult)
+    for (size_t offset = 0; offset < file.Size(); offset += hashSliceSize)
     {
-        if (0 == cbRead)
-        {
-            break;
-        }
+        auto length = std::min<size_t>(hashSliceSize, file.Size() - offset);
 
-        if (!CryptHashData(hHash, rgbFile, cbRead, 0))
+        if (!CryptHashData(hHash, file.Data() + offset, DWORD(length), 0))
         {
             dwStatus = GetLastError();
             std::wcerr << L"CryptHashData failed:" << dwStatus << std::endl;
-            CryptReleaseContext(hProv, 0);
             CryptDestroyHash(hHash);
-            CloseHandle(hFile);
+            CryptReleaseContext(hProv, 0);
 
             return std::string();
         }
-
-        bResult = ReadFile(hFile, rgbFile, BUFSIZE, &cbRead, NULL);
-    }
-
-    if (!bResult)
-    {
-        dwStatus = GetLastError();
-        std::wcerr << L"ReadFile failed:" << dwStatus << std::endl;
-        CryptReleaseContext(hProv, 0);
-        CryptDestroyHash(hHash);
-        CloseHandle(hFile);
-
-        return std::string();
     }
 
     std::stringstream ss;
@@ -125,7 +102,6 @@ std::string md5(
 
     CryptDestroyHash(hHash);
     CryptReleaseContext(hProv, 0);
-    CloseHandle(hFile);
 
     return ss.str();
 }
@@ -149,9 +125,54 @@ PluginService::PluginService(
     inputCount INTEGER,
     outputCount INTEGER,
     isSynth INTEGER,
-    hasEditor INTEGER
+    hasEditor INTEGER,
+    fileSize INTEGER,
+    fileTime INTEGER
   )
 )");
+
+    // Libraries from before the file size and time were stored
+    auto columnsStmt = _db->prepare<std::string>("SELECT name FROM pragma_table_info('plugins')");
+    auto columns = columnsStmt.execute();
+    if (std::find(columns.begin(), columns.end(), "fileSize") == columns.end())
+    {
+        _db->execute("ALTER TABLE plugins ADD COLUMN fileSize INTEGER");
+        _db->execute("ALTER TABLE plugins ADD COLUMN fileTime INTEGER");
+    }
+
+    // Modules the scanner found that are not plugins, they are not probed
+    // again until they change
+    _db->execute(R"(
+  CREATE TABLE IF NOT EXISTS skippedModules (
+    path TEXT PRIMARY KEY,
+    fileSize INTEGER,
+    fileTime INTEGER
+  )
+)");
+
+    _db->execute("CREATE INDEX IF NOT EXISTS pluginsByMd5 ON plugins (md5)");
+    _db->execute("CREATE INDEX IF NOT EXISTS pluginsByPath ON plugins (path)");
+    _db->execute("CREATE INDEX IF NOT EXISTS pluginsByKind ON plugins (isSynth, effectName)");
+    _db->execute("CREATE INDEX IF NOT EXISTS pluginsByEffectName ON plugins (effectName)");
+
+    _selectPluginIdStatement = std::make_unique<sqlitelib::Statement<int>>(
+        _db->prepare<int>("SELECT id FROM plugins WHERE md5 = ?"));
+
+    _insertPluginStatement = std::make_unique<sqlitelib::Statement<void>>(_db->prepare(R"(
+INSERT INTO plugins ( type, path, md5,    vendorName, vendorVersion,  effectName, programCount, paramCount, inputCount, outputCount, isSynth,    hasEditor,  fileSize,   fileTime )
+             VALUES ( ?,    ?,    ?,      ?,          ?,              ?,          ?,            ?,          ?,          ?,           ?,          ?,          ?,          ? )
+)"));
+
+    _updatePluginStatement = std::make_unique<sqlitelib::Statement<void>>(_db->prepare(R"(
+UPDATE plugins SET
+    type = ?, path = ?, md5 = ?, vendorName = ?, vendorVersion = ?, effectName = ?,
+    programCount = ?, paramCount = ?, inputCount = ?, outputCount = ?, isSynth = ?, hasEditor = ?,
+    fileSize = ?, fileTime = ?
+WHERE id = ?
+)"));
+
+    _selectModuleHashStatement = std::make_unique<sqlitelib::Statement<std::string>>(
+        _db->prepare<std::string>("SELECT md5 FROM plugins WHERE path = ? AND fileSize = ? AND fileTime = ?"));
 }
 
 std::shared_ptr<class VstPlugin> PluginService::LoadPlugin(
@@ -164,7 +185,7 @@ std::shared_ptr<class VstPlugin> PluginService::LoadPlugin(
     const std::wstring &filename)
 {
     auto fn = ConvertWideToBytes(filename);
-    auto r = md5(filename);
+    auto module = HashModule(filename);
 
     auto result = std::make_shared<VstPlugin>();
 
@@ -174,7 +195,7 @@ std::shared_ptr<class VstPlugin> PluginService::LoadPlugin(
         {
             .type = "VST2",
             .path = ConvertWideToBytes(filename),
-            .md5 = r,
+            .md5 = module.md5,
             .vendorName = result->getVendorName(),
             .vendorVersion = result->getVendorVersion(),
             .effectName = result->getEffectName(),
@@ -184,6 +205,8 @@ std::shared_ptr<class VstPlugin> PluginService::LoadPlugin(
             .outputCount = result->getOutputCount(),
             .isSynth = result->flagsIsSynth(),
             .hasEditor = result->flagsHasEditor(),
+            .fileSize = module.size,
+            .fileTime = module.time,
         };
 
     EnsurePluginDescription(desc);
@@ -211,21 +234,90 @@ std::shared_ptr<VstPlugin> PluginService::LoadFromFileDialog()
     return LoadPlugin(fn);
 }
 
+std::vector<std::shared_ptr<PluginModule>> PluginService::PrewarmModules(
+    const std::vector<std::string> &filenames)
+{
+    std::vector<std::wstring> paths;
+
+    for (auto &filename : filenames)
+    {
+        paths.push_back(ConvertFromBytes(filename));
+    }
+
+    return PluginModule::Prewarm(paths);
+}
+
+PluginService::ModuleFile PluginService::HashModule(
+    const std::wstring &filename)
+{
+    ModuleFile result;
+
+    std::error_code sizeError, timeError;
+    auto size = std::filesystem::file_size(filename, sizeError);
+    auto time = std::filesystem::last_write_time(filename, timeError);
+
+    if (!sizeError && !timeError)
+    {
+        result.size = int64_t(size);
+        result.time = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+    }
+
+    if (result.size >= 0)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto found = _moduleFiles.find(filename);
+        if (found != _moduleFiles.end() && found->second.size == result.size && found->second.time == result.time)
+        {
+            return found->second;
+        }
+
+        // sqlitelib does not bind 64 bit integers, a double holds the size
+        // and time exactly
+        auto rows = _selectModuleHashStatement->execute(
+            ConvertWideToBytes(filename),
+            double(result.size),
+            double(result.time));
+
+        if (!rows.empty() && !rows[0].empty())
+        {
+            result.md5 = rows[0];
+            _moduleFiles[filename] = result;
+
+            return result;
+        }
+    }
+
+    // Hashing is done outside the lock, so other modules can be hashed at
+    // the same time
+    result.md5 = md5(filename);
+
+    if (!result.md5.empty() && result.size >= 0)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _moduleFiles[filename] = result;
+    }
+
+    return result;
+}
+
 void PluginService::EnsurePluginDescription(
     struct PluginDescription desc)
 {
-    auto stmt = _db->prepare<int>("SELECT id FROM plugins WHERE md5 = ?");
+    std::lock_guard<std::mutex> lock(_mutex);
 
-    auto rows = stmt.execute(desc.md5);
+    StorePluginDescription(desc);
+}
+
+void PluginService::StorePluginDescription(
+    const struct PluginDescription &desc)
+{
+    auto rows = _selectPluginIdStatement->execute(desc.md5);
 
     if (rows.empty())
     {
-        auto stmt = _db->prepare(R"(
-INSERT INTO plugins ( type, path, md5,    vendorName, vendorVersion,  effectName, programCount, paramCount, inputCount, outputCount, isSynth,    hasEditor )
-             VALUES ( ?,    ?,    ?,      ?,          ?,              ?,          ?,            ?,          ?,          ?,           ?,          ? )
-)");
-
-        stmt.execute(
+        _insertPluginStatement->execute(
             desc.type,
             desc.path,
             desc.md5,
@@ -237,18 +329,13 @@ INSERT INTO plugins ( type, path, md5,    vendorName, vendorVersion,  effectName
             desc.inputCount,
             desc.outputCount,
             desc.isSynth ? 1 : 0,
-            desc.hasEditor ? 1 : 0);
+            desc.hasEditor ? 1 : 0,
+            double(desc.fileSize),
+            double(desc.fileTime));
     }
     else
     {
-        auto stmt = _db->prepare(R"(
-UPDATE plugins SET
-    type = ?, path = ?, md5 = ?, vendorName = ?, vendorVersion = ?, effectName = ?,
-    programCount = ?, paramCount = ?, inputCount = ?, outputCount = ?, isSynth = ?, hasEditor = ?
-WHERE id = ?
-)");
-
-        stmt.execute(
+        _updatePluginStatement->execute(
             desc.type,
             desc.path,
             desc.md5,
@@ -261,14 +348,16 @@ WHERE id = ?
             desc.outputCount,
             desc.isSynth ? 1 : 0,
             desc.hasEditor ? 1 : 0,
+            double(desc.fileSize),
+            double(desc.fileTime),
             rows[0]);
     }
 }
 
-const char *selectPluginFromSqlite = "SELECT id, type, path, md5, vendorName, vendorVersion, effectName, programCount, paramCount, inputCount, outputCount, isSynth, hasEditor FROM plugins";
+const char *selectPluginFromSqlite = "SELECT id, type, path, md5, vendorName, vendorVersion, effectName, programCount, paramCount, inputCount, outputCount, isSynth, hasEditor, fileSize, fileTime FROM plugins";
 
 PluginDescription mapPluginFromSqlite(
-    const std::tuple<int, std::string, std::string, std::string, std::string, int, std::string, int, int, int, int, int, int> &row)
+    const std::tuple<int, std::string, std::string, std::string, std::string, int, std::string, int, int, int, int, int, int, double, double> &row)
 {
     return PluginDescription{
         .id = std::get<0>(row),
@@ -284,20 +373,244 @@ PluginDescription mapPluginFromSqlite(
         .outputCount = std::get<10>(row),
         .isSynth = std::get<11>(row) == 1,
         .hasEditor = std::get<12>(row) == 1,
+        .fileSize = int64_t(std::get<13>(row)),
+        .fileTime = int64_t(std::get<14>(row)),
     };
 }
 
 std::vector<struct PluginDescription> PluginService::ListPlugins(
     std::function<bool(const struct PluginDescription &)> filter)
 {
-    std::vector<struct PluginDescription> result;
-
-    auto stmt = _db->prepare<int, std::string, std::string, std::string, std::string, int, std::string, int, int, int, int, int, int>(selectPluginFromSqlite);
-
-    auto rows = stmt.execute();
+    auto rows = QueryPlugins(PluginQuery());
 
     return boolinq::from(rows)
-        .select(mapPluginFromSqlite)
         .where(filter)
         .toStdVector();
 }
+
+// Escapes the wildcards in the search text, so it is matched as is
+static std::string LikePattern(
+    const std::string &text)
+{
+    std::string result = "%";
+
+    for (auto c : text)
+    {
+        if (c == '%' || c == '_' || c == '\\')
+        {
+            result += '\\';
+        }
+
+        result += c;
+    }
+
+    return result + "%";
+}
+
+std::vector<struct PluginDescription> PluginService::QueryPlugins(
+    const struct PluginQuery &query)
+{
+    // Every combination of filters gets its own statement, so sqlite can
+    // pick an index for it. The parameters are numbered, the ones a
+    // statement does not use are bound anyway.
+    enum
+    {
+        filterOnKind = 1,
+        filterOnVendor = 2,
+        filterOnSearch = 4,
+    };
+
+    int filters = 0;
+    filters |= query.kind != PluginQuery::Kinds::All ? filterOnKind : 0;
+    filters |= !query.vendorName.empty() ? filterOnVendor : 0;
+    filters |= !query.search.empty() ? filterOnSearch : 0;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto &stmt = _queryStatements[filters];
+
+    if (stmt == nullptr)
+    {
+        std::string sql = selectPluginFromSqlite;
+        sql += " WHERE 1";
+
+        if ((filters & filterOnKind) != 0)
+        {
+            sql += " AND isSynth = ?1";
+        }
+        if ((filters & filterOnVendor) != 0)
+        {
+            sql += " AND vendorName = ?2";
+        }
+        if ((filters & filterOnSearch) != 0)
+        {
+            sql += " AND (effectName LIKE ?3 ESCAPE '\\' OR vendorName LIKE ?3 ESCAPE '\\')";
+        }
+
+        sql += " ORDER BY effectName LIMIT ?4 OFFSET ?5";
+
+        stmt = std::make_unique<PluginStatement>(_db->prepare<int, std::string, std::string, std::string, std::string, int, std::string, int, int, int, int, int, int, double, double>(sql.c_str()));
+    }
+
+    auto rows = stmt->execute(
+        query.kind == PluginQuery::Kinds::Instruments ? 1 : 0,
+        query.vendorName,
+        LikePattern(query.search),
+        query.limit,
+        query.offset);
+
+    std::vector<struct PluginDescription> result;
+    result.reserve(rows.size());
+
+    for (auto &row : rows)
+    {
+        result.push_back(mapPluginFromSqlite(row));
+    }
+
+    return result;
+}
+
+void PluginService::ScanPlugins(
+    const std::vector<std::string> &directories)
+{
+    // The scanner works with UTF-8 paths, the library stores them as bytes
+    std::map<std::string, PluginScanner::ScannedModule> scannedModules;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto stmt = _db->prepare<std::string, double, double>("SELECT path, fileSize, fileTime FROM plugins UNION ALL SELECT path, fileSize, fileTime FROM skippedModules");
+
+        for (auto &row : stmt.execute())
+        {
+            scannedModules[ConvertWideToUtf8(ConvertFromBytes(std::get<0>(row)))] = PluginScanner::ScannedModule{
+                int64_t(std::get<1>(row)),
+                int64_t(std::get<2>(row)),
+            };
+        }
+    }
+
+    wchar_t executable[MAX_PATH + 1] = {'\0'};
+    GetModuleFileNameW(nullptr, executable, MAX_PATH);
+
+    auto probePath = std::filesystem::path(executable).parent_path() / L"plugin-probe.exe";
+
+    PluginScanner scanner(ConvertWideToUtf8(probePath.wstring()));
+    scanner.SetParallelProbes(std::max<size_t>(std::thread::hardware_concurrency(), 1));
+    scanner.SetModuleHasher([this](const std::string &path) { return HashModule(ConvertUtf8ToWide(path)).md5; });
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _scanner = &scanner;
+
+        if (_scanCancelled.load())
+        {
+            scanner.Cancel();
+        }
+    }
+
+    auto results = scanner.Scan(directories, scannedModules);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _scanner = nullptr;
+
+    auto skipStmt = _db->prepare("INSERT OR REPLACE INTO skippedModules (path, fileSize, fileTime) VALUES (?, ?, ?)");
+
+    // One transaction per batch instead of one per row
+    for (size_t first = 0; first < results.size(); first += scanBatchSize)
+    {
+        _db->execute("BEGIN TRANSACTION");
+
+        for (size_t i = first; i < results.size() && i < first + scanBatchSize; i++)
+        {
+            auto &result = results[i];
+            auto path = ConvertWideToBytes(ConvertUtf8ToWide(result.path));
+
+            if (!result.isPlugin)
+            {
+                skipStmt.execute(path, double(result.fileSize), double(result.fileTime));
+            }
+            else if (!result.description.md5.empty())
+            {
+                result.description.path = path;
+                StorePluginDescription(result.description);
+            }
+        }
+
+        _db->execute("COMMIT");
+    }
+
+    spdlog::info("plugin scan stored {0} modules", results.size());
+}
+
+void PluginService::CancelScan()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _scanCancelled.store(true);
+
+    if (_scanner != nullptr)
+    {
+        _scanner->Cancel();
+    }
+}
+
+std::vector<std::string> PluginService::DefaultPluginDirectories()
+{
+    std::vector<std::wstring> candidates;
+
+    wchar_t registryPath[MAX_PATH + 1] = {'\0'};
+    DWORD registryPathSize = sizeof(registryPath);
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\VST", L"VSTPluginsPath", RRF_RT_REG_SZ, nullptr, registryPath, &registryPathSize) == ERROR_SUCCESS)
+    {
+        candidates.push_back(registryPath);
+    }
+
+    auto vstPath = _wgetenv(L"VST_PATH");
+    if (vstPath != nullptr)
+    {
+        std::wstring paths = vstPath;
+        size_t start = 0;
+
+        while (start <= paths.size())
+        {
+            auto end = paths.find(L';', start);
+            if (end == std::wstring::npos)
+            {
+                end = paths.size();
+            }
+
+            if (end > start)
+            {
+                candidates.push_back(paths.substr(start, end - start));
+            }
+
+            start = end + 1;
+        }
+    }
+
+    candidates.push_back(L"C:\\Program Files\\VSTPlugins");
+    candidates.push_back(L"C:\\Program Files\\Steinberg\\VSTPlugins");
+    candidates.push_back(L"C:\\Program Files\\Common Files\\VST2");
+    candidates.push_back(L"C:\\Program Files\\Common Files\\Steinberg\\VST2");
+
+    std::vector<std::string> result;
+
+    for (auto &candidate : candidates)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_directory(candidate, error))
+        {
+            continue;
+        }
+
+        auto directory = ConvertWideToUtf8(candidate);
+        if (std::find(result.begin(), result.end(), directory) == result.end())
+        {
+            result.push_back(directory);
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,839 @@
+#include "processinggraph.h"
+
+#include "dspkernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <spdlog/spdlog.h>
+
+static std::atomic<size_t> s_largestScratchSize = 0;
+
+ProcessingGraph::ProcessingGraph()
+{
+    AddNode(NodeTypes::Output, nullptr, 1.0f);
+}
+
+ProcessingGraph::NodeId ProcessingGraph::AddNode(
+    NodeTypes type,
+    std::shared_ptr<VstPlugin> plugin,
+    float gain)
+{
+    Node node;
+    node.type = type;
+    node.plugin = plugin;
+    node.gain = gain;
+
+    _nodes.push_back(node);
+    _compiled = false;
+
+    return NodeId(_nodes.size() - 1);
+}
+
+ProcessingGraph::NodeId ProcessingGraph::AddPlugin(
+    std::shared_ptr<VstPlugin> plugin)
+{
+    return AddNode(NodeTypes::Plugin, plugin, 1.0f);
+}
+
+ProcessingGraph::NodeId ProcessingGraph::AddSend(
+    float gain)
+{
+    return AddNode(NodeTypes::Send, nullptr, gain);
+}
+
+ProcessingGraph::NodeId ProcessingGraph::AddSplitter()
+{
+    return AddNode(NodeTypes::Splitter, nullptr, 1.0f);
+}
+
+ProcessingGraph::NodeId ProcessingGraph::AddSummer()
+{
+    return AddNode(NodeTypes::Summer, nullptr, 1.0f);
+}
+
+ProcessingGraph::NodeTypes ProcessingGraph::NodeType(
+    NodeId node) const
+{
+    return _nodes[node].type;
+}
+
+size_t ProcessingGraph::NodeCount() const
+{
+    return _nodes.size();
+}
+
+bool ProcessingGraph::Connect(
+    NodeId from,
+    NodeId to)
+{
+    if (from >= _nodes.size() || to >= _nodes.size() || from == to || from == OutputNode)
+    {
+        return false;
+    }
+
+    auto &inputs = _nodes[to].inputs;
+
+    if (std::find(inputs.begin(), inputs.end(), from) != inputs.end())
+    {
+        return false;
+    }
+
+    inputs.push_back(from);
+    _compiled = false;
+
+    return true;
+}
+
+bool ProcessingGraph::Sort(
+    NodeId node,
+    std::vector<uint8_t> &marks,
+    std::vector<NodeId> &order) const
+{
+    const uint8_t visiting = 1;
+    const uint8_t done = 2;
+
+    if (marks[node] == done)
+    {
+        return true;
+    }
+
+    if (marks[node] == visiting)
+    {
+        return false;
+    }
+
+    marks[node] = visiting;
+
+    for (auto input : _nodes[node].inputs)
+    {
+        if (!Sort(input, marks, order))
+        {
+            return false;
+        }
+    }
+
+    marks[node] = done;
+    order.push_back(node);
+
+    return true;
+}
+
+bool ProcessingGraph::Compile()
+{
+    _compiled = false;
+    _schedule.clear();
+    _slotCount = 0;
+    _outputSlots.clear();
+    _outputChannels.clear();
+
+    std::vector<uint8_t> marks(_nodes.size(), 0);
+    std::vector<NodeId> order;
+
+    if (!Sort(OutputNode, marks, order))
+    {
+        spdlog::error("the processing graph has a cycle");
+
+        return false;
+    }
+
+    // Every channel that is written gets a value, with the step that writes
+    // it and the last step that reads it. A node that passes its single input
+    // on reads the values of that input in place.
+    std::vector<size_t> defined = {0};
+    std::vector<size_t> lastRead = {0};
+    std::vector<std::vector<uint32_t>> outputs(_nodes.size());
+    std::vector<size_t> channelCounts(_nodes.size(), 0);
+    _maxFrameCount = DefaultMaxFrameCount;
+
+    auto define = [&](size_t count) {
+        std::vector<uint32_t> values(count);
+        for (auto &value : values)
+        {
+            value = uint32_t(defined.size());
+            defined.push_back(_schedule.size());
+            lastRead.push_back(_schedule.size());
+        }
+
+        return values;
+    };
+
+    auto read = [&](uint32_t value) {
+        lastRead[value] = std::max(lastRead[value], _schedule.size());
+    };
+
+    for (auto id : order)
+    {
+        auto &node = _nodes[id];
+
+        size_t inputChannelCount = 0;
+        for (auto input : node.inputs)
+        {
+            inputChannelCount = std::max(inputChannelCount, channelCounts[input]);
+        }
+
+        Step step;
+        step.gain = node.gain;
+
+        // A send always scales into channels of its own, the other nodes only
+        // need them when they have more than one input to add up. A narrower
+        // input wraps around like in DspKernels.
+        std::vector<uint32_t> input;
+        if (inputChannelCount > 0 && (node.inputs.size() > 1 || node.type == NodeTypes::Send))
+        {
+            step.sumSlots = define(inputChannelCount);
+
+            for (size_t c = 0; c < step.sumSlots.size(); c++)
+            {
+                for (auto from : node.inputs)
+                {
+                    auto &source = outputs[from];
+                    if (!source.empty())
+                    {
+                        step.sums.push_back(std::make_pair(source[c % source.size()], step.sumSlots[c]));
+                        read(source[c % source.size()]);
+                    }
+                }
+            }
+
+            input = step.sumSlots;
+        }
+        else if (node.inputs.size() == 1)
+        {
+            input = outputs[node.inputs.front()];
+        }
+
+        if (node.type == NodeTypes::Plugin)
+        {
+            step.plugin = node.plugin.get();
+            step.pluginInputSlots.resize(size_t(std::max(0, node.plugin->getInputCount())), SilentSlot);
+
+            for (size_t c = 0; c < step.pluginInputSlots.size() && !input.empty(); c++)
+            {
+                step.pluginInputSlots[c] = input[c % input.size()];
+                read(step.pluginInputSlots[c]);
+            }
+
+            // Outputs nothing reads are still written by the plugin
+            step.pluginOutputSlots = define(size_t(std::max(0, node.plugin->getOutputCount())));
+            step.pluginInputs.resize(step.pluginInputSlots.size());
+            step.pluginOutputs.resize(step.pluginOutputSlots.size());
+
+            outputs[id] = step.pluginOutputSlots;
+            channelCounts[id] = step.pluginOutputSlots.size();
+            _maxFrameCount = std::min(_maxFrameCount, node.plugin->getBlockSize());
+
+            // A new graph starts with every plugin awake
+            step.tailFrames = node.plugin->getTailFrames();
+        }
+        else
+        {
+            outputs[id] = input;
+            channelCounts[id] = inputChannelCount;
+        }
+
+        if (step.plugin != nullptr || !step.sumSlots.empty())
+        {
+            _schedule.push_back(step);
+        }
+    }
+
+    // The output is read after the last step
+    _outputSlots = outputs[OutputNode];
+    for (auto value : _outputSlots)
+    {
+        lastRead[value] = _schedule.size();
+    }
+
+    // Values are defined in the order of the steps. Before a step the slots
+    // of the values that were read for the last time are freed, so a plugin
+    // never writes into a slot it reads.
+    std::vector<uint32_t> slots(defined.size(), SilentSlot);
+    std::vector<uint32_t> freeSlots;
+    std::vector<uint32_t> live;
+    uint32_t slotCount = 1;
+    uint32_t value = 1;
+
+    for (size_t s = 0; s < _schedule.size(); s++)
+    {
+        for (size_t i = 0; i < live.size();)
+        {
+            if (lastRead[live[i]] < s)
+            {
+                freeSlots.push_back(slots[live[i]]);
+                live[i] = live.back();
+                live.pop_back();
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        for (; value < defined.size() && defined[value] == s; value++)
+        {
+            if (freeSlots.empty())
+            {
+                slots[value] = slotCount++;
+            }
+            else
+            {
+                slots[value] = freeSlots.back();
+                freeSlots.pop_back();
+            }
+
+            live.push_back(value);
+        }
+    }
+
+    for (auto &step : _schedule)
+    {
+        for (auto *values : {&step.sumSlots, &step.pluginInputSlots, &step.pluginOutputSlots})
+        {
+            for (auto &v : *values)
+            {
+                v = slots[v];
+            }
+        }
+
+        for (auto &sum : step.sums)
+        {
+            sum.first = slots[sum.first];
+            sum.second = slots[sum.second];
+        }
+    }
+
+    for (auto &v : _outputSlots)
+    {
+        v = slots[v];
+    }
+
+    _outputChannels.resize(_outputSlots.size());
+    _silentSlots.assign(slotCount, 0);
+    _slotCount = slotCount;
+    _compiled = true;
+
+    auto largest = s_largestScratchSize.load();
+    while (largest < ScratchSize() && !s_largestScratchSize.compare_exchange_weak(largest, ScratchSize()))
+    {
+    }
+
+    return true;
+}
+
+bool ProcessingGraph::IsCompiled() const
+{
+    return _compiled;
+}
+
+size_t ProcessingGraph::MaxFrameCount() const
+{
+    return _maxFrameCount;
+}
+
+size_t ProcessingGraph::ScratchSize() const
+{
+    return _slotCount * _maxFrameCount;
+}
+
+size_t ProcessingGraph::LargestScratchSize()
+{
+    return s_largestScratchSize.load();
+}
+
+const float *const *ProcessingGraph::Process(
+    float *scratch,
+    size_t frameCount,
+    uint32_t &channelCount,
+    AudioTelemetry *telemetry)
+{
+    channelCount = 0;
+
+    if (!_compiled)
+    {
+        return nullptr;
+    }
+
+    frameCount = std::min(frameCount, _maxFrameCount);
+
+    auto slot = [&](uint32_t index) {
+        return scratch + size_t(index) * _maxFrameCount;
+    };
+
+    // The scratch buffer is shared, so the silence is not left to chance
+    DspKernels::Clear(slot(SilentSlot), frameCount);
+    _silentSlots[SilentSlot] = 1;
+
+    for (auto &step : _schedule)
+    {
+        // Silence added up is silence
+        bool sumSilent = true;
+        for (auto &sum : step.sums)
+        {
+            sumSilent = sumSilent && _silentSlots[sum.first] != 0;
+        }
+
+        for (auto sumSlot : step.sumSlots)
+        {
+            DspKernels::Clear(slot(sumSlot), frameCount);
+            _silentSlots[sumSlot] = sumSilent ? 1 : 0;
+        }
+
+        for (auto &sum : step.sums)
+        {
+            DspKernels::Accumulate(slot(sum.second), slot(sum.first), frameCount, step.gain);
+        }
+
+        if (step.plugin == nullptr)
+        {
+            continue;
+        }
+
+        bool inputSilent = true;
+        for (size_t c = 0; c < step.pluginInputs.size(); c++)
+        {
+            step.pluginInputs[c] = slot(step.pluginInputSlots[c]);
+            inputSilent = inputSilent && _silentSlots[step.pluginInputSlots[c]] != 0;
+        }
+
+        for (size_t c = 0; c < step.pluginOutputs.size(); c++)
+        {
+            step.pluginOutputs[c] = slot(step.pluginOutputSlots[c]);
+        }
+
+        if (!WakeOrSleep(step, inputSilent, frameCount, scratch))
+        {
+            continue;
+        }
+
+        auto startNs = telemetry != nullptr ? telemetry->Now() : 0;
+
+        // The frame count is not more than the block size of any plugin, so
+        // every plugin processes all of it
+        step.plugin->processAudio(step.pluginInputs.data(), step.pluginOutputs.data(), frameCount);
+
+        if (telemetry != nullptr)
+        {
+            telemetry->RecordPlugin(step.plugin, startNs, telemetry->Now());
+        }
+
+        bool outputSilent = true;
+        for (size_t c = 0; c < step.pluginOutputs.size(); c++)
+        {
+            auto silent = DspKernels::Peak(step.pluginOutputs[c], frameCount) < SilenceThreshold;
+            _silentSlots[step.pluginOutputSlots[c]] = silent ? 1 : 0;
+            outputSilent = outputSilent && silent;
+        }
+
+        UpdateSleep(step, inputSilent, outputSilent, frameCount);
+    }
+
+    if (_outputSlots.empty())
+    {
+        return nullptr;
+    }
+
+    for (size_t c = 0; c < _outputSlots.size(); c++)
+    {
+        _outputChannels[c] = slot(_outputSlots[c]);
+    }
+
+    channelCount = uint32_t(_outputSlots.size());
+
+    return _outputChannels.data();
+}
+
+bool ProcessingGraph::WakeOrSleep(
+    Step &step,
+    bool inputSilent,
+    size_t frameCount,
+    float *scratch)
+{
+    if (!step.sleeping)
+    {
+        return true;
+    }
+
+    // processEvents() ran before the graph, so midi for this block is pending
+    if (!inputSilent || step.plugin->hasPendingMidiEvents() || !step.plugin->isSleepAllowed())
+    {
+        step.sleeping = false;
+        step.silentFrames = 0;
+
+        return true;
+    }
+
+    for (auto outputSlot : step.pluginOutputSlots)
+    {
+        DspKernels::Clear(scratch + size_t(outputSlot) * _maxFrameCount, frameCount);
+        _silentSlots[outputSlot] = 1;
+    }
+
+    step.plugin->skipAudio(frameCount);
+
+    return false;
+}
+
+void ProcessingGraph::UpdateSleep(
+    Step &step,
+    bool inputSilent,
+    bool outputSilent,
+    size_t frameCount)
+{
+    if (!inputSilent || !outputSilent || step.plugin->hasPendingMidiEvents())
+    {
+        step.silentFrames = 0;
+
+        return;
+    }
+
+    // The tail is counted from the block where everything went silent, a
+    // tail that is still sounding below the threshold is not cut off before
+    // the plugin says it ends
+    step.silentFrames += frameCount;
+
+    if (step.silentFrames > step.tailFrames && step.plugin->isSleepAllowed())
+    {
+        step.sleeping = true;
+    }
+}
+
+std::unique_ptr<ProcessingGraph> ProcessingGraph::CreateChain(
+    const std::shared_ptr<VstPlugin> &instrument,
+    const std::vector<std::shared_ptr<VstPlugin>> &effects)
+{
+    auto graph = std::make_unique<ProcessingGraph>();
+
+    if (instrument != nullptr)
+    {
+        auto last = graph->AddPlugin(instrument);
+
+        for (auto &effect : effects)
+        {
+            if (effect == nullptr)
+            {
+                continue;
+            }
+
+            auto node = graph->AddPlugin(effect);
+            graph->Connect(last, node);
+            last = node;
+        }
+
+        graph->Connect(last, OutputNode);
+    }
+
+    graph->Compile();
+
+    return graph;
+}
+
+#ifdef TEST_YOUR_CODE
+#include <cmath>
+#include <iostream>
+
+static int _processedBlockCount = 0;
+static float _testLevel = 1.0f;
+
+static VstIntPtr TestEffectDispatcher(
+    AEffect *effect,
+    VstInt32 opcode,
+    VstInt32 index,
+    VstIntPtr value,
+    void *ptr,
+    float opt)
+{
+    (void)index;
+    (void)value;
+    (void)ptr;
+    (void)opt;
+
+    if (opcode == effClose)
+    {
+        delete effect;
+    }
+
+    if (opcode == effGetTailSize)
+    {
+        return 128;
+    }
+
+    return 0;
+}
+
+// Writes 1.0 on the left and 2.0 on the right
+static void ConstantProcessReplacing(
+    AEffect *effect,
+    float **inputs,
+    float **outputs,
+    VstInt32 sampleFrames)
+{
+    (void)effect;
+    (void)inputs;
+
+    for (VstInt32 i = 0; i < sampleFrames; i++)
+    {
+        outputs[0][i] = 1.0f;
+        outputs[1][i] = 2.0f;
+    }
+
+    _processedBlockCount++;
+}
+
+// Writes the test level on both sides
+static void LevelProcessReplacing(
+    AEffect *effect,
+    float **inputs,
+    float **outputs,
+    VstInt32 sampleFrames)
+{
+    (void)effect;
+    (void)inputs;
+
+    for (VstInt32 i = 0; i < sampleFrames; i++)
+    {
+        outputs[0][i] = outputs[1][i] = _testLevel;
+    }
+
+    _processedBlockCount++;
+}
+
+static void HalfProcessReplacing(
+    AEffect *effect,
+    float **inputs,
+    float **outputs,
+    VstInt32 sampleFrames)
+{
+    (void)effect;
+
+    for (int c = 0; c < 2; c++)
+    {
+        for (VstInt32 i = 0; i < sampleFrames; i++)
+        {
+            outputs[c][i] = inputs[c][i] * 0.5f;
+        }
+    }
+
+    _processedBlockCount++;
+}
+
+static AEffect *CreateTestEffect(
+    int inputCount,
+    void (*processReplacing)(AEffect *, float **, float **, VstInt32))
+{
+    auto effect = new AEffect();
+    effect->magic = kEffectMagic;
+    effect->dispatcher = TestEffectDispatcher;
+    effect->processReplacing = processReplacing;
+    effect->numInputs = inputCount;
+    effect->numOutputs = 2;
+
+    return effect;
+}
+
+static AEffect *ConstantMain(
+    audioMasterCallback callback)
+{
+    (void)callback;
+
+    return CreateTestEffect(0, ConstantProcessReplacing);
+}
+
+static AEffect *LevelMain(
+    audioMasterCallback callback)
+{
+    (void)callback;
+
+    return CreateTestEffect(0, LevelProcessReplacing);
+}
+
+static AEffect *HalfMain(
+    audioMasterCallback callback)
+{
+    (void)callback;
+
+    return CreateTestEffect(2, HalfProcessReplacing);
+}
+
+static std::shared_ptr<VstPlugin> CreateTestPlugin(
+    VstPlugin::VstEntryProc *entryProc)
+{
+    auto plugin = std::make_shared<VstPlugin>();
+    plugin->init(entryProc, "test:Effect");
+
+    return plugin;
+}
+
+static bool ExpectOutput(
+    ProcessingGraph &graph,
+    std::vector<float> &scratch,
+    const char *name,
+    float left,
+    float right)
+{
+    if (scratch.size() < graph.ScratchSize())
+    {
+        scratch.resize(graph.ScratchSize());
+    }
+
+    uint32_t channelCount = 0;
+    auto output = graph.Process(scratch.data(), 64, channelCount);
+
+    if (output == nullptr || channelCount != 2)
+    {
+        std::cout << "ProcessingGraph " << name << " has " << channelCount << " output channels, expected 2" << std::endl;
+
+        return false;
+    }
+
+    if (std::fabs(output[0][63] - left) > 1e-6f || std::fabs(output[1][63] - right) > 1e-6f)
+    {
+        std::cout << "ProcessingGraph " << name << " output " << output[0][63] << ", " << output[1][63] << ", expected " << left << ", " << right << std::endl;
+
+        return false;
+    }
+
+    return true;
+}
+
+void ProcessingGraph::Tests()
+{
+    auto constant = CreateTestPlugin(ConstantMain);
+    auto half = CreateTestPlugin(HalfMain);
+    auto otherHalf = CreateTestPlugin(HalfMain);
+
+    // More effects than there used to be slots for
+    std::vector<std::shared_ptr<VstPlugin>> effects = {half, nullptr, otherHalf};
+    for (int i = 0; i < 4; i++)
+    {
+        effects.push_back(CreateTestPlugin(HalfMain));
+    }
+
+    // Every graph below shares this scratch buffer, like the tracks that
+    // render on one thread
+    std::vector<float> scratch;
+
+    auto chain = CreateChain(constant, effects);
+    ExpectOutput(*chain, scratch, "chain", 1.0f / 64.0f, 2.0f / 64.0f);
+
+    if (chain->MaxFrameCount() != constant->getBlockSize())
+    {
+        std::cout << "ProcessingGraph takes " << chain->MaxFrameCount() << " frames at once, expected the block size" << std::endl;
+    }
+
+    // Silence and the channels of two plugins, however long the chain is
+    if (chain->ScratchSize() != 5 * chain->MaxFrameCount())
+    {
+        std::cout << "ProcessingGraph needs " << chain->ScratchSize() / chain->MaxFrameCount() << " scratch channels for a chain, expected 5" << std::endl;
+    }
+
+    // The instrument is split into a dry path and a send, and summed again
+    ProcessingGraph graph;
+    auto source = graph.AddPlugin(constant);
+    auto splitter = graph.AddSplitter();
+    auto effect = graph.AddPlugin(half);
+    auto send = graph.AddSend(0.25f);
+    auto summer = graph.AddSummer();
+    auto unused = graph.AddPlugin(otherHalf);
+
+    graph.Connect(source, splitter);
+    graph.Connect(splitter, effect);
+    graph.Connect(splitter, send);
+    graph.Connect(effect, summer);
+    graph.Connect(send, summer);
+    graph.Connect(source, unused);
+    graph.Connect(summer, OutputNode);
+
+    if (graph.Connect(summer, OutputNode) || graph.Connect(OutputNode, effect))
+    {
+        std::cout << "ProcessingGraph connected the same nodes twice, or the output to a node" << std::endl;
+    }
+
+    if (!graph.Compile())
+    {
+        std::cout << "ProcessingGraph failed to compile a graph without cycles" << std::endl;
+    }
+
+    _processedBlockCount = 0;
+    ExpectOutput(graph, scratch, "with a send", 0.5f + 0.25f, 1.0f + 0.5f);
+
+    // The plugin that is not connected to the output does not run
+    if (_processedBlockCount != 2)
+    {
+        std::cout << "ProcessingGraph processed " << _processedBlockCount << " plugins, expected 2" << std::endl;
+    }
+
+    // The sum of the send reuses the channels of the instrument, which are
+    // no longer read by then
+    if (graph.ScratchSize() != 7 * graph.MaxFrameCount())
+    {
+        std::cout << "ProcessingGraph needs " << graph.ScratchSize() / graph.MaxFrameCount() << " scratch channels with a send, expected 7" << std::endl;
+    }
+
+    // The other graph left its channels in the scratch buffer
+    ExpectOutput(*chain, scratch, "chain after another graph", 1.0f / 64.0f, 2.0f / 64.0f);
+
+    // A cycle is refused and nothing is processed
+    graph.Connect(summer, splitter);
+
+    if (graph.Compile() || graph.IsCompiled())
+    {
+        std::cout << "ProcessingGraph compiled a graph with a cycle" << std::endl;
+    }
+
+    uint32_t channelCount = 0;
+    if (graph.Process(scratch.data(), 64, channelCount) != nullptr || channelCount != 0)
+    {
+        std::cout << "ProcessingGraph processed a graph with a cycle" << std::endl;
+    }
+
+    // Without an instrument there is nothing to hear
+    auto empty = CreateChain(nullptr, effects);
+    if (empty->Process(scratch.data(), 64, channelCount) != nullptr)
+    {
+        std::cout << "ProcessingGraph has output without an instrument" << std::endl;
+    }
+
+    // A silent instrument and its effect sleep once their tail of 128 frames
+    // has passed
+    _testLevel = 0.0f;
+    auto level = CreateTestPlugin(LevelMain);
+    auto sleeping = CreateChain(level, {CreateTestPlugin(HalfMain)});
+
+    for (int i = 0; i < 3; i++)
+    {
+        ExpectOutput(*sleeping, scratch, "going to sleep", 0.0f, 0.0f);
+    }
+
+    _processedBlockCount = 0;
+    ExpectOutput(*sleeping, scratch, "asleep", 0.0f, 0.0f);
+
+    if (_processedBlockCount != 0 || level->getSamplePos() != 4 * 64)
+    {
+        std::cout << "ProcessingGraph processed " << _processedBlockCount << " sleeping plugins, at " << level->getSamplePos() << std::endl;
+    }
+
+    // Midi wakes the instrument, and its output the effect
+    _testLevel = 1.0f;
+    level->sendMidiNote(0, 60, true, 100);
+    level->processEvents();
+    ExpectOutput(*sleeping, scratch, "woken by midi", 0.5f, 0.5f);
+
+    // An instrument that may not sleep keeps running in silence, the effect
+    // after it still sleeps
+    _testLevel = 0.0f;
+    level->setSleepAllowed(false);
+
+    for (int i = 0; i < 3; i++)
+    {
+        ExpectOutput(*sleeping, scratch, "not allowed to sleep", 0.0f, 0.0f);
+    }
+
+    _processedBlockCount = 0;
+    ExpectOutput(*sleeping, scratch, "not allowed to sleep", 0.0f, 0.0f);
+
+    if (_processedBlockCount != 1)
+    {
+        std::cout << "ProcessingGraph processed " << _processedBlockCount << " plugins where one may not sleep, expected 1" << std::endl;
+    }
+}
+#endif
@@ -1,5 +1,7 @@
 #include "region.h"
 
+#include <iostream>
+
 const std::string &Region::GetName() const
 {
     return _name;
@@ -22,9 +24,55 @@ void Region::SetLength(
     _length = length;
 }
 
-const MidiEvent::CollectionInTime &Region::Events() const
+MidiEventsInTime Region::Events() const
+{
+    return MidiEventsInTime(_events->data(), _events->data() + _events->size());
+}
+
+static bool EventBeforeTime(
+    const TimedMidiEvent &event,
+    std::chrono::milliseconds::rep time)
+{
+    return event.time < time;
+}
+
+static bool TimeBeforeEvent(
+    std::chrono::milliseconds::rep time,
+    const TimedMidiEvent &event)
+{
+    return time < event.time;
+}
+
+MidiEventsInTime Region::EventsInRange(
+    std::chrono::milliseconds::rep start,
+    std::chrono::milliseconds::rep end) const
+{
+    const auto &events = *_events;
+
+    auto first = std::lower_bound(events.begin(), events.end(), start, EventBeforeTime);
+    auto last = std::lower_bound(first, events.end(), end, EventBeforeTime);
+
+    return MidiEventsInTime(events.data() + (first - events.begin()), events.data() + (last - events.begin()));
+}
+
+const TimedMidiEvent::Collection &Region::SortedEvents() const
 {
-    return _events;
+    return *_events;
+}
+
+TimedMidiEvent::Collection &Region::MutableEvents()
+{
+    if (_events.use_count() > 1)
+    {
+        _events = std::make_shared<TimedMidiEvent::Collection>(*_events);
+    }
+
+    return *_events;
+}
+
+bool Region::SharesEvents() const
+{
+    return _events.use_count() > 1;
 }
 
 uint32_t Region::GetMinNote() const
@@ -43,53 +91,120 @@ void Region::AddEvent(
     bool onOff,
     int velocity)
 {
-    if (noteNumber < _minNote)
-    {
-        _minNote = noteNumber;
-    }
-    if (noteNumber > _maxNote)
-    {
-        _maxNote = noteNumber;
-    }
-
     MidiEvent event;
     event.num = noteNumber;
     event.type = MidiEventTypes::M_NOTE;
     event.value = onOff ? velocity : 0;
     event.channel = 0;
 
-    if (_events.find(time) == _events.end())
+    AddEvent(TimedMidiEvent(time, event));
+}
+
+void Region::AddEvent(
+    const TimedMidiEvent &event)
+{
+    if (event.num < _minNote)
     {
-        _events.insert(std::make_pair(time, std::vector<MidiEvent>{event}));
+        _minNote = event.num;
     }
-    else
+    if (event.num > _maxNote)
     {
-        _events[time].push_back(event);
+        _maxNote = event.num;
     }
 
-    UpdateLength(time);
+    // The given event can be one of ours, copy it before inserting
+    auto added = event;
+
+    InsertEvent(added);
+
+    UpdateLength(added.time);
 }
 
 void Region::RemoveEvent(
     std::chrono::milliseconds::rep time,
     uint32_t noteNumber)
 {
-    if (_events.find(time) == _events.end())
+    auto found = FindEvent(
+        time,
+        [noteNumber](const MidiEvent &e) {
+            return e.num == noteNumber;
+        });
+
+    if (found == _events->size())
     {
         return;
     }
 
-    auto found = find_if(
-        _events[time].begin(),
-        _events[time].end(),
+    auto &events = MutableEvents();
+
+    events.erase(events.begin() + std::ptrdiff_t(found));
+}
+
+void Region::RemoveEvent(
+    const TimedMidiEvent &event)
+{
+    auto found = FindEvent(
+        event.time,
+        [&event](const MidiEvent &e) {
+            return e.channel == event.channel && e.num == event.num && e.type == event.type && e.value == event.value;
+        });
+
+    if (found == _events->size())
+    {
+        return;
+    }
+
+    auto &events = MutableEvents();
+
+    events.erase(events.begin() + std::ptrdiff_t(found));
+}
+
+bool Region::FindNote(
+    std::chrono::milliseconds::rep start,
+    std::chrono::milliseconds::rep length,
+    uint32_t noteNumber,
+    TimedMidiEvent &noteOn,
+    TimedMidiEvent &noteOff) const
+{
+    auto on = FindEvent(
+        start,
         [noteNumber](const MidiEvent &e) {
-            return e.num == noteNumber;
+            return e.type == MidiEventTypes::M_NOTE && e.num == noteNumber && e.value != 0;
+        });
+
+    if (on == _events->size())
+    {
+        return false;
+    }
+
+    auto channel = (*_events)[on].channel;
+
+    auto off = FindEvent(
+        start + length,
+        [noteNumber, channel](const MidiEvent &e) {
+            return e.type == MidiEventTypes::M_NOTE && e.num == noteNumber && e.value == 0 && e.channel == channel;
         });
 
-    if (found != _events[time].end())
+    // The notes are paired on their number only, the note off can be on
+    // another channel
+    if (off == _events->size())
+    {
+        off = FindEvent(
+            start + length,
+            [noteNumber](const MidiEvent &e) {
+                return e.type == MidiEventTypes::M_NOTE && e.num == noteNumber && e.value == 0;
+            });
+    }
+
+    if (off == _events->size())
     {
-        _events[time].erase(found);
+        return false;
     }
+
+    noteOn = (*_events)[on];
+    noteOff = (*_events)[off];
+
+    return true;
 }
 
 void Region::MoveEvent(
@@ -97,28 +212,93 @@ void Region::MoveEvent(
     std::chrono::milliseconds::rep from,
     std::chrono::milliseconds::rep to)
 {
-    if (_events.find(from) == _events.end())
-    {
-        return;
-    }
-
-    auto found = find_if(
-        _events[from].begin(),
-        _events[from].end(),
+    auto found = FindEvent(
+        from,
         [e](const MidiEvent &ee) {
             return e.channel == ee.channel && e.num == ee.num && e.type == ee.type && e.value == ee.value;
         });
 
-    if (found != _events[from].end())
+    if (found == _events->size())
     {
-        _events[from].erase(found);
+        return;
     }
 
-    _events[to].push_back(e);
+    // The given event can be one of ours, copy it before erasing
+    auto moved = TimedMidiEvent(to, (*_events)[found]);
+
+    auto &events = MutableEvents();
+
+    events.erase(events.begin() + std::ptrdiff_t(found));
+
+    InsertEvent(moved);
 
     UpdateLength(to);
 }
 
+void Region::SetEvents(
+    TimedMidiEvent::Collection events)
+{
+    auto byTime = [](const TimedMidiEvent &a, const TimedMidiEvent &b) { return a.time < b.time; };
+
+    if (!std::is_sorted(events.begin(), events.end(), byTime))
+    {
+        std::stable_sort(events.begin(), events.end(), byTime);
+    }
+
+    _minNote = (std::numeric_limits<uint32_t>::max)();
+    _maxNote = 0;
+
+    for (auto &e : events)
+    {
+        _minNote = std::min(_minNote, e.num);
+        _maxNote = std::max(_maxNote, e.num);
+    }
+
+    if (!events.empty())
+    {
+        UpdateLength(events.back().time);
+    }
+
+    _events = std::make_shared<TimedMidiEvent::Collection>(std::move(events));
+}
+
+void Region::InsertEvent(
+    const TimedMidiEvent &event)
+{
+    auto &events = MutableEvents();
+
+    // Recording and loading add events in order, which makes this an append
+    if (events.empty() || events.back().time <= event.time)
+    {
+        events.push_back(event);
+
+        return;
+    }
+
+    auto pos = std::upper_bound(events.begin(), events.end(), event.time, TimeBeforeEvent);
+
+    events.insert(pos, event);
+}
+
+size_t Region::FindEvent(
+    std::chrono::milliseconds::rep time,
+    const std::function<bool(const MidiEvent &)> &match) const
+{
+    const auto &events = *_events;
+
+    auto first = std::lower_bound(events.begin(), events.end(), time, EventBeforeTime);
+
+    for (auto it = first; it != events.end() && it->time == time; ++it)
+    {
+        if (match(*it))
+        {
+            return size_t(it - events.begin());
+        }
+    }
+
+    return events.size();
+}
+
 void Region::UpdateLength(
     std::chrono::milliseconds::rep time)
 {
@@ -128,3 +308,61 @@ void Region::UpdateLength(
         _length = requiredLength;
     }
 }
+
+#ifdef TEST_YOUR_CODE
+void Region::Tests()
+{
+    auto sut = Region();
+    sut.AddEvent(2000, 62, true, 100);
+    sut.AddEvent(0, 60, true, 100);
+    sut.AddEvent(2000, 64, true, 100);
+    sut.AddEvent(1000, 60, false, 0);
+    sut.AddEvent(3000, 62, false, 0);
+    sut.MoveEvent(sut.SortedEvents()[1], 1000, 2000);
+    sut.RemoveEvent(3000, 62);
+
+    std::vector<std::chrono::milliseconds::rep> times;
+    std::vector<uint32_t> notes;
+    for (const auto &t : sut.Events())
+    {
+        times.push_back(t.first);
+        for (const auto &e : t.second)
+        {
+            notes.push_back(e.num);
+        }
+    }
+
+    if (times != std::vector<std::chrono::milliseconds::rep>{0, 2000} || notes != std::vector<uint32_t>{60, 62, 64, 60})
+    {
+        std::cout << "Region events are not grouped and sorted on time" << std::endl;
+    }
+
+    auto count = 0;
+    for (const auto &t : sut.EventsInRange(1, 2001))
+    {
+        count += int(t.second.size());
+    }
+
+    if (count != 3)
+    {
+        std::cout << "Region::EventsInRange(1, 2001) has " << count << " events, expected 3" << std::endl;
+    }
+
+    // Copies share the events until one of them really changes them
+    auto copy = sut;
+    copy.RemoveEvent(500, 60);
+    copy.MoveEvent(sut.SortedEvents()[0], 500, 1000);
+
+    if (&copy.SortedEvents() != &sut.SortedEvents())
+    {
+        std::cout << "Region copied its events without changing them" << std::endl;
+    }
+
+    copy.RemoveEvent(0, 60);
+
+    if (&copy.SortedEvents() == &sut.SortedEvents() || sut.SortedEvents().size() != copy.SortedEvents().size() + 1)
+    {
+        std::cout << "Region changed events it shares with a copy" << std::endl;
+    }
+}
+#endif
@@ -0,0 +1,373 @@
+#include "regiontree.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+// The priorities only have to look random, a hash of the start keeps them
+// the same for the same region in every copy of the tree
+static uint64_t Priority(
+    std::chrono::milliseconds::rep start)
+{
+    auto x = uint64_t(start) + 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+
+    return x ^ (x >> 31);
+}
+
+RegionTree::RegionTree(
+    const std::map<std::chrono::milliseconds::rep, Region> &regions)
+{
+    // Every region is added on the right of the tree, the nodes on the right
+    // edge with a lower priority move into its left subtree
+    std::vector<std::shared_ptr<Node>> rightEdge;
+
+    for (auto &region : regions)
+    {
+        auto node = MakeNode(region.first, region.second);
+
+        std::shared_ptr<Node> left;
+        while (!rightEdge.empty() && rightEdge.back()->priority < node->priority)
+        {
+            left = rightEdge.back();
+            rightEdge.pop_back();
+
+            // Its right subtree is complete once it leaves the edge
+            Update(*left);
+        }
+
+        node->left = left;
+
+        if (!rightEdge.empty())
+        {
+            rightEdge.back()->right = node;
+        }
+
+        rightEdge.push_back(node);
+    }
+
+    while (!rightEdge.empty())
+    {
+        _root = rightEdge.back();
+        rightEdge.pop_back();
+
+        Update(*_root);
+    }
+}
+
+RegionTree::const_iterator RegionTree::begin() const
+{
+    auto node = _root.get();
+
+    while (node != nullptr && node->left != nullptr)
+    {
+        node = node->left.get();
+    }
+
+    return const_iterator(_root.get(), node);
+}
+
+RegionTree::const_iterator RegionTree::find(
+    std::chrono::milliseconds::rep start) const
+{
+    auto node = _root.get();
+
+    while (node != nullptr && node->value.first != start)
+    {
+        node = start < node->value.first ? node->left.get() : node->right.get();
+    }
+
+    return const_iterator(_root.get(), node);
+}
+
+const Region &RegionTree::at(
+    std::chrono::milliseconds::rep start) const
+{
+    auto found = find(start);
+
+    if (found == end())
+    {
+        throw std::out_of_range("no region starts there");
+    }
+
+    return found->second;
+}
+
+bool RegionTree::Insert(
+    std::chrono::milliseconds::rep start,
+    const Region &region)
+{
+    if (find(start) != end())
+    {
+        return false;
+    }
+
+    _root = Insert(_root, MakeNode(start, region));
+
+    return true;
+}
+
+bool RegionTree::Erase(
+    std::chrono::milliseconds::rep start)
+{
+    if (find(start) == end())
+    {
+        return false;
+    }
+
+    _root = Erase(_root, start);
+
+    return true;
+}
+
+bool RegionTree::Edit(
+    std::chrono::milliseconds::rep start,
+    const std::function<void(Region &)> &func)
+{
+    if (find(start) == end())
+    {
+        return false;
+    }
+
+    _root = Edit(_root, start, func);
+
+    return true;
+}
+
+const RegionTree::Node *RegionTree::Next(
+    const Node *root,
+    std::chrono::milliseconds::rep start)
+{
+    const Node *result = nullptr;
+
+    for (auto node = root; node != nullptr;)
+    {
+        if (start < node->value.first)
+        {
+            result = node;
+            node = node->left.get();
+        }
+        else
+        {
+            node = node->right.get();
+        }
+    }
+
+    return result;
+}
+
+const RegionTree::Node *RegionTree::Previous(
+    const Node *root,
+    std::chrono::milliseconds::rep start)
+{
+    const Node *result = nullptr;
+
+    for (auto node = root; node != nullptr;)
+    {
+        if (node->value.first < start)
+        {
+            result = node;
+            node = node->right.get();
+        }
+        else
+        {
+            node = node->left.get();
+        }
+    }
+
+    return result;
+}
+
+const RegionTree::Node *RegionTree::Last(
+    const Node *root)
+{
+    auto node = root;
+
+    while (node != nullptr && node->right != nullptr)
+    {
+        node = node->right.get();
+    }
+
+    return node;
+}
+
+std::shared_ptr<RegionTree::Node> RegionTree::MakeNode(
+    std::chrono::milliseconds::rep start,
+    const Region &region)
+{
+    auto node = std::make_shared<Node>(Node{value_type(start, region), 0, 0, 0, Priority(start), nullptr, nullptr});
+
+    Update(*node);
+
+    return node;
+}
+
+std::shared_ptr<RegionTree::Node> RegionTree::CopyNode(
+    const std::shared_ptr<Node> &node)
+{
+    return std::make_shared<Node>(*node);
+}
+
+void RegionTree::Update(
+    Node &node)
+{
+    node.end = node.value.first + node.value.second.Length();
+    node.maxEnd = node.end;
+    node.size = 1;
+
+    if (node.left != nullptr)
+    {
+        node.maxEnd = std::max(node.maxEnd, node.left->maxEnd);
+        node.size += node.left->size;
+    }
+
+    if (node.right != nullptr)
+    {
+        node.maxEnd = std::max(node.maxEnd, node.right->maxEnd);
+        node.size += node.right->size;
+    }
+}
+
+void RegionTree::Split(
+    const std::shared_ptr<Node> &node,
+    std::chrono::milliseconds::rep start,
+    std::shared_ptr<Node> &before,
+    std::shared_ptr<Node> &after)
+{
+    if (node == nullptr)
+    {
+        before = nullptr;
+        after = nullptr;
+
+        return;
+    }
+
+    auto copy = CopyNode(node);
+
+    if (node->value.first < start)
+    {
+        Split(node->right, start, copy->right, after);
+        before = copy;
+    }
+    else
+    {
+        Split(node->left, start, before, copy->left);
+        after = copy;
+    }
+
+    Update(*copy);
+}
+
+std::shared_ptr<RegionTree::Node> RegionTree::Merge(
+    const std::shared_ptr<Node> &before,
+    const std::shared_ptr<Node> &after)
+{
+    if (before == nullptr)
+    {
+        return after;
+    }
+
+    if (after == nullptr)
+    {
+        return before;
+    }
+
+    if (before->priority > after->priority)
+    {
+        auto copy = CopyNode(before);
+        copy->right = Merge(before->right, after);
+        Update(*copy);
+
+        return copy;
+    }
+
+    auto copy = CopyNode(after);
+    copy->left = Merge(before, after->left);
+    Update(*copy);
+
+    return copy;
+}
+
+std::shared_ptr<RegionTree::Node> RegionTree::Insert(
+    const std::shared_ptr<Node> &node,
+    const std::shared_ptr<Node> &added)
+{
+    if (node == nullptr)
+    {
+        return added;
+    }
+
+    if (added->priority > node->priority)
+    {
+        Split(node, added->value.first, added->left, added->right);
+        Update(*added);
+
+        return added;
+    }
+
+    auto copy = CopyNode(node);
+
+    if (added->value.first < node->value.first)
+    {
+        copy->left = Insert(node->left, added);
+    }
+    else
+    {
+        copy->right = Insert(node->right, added);
+    }
+
+    Update(*copy);
+
+    return copy;
+}
+
+std::shared_ptr<RegionTree::Node> RegionTree::Erase(
+    const std::shared_ptr<Node> &node,
+    std::chrono::milliseconds::rep start)
+{
+    if (start == node->value.first)
+    {
+        return Merge(node->left, node->right);
+    }
+
+    auto copy = CopyNode(node);
+
+    if (start < node->value.first)
+    {
+        copy->left = Erase(node->left, start);
+    }
+    else
+    {
+        copy->right = Erase(node->right, start);
+    }
+
+    Update(*copy);
+
+    return copy;
+}
+
+std::shared_ptr<RegionTree::Node> RegionTree::Edit(
+    const std::shared_ptr<Node> &node,
+    std::chrono::milliseconds::rep start,
+    const std::function<void(Region &)> &func)
+{
+    auto copy = CopyNode(node);
+
+    if (start < node->value.first)
+    {
+        copy->left = Edit(node->left, start, func);
+    }
+    else if (node->value.first < start)
+    {
+        copy->right = Edit(node->right, start, func);
+    }
+    else
+    {
+        func(copy->value.second);
+    }
+
+    Update(*copy);
+
+    return copy;
+}
@@ -0,0 +1,126 @@
+#include "songsnapshot.h"
+
+static std::unique_ptr<PluginSnapshot> TakePluginSnapshot(
+    const std::shared_ptr<VstPlugin> &plugin)
+{
+    if (plugin == nullptr)
+    {
+        return nullptr;
+    }
+
+    auto result = std::make_unique<PluginSnapshot>();
+    result->modulePath = plugin->ModulePath();
+    result->sleepAllowed = plugin->isSleepAllowed();
+    result->plugin = plugin;
+
+    return result;
+}
+
+static void CapturePluginChunk(
+    PluginSnapshot &snapshot)
+{
+    void *chunk = nullptr;
+    auto length = snapshot.plugin->dispatcher(effGetChunk, 0, 0, &chunk, 0.0f);
+
+    if (chunk != nullptr && length > 0)
+    {
+        auto bytes = reinterpret_cast<const uint8_t *>(chunk);
+        snapshot.chunk.assign(bytes, bytes + length);
+    }
+
+    snapshot.plugin = nullptr;
+}
+
+std::unique_ptr<SongSnapshot> SongSnapshot::Take(
+    ITracksManager *tracksManager,
+    WorkerPool *workerPool)
+{
+    auto result = TakeWithoutChunks(tracksManager);
+
+    result->CaptureChunks(workerPool);
+
+    return result;
+}
+
+std::unique_ptr<SongSnapshot> SongSnapshot::TakeWithoutChunks(
+    ITracksManager *tracksManager)
+{
+    auto result = std::make_unique<SongSnapshot>();
+
+    result->buses = tracksManager->GetBuses();
+    result->masterBus = tracksManager->GetMasterBus();
+
+    auto &tracks = tracksManager->GetTracks();
+    result->tracks.reserve(tracks.size());
+
+    for (auto &track : tracks)
+    {
+        result->tracks.push_back(TrackSnapshot{track});
+
+        auto &snapshot = result->tracks.back();
+
+        auto instrument = track.GetInstrument();
+        if (instrument == nullptr)
+        {
+            continue;
+        }
+
+        snapshot.hasInstrument = true;
+        snapshot.instrumentName = instrument->Name();
+        snapshot.midiChannel = instrument->MidiChannel();
+
+        snapshot.effectPlugins.resize(size_t(instrument->EffectPluginCount()));
+        for (size_t e = 0; e < snapshot.effectPlugins.size(); e++)
+        {
+            snapshot.effectPlugins[e] = TakePluginSnapshot(instrument->EffectPlugin(int(e)));
+        }
+
+        // Only the pointer is read under the lock, the audio thread renders
+        // with the same lock and must not wait for the chunk
+        instrument->Lock();
+        auto plugin = instrument->InstrumentPlugin();
+        instrument->Unlock();
+
+        snapshot.instrumentPlugin = TakePluginSnapshot(plugin);
+    }
+
+    return result;
+}
+
+void SongSnapshot::CaptureChunks(
+    WorkerPool *workerPool)
+{
+    std::vector<PluginSnapshot *> plugins;
+
+    for (auto &track : tracks)
+    {
+        for (auto &effectPlugin : track.effectPlugins)
+        {
+            if (effectPlugin != nullptr && effectPlugin->plugin != nullptr)
+            {
+                plugins.push_back(effectPlugin.get());
+            }
+        }
+
+        if (track.instrumentPlugin != nullptr && track.instrumentPlugin->plugin != nullptr)
+        {
+            plugins.push_back(track.instrumentPlugin.get());
+        }
+    }
+
+    // Plugins can take a while to serialize their state, so the chunks are
+    // asked for on a pool of threads
+    auto task = [&](size_t index) { CapturePluginChunk(*plugins[index]); };
+
+    if (workerPool == nullptr)
+    {
+        for (size_t i = 0; i < plugins.size(); i++)
+        {
+            task(i);
+        }
+
+        return;
+    }
+
+    workerPool->ParallelFor(plugins.size(), task);
+}
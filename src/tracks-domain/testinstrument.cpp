@@ -0,0 +1,263 @@
+#include "testinstrument.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+const char *TestInstrument::ModuleName = "builtin:TestInstrument";
+
+namespace
+{
+    const int maxVoices = 16;
+    const int maxPendingEvents = 512;
+    const float attackSeconds = 0.005f;
+    const float releaseSeconds = 0.05f;
+    const float masterGain = 0.2f;
+
+    struct Voice
+    {
+        int note = -1;
+        bool releasing = false;
+        float velocity = 0.0f;
+        float level = 0.0f;
+        double phase = 0.0;
+        double increment = 0.0;
+    };
+
+    struct TestInstrumentEffect
+    {
+        AEffect effect; // must be the first member, the AEffect pointer is cast back to this struct
+        float sampleRate = 44100.0f;
+        Voice voices[maxVoices];
+        VstMidiEvent pendingEvents[maxPendingEvents];
+        int pendingEventCount = 0;
+    };
+
+    TestInstrumentEffect *FromEffect(
+        AEffect *effect)
+    {
+        return reinterpret_cast<TestInstrumentEffect *>(effect);
+    }
+
+    void NoteOn(
+        TestInstrumentEffect *instance,
+        int note,
+        int velocity)
+    {
+        Voice *voice = nullptr;
+        for (auto &v : instance->voices)
+        {
+            if (v.note == note || v.note < 0)
+            {
+                voice = &v;
+                break;
+            }
+        }
+
+        if (voice == nullptr)
+        {
+            // steal the quietest voice
+            voice = std::min_element(
+                std::begin(instance->voices),
+                std::end(instance->voices),
+                [](const Voice &a, const Voice &b) { return a.level < b.level; });
+        }
+
+        const double frequency = 440.0 * std::pow(2.0, (note - 69) / 12.0);
+
+        voice->note = note;
+        voice->releasing = false;
+        voice->velocity = velocity / 127.0f;
+        voice->increment = 2.0 * 3.14159265358979323846 * frequency / instance->sampleRate;
+    }
+
+    void NoteOff(
+        TestInstrumentEffect *instance,
+        int note)
+    {
+        for (auto &v : instance->voices)
+        {
+            if (v.note == note)
+            {
+                v.releasing = true;
+            }
+        }
+    }
+
+    void HandleMidiEvent(
+        TestInstrumentEffect *instance,
+        const VstMidiEvent &e)
+    {
+        const int status = e.midiData[0] & 0xf0;
+        const int note = e.midiData[1] & 0x7f;
+        const int velocity = e.midiData[2] & 0x7f;
+
+        if (status == 0x90 && velocity > 0)
+        {
+            NoteOn(instance, note, velocity);
+        }
+        else if (status == 0x80 || status == 0x90)
+        {
+            NoteOff(instance, note);
+        }
+        else if (status == 0xb0 && (note == 120 || note == 123))
+        {
+            // all sounds off/all notes off
+            for (auto &v : instance->voices)
+            {
+                v.releasing = true;
+            }
+        }
+    }
+
+    void ProcessReplacing(
+        AEffect *effect,
+        float ** /*inputs*/,
+        float **outputs,
+        VstInt32 sampleFrames)
+    {
+        auto instance = FromEffect(effect);
+        const float attackStep = 1.0f / (attackSeconds * instance->sampleRate);
+        const float releaseStep = 1.0f / (releaseSeconds * instance->sampleRate);
+
+        int nextEvent = 0;
+        for (VstInt32 frame = 0; frame < sampleFrames; ++frame)
+        {
+            while (nextEvent < instance->pendingEventCount && (instance->pendingEvents[nextEvent].deltaFrames <= frame || frame == sampleFrames - 1))
+            {
+                HandleMidiEvent(instance, instance->pendingEvents[nextEvent++]);
+            }
+
+            float sample = 0.0f;
+            for (auto &v : instance->voices)
+            {
+                if (v.note < 0)
+                {
+                    continue;
+                }
+
+                if (v.releasing)
+                {
+                    v.level -= releaseStep;
+                    if (v.level <= 0.0f)
+                    {
+                        v.level = 0.0f;
+                        v.note = -1;
+                        continue;
+                    }
+                }
+                else if (v.level < 1.0f)
+                {
+                    v.level = std::min(1.0f, v.level + attackStep);
+                }
+
+                sample += float(std::sin(v.phase)) * v.level * v.velocity;
+                v.phase = std::fmod(v.phase + v.increment, 2.0 * 3.14159265358979323846);
+            }
+
+            outputs[0][frame] = sample * masterGain;
+            outputs[1][frame] = sample * masterGain;
+        }
+
+        instance->pendingEventCount = 0;
+    }
+
+    VstIntPtr Dispatcher(
+        AEffect *effect,
+        VstInt32 opcode,
+        VstInt32 /*index*/,
+        VstIntPtr /*value*/,
+        void *ptr,
+        float opt)
+    {
+        auto instance = FromEffect(effect);
+
+        switch (opcode)
+        {
+            case effClose:
+            {
+                delete instance;
+                return 1;
+            }
+            case effSetSampleRate:
+            {
+                instance->sampleRate = opt;
+                return 1;
+            }
+            case effProcessEvents:
+            {
+                auto events = static_cast<VstEvents *>(ptr);
+                for (int i = 0; i < events->numEvents && instance->pendingEventCount < maxPendingEvents; i++)
+                {
+                    if (events->events[i]->type != kVstMidiType)
+                    {
+                        continue;
+                    }
+
+                    instance->pendingEvents[instance->pendingEventCount++] = *reinterpret_cast<VstMidiEvent *>(events->events[i]);
+                }
+
+                std::stable_sort(
+                    instance->pendingEvents,
+                    instance->pendingEvents + instance->pendingEventCount,
+                    [](const VstMidiEvent &a, const VstMidiEvent &b) { return a.deltaFrames < b.deltaFrames; });
+
+                return 1;
+            }
+            case effGetChunk:
+            {
+                *static_cast<void **>(ptr) = nullptr;
+                return 0;
+            }
+            case effGetEffectName:
+            {
+                snprintf(static_cast<char *>(ptr), kVstMaxEffectNameLen, "%s", "Test Instrument");
+                return 1;
+            }
+            case effGetVendorString:
+            {
+                snprintf(static_cast<char *>(ptr), kVstMaxVendorStrLen, "%s", "vsthost");
+                return 1;
+            }
+            case effCanDo:
+            {
+                return strcmp(static_cast<const char *>(ptr), "receiveVstMidiEvent") == 0 ? 1 : 0;
+            }
+            default:
+            {
+                return 0;
+            }
+        }
+    }
+} // namespace
+
+AEffect *TestInstrument::VSTPluginMain(
+    audioMasterCallback /*hostCallback*/)
+{
+    auto instance = new TestInstrumentEffect();
+
+    instance->effect.magic = kEffectMagic;
+    instance->effect.dispatcher = Dispatcher;
+    instance->effect.processReplacing = ProcessReplacing;
+    instance->effect.numInputs = 0;
+    instance->effect.numOutputs = 2;
+    instance->effect.flags = effFlagsIsSynth | effFlagsCanReplacing;
+    instance->effect.uniqueID = ('v' << 24) | ('h' << 16) | ('T' << 8) | 'I';
+    instance->effect.version = 1;
+    instance->effect.object = instance;
+
+    return &instance->effect;
+}
+
+std::shared_ptr<VstPlugin> TestInstrument::Create()
+{
+    auto plugin = std::make_shared<VstPlugin>();
+
+    if (!plugin->init(VSTPluginMain, ModuleName))
+    {
+        return nullptr;
+    }
+
+    return plugin;
+}
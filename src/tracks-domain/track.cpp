@@ -1,6 +1,10 @@
 #include "track.h"
 
 #include "base64.h"
+#include "hash.h"
+#include <algorithm>
+#include <iostream>
+#include <iterator>
 #include <spdlog/spdlog.h>
 
 static uint32_t s_TrackCounter = 1;
@@ -24,7 +28,7 @@ void Track::StartRecording()
 std::chrono::milliseconds::rep Track::StartNewRegion(
     std::chrono::milliseconds::rep start)
 {
-    auto tmp = GetActiveRegionAt(_regions, start, 0);
+    auto tmp = GetActiveRegionAt(start, 0);
     if (tmp != -1)
     {
         return tmp;
@@ -48,7 +52,7 @@ void Track::RecordMidiEvent(
 {
     if (_activeRegion == -1)
     {
-        _activeRegion = GetActiveRegionAt(_regions, time);
+        _activeRegion = GetActiveRegionAt(time);
     }
 
     if (_activeRegion == -1)
@@ -58,10 +62,33 @@ void Track::RecordMidiEvent(
 
         AddRegion(time - (time % 4000), region);
 
-        _activeRegion = GetActiveRegionAt(_regions, time);
+        _activeRegion = GetActiveRegionAt(time);
     }
 
-    _regions[_activeRegion].AddEvent(time - _activeRegion, noteNumber, onOff, velocity);
+    auto record = [&](Region &region) {
+        region.AddEvent(time - _activeRegion, noteNumber, onOff, velocity);
+    };
+
+    // An event is appended in place while no copy of the track, like a
+    // snapshot in the history, shares the region or its events. The audio
+    // thread reads the region, so that is done under the instrument lock.
+    if (_instrument != nullptr)
+    {
+        _instrument->Lock();
+    }
+
+    auto recorded = !GetRegion(_activeRegion).SharesEvents() && _regions.EditUnshared(_activeRegion, record);
+
+    if (_instrument != nullptr)
+    {
+        _instrument->Unlock();
+    }
+
+    // Otherwise the region is copied once, the next events go in place
+    if (!recorded)
+    {
+        EditRegion(_activeRegion, record);
+    }
 }
 
 void Track::SetName(
@@ -95,7 +122,9 @@ void Track::DownloadInstrumentSettings()
     void *getLen;
     auto length = _instrument->InstrumentPlugin()->dispatcher(effGetChunk, 0, 0, &getLen, 0.0f);
     auto data = reinterpret_cast<BYTE *>(getLen);
-    _instrumentDataBase64 = base64_encode(&data[0], length);
+    _instrumentDataBase64 = std::make_shared<const std::string>(base64_encode(&data[0], length));
+    _instrumentDataHash = fnv1a_hash(data, size_t(length));
+    _instrument->SetInstrumentChunkHash(_instrumentDataHash);
 
     _instrument->Unlock();
 }
@@ -115,10 +144,25 @@ void Track::UploadInstrumentSettings()
         return;
     }
 
-    auto data = base64_decode(_instrumentDataBase64);
+    if (_instrumentDataBase64 == nullptr)
+    {
+        _instrument->Unlock();
+        return;
+    }
+
+    // The instrument does not know the hash while the editor is open, or
+    // after it was closed, the plugin can be changed there without us knowing
+    if (_instrumentDataHash == _instrument->InstrumentChunkHash())
+    {
+        _instrument->Unlock();
+        return;
+    }
+
+    auto data = base64_decode(*_instrumentDataBase64);
 
     /* Load plugin data*/
     _instrument->InstrumentPlugin()->dispatcher(effSetChunk, 0, (VstInt32)data.size(), data.data(), 0);
+    _instrument->SetInstrumentChunkHash(_instrumentDataHash);
 
     _instrument->Unlock();
 }
@@ -143,7 +187,14 @@ void Track::DownloadEffectSettings(
     void *getLen;
     auto length = _instrument->EffectPlugin(index)->dispatcher(effGetChunk, 0, 0, &getLen, 0.0f);
     auto data = reinterpret_cast<BYTE *>(getLen);
-    _effectsDataBase64[index] = base64_encode(&data[0], length);
+    if (size_t(index) >= _effectsDataBase64.size())
+    {
+        _effectsDataBase64.resize(size_t(index) + 1);
+        _effectsDataHash.resize(size_t(index) + 1, 0);
+    }
+    _effectsDataBase64[index] = std::make_shared<const std::string>(base64_encode(&data[0], length));
+    _effectsDataHash[index] = fnv1a_hash(data, size_t(length));
+    _instrument->SetEffectChunkHash(index, _effectsDataHash[index]);
 
     _instrument->Unlock();
 }
@@ -164,10 +215,23 @@ void Track::UploadEffectSettings(
         return;
     }
 
-    auto data = base64_decode(_effectsDataBase64[index]);
+    if (size_t(index) >= _effectsDataBase64.size() || _effectsDataBase64[index] == nullptr)
+    {
+        _instrument->Unlock();
+        return;
+    }
+
+    if (_effectsDataHash[index] == _instrument->EffectChunkHash(index))
+    {
+        _instrument->Unlock();
+        return;
+    }
+
+    auto data = base64_decode(*_effectsDataBase64[index]);
 
     /* Load plugin data*/
     _instrument->EffectPlugin(index)->dispatcher(effSetChunk, 0, (VstInt32)data.size(), data.data(), 0);
+    _instrument->SetEffectChunkHash(index, _effectsDataHash[index]);
 
     _instrument->Unlock();
 }
@@ -187,6 +251,24 @@ void Track::ToggleMuted()
     _muted = !_muted;
 }
 
+void Track::SetGain(
+    float gain)
+{
+    _gain = std::max(0.0f, gain);
+}
+
+void Track::SetPan(
+    float pan)
+{
+    _pan = std::clamp(pan, -1.0f, 1.0f);
+}
+
+void Track::SetOutputBus(
+    uint32_t busId)
+{
+    _outputBus = busId;
+}
+
 void Track::Idle()
 {
     if (_instrument == nullptr)
@@ -201,7 +283,7 @@ void Track::Idle()
 
     _instrument->InstrumentPlugin()->dispatcher(audioMasterIdle);
 
-    for (int i = 0; i < MAX_EFFECT_PLUGINS; i++)
+    for (int i = 0; i < _instrument->EffectPluginCount(); i++)
     {
         if (_instrument->EffectPlugin(i) == nullptr)
         {
@@ -258,43 +340,253 @@ Track::RegionCollection const &Track::Regions() const
     return _regions;
 }
 
+void Track::PublishRegions(
+    RegionCollection regions)
+{
+    if (_instrument != nullptr)
+    {
+        _instrument->Lock();
+    }
+
+    _regions.swap(regions);
+
+    if (_instrument != nullptr)
+    {
+        _instrument->Unlock();
+    }
+}
+
 void Track::SetRegions(
-    RegionCollection const &regions)
+    std::map<std::chrono::milliseconds::rep, Region> const &regions)
 {
-    _regions = regions;
+    PublishRegions(RegionCollection(regions));
 }
 
-Region &Track::GetRegion(
-    std::chrono::milliseconds::rep at)
+const Region &Track::GetRegion(
+    std::chrono::milliseconds::rep at) const
 {
-    return _regions[at];
+    static const Region emptyRegion;
+
+    auto found = _regions.find(at);
+
+    if (found == _regions.end())
+    {
+        return emptyRegion;
+    }
+
+    return found->second;
 }
 
 void Track::AddRegion(
     std::chrono::milliseconds::rep startAt,
     Region const &region)
 {
-    _regions.insert(std::make_pair(startAt, region));
+    auto regions = _regions;
+
+    if (!regions.Insert(startAt, region))
+    {
+        return;
+    }
+
+    PublishRegions(std::move(regions));
 }
 
 void Track::RemoveRegion(
     std::chrono::milliseconds::rep startAt)
 {
-    _regions.erase(startAt);
+    auto regions = _regions;
+
+    if (!regions.Erase(startAt))
+    {
+        return;
+    }
+
+    PublishRegions(std::move(regions));
 }
 
 std::chrono::milliseconds::rep Track::GetActiveRegionAt(
-    std::map<std::chrono::milliseconds::rep, Region> &regions,
     std::chrono::milliseconds::rep time,
-    std::chrono::milliseconds::rep margin)
+    std::chrono::milliseconds::rep margin) const
+{
+    // The first region that starts at or before time and ends at most margin before it
+    std::chrono::milliseconds::rep result = -1;
+
+    ForEachRegionInRange(time - margin, time + 1, [&](std::chrono::milliseconds::rep regionStart, const Region &) {
+        if (result == -1 || regionStart < result)
+        {
+            result = regionStart;
+        }
+    });
+
+    return result;
+}
+
+#ifdef TEST_YOUR_CODE
+void Track::Tests()
 {
-    for (auto i = regions.begin(); i != regions.end(); ++i)
+    auto sut = Track();
+    std::vector<std::chrono::milliseconds::rep> starts;
+    unsigned int seed = 12345;
+    auto random = [&](unsigned int max) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % max;
+    };
+
+    for (int round = 0; round < 2000; round++)
     {
-        if (i->first <= time && (i->first + i->second.Length() + margin) >= time)
+        if (random(4) == 0 && !sut.Regions().empty())
         {
-            return i->first;
+            auto it = sut.Regions().begin();
+            std::advance(it, random(unsigned(sut.Regions().size())));
+            sut.RemoveRegion(it->first);
+        }
+        else
+        {
+            Region region;
+            region.SetLength(random(8) == 0 ? 64000 : 1000 + random(4000));
+            sut.AddRegion(random(400000), region);
+        }
+
+        if (round % 100 == 0 && !sut.Regions().empty())
+        {
+            // A long region at the start reaches into every later range
+            sut.EditRegion(sut.Regions().begin()->first, [](Region &region) { region.SetLength(200000); });
+        }
+
+        auto start = std::chrono::milliseconds::rep(random(420000));
+        auto end = start + random(8000);
+
+        std::vector<std::chrono::milliseconds::rep> expected, actual;
+        for (auto &region : sut.Regions())
+        {
+            if (region.first >= end) continue;
+            if (region.first + region.second.Length() < start) continue;
+            expected.push_back(region.first);
+        }
+
+        sut.ForEachRegionInRange(start, end, [&](std::chrono::milliseconds::rep regionStart, const Region &) {
+            actual.push_back(regionStart);
+        });
+        std::sort(actual.begin(), actual.end());
+
+        if (expected != actual)
+        {
+            std::cout << "ForEachRegionInRange(" << start << ", " << end << ") found " << actual.size() << " regions, expected " << expected.size() << std::endl;
+        }
+
+        if (round % 250 == 0)
+        {
+            // A track that is loaded with all regions at once finds the same
+            auto loaded = Track();
+            loaded.SetRegions(std::map<std::chrono::milliseconds::rep, Region>(sut.Regions().begin(), sut.Regions().end()));
+
+            std::vector<std::chrono::milliseconds::rep> loadedActual;
+            loaded.ForEachRegionInRange(start, end, [&](std::chrono::milliseconds::rep regionStart, const Region &) {
+                loadedActual.push_back(regionStart);
+            });
+
+            if (loaded.Regions().size() != sut.Regions().size() || expected != loadedActual)
+            {
+                std::cout << "SetRegions found " << loadedActual.size() << " regions, expected " << expected.size() << std::endl;
+            }
+        }
+
+        std::chrono::milliseconds::rep expectedActive = -1;
+        for (auto &region : sut.Regions())
+        {
+            if (region.first <= start && (region.first + region.second.Length() + 4000) >= start)
+            {
+                expectedActive = region.first;
+                break;
+            }
+        }
+
+        if (sut.GetActiveRegionAt(start) != expectedActive)
+        {
+            std::cout << "GetActiveRegionAt(" << start << ") = " << sut.GetActiveRegionAt(start) << " != " << expectedActive << std::endl;
         }
     }
 
-    return -1;
+    // A copy shares the regions until one of the tracks changes them
+    auto regionStart = sut.Regions().begin()->first;
+    auto eventCount = sut.Regions().begin()->second.SortedEvents().size();
+    auto copy = sut;
+
+    if (&copy.Regions().at(regionStart) != &sut.Regions().at(regionStart))
+    {
+        std::cout << "A copy of a track does not share the regions" << std::endl;
+    }
+
+    copy.EditRegion(regionStart, [](Region &region) { region.AddEvent(0, 60, true, 100); });
+    copy.RemoveRegion(std::prev(copy.Regions().end())->first);
+
+    if (sut.Regions().begin()->second.SortedEvents().size() != eventCount || sut.Regions().size() != copy.Regions().size() + 1)
+    {
+        std::cout << "Changing a copy of a track changed the original" << std::endl;
+    }
+
+    // A change copies only the regions on the path to it in the tree
+    size_t copiedRegions = 0;
+    for (auto &region : sut.Regions())
+    {
+        auto found = copy.Regions().find(region.first);
+        if (found != copy.Regions().end() && &found->second != &region.second)
+        {
+            copiedRegions++;
+        }
+    }
+
+    if (copiedRegions > 64)
+    {
+        std::cout << "Editing a copy of a track copied " << copiedRegions << " of " << sut.Regions().size() << " regions" << std::endl;
+    }
+
+    // The regions an edit replaces are not changed in place, the audio
+    // thread or a snapshot may still read them
+    auto edited = Track();
+    edited.SetInstrument(std::make_shared<Instrument>());
+    edited.AddRegion(0, Region());
+
+    auto readByAudio = edited.Regions();
+
+    edited.EditRegion(0, [](Region &region) { region.AddEvent(0, 60, true, 100); });
+    edited.AddRegion(4000, Region());
+
+    if (!readByAudio.at(0).SortedEvents().empty() || readByAudio.size() != 1 || edited.Regions().at(0).SortedEvents().size() != 1)
+    {
+        std::cout << "Editing a track changed the regions in place" << std::endl;
+    }
+
+    // Recording appends in place while nothing shares the region, and copies
+    // it once when a copy of the track does
+    auto recording = Track();
+    recording.SetInstrument(std::make_shared<Instrument>());
+    recording.StartRecording();
+    recording.RecordMidiEvent(0, 60, true, 100);
+
+    auto recordedRegion = recording.GetActiveRegionAt(0);
+    auto recordedEvents = &recording.Regions().at(recordedRegion).SortedEvents();
+
+    recording.RecordMidiEvent(500, 60, false, 0);
+
+    if (&recording.Regions().at(recordedRegion).SortedEvents() != recordedEvents)
+    {
+        std::cout << "Recording copied the events of a region nothing shares" << std::endl;
+    }
+
+    auto recordingSnapshot = recording;
+    recording.RecordMidiEvent(1000, 62, true, 100);
+    recordedEvents = &recording.Regions().at(recordedRegion).SortedEvents();
+    recording.RecordMidiEvent(1500, 62, false, 0);
+
+    if (recordingSnapshot.Regions().at(recordedRegion).SortedEvents().size() != 2 || recording.Regions().at(recordedRegion).SortedEvents().size() != 4)
+    {
+        std::cout << "Recording changed a copy of the track" << std::endl;
+    }
+
+    if (&recording.Regions().at(recordedRegion).SortedEvents() != recordedEvents)
+    {
+        std::cout << "Recording copied the region again after a copy of the track" << std::endl;
+    }
 }
+#endif
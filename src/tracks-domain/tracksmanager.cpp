@@ -257,6 +257,76 @@ std::shared_ptr<Instrument> TracksManager::GetInstrument(
     return (*found).GetInstrument();
 }
 
+MixerBus *TracksManager::GetBus(
+    uint32_t busId)
+{
+    if (busId == MixerBus::Master)
+    {
+        return &_masterBus;
+    }
+
+    auto found = std::find_if(
+        _buses.begin(),
+        _buses.end(),
+        [&](const MixerBus &x) {
+            return x.Id() == busId;
+        });
+
+    if (found == _buses.end())
+    {
+        return nullptr;
+    }
+
+    return &(*found);
+}
+
+uint32_t TracksManager::AddBus(
+    const std::string &name)
+{
+    MixerBus newBus;
+    newBus.SetName(name);
+
+    _buses.push_back(newBus);
+
+    return newBus.Id();
+}
+
+void TracksManager::RemoveBus(
+    uint32_t busId)
+{
+    auto found = std::find_if(
+        _buses.begin(),
+        _buses.end(),
+        [&](const MixerBus &x) {
+            return x.Id() == busId;
+        });
+
+    if (found == _buses.end())
+    {
+        return;
+    }
+
+    auto output = found->GetOutputBus();
+
+    _buses.erase(found);
+
+    for (auto &track : _tracks)
+    {
+        if (track.GetOutputBus() == busId)
+        {
+            track.SetOutputBus(output);
+        }
+    }
+
+    for (auto &bus : _buses)
+    {
+        if (bus.GetOutputBus() == busId)
+        {
+            bus.SetOutputBus(output);
+        }
+    }
+}
+
 void TracksManager::RemoveActiveRegion()
 {
     auto trackId = std::get<uint32_t>(activeRegion);
@@ -290,9 +360,28 @@ void TracksManager::CleanupInstruments()
     }
 }
 
+static int StepToDeltaFrame(
+    std::chrono::milliseconds::rep time,
+    std::chrono::milliseconds::rep start,
+    std::chrono::milliseconds::rep end,
+    uint32_t firstFrame,
+    uint32_t frameCount)
+{
+    if (frameCount == 0 || end <= start)
+    {
+        return int(firstFrame);
+    }
+
+    auto offset = (time - start) * std::chrono::milliseconds::rep(frameCount) / (end - start);
+
+    return int(firstFrame + std::min(std::chrono::milliseconds::rep(frameCount - 1), offset));
+}
+
 void TracksManager::SendMidiNotesInRegion(
     std::chrono::milliseconds::rep start,
-    std::chrono::milliseconds::rep end)
+    std::chrono::milliseconds::rep end,
+    uint32_t firstFrame,
+    uint32_t frameCount)
 {
     auto trackId = std::get<uint32_t>(activeRegion);
 
@@ -324,19 +413,26 @@ void TracksManager::SendMidiNotesInRegion(
 
     auto regionStart = std::get<std::chrono::milliseconds::rep>(activeRegion);
 
-    auto &region = track.GetRegion(regionStart);
+    auto found = track.Regions().find(regionStart);
+    if (found == track.Regions().end())
+    {
+        track.GetInstrument()->Unlock();
 
-    for (const auto &event : region.Events())
+        return;
+    }
+
+    for (const auto &event : found->second.EventsInRange(start - regionStart, end - regionStart))
     {
-        if ((event.first + regionStart) > end) continue;
-        if ((event.first + regionStart) < start) continue;
+        auto deltaFrames = StepToDeltaFrame(event.first + regionStart, start, end, firstFrame, frameCount);
+
         for (const auto &m : event.second)
         {
             track.GetInstrument()->InstrumentPlugin()->sendMidiNote(
                 m.channel,
                 m.num,
                 m.value != 0,
-                m.value);
+                m.value,
+                deltaFrames);
         }
     }
 
@@ -345,7 +441,9 @@ void TracksManager::SendMidiNotesInRegion(
 
 void TracksManager::SendMidiNotesInSong(
     std::chrono::milliseconds::rep start,
-    std::chrono::milliseconds::rep end)
+    std::chrono::milliseconds::rep end,
+    uint32_t firstFrame,
+    uint32_t frameCount)
 {
     for (auto &track : GetTracks())
     {
@@ -363,26 +461,212 @@ void TracksManager::SendMidiNotesInSong(
             continue;
         }
 
-        for (const auto &region : track.Regions())
-        {
-            if (region.first > end) continue;
-            if (region.first + region.second.Length() < start) continue;
+        auto &plugin = track.GetInstrument()->InstrumentPlugin();
 
-            for (const auto &event : region.second.Events())
+        track.ForEachRegionInRange(start, end, [&](std::chrono::milliseconds::rep regionStart, const Region &region) {
+            for (const auto &event : region.EventsInRange(start - regionStart, end - regionStart))
             {
-                if ((event.first + region.first) > end) continue;
-                if ((event.first + region.first) < start) continue;
+                auto deltaFrames = StepToDeltaFrame(event.first + regionStart, start, end, firstFrame, frameCount);
+
                 for (const auto &m : event.second)
                 {
-                    track.GetInstrument()->InstrumentPlugin()->sendMidiNote(
+                    plugin->sendMidiNote(
                         m.channel,
                         m.num,
                         m.value != 0,
-                        m.value);
+                        m.value,
+                        deltaFrames);
                 }
             }
-        }
+        });
 
         track.GetInstrument()->Unlock();
     }
 }
+
+#ifdef TEST_YOUR_CODE
+static std::vector<VstInt32> _recordedDeltaFrames;
+static VstEvents *_dispatchedEvents = nullptr;
+static std::string _recorderChunk = "first";
+static int _recorderSetChunkCount = 0;
+
+static VstIntPtr MidiRecorderDispatcher(
+    AEffect *effect,
+    VstInt32 opcode,
+    VstInt32 index,
+    VstIntPtr value,
+    void *ptr,
+    float opt)
+{
+    (void)index;
+    (void)value;
+    (void)opt;
+
+    if (opcode == effClose)
+    {
+        delete effect;
+    }
+    else if (opcode == effProcessEvents)
+    {
+        // Like many plugins, the events are only read in processReplacing()
+        _dispatchedEvents = reinterpret_cast<VstEvents *>(ptr);
+    }
+    else if (opcode == effGetChunk)
+    {
+        *reinterpret_cast<void **>(ptr) = _recorderChunk.data();
+
+        return VstIntPtr(_recorderChunk.size());
+    }
+    else if (opcode == effSetChunk)
+    {
+        _recorderChunk = std::string(reinterpret_cast<char *>(ptr), size_t(value));
+        _recorderSetChunkCount++;
+    }
+
+    return 0;
+}
+
+static void MidiRecorderProcessReplacing(
+    AEffect *effect,
+    float **inputs,
+    float **outputs,
+    VstInt32 sampleFrames)
+{
+    (void)effect;
+    (void)inputs;
+    (void)outputs;
+    (void)sampleFrames;
+
+    if (_dispatchedEvents != nullptr)
+    {
+        for (int i = 0; i < _dispatchedEvents->numEvents; i++)
+        {
+            _recordedDeltaFrames.push_back(_dispatchedEvents->events[i]->deltaFrames);
+        }
+
+        _dispatchedEvents = nullptr;
+    }
+
+    // Marks the end of a chunk
+    _recordedDeltaFrames.push_back(-1);
+}
+
+static AEffect *MidiRecorderMain(
+    audioMasterCallback callback)
+{
+    (void)callback;
+
+    auto effect = new AEffect();
+    effect->magic = kEffectMagic;
+    effect->dispatcher = MidiRecorderDispatcher;
+    effect->processReplacing = MidiRecorderProcessReplacing;
+    effect->numOutputs = 2;
+    effect->flags = effFlagsIsSynth | effFlagsCanReplacing;
+
+    return effect;
+}
+
+static void ExpectDeltaFrames(
+    const char *name,
+    const std::vector<VstInt32> &expected)
+{
+    if (_recordedDeltaFrames != expected)
+    {
+        std::cout << name << ": recorded deltaFrames";
+        for (auto d : _recordedDeltaFrames) std::cout << " " << d;
+        std::cout << " != expected";
+        for (auto d : expected) std::cout << " " << d;
+        std::cout << std::endl;
+    }
+
+    _recordedDeltaFrames.clear();
+}
+
+// Closes the editor like the user does with the close button of its window
+class EditorWindowPlugin : public VstPlugin
+{
+public:
+    void CloseEditorWindow()
+    {
+        closingEditorWindow();
+    }
+};
+
+void TracksManager::Tests()
+{
+    auto plugin = std::make_shared<EditorWindowPlugin>();
+    plugin->init(MidiRecorderMain, "test:MidiRecorder");
+
+    auto instrument = std::make_shared<Instrument>();
+    instrument->SetInstrumentPlugin(plugin);
+
+    auto sut = TracksManager();
+    auto trackId = sut.AddTrack("test", instrument);
+
+    Region region;
+    region.AddEvent(0, 60, true, 100);
+    region.AddEvent(1000, 62, true, 100);
+    region.AddEvent(2000, 64, true, 100);
+    region.AddEvent(3999, 65, true, 100);
+    region.AddEvent(4000, 67, true, 100);
+    sut.GetTrack(trackId).AddRegion(0, region);
+
+    std::vector<float> outputBuffer(2 * 1024);
+    float *outputs[] = {outputBuffer.data(), outputBuffer.data() + 1024};
+
+    // 2048 frames are processed in two chunks of the plugins block size (1024)
+    sut.SendMidiNotesInSong(0, 4000, 0, 2048);
+    plugin->processEvents();
+    plugin->processAudio(nullptr, outputs, 1024);
+    plugin->processAudio(nullptr, outputs, 1024);
+    ExpectDeltaFrames("SendMidiNotesInSong", {0, 512, -1, 0, 1023, -1});
+
+    // The end of the range is not included, the event at 4000 belongs to the next block
+    sut.SendMidiNotesInSong(4000, 6000, 0, 1024);
+    plugin->processEvents();
+    plugin->processAudio(nullptr, outputs, 1024);
+    ExpectDeltaFrames("SendMidiNotesInSong end", {0, -1});
+
+    // A block that is split in two parts, like when the region loops
+    sut.SetActiveRegion(trackId, 0);
+    sut.SendMidiNotesInRegion(3000, 4000, 0, 256);
+    sut.SendMidiNotesInRegion(0, 3000, 256, 768);
+    plugin->processEvents();
+    plugin->processAudio(nullptr, outputs, 1024);
+    ExpectDeltaFrames("SendMidiNotesInRegion", {255, 256, 512, 768, -1});
+
+    // Uploading the chunk the plugin already has is skipped
+    auto &track = sut.GetTrack(trackId);
+    track.DownloadInstrumentSettings();
+    auto before = track;
+    track.UploadInstrumentSettings();
+
+    if (_recorderSetChunkCount != 0)
+    {
+        std::cout << "UploadInstrumentSettings sent a chunk the plugin already has" << std::endl;
+    }
+
+    _recorderChunk = "second";
+    track.DownloadInstrumentSettings();
+    before.UploadInstrumentSettings();
+    before.UploadInstrumentSettings();
+
+    if (_recorderSetChunkCount != 1 || _recorderChunk != "first")
+    {
+        std::cout << "UploadInstrumentSettings sent " << _recorderSetChunkCount << " chunks for one change, plugin has \"" << _recorderChunk << "\"" << std::endl;
+    }
+
+    // The plugin is changed in its editor, and the editor closed without a download
+    _recorderChunk = "edited";
+    plugin->CloseEditorWindow();
+    before.UploadInstrumentSettings();
+
+    if (_recorderSetChunkCount != 2 || _recorderChunk != "first")
+    {
+        std::cout << "UploadInstrumentSettings skipped a chunk after the editor was closed, plugin has \"" << _recorderChunk << "\"" << std::endl;
+    }
+
+    sut.RemoveTrack(trackId);
+    instrument->SetInstrumentPlugin(nullptr);
+}
+#endif
@@ -0,0 +1,249 @@
+#include "tracksrenderer.h"
+
+#include "dspkernels.h"
+#include "instrument.h"
+#include "track.h"
+
+#include <algorithm>
+
+TracksRenderer::TracksRenderer() = default;
+
+void TracksRenderer::SetTracksManager(
+    ITracksManager *tracks)
+{
+    _tracks = tracks;
+}
+
+void TracksRenderer::SetWorkerPool(
+    WorkerPool *workerPool)
+{
+    _workerPool = workerPool;
+}
+
+void TracksRenderer::SetTelemetry(
+    AudioTelemetry *telemetry)
+{
+    _telemetry = telemetry;
+}
+
+std::map<uintptr_t, std::string> TracksRenderer::PluginNames() const
+{
+    std::map<uintptr_t, std::string> names;
+
+    if (_tracks == nullptr)
+    {
+        return names;
+    }
+
+    for (auto &track : _tracks->GetTracks())
+    {
+        auto instrument = track.GetInstrument();
+        if (instrument == nullptr)
+        {
+            continue;
+        }
+
+        auto &plugin = instrument->InstrumentPlugin();
+        if (plugin != nullptr)
+        {
+            names[reinterpret_cast<uintptr_t>(plugin.get())] = track.GetName() + ": " + plugin->Title();
+        }
+
+        for (int i = 0; i < instrument->EffectPluginCount(); i++)
+        {
+            auto effect = instrument->EffectPlugin(i);
+            if (effect != nullptr)
+            {
+                names[reinterpret_cast<uintptr_t>(effect.get())] = track.GetName() + ": " + effect->Title();
+            }
+        }
+    }
+
+    return names;
+}
+
+void TracksRenderer::Prepare(
+    uint32_t maxFrameCount,
+    uint32_t channelCount)
+{
+    if (_tracks == nullptr)
+    {
+        return;
+    }
+
+    // Only this function changes the buffers, so they can be read here
+    // without the lock
+    auto trackCount = std::max(_trackBuffers.size(), _tracks->GetTracks().size());
+    auto sampleCount = std::max(_bufferSampleCount, size_t(maxFrameCount) * channelCount);
+    auto scratchCount = std::max(_scratchBuffers.size(), (_workerPool != nullptr ? _workerPool->ThreadCount() : 0) + 1);
+    auto scratchSize = std::max(_scratchSize, ProcessingGraph::LargestScratchSize());
+
+    _mixer.Prepare(_tracks, sampleCount, channelCount);
+
+    auto buffersGrow = trackCount != _trackBuffers.size() || sampleCount != _bufferSampleCount;
+    auto scratchGrows = scratchCount != _scratchBuffers.size() || scratchSize != _scratchSize;
+
+    if (!buffersGrow && !scratchGrows)
+    {
+        return;
+    }
+
+    std::vector<std::vector<float>> buffers;
+    if (buffersGrow)
+    {
+        buffers.assign(trackCount, std::vector<float>(sampleCount));
+    }
+
+    std::vector<std::vector<float>> scratchBuffers;
+    if (scratchGrows)
+    {
+        scratchBuffers.assign(scratchCount, std::vector<float>(scratchSize));
+    }
+
+    _buffersMutex.lock();
+
+    if (buffersGrow)
+    {
+        _trackBuffers.swap(buffers);
+        _bufferSampleCount = sampleCount;
+    }
+
+    if (scratchGrows)
+    {
+        _scratchBuffers.swap(scratchBuffers);
+        _scratchSize = scratchSize;
+    }
+
+    _buffersMutex.unlock();
+}
+
+void TracksRenderer::RenderTracks(
+    float *data,
+    uint32_t frameCount,
+    uint32_t channelCount,
+    uint32_t sampleRate)
+{
+    const auto sampleCount = size_t(frameCount) * channelCount;
+
+    _buffersMutex.lock();
+
+    const auto partFrameCount = channelCount > 0 ? uint32_t(_bufferSampleCount / channelCount) : 0;
+
+    if (_tracks == nullptr || partFrameCount == 0)
+    {
+        _buffersMutex.unlock();
+
+        if (data != nullptr)
+        {
+            DspKernels::Clear(data, sampleCount);
+        }
+
+        return;
+    }
+
+    // The plugins keep the events of the block that are past a part, and
+    // shift them to the next part
+    for (uint32_t done = 0; done < frameCount; done += partFrameCount)
+    {
+        RenderPart(
+            data != nullptr ? data + size_t(done) * channelCount : nullptr,
+            std::min(partFrameCount, frameCount - done),
+            channelCount,
+            sampleRate);
+    }
+
+    _buffersMutex.unlock();
+}
+
+void TracksRenderer::RenderPart(
+    float *data,
+    uint32_t frameCount,
+    uint32_t channelCount,
+    uint32_t sampleRate)
+{
+    const auto sampleCount = size_t(frameCount) * channelCount;
+
+    auto &tracks = _tracks->GetTracks();
+    auto trackCount = std::min(tracks.size(), _trackBuffers.size());
+
+    auto renderTrack = [&](size_t index) {
+        auto &buffer = _trackBuffers[index];
+
+        DspKernels::Clear(buffer.data(), sampleCount);
+
+        RenderTrack(tracks[index], buffer.data(), frameCount, channelCount);
+    };
+
+    if (_workerPool == nullptr || _workerPool->ThreadCount() == 0 || trackCount < 2)
+    {
+        for (size_t i = 0; i < trackCount; i++)
+        {
+            renderTrack(i);
+        }
+    }
+    else
+    {
+        _workerPool->ParallelFor(trackCount, renderTrack);
+    }
+
+    if (data == nullptr)
+    {
+        return;
+    }
+
+    _mixer.Mix(_tracks, _trackBuffers, data, frameCount, channelCount, sampleRate);
+}
+
+void TracksRenderer::RenderTrack(
+    Track &track,
+    float *data,
+    uint32_t frameCount,
+    uint32_t channelCount)
+{
+    auto instrument = track.GetInstrument();
+    if (instrument == nullptr)
+    {
+        return;
+    }
+
+    instrument->Lock();
+
+    auto &vstPlugin = instrument->InstrumentPlugin();
+    auto graph = instrument->Graph();
+    auto workerIndex = WorkerPool::WorkerIndex();
+
+    // A graph that was compiled after the last Prepare() can need more
+    // scratch, the track is silent until the next Prepare()
+    if (vstPlugin == nullptr || graph == nullptr || workerIndex >= _scratchBuffers.size() || _scratchSize < graph->ScratchSize())
+    {
+        instrument->Unlock();
+
+        return;
+    }
+
+    vstPlugin->processEvents();
+
+    auto &scratch = _scratchBuffers[workerIndex];
+
+    size_t tmpFrameCount = frameCount;
+
+    size_t ofs = 0;
+    while (tmpFrameCount > 0)
+    {
+        const auto nFrame = std::min(tmpFrameCount, graph->MaxFrameCount());
+        uint32_t nSrcChannels = 0;
+        auto graphOutput = graph->Process(scratch.data(), nFrame, nSrcChannels, _telemetry);
+
+        if (graphOutput == nullptr)
+        {
+            break;
+        }
+
+        DspKernels::InterleaveAccumulate(data + ofs, channelCount, graphOutput, nSrcChannels, nFrame);
+
+        tmpFrameCount -= nFrame;
+        ofs += nFrame * channelCount;
+    }
+
+    instrument->Unlock();
+}
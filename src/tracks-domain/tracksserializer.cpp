@@ -1,48 +1,29 @@
 #include "tracksserializer.h"
 
 #include "base64.h"
+#include "pluginloadqueue.h"
+#include "songsnapshot.h"
 #include "track.h"
+#include <charconv>
 #include <fstream>
 #include <glm/glm.hpp>
 #include <spdlog/spdlog.h>
+#include <yaml-cpp/eventhandler.h>
 #include <yaml-cpp/yaml.h>
 
+const size_t fileBufferSize = 1024 * 1024;
+
 TracksSerializer::TracksSerializer(
     ITracksManager *tracks,
     IPluginService *vstPluginService)
     : _tracks(tracks), _vstPluginService(vstPluginService)
 {}
 
-namespace YAML
+void TracksSerializer::SetWorkerPool(
+    WorkerPool *workerPool)
 {
-
-    template <>
-    struct convert<glm::vec4>
-    {
-        static Node encode(const glm::vec4 &rhs)
-        {
-            Node node;
-            node.push_back(rhs.x);
-            node.push_back(rhs.y);
-            node.push_back(rhs.z);
-            node.push_back(rhs.w);
-            return node;
-        }
-
-        static bool decode(const Node &node, glm::vec4 &rhs)
-        {
-            if (!node.IsSequence() || node.size() != 4)
-                return false;
-
-            rhs.x = node[0].as<float>();
-            rhs.y = node[1].as<float>();
-            rhs.z = node[2].as<float>();
-            rhs.w = node[3].as<float>();
-            return true;
-        }
-    };
-
-} // namespace YAML
+    _workerPool = workerPool;
+}
 
 YAML::Emitter &operator<<(YAML::Emitter &out, const glm::vec4 &v)
 {
@@ -53,7 +34,7 @@ YAML::Emitter &operator<<(YAML::Emitter &out, const glm::vec4 &v)
 
 void SerializePlugin(
     YAML::Emitter &out,
-    const std::shared_ptr<VstPlugin> &plugin)
+    const std::unique_ptr<PluginSnapshot> &plugin)
 {
     if (plugin == nullptr)
     {
@@ -62,45 +43,46 @@ void SerializePlugin(
 
     out << YAML::Key << "Plugin" << YAML::Value << YAML::BeginMap;
 
-    out << YAML::Key << "ModulePath" << YAML::Value << plugin->ModulePath();
+    out << YAML::Key << "ModulePath" << YAML::Value << plugin->modulePath;
 
     /* Save plugin data*/
-    void *getLen;
-    auto length = plugin->dispatcher(effGetChunk, 0, 0, &getLen, 0.0f);
-    auto data = reinterpret_cast<BYTE *>(getLen);
-    out << YAML::Key << "PluginData" << YAML::Value << base64_encode(&data[0], length);
+    out << YAML::Key << "PluginData" << YAML::Value << base64_encode(plugin->chunk.data(), intptr_t(plugin->chunk.size()));
+
+    // Only written for the plugins that opted out, sleeping is the default
+    if (!plugin->sleepAllowed)
+    {
+        out << YAML::Key << "SleepAllowed" << YAML::Value << false;
+    }
 
     out << YAML::EndMap; // Plugin
 }
 
 void SerializeInstrument(
     YAML::Emitter &out,
-    std::shared_ptr<Instrument> instrument)
+    const TrackSnapshot &snapshot)
 {
-    if (instrument == nullptr)
+    if (!snapshot.hasInstrument)
     {
         return;
     }
 
     out << YAML::Key << "Instrument" << YAML::Value << YAML::BeginMap;
 
-    out << YAML::Key << "Name" << YAML::Value << instrument->Name();
-    out << YAML::Key << "MidiChannel" << YAML::Value << instrument->MidiChannel();
+    out << YAML::Key << "Name" << YAML::Value << snapshot.instrumentName;
+    out << YAML::Key << "MidiChannel" << YAML::Value << snapshot.midiChannel;
 
     out << YAML::Key << "Effects" << YAML::Value << YAML::BeginSeq;
-    for (int i = 0; i < MAX_EFFECT_PLUGINS; i++)
+    for (size_t i = 0; i < snapshot.effectPlugins.size(); i++)
     {
         out << YAML::Value << YAML::BeginMap;
 
-        SerializePlugin(out, instrument->EffectPlugin(i));
+        SerializePlugin(out, snapshot.effectPlugins[i]);
 
         out << YAML::EndMap;
     }
     out << YAML::EndSeq;
 
-    instrument->Lock();
-    SerializePlugin(out, instrument->InstrumentPlugin());
-    instrument->Unlock();
+    SerializePlugin(out, snapshot.instrumentPlugin);
 
     out << YAML::EndMap; // Instrument
 }
@@ -108,7 +90,7 @@ void SerializeInstrument(
 void SerializeEvent(
     YAML::Emitter &out,
     std::chrono::milliseconds::rep key,
-    const std::vector<MidiEvent> &e)
+    const MidiEventsInTime::Events &e)
 {
     if (e.empty())
     {
@@ -154,17 +136,52 @@ void SerializeRegion(
     out << YAML::EndMap; // Region
 }
 
+// Buses are referred to by their index in the file, -1 is the master bus
+static int BusIndex(
+    const std::vector<MixerBus> &buses,
+    uint32_t busId)
+{
+    for (size_t i = 0; i < buses.size(); i++)
+    {
+        if (buses[i].Id() == busId)
+        {
+            return int(i);
+        }
+    }
+
+    return -1;
+}
+
+void SerializeBus(
+    YAML::Emitter &out,
+    const MixerBus &bus,
+    const std::vector<MixerBus> &buses)
+{
+    out << YAML::BeginMap; // Bus
+    out << YAML::Key << "Name" << YAML::Value << bus.GetName();
+    out << YAML::Key << "Gain" << YAML::Value << bus.GetGain();
+    out << YAML::Key << "Pan" << YAML::Value << bus.GetPan();
+    out << YAML::Key << "Output" << YAML::Value << BusIndex(buses, bus.GetOutputBus());
+    out << YAML::EndMap; // Bus
+}
+
 void SerializeTrack(
     YAML::Emitter &out,
-    Track *track)
+    TrackSnapshot &snapshot,
+    const std::vector<MixerBus> &buses)
 {
+    auto track = &snapshot.track;
+
     out << YAML::BeginMap; // Track
     out << YAML::Key << "Name" << YAML::Value << track->GetName();
     out << YAML::Key << "Color" << YAML::Value << glm::vec4(track->GetColor()[0], track->GetColor()[1], track->GetColor()[2], track->GetColor()[3]);
     out << YAML::Key << "IsMuted" << YAML::Value << track->IsMuted();
     out << YAML::Key << "IsReadyForRecoding" << YAML::Value << track->IsReadyForRecoding();
+    out << YAML::Key << "Gain" << YAML::Value << track->GetGain();
+    out << YAML::Key << "Pan" << YAML::Value << track->GetPan();
+    out << YAML::Key << "Bus" << YAML::Value << BusIndex(buses, track->GetOutputBus());
 
-    SerializeInstrument(out, track->GetInstrument());
+    SerializeInstrument(out, snapshot);
 
     out << YAML::Key << "Regions" << YAML::Value << YAML::BeginSeq;
     for (auto &region : track->Regions())
@@ -179,175 +196,716 @@ void SerializeTrack(
 void TracksSerializer::Serialize(
     const std::string &filepath)
 {
-    YAML::Emitter out;
+    std::vector<char> fileBuffer(fileBufferSize);
+    std::ofstream fout;
+    fout.rdbuf()->pubsetbuf(fileBuffer.data(), std::streamsize(fileBuffer.size()));
+    fout.open(filepath);
+
+    if (!fout.is_open())
+    {
+        spdlog::error("failed to open {0} for writing", filepath);
+
+        return;
+    }
+
+    // The plugin chunks are all asked for up front, so the plugins can work
+    // on them in parallel. The emitter writes to the file as it goes.
+    auto snapshot = SongSnapshot::Take(_tracks, _workerPool);
+
+    YAML::Emitter out(fout);
 
     out << YAML::BeginMap;
     out << YAML::Key << "Song" << YAML::Value << "Untitled";
+
+    out << YAML::Key << "Master" << YAML::Value << YAML::BeginMap;
+    out << YAML::Key << "Gain" << YAML::Value << snapshot->masterBus.GetGain();
+    out << YAML::Key << "Pan" << YAML::Value << snapshot->masterBus.GetPan();
+    out << YAML::EndMap; // Master
+
+    out << YAML::Key << "Buses" << YAML::Value << YAML::BeginSeq;
+    for (auto &bus : snapshot->buses)
+    {
+        SerializeBus(out, bus, snapshot->buses);
+    }
+    out << YAML::EndSeq; // Buses
+
     out << YAML::Key << "Tracks" << YAML::Value << YAML::BeginSeq;
 
-    for (auto track : _tracks->GetTracks())
+    for (auto &track : snapshot->tracks)
     {
-        SerializeTrack(out, &track);
+        SerializeTrack(out, track, snapshot->buses);
     }
 
     out << YAML::EndSeq;
     out << YAML::EndMap;
 
-    std::ofstream fout(filepath);
-    fout << out.c_str();
+    fout.close();
+
+    if (!out.good() || !fout)
+    {
+        spdlog::error("failed to write {0}", filepath);
+    }
 }
 
-std::shared_ptr<VstPlugin> DeserializePlugin(
-    const YAML::Node &instrumentData,
-    IPluginService *vstPluginService)
+template <typename T>
+static T ParseScalar(
+    const std::string &value)
+{
+    T result = T();
+
+    std::from_chars(value.data(), value.data() + value.size(), result);
+
+    return result;
+}
+
+template <>
+bool ParseScalar<bool>(
+    const std::string &value)
+{
+    return value == "true" || value == "True" || value == "TRUE" || value == "y" || value == "yes" || value == "on";
+}
+
+// Builds the tracks while the parser walks the file, instead of loading the
+// whole document first. Every value is matched on its path from the root,
+// like "/Tracks/-/Regions/-/Name", where "-" is an item in a sequence. The
+// plugins are queued while parsing, AddTracks() loads them all at once and
+// then adds the tracks.
+class SongEventHandler : public YAML::EventHandler
 {
-    auto pluginData = instrumentData["Plugin"];
-    if (!pluginData)
+public:
+    SongEventHandler(
+        ITracksManager *tracks,
+        IPluginService *vstPluginService,
+        WorkerPool *workerPool)
+        : _tracks(tracks), _pluginLoadQueue(vstPluginService, workerPool)
+    {}
+
+    bool HasSong() const { return _hasSong; }
+
+    void AddTracks()
     {
-        spdlog::error("no plugin data found");
+        _pluginLoadQueue.Load();
 
-        return nullptr;
+        AddBuses();
+
+        for (auto &pending : _pendingTracks)
+        {
+            AddTrack(pending);
+        }
+
+        _pendingTracks.clear();
     }
 
-    auto pluginModulePath = pluginData["ModulePath"].as<std::string>();
-    auto pluginPluginData = pluginData["PluginData"].as<std::string>();
+    virtual void OnDocumentStart(
+        const YAML::Mark &mark)
+    {
+        (void)mark;
+    }
 
-    auto plugin = vstPluginService->LoadPlugin(pluginModulePath);
+    virtual void OnDocumentEnd()
+    {}
 
-    if (plugin == nullptr)
+    virtual void OnNull(
+        const YAML::Mark &mark,
+        YAML::anchor_t anchor)
     {
-        spdlog::error("failed to load module");
+        OnScalar(mark, "", anchor, "");
+    }
 
-        return nullptr;
+    virtual void OnAlias(
+        const YAML::Mark &mark,
+        YAML::anchor_t anchor)
+    {
+        OnScalar(mark, "", anchor, "");
     }
 
-    auto data = base64_decode(pluginPluginData);
+    virtual void OnScalar(
+        const YAML::Mark &mark,
+        const std::string &tag,
+        YAML::anchor_t anchor,
+        const std::string &value)
+    {
+        (void)mark;
+        (void)tag;
+        (void)anchor;
 
-    /* Load plugin data*/
-    plugin->dispatcher(effSetChunk, 0, (VstInt32)data.size(), data.data(), 0);
+        if (!_frames.empty() && _frames.back().isMap && _frames.back().expectKey)
+        {
+            _path.resize(_frames.back().pathLength);
+            _path += "/";
+            _path += value;
+            _frames.back().expectKey = false;
 
-    return plugin;
-}
+            return;
+        }
 
-std::shared_ptr<Instrument> DeserializeInstrument(
-    const YAML::Node &trackData,
-    IPluginService *vstPluginService)
-{
-    auto instrumentData = trackData["Instrument"];
-    if (!instrumentData)
+        BeginValue();
+        Scalar(value);
+        EndValue();
+    }
+
+    virtual void OnSequenceStart(
+        const YAML::Mark &mark,
+        const std::string &tag,
+        YAML::anchor_t anchor,
+        YAML::EmitterStyle::value style)
+    {
+        (void)mark;
+        (void)tag;
+        (void)anchor;
+        (void)style;
+
+        BeginValue();
+        _frames.push_back(Frame{false, _path.size(), false, -1});
+    }
+
+    virtual void OnSequenceEnd()
+    {
+        _path.resize(_frames.back().pathLength);
+        _frames.pop_back();
+        EndValue();
+    }
+
+    virtual void OnMapStart(
+        const YAML::Mark &mark,
+        const std::string &tag,
+        YAML::anchor_t anchor,
+        YAML::EmitterStyle::value style)
+    {
+        (void)mark;
+        (void)tag;
+        (void)anchor;
+        (void)style;
+
+        BeginValue();
+        MapStart();
+        _frames.push_back(Frame{true, _path.size(), true, -1});
+    }
+
+    virtual void OnMapEnd()
+    {
+        _path.resize(_frames.back().pathLength);
+        _frames.pop_back();
+        MapEnd();
+        EndValue();
+    }
+
+private:
+    ITracksManager *_tracks = nullptr;
+    PluginLoadQueue _pluginLoadQueue;
+    bool _hasSong = false;
+
+    struct PendingTrack
     {
-        spdlog::error("no instrument data found");
+        std::string name;
+        glm::vec4 color;
+        bool hasColor;
+        int isMuted;
+        int isReadyForRecording;
+        float gain;
+        float pan;
+        int busIndex;
+        std::shared_ptr<Instrument> instrument;
+        std::map<std::chrono::milliseconds::rep, Region> regions;
+    };
+
+    std::vector<PendingTrack> _pendingTracks;
+
+    struct PendingBus
+    {
+        std::string name;
+        float gain = 1.0f;
+        float pan = 0.0f;
+        int outputIndex = -1;
+    };
+
+    std::vector<PendingBus> _pendingBuses;
+    std::vector<uint32_t> _busIds;
+    float _masterGain = 1.0f;
+    float _masterPan = 0.0f;
+
+    struct Frame
+    {
+        bool isMap;
+        size_t pathLength;
+        bool expectKey;
+        int index;
+    };
 
-        return nullptr;
+    std::vector<Frame> _frames;
+    std::string _path;
+
+    std::string _trackName;
+    glm::vec4 _trackColor;
+    bool _hasTrackColor = false;
+    int _trackIsMuted = -1;
+    int _trackIsReadyForRecording = -1;
+    float _trackGain = 1.0f;
+    float _trackPan = 0.0f;
+    int _trackBusIndex = -1;
+    std::shared_ptr<Instrument> _instrument;
+    std::map<std::chrono::milliseconds::rep, Region> _regions;
+
+    int _effectIndex = -1;
+    std::string _pluginModulePath;
+    std::string _pluginData;
+    bool _pluginSleepAllowed = true;
+
+    std::chrono::milliseconds::rep _regionStart = 0;
+    std::string _regionName;
+    std::chrono::milliseconds::rep _regionLength = 0;
+    TimedMidiEvent::Collection _regionEvents;
+    std::chrono::milliseconds::rep _eventStart = 0;
+    size_t _firstEventAtStart = 0;
+    TimedMidiEvent _midiEvent;
+
+    int Index() const
+    {
+        return _frames.empty() ? -1 : _frames.back().index;
     }
 
-    auto instrumentName = instrumentData["Name"].as<std::string>();
-    auto instrumentMidiChannel = instrumentData["MidiChannel"].as<int>();
+    void BeginValue()
+    {
+        if (_frames.empty() || _frames.back().isMap)
+        {
+            return;
+        }
 
-    auto instrument = std::make_shared<Instrument>();
-    instrument->SetName(instrumentName);
-    instrument->SetMidiChannel(instrumentMidiChannel);
+        _path.resize(_frames.back().pathLength);
+        _path += "/-";
+        _frames.back().index++;
+    }
 
-    auto effetcs = instrumentData["Effects"];
-    if (effetcs != nullptr)
+    void EndValue()
     {
-        for (int i = 0; i < MAX_EFFECT_PLUGINS; i++)
+        if (!_frames.empty() && _frames.back().isMap)
         {
-            auto effectPlugin = DeserializePlugin(effetcs[i], vstPluginService);
-            if (effectPlugin != nullptr)
+            _frames.back().expectKey = true;
+        }
+    }
+
+    void MapStart()
+    {
+        if (_path == "/Tracks/-")
+        {
+            _trackName = "";
+            _hasTrackColor = false;
+            _trackIsMuted = -1;
+            _trackIsReadyForRecording = -1;
+            _trackGain = 1.0f;
+            _trackPan = 0.0f;
+            _trackBusIndex = -1;
+            _instrument = nullptr;
+            _regions.clear();
+        }
+        else if (_path == "/Buses/-")
+        {
+            _pendingBuses.push_back(PendingBus());
+        }
+        else if (_path == "/Tracks/-/Instrument")
+        {
+            _instrument = std::make_shared<Instrument>();
+        }
+        else if (_path == "/Tracks/-/Instrument/Effects/-")
+        {
+            _effectIndex = Index();
+        }
+        else if (_path == "/Tracks/-/Instrument/Plugin" || _path == "/Tracks/-/Instrument/Effects/-/Plugin")
+        {
+            _pluginModulePath = "";
+            _pluginData = "";
+            _pluginSleepAllowed = true;
+        }
+        else if (_path == "/Tracks/-/Regions/-")
+        {
+            _regionStart = 0;
+            _regionName = "";
+            _regionLength = 0;
+            _regionEvents.clear();
+        }
+        else if (_path == "/Tracks/-/Regions/-/Events/-")
+        {
+            _eventStart = 0;
+            _firstEventAtStart = _regionEvents.size();
+        }
+        else if (_path == "/Tracks/-/Regions/-/Events/-/MidiEvents/-")
+        {
+            _midiEvent = TimedMidiEvent();
+        }
+    }
+
+    void MapEnd()
+    {
+        if (_path == "/Tracks/-")
+        {
+            _pendingTracks.push_back(PendingTrack{
+                _trackName,
+                _trackColor,
+                _hasTrackColor,
+                _trackIsMuted,
+                _trackIsReadyForRecording,
+                _trackGain,
+                _trackPan,
+                _trackBusIndex,
+                _instrument,
+                std::move(_regions),
+            });
+
+            _regions.clear();
+            _instrument = nullptr;
+        }
+        else if (_path == "/Tracks/-/Instrument/Plugin")
+        {
+            QueuePlugin(PluginLoadQueue::InstrumentPluginIndex);
+        }
+        else if (_path == "/Tracks/-/Instrument/Effects/-/Plugin")
+        {
+            QueuePlugin(_effectIndex);
+        }
+        else if (_path == "/Tracks/-/Regions/-")
+        {
+            Region region;
+            region.SetName(_regionName);
+            region.SetLength(_regionLength);
+            region.SetEvents(std::move(_regionEvents));
+            _regionEvents = TimedMidiEvent::Collection();
+
+            _regions.insert(std::make_pair(_regionStart, region));
+        }
+        else if (_path == "/Tracks/-/Regions/-/Events/-")
+        {
+            // The start can come after the events
+            for (size_t i = _firstEventAtStart; i < _regionEvents.size(); i++)
             {
-                instrument->SetEffectPlugin(i, effectPlugin);
+                _regionEvents[i].time = _eventStart;
             }
         }
+        else if (_path == "/Tracks/-/Regions/-/Events/-/MidiEvents/-")
+        {
+            _regionEvents.push_back(_midiEvent);
+        }
     }
 
-    auto plugin = DeserializePlugin(instrumentData, vstPluginService);
-    if (plugin != nullptr)
+    void Scalar(
+        const std::string &value)
     {
-        instrument->SetInstrumentPlugin(plugin);
+        if (_path == "/Song")
+        {
+            _hasSong = true;
+        }
+        else if (_path == "/Tracks/-/Name")
+        {
+            _trackName = value;
+        }
+        else if (_path == "/Tracks/-/Color/-")
+        {
+            if (Index() >= 0 && Index() < 4)
+            {
+                _trackColor[Index()] = ParseScalar<float>(value);
+                _hasTrackColor = true;
+            }
+        }
+        else if (_path == "/Tracks/-/IsMuted")
+        {
+            _trackIsMuted = ParseScalar<bool>(value) ? 1 : 0;
+        }
+        else if (_path == "/Tracks/-/IsReadyForRecoding")
+        {
+            _trackIsReadyForRecording = ParseScalar<bool>(value) ? 1 : 0;
+        }
+        else if (_path == "/Tracks/-/Gain")
+        {
+            _trackGain = ParseScalar<float>(value);
+        }
+        else if (_path == "/Tracks/-/Pan")
+        {
+            _trackPan = ParseScalar<float>(value);
+        }
+        else if (_path == "/Tracks/-/Bus")
+        {
+            _trackBusIndex = ParseScalar<int>(value);
+        }
+        else if (_path == "/Master/Gain")
+        {
+            _masterGain = ParseScalar<float>(value);
+        }
+        else if (_path == "/Master/Pan")
+        {
+            _masterPan = ParseScalar<float>(value);
+        }
+        else if (_path == "/Buses/-/Name")
+        {
+            _pendingBuses.back().name = value;
+        }
+        else if (_path == "/Buses/-/Gain")
+        {
+            _pendingBuses.back().gain = ParseScalar<float>(value);
+        }
+        else if (_path == "/Buses/-/Pan")
+        {
+            _pendingBuses.back().pan = ParseScalar<float>(value);
+        }
+        else if (_path == "/Buses/-/Output")
+        {
+            _pendingBuses.back().outputIndex = ParseScalar<int>(value);
+        }
+        else if (_path == "/Tracks/-/Instrument/Name")
+        {
+            _instrument->SetName(value);
+        }
+        else if (_path == "/Tracks/-/Instrument/MidiChannel")
+        {
+            _instrument->SetMidiChannel(ParseScalar<int>(value));
+        }
+        else if (_path == "/Tracks/-/Instrument/Plugin/ModulePath" || _path == "/Tracks/-/Instrument/Effects/-/Plugin/ModulePath")
+        {
+            _pluginModulePath = value;
+        }
+        else if (_path == "/Tracks/-/Instrument/Plugin/PluginData" || _path == "/Tracks/-/Instrument/Effects/-/Plugin/PluginData")
+        {
+            _pluginData = value;
+        }
+        else if (_path == "/Tracks/-/Instrument/Plugin/SleepAllowed" || _path == "/Tracks/-/Instrument/Effects/-/Plugin/SleepAllowed")
+        {
+            _pluginSleepAllowed = ParseScalar<bool>(value);
+        }
+        else if (_path == "/Tracks/-/Regions/-/Start")
+        {
+            _regionStart = ParseScalar<std::chrono::milliseconds::rep>(value);
+        }
+        else if (_path == "/Tracks/-/Regions/-/Name")
+        {
+            _regionName = value;
+        }
+        else if (_path == "/Tracks/-/Regions/-/Length")
+        {
+            _regionLength = ParseScalar<std::chrono::milliseconds::rep>(value);
+        }
+        else if (_path == "/Tracks/-/Regions/-/Events/-/Start")
+        {
+            _eventStart = ParseScalar<std::chrono::milliseconds::rep>(value);
+        }
+        else if (_path == "/Tracks/-/Regions/-/Events/-/MidiEvents/-/Value")
+        {
+            _midiEvent.value = ParseScalar<uint32_t>(value);
+        }
+        else if (_path == "/Tracks/-/Regions/-/Events/-/MidiEvents/-/Channel")
+        {
+            _midiEvent.channel = ParseScalar<uint32_t>(value);
+        }
+        else if (_path == "/Tracks/-/Regions/-/Events/-/MidiEvents/-/Num")
+        {
+            _midiEvent.num = ParseScalar<uint32_t>(value);
+        }
+        else if (_path == "/Tracks/-/Regions/-/Events/-/MidiEvents/-/Type")
+        {
+            _midiEvent.type = MidiEventTypes(ParseScalar<int>(value));
+        }
     }
 
-    return instrument;
-}
+    void QueuePlugin(
+        int effectIndex)
+    {
+        if (_instrument == nullptr)
+        {
+            return;
+        }
 
-bool TracksSerializer::Deserialize(
-    const std::string &filepath)
-{
-    std::ifstream stream(filepath);
-    std::stringstream strStream;
-    strStream << stream.rdbuf();
+        _pluginLoadQueue.AddEncoded(_instrument, effectIndex, _pluginModulePath, std::move(_pluginData), _pluginSleepAllowed);
+        _pluginData = std::string();
+    }
 
-    YAML::Node data = YAML::Load(strStream.str());
-    if (!data["Song"])
+    uint32_t BusId(
+        int index) const
     {
-        spdlog::error("no song data found in {0}", filepath);
+        if (index < 0 || size_t(index) >= _busIds.size())
+        {
+            return MixerBus::Master;
+        }
 
-        return false;
+        return _busIds[size_t(index)];
     }
 
-    std::string songName = data["Song"].as<std::string>();
+    void AddBuses()
+    {
+        _tracks->GetMasterBus().SetGain(_masterGain);
+        _tracks->GetMasterBus().SetPan(_masterPan);
 
-    auto allTracksData = data["Tracks"];
+        // All buses are added before the outputs are set, a bus can output
+        // to a bus further down in the file
+        _busIds.clear();
+        for (auto &pending : _pendingBuses)
+        {
+            _busIds.push_back(_tracks->AddBus(pending.name));
+        }
 
-    for (const auto &trackData : allTracksData)
-    {
-        auto trackName = trackData["Name"].as<std::string>();
-        auto trackColor = trackData["Color"];
-        auto trackIsMuted = trackData["IsMuted"];
-        auto trackIsReadyForRecoding = trackData["IsReadyForRecoding"];
-        auto regionsData = trackData["Regions"];
+        for (size_t i = 0; i < _pendingBuses.size(); i++)
+        {
+            auto bus = _tracks->GetBus(_busIds[i]);
+            bus->SetGain(_pendingBuses[i].gain);
+            bus->SetPan(_pendingBuses[i].pan);
+            bus->SetOutputBus(BusId(_pendingBuses[i].outputIndex));
+        }
 
-        auto trackId = _tracks->AddTrack(trackName, DeserializeInstrument(trackData, _vstPluginService));
+        _pendingBuses.clear();
+    }
+
+    void AddTrack(
+        PendingTrack &pending)
+    {
+        auto trackId = _tracks->AddTrack(pending.name, pending.instrument);
         if (trackId == Track::Null)
         {
-            continue;
+            return;
         }
 
         auto &track = _tracks->GetTrack(trackId);
-        if (trackColor)
+        if (pending.hasColor)
         {
-            track.SetColor(trackColor.as<glm::vec4>());
+            track.SetColor(pending.color);
         }
-        if (trackIsMuted)
+        if (pending.isMuted >= 0)
         {
-            trackIsMuted.as<bool>() ? track.Mute() : track.Unmute();
+            pending.isMuted == 1 ? track.Mute() : track.Unmute();
         }
-        if (trackIsReadyForRecoding)
+        if (pending.isReadyForRecording >= 0)
         {
-            track.SetReadyForRecording(trackIsReadyForRecoding.as<bool>());
+            track.SetReadyForRecording(pending.isReadyForRecording == 1);
         }
+        track.SetGain(pending.gain);
+        track.SetPan(pending.pan);
+        track.SetOutputBus(BusId(pending.busIndex));
 
-        if (regionsData)
-        {
-            for (auto regionData : regionsData)
-            {
-                auto start = regionData["Start"].as<std::chrono::milliseconds::rep>();
-                auto name = regionData["Name"].as<std::string>();
-                auto length = regionData["Length"].as<std::chrono::milliseconds::rep>();
-                auto eventsData = regionData["Events"];
-
-                Region region;
-
-                region.SetName(name);
-                region.SetLength(length);
-
-                for (const auto &eventData : eventsData)
-                {
-                    auto start = eventData["Start"].as<std::chrono::milliseconds::rep>();
-                    auto midiEventsData = eventData["MidiEvents"];
-                    for (const auto &midiEventData : midiEventsData)
-                    {
-                        auto value = midiEventData["Value"].as<uint32_t>();
-                        auto num = midiEventData["Num"].as<uint32_t>();
-
-                        region.AddEvent(start, num, value > 0, value);
-                    }
-                }
-
-                track.AddRegion(start, region);
-            }
-        }
+        track.SetRegions(pending.regions);
+    }
+};
+
+bool TracksSerializer::Deserialize(
+    const std::string &filepath)
+{
+    std::vector<char> fileBuffer(fileBufferSize);
+    std::ifstream stream;
+    stream.rdbuf()->pubsetbuf(fileBuffer.data(), std::streamsize(fileBuffer.size()));
+    stream.open(filepath);
+
+    if (!stream.is_open())
+    {
+        spdlog::error("failed to open {0}", filepath);
+
+        return false;
     }
 
+    SongEventHandler handler(_tracks, _vstPluginService, _workerPool);
+
+    try
+    {
+        YAML::Parser parser(stream);
+
+        parser.HandleNextDocument(handler);
+    }
+    catch (const YAML::Exception &e)
+    {
+        spdlog::error("failed to parse {0}: {1}", filepath, e.what());
+
+        return false;
+    }
+
+    if (!handler.HasSong())
+    {
+        spdlog::error("no song data found in {0}", filepath);
+
+        return false;
+    }
+
+    handler.AddTracks();
+
     return true;
 }
+
+#ifdef TEST_YOUR_CODE
+#include "tracksmanager.h"
+#include <filesystem>
+#include <iostream>
+
+void TracksSerializer::Tests()
+{
+    auto filepath = (std::filesystem::temp_directory_path() / "vsthost-tracksserializer-test.yaml").string();
+
+    TracksManager source;
+    auto trackId = source.AddTrack("first", std::make_shared<Instrument>());
+    source.GetTrack(trackId).Mute();
+    source.GetTrack(trackId).SetColor(0.25f, 0.5f, 0.75f, 1.0f);
+    auto secondId = source.AddTrack("second", nullptr);
+
+    auto drums = source.AddBus("drums");
+    auto group = source.AddBus("group");
+    source.GetBus(drums)->SetOutputBus(group);
+    source.GetBus(group)->SetGain(0.5f);
+    source.GetMasterBus().SetPan(0.25f);
+    source.GetTrack(secondId).SetGain(0.75f);
+    source.GetTrack(secondId).SetPan(-0.5f);
+    source.GetTrack(secondId).SetOutputBus(drums);
+
+    Region region;
+    region.SetName("intro");
+    region.AddEvent(0, 60, true, 100);
+    region.AddEvent(1000, 60, false, 0);
+    region.AddEvent(1000, 64, true, 90);
+    region.SetLength(32000);
+    source.GetTrack(trackId).AddRegion(4000, region);
+    source.GetTrack(trackId).AddRegion(64000, Region());
+
+    TracksSerializer(&source, nullptr).Serialize(filepath);
+
+    TracksManager target;
+    if (!TracksSerializer(&target, nullptr).Deserialize(filepath))
+    {
+        std::cout << "Deserialize failed to read " << filepath << std::endl;
+    }
+
+    auto &tracks = target.GetTracks();
+    if (tracks.size() != 2 || tracks[0].GetName() != "first" || tracks[1].GetName() != "second")
+    {
+        std::cout << "Deserialize loaded " << tracks.size() << " tracks, expected first and second" << std::endl;
+
+        return;
+    }
+
+    if (!tracks[0].IsMuted() || tracks[1].IsMuted() || tracks[0].GetColor()[2] != 0.75f || tracks[0].GetInstrument() == nullptr)
+    {
+        std::cout << "Deserialize did not restore the track settings" << std::endl;
+    }
+
+    auto &buses = target.GetBuses();
+    if (buses.size() != 2 || buses[0].GetName() != "drums" || buses[0].GetOutputBus() != buses[1].Id() || buses[1].GetGain() != 0.5f || buses[1].GetOutputBus() != MixerBus::Master ||
+        target.GetMasterBus().GetPan() != 0.25f || tracks[1].GetGain() != 0.75f || tracks[1].GetPan() != -0.5f || tracks[1].GetOutputBus() != buses[0].Id() || tracks[0].GetOutputBus() != MixerBus::Master)
+    {
+        std::cout << "Deserialize did not restore the mixer" << std::endl;
+    }
+
+    auto &regions = tracks[0].Regions();
+    if (regions.size() != 2 || regions.count(4000) == 0 || regions.count(64000) == 0)
+    {
+        std::cout << "Deserialize loaded " << regions.size() << " regions, expected 2" << std::endl;
+
+        return;
+    }
+
+    auto &loaded = regions.at(4000);
+    auto &expected = region.SortedEvents();
+    auto &actual = loaded.SortedEvents();
+
+    bool same = expected.size() == actual.size();
+    for (size_t i = 0; same && i < expected.size(); i++)
+    {
+        same = expected[i].time == actual[i].time && expected[i].num == actual[i].num && expected[i].value == actual[i].value;
+    }
+
+    if (!same || loaded.GetName() != "intro" || loaded.Length() != 32000)
+    {
+        std::cout << "Deserialize did not restore the region" << std::endl;
+    }
+
+    std::filesystem::remove(filepath);
+}
+#endif
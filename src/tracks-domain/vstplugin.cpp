@@ -1,5 +1,8 @@
 #include <vstplugin.h>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
 #include <stdexcept>
@@ -23,11 +26,16 @@
         x = nullptr;    \
     }
 
-VstPlugin::VstPlugin() = default;
+VstPlugin::VstPlugin()
+{
+    // Reserve everything processEvents() needs up front, so the audio thread never allocates
+    _vstMidiEvents.reserve(MAX_PENDING_MIDI_EVENTS);
+    _vstEventBuffer.resize(sizeof(VstEvents) + sizeof(VstEvent *) * MAX_PENDING_MIDI_EVENTS);
+}
 
 VstPlugin::~VstPlugin()
 {
-    if (_vstLibraryHandle != NULL)
+    if (_aEffect != nullptr || _module != nullptr)
     {
         cleanup();
     }
@@ -160,6 +168,7 @@ intptr_t VstPlugin::dispatcher(
     return _aEffect->dispatcher(_aEffect, opcode, index, value, ptr, opt);
 }
 
+#ifdef _WIN32
 void VstPlugin::resizeEditor(
     const RECT &clientRc) const
 {
@@ -274,6 +283,13 @@ void VstPlugin::openEditor(
     ShowWindow(_editorHwnd, SW_SHOW);
 }
 
+#else
+void VstPlugin::openEditor(
+    HWND)
+{
+}
+#endif
+
 bool VstPlugin::isEditorOpen()
 {
     return _editorHwnd != nullptr;
@@ -281,53 +297,108 @@ bool VstPlugin::isEditorOpen()
 
 void VstPlugin::closeEditor()
 {
+#ifdef _WIN32
     HWND tmp = _editorHwnd;
     closingEditorWindow();
     DestroyWindow(tmp);
+#endif
 }
 
 void VstPlugin::closingEditorWindow()
 {
     dispatcher(effEditClose, 0, 0, _editorHwnd);
     _editorHwnd = nullptr;
+    _editorCloseCount++;
+}
+
+uint64_t VstPlugin::getEditorCloseCount() const
+{
+    return _editorCloseCount;
 }
 
 void VstPlugin::sendMidiNote(
     int midiChannel,
     int noteNumber,
     bool onOff,
-    int velocity)
+    int velocity,
+    int deltaFrames)
 {
     VstMidiEvent e{};
     e.type = kVstMidiType;
     e.byteSize = sizeof(e);
     e.flags = kVstMidiEventIsRealtime;
+    e.deltaFrames = std::max(0, deltaFrames);
     e.midiData[0] = static_cast<char>(midiChannel + (onOff ? 0x90 : 0x80));
     e.midiData[1] = static_cast<char>(noteNumber);
     e.midiData[2] = static_cast<char>(velocity);
-    if (auto l = _vstMidi.lock())
+
+    if (!_vstMidi.Push(e))
+    {
+        _vstMidiOverflowCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void VstPlugin::sendMidiController(
+    int midiChannel,
+    int controller,
+    int value,
+    int deltaFrames)
+{
+    VstMidiEvent e{};
+    e.type = kVstMidiType;
+    e.byteSize = sizeof(e);
+    e.flags = kVstMidiEventIsRealtime;
+    e.deltaFrames = std::max(0, deltaFrames);
+    e.midiData[0] = static_cast<char>(midiChannel + 0xB0);
+    e.midiData[1] = static_cast<char>(controller);
+    e.midiData[2] = static_cast<char>(value);
+
+    if (!_vstMidi.Push(e))
     {
-        (void)l;
-        _vstMidi.events.push_back(e);
+        _vstMidiOverflowCount.fetch_add(1, std::memory_order_relaxed);
     }
 }
 
-// This function is called from refillCallback() which is running in audio thread.
+uint32_t VstPlugin::getMidiOverflowCount() const
+{
+    return _vstMidiOverflowCount.load(std::memory_order_relaxed);
+}
+
+// This function is called from the audio thread.
 void VstPlugin::processEvents()
 {
-    _vstMidiEvents.clear();
+    VstMidiEvent e;
+    while (_vstMidiEvents.size() < MAX_PENDING_MIDI_EVENTS && _vstMidi.Pop(e))
+    {
+        // Events mostly arrive in order, so this is usually an append. The
+        // vector has reserved room for all events and will not allocate.
+        auto pos = std::upper_bound(
+            _vstMidiEvents.begin(),
+            _vstMidiEvents.end(),
+            e.deltaFrames,
+            [](VstInt32 deltaFrames, const VstMidiEvent &pending) { return deltaFrames < pending.deltaFrames; });
+
+        _vstMidiEvents.insert(pos, e);
+    }
+}
+
+// This function is called from the audio thread.
+bool VstPlugin::hasPendingMidiEvents() const
+{
+    return !_vstMidiEvents.empty();
+}
 
-    if (auto l = _vstMidi.lock())
+size_t VstPlugin::dispatchPendingEvents(
+    size_t frameCount)
+{
+    size_t n = 0;
+    while (n < _vstMidiEvents.size() && size_t(_vstMidiEvents[n].deltaFrames) < frameCount)
     {
-        (void)l;
-        std::swap(_vstMidiEvents, _vstMidi.events);
+        n++;
     }
 
-    if (!_vstMidiEvents.empty())
+    if (n > 0)
     {
-        const auto n = _vstMidiEvents.size();
-        const auto bytes = sizeof(VstEvents) + sizeof(VstEvent *) * n;
-        _vstEventBuffer.resize(bytes);
         auto *ve = reinterpret_cast<VstEvents *>(_vstEventBuffer.data());
         ve->numEvents = static_cast<int>(n);
         ve->reserved = 0;
@@ -337,20 +408,82 @@ void VstPlugin::processEvents()
         }
         dispatcher(effProcessEvents, 0, 0, ve);
     }
+
+    return n;
+}
+
+void VstPlugin::releaseDispatchedEvents(
+    size_t dispatchedCount,
+    size_t frameCount)
+{
+    if (_vstMidiEvents.empty())
+    {
+        return;
+    }
+
+    _vstMidiEvents.erase(_vstMidiEvents.begin(), _vstMidiEvents.begin() + dispatchedCount);
+
+    // The remaining events belong to a later chunk
+    for (auto &pending : _vstMidiEvents)
+    {
+        pending.deltaFrames -= static_cast<VstInt32>(frameCount);
+    }
 }
 
-// This function is called from refillCallback() which is running in audio thread.
-float **VstPlugin::processAudio(
-    size_t frameCount,
-    size_t &outputFrameCount)
+// This function is called from the audio thread.
+size_t VstPlugin::processAudio(
+    float **inputs,
+    float **outputs,
+    size_t frameCount)
 {
-    frameCount = std::min<size_t>(frameCount, _outputBuffer.size() / getChannelCount());
+    frameCount = std::min<size_t>(frameCount, getBlockSize());
+
+    auto dispatchedCount = dispatchPendingEvents(frameCount);
 
-    _aEffect->processReplacing(_aEffect, _inputBufferHeads.data(), _outputBufferHeads.data(), static_cast<int>(frameCount));
+    _aEffect->processReplacing(_aEffect, inputs, outputs, static_cast<int>(frameCount));
     _samplePos += frameCount;
-    outputFrameCount = frameCount;
 
-    return _outputBufferHeads.data();
+    // The plugin may keep pointers to the events until processReplacing()
+    // returns, so they are only removed now
+    releaseDispatchedEvents(dispatchedCount, frameCount);
+
+    return frameCount;
+}
+
+// This function is called from the audio thread.
+void VstPlugin::skipAudio(
+    size_t frameCount)
+{
+    _samplePos += frameCount;
+}
+
+bool VstPlugin::isSleepAllowed() const
+{
+    return _sleepAllowed.load(std::memory_order_relaxed);
+}
+
+void VstPlugin::setSleepAllowed(
+    bool allowed)
+{
+    _sleepAllowed.store(allowed, std::memory_order_relaxed);
+}
+
+size_t VstPlugin::getTailFrames() const
+{
+    // 0 means the plugin does not know, 1 that it has no tail
+    auto tailSize = dispatcher(effGetTailSize);
+
+    if (tailSize > 1)
+    {
+        return size_t(tailSize);
+    }
+
+    if (tailSize == 1 || getFlags(effFlagsNoSoundInStop))
+    {
+        return 0;
+    }
+
+    return getSampleRate() * (flagsIsSynth() ? UNKNOWN_INSTRUMENT_TAIL_MS : UNKNOWN_EFFECT_TAIL_MS) / 1000;
 }
 
 bool VstPlugin::init(
@@ -358,6 +491,7 @@ bool VstPlugin::init(
 {
     _modulePath = ConvertFromBytes(vstModulePath);
 
+#ifdef _WIN32
     {
         wchar_t buf[MAX_PATH + 1];
         wchar_t *namePtr = nullptr;
@@ -385,30 +519,47 @@ bool VstPlugin::init(
 
         return false;
     }
+#else
+    _moduleDirectory = std::filesystem::absolute(std::filesystem::path(vstModulePath)).parent_path().string() + "/";
+#endif
 
-    _vstLibraryHandle = LoadLibrary(_modulePath.c_str());
+    // Every plugin of the same module shares one loaded library
+    _module = PluginModule::Load(_modulePath);
 
-    if (!_vstLibraryHandle)
+    if (_module == nullptr)
     {
-        std::wcerr << L"Can't open VST DLL" << std::endl;
+        std::wcerr << L"Can't open VST module" << std::endl;
 
         return false;
     }
 
-    typedef AEffect *(VstEntryProc)(audioMasterCallback);
-    auto *vstEntryProc = reinterpret_cast<VstEntryProc *>(GetProcAddress(_vstLibraryHandle, "VSTPluginMain"));
-    if (!vstEntryProc)
-    {
-        vstEntryProc = reinterpret_cast<VstEntryProc *>(GetProcAddress(_vstLibraryHandle, "main"));
-    }
+    auto *vstEntryProc = reinterpret_cast<VstEntryProc *>(_module->EntryProc());
 
     if (!vstEntryProc)
     {
         std::wcerr << L"VST's entry point not found" << std::endl;
 
+        _module = nullptr;
+
         return false;
     }
 
+    return initEffect(vstEntryProc);
+}
+
+bool VstPlugin::init(
+    VstEntryProc *vstEntryProc,
+    const char *name)
+{
+    _modulePath = ConvertFromBytes(name);
+    _moduleDirectory.clear();
+
+    return initEffect(vstEntryProc);
+}
+
+bool VstPlugin::initEffect(
+    VstEntryProc *vstEntryProc)
+{
     _aEffect = vstEntryProc(hostCallback_static);
 
     if (!(_aEffect && _aEffect->magic == kEffectMagic))
@@ -422,18 +573,7 @@ bool VstPlugin::init(
 
     std::wcout << _modulePath << std::endl;
     std::cout << "_aEffect->numInputs : " << _aEffect->numInputs << std::endl;
-    _inputBuffer.resize(static_cast<size_t>(_aEffect->numInputs) * getBlockSize());
-    for (int i = 0; i < _aEffect->numInputs; ++i)
-    {
-        _inputBufferHeads.push_back(&_inputBuffer[static_cast<size_t>(i) * getBlockSize()]);
-    }
-
     std::cout << "_aEffect->numOutputs : " << _aEffect->numOutputs << std::endl;
-    _outputBuffer.resize(static_cast<size_t>(_aEffect->numOutputs) * getBlockSize());
-    for (int i = 0; i < _aEffect->numOutputs; ++i)
-    {
-        _outputBufferHeads.push_back(&_outputBuffer[static_cast<size_t>(i) * getBlockSize()]);
-    }
 
     dispatcher(effOpen);
     dispatcher(effSetSampleRate, 0, 0, nullptr, static_cast<float>(getSampleRate()));
@@ -460,15 +600,17 @@ void VstPlugin::cleanup()
         dispatcher(effEditClose);
         _editorHwnd = nullptr;
     }
-     dispatcher(effStopProcess);
-    //  dispatcher(effMainsChanged, 0, 0);
-    dispatcher(effClose);
 
-    if (_vstLibraryHandle)
+    if (_aEffect != nullptr)
     {
-        FreeLibrary(_vstLibraryHandle);
-        _vstLibraryHandle = nullptr;
+        dispatcher(effStopProcess);
+        //  dispatcher(effMainsChanged, 0, 0);
+        dispatcher(effClose);
+        _aEffect = nullptr;
     }
+
+    // The library is unloaded with its last plugin
+    _module = nullptr;
 }
 
 VstIntPtr VstPlugin::hostCallback_static(
@@ -541,12 +683,12 @@ VstIntPtr VstPlugin::hostCallback(
         }
         case audioMasterGetVendorString:
         {
-            strcpy_s(static_cast<char *>(ptr), kVstMaxVendorStrLen, getVendorString());
+            snprintf(static_cast<char *>(ptr), kVstMaxVendorStrLen, "%s", getVendorString());
             return 1;
         }
         case audioMasterGetProductString:
         {
-            strcpy_s(static_cast<char *>(ptr), kVstMaxProductStrLen, getProductString());
+            snprintf(static_cast<char *>(ptr), kVstMaxProductStrLen, "%s", getProductString());
             return 1;
         }
         case audioMasterGetTime:
@@ -570,6 +712,7 @@ VstIntPtr VstPlugin::hostCallback(
         }
         case audioMasterSizeWindow:
         {
+#ifdef _WIN32
             if (_editorHwnd != nullptr)
             {
                 RECT rc;
@@ -580,6 +723,7 @@ VstIntPtr VstPlugin::hostCallback(
 
                 // resizeEditor(rc);
             }
+#endif
             break;
         }
         case audioMasterCanDo:
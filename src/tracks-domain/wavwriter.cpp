@@ -0,0 +1,120 @@
+#include "wavwriter.h"
+
+#include <algorithm>
+#include <limits>
+#include <spdlog/spdlog.h>
+
+const uint16_t waveFormatIeeeFloat = 3;
+const size_t fileBufferSize = 1024 * 1024;
+
+WavWriter::WavWriter() = default;
+
+WavWriter::~WavWriter()
+{
+    Close();
+}
+
+bool WavWriter::Open(
+    const std::string &filepath,
+    uint32_t sampleRate,
+    uint16_t channelCount)
+{
+    Close();
+
+    _fileBuffer.resize(fileBufferSize);
+    _file.rdbuf()->pubsetbuf(_fileBuffer.data(), _fileBuffer.size());
+    _file.open(filepath, std::ios::binary | std::ios::trunc);
+
+    if (!_file.is_open())
+    {
+        spdlog::error("failed to open {0} for writing", filepath);
+
+        return false;
+    }
+
+    _sampleRate = sampleRate;
+    _channelCount = channelCount;
+    _frameCount = 0;
+
+    // Written again with the final sizes when the file is closed
+    WriteHeader();
+
+    return _file.good();
+}
+
+bool WavWriter::Write(
+    const float *interleavedData,
+    uint32_t frameCount)
+{
+    if (!_file.is_open())
+    {
+        return false;
+    }
+
+    _file.write(
+        reinterpret_cast<const char *>(interleavedData),
+        std::streamsize(frameCount) * _channelCount * sizeof(float));
+
+    _frameCount += frameCount;
+
+    return _file.good();
+}
+
+bool WavWriter::Close()
+{
+    if (!_file.is_open())
+    {
+        return false;
+    }
+
+    _file.seekp(0);
+    WriteHeader();
+
+    auto result = _file.good();
+
+    _file.close();
+
+    return result;
+}
+
+bool WavWriter::IsOpen() const
+{
+    return _file.is_open();
+}
+
+template <typename T>
+void WriteValue(
+    std::ofstream &file,
+    T value)
+{
+    file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void WavWriter::WriteHeader()
+{
+    const uint16_t bitsPerSample = 32;
+    const uint16_t blockAlign = _channelCount * (bitsPerSample / 8);
+    const uint64_t dataSize = _frameCount * blockAlign;
+    const uint32_t clampedDataSize = uint32_t(std::min<uint64_t>(dataSize, std::numeric_limits<uint32_t>::max() - 50));
+
+    _file.write("RIFF", 4);
+    WriteValue<uint32_t>(_file, 4 + (8 + 16) + (8 + 4) + (8 + clampedDataSize));
+    _file.write("WAVE", 4);
+
+    _file.write("fmt ", 4);
+    WriteValue<uint32_t>(_file, 16);
+    WriteValue<uint16_t>(_file, waveFormatIeeeFloat);
+    WriteValue<uint16_t>(_file, _channelCount);
+    WriteValue<uint32_t>(_file, _sampleRate);
+    WriteValue<uint32_t>(_file, _sampleRate * blockAlign);
+    WriteValue<uint16_t>(_file, blockAlign);
+    WriteValue<uint16_t>(_file, bitsPerSample);
+
+    // non-PCM formats require a fact chunk
+    _file.write("fact", 4);
+    WriteValue<uint32_t>(_file, 4);
+    WriteValue<uint32_t>(_file, uint32_t(std::min<uint64_t>(_frameCount, std::numeric_limits<uint32_t>::max())));
+
+    _file.write("data", 4);
+    WriteValue<uint32_t>(_file, clampedDataSize);
+}
@@ -0,0 +1,136 @@
+#include "workerpool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+static thread_local size_t s_workerIndex = 0;
+
+WorkerPool::WorkerPool(
+    size_t threadCount,
+    bool realtime)
+    : _realtime(realtime)
+{
+    _threads.reserve(threadCount);
+
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        _threads.emplace_back([this, i]() { WorkerLoop(i + 1); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    _stopping.store(true, std::memory_order_release);
+    _generation.fetch_add(1, std::memory_order_release);
+    _generation.notify_all();
+
+    for (auto &thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+size_t WorkerPool::DefaultThreadCount()
+{
+    auto cores = size_t(std::thread::hardware_concurrency());
+
+    return cores > 1 ? cores - 1 : 0;
+}
+
+size_t WorkerPool::ThreadCount() const
+{
+    return _threads.size();
+}
+
+size_t WorkerPool::WorkerIndex()
+{
+    return s_workerIndex;
+}
+
+void WorkerPool::Run(
+    size_t taskCount,
+    TaskFunc func,
+    void *context)
+{
+    if (taskCount == 0)
+    {
+        return;
+    }
+
+    if (_threads.empty() || taskCount == 1)
+    {
+        for (size_t i = 0; i < taskCount; i++)
+        {
+            func(context, i);
+        }
+
+        return;
+    }
+
+    _taskCount = taskCount;
+    _func = func;
+    _context = context;
+    _nextTask.store(0, std::memory_order_relaxed);
+    _busyWorkers.store(uint32_t(_threads.size()), std::memory_order_relaxed);
+
+    _generation.fetch_add(1, std::memory_order_release);
+    _generation.notify_all();
+
+    ExecuteTasks();
+
+    // Every worker checks in once per generation, after that no worker
+    // touches the task state and the next Run() can safely overwrite it.
+    auto busy = _busyWorkers.load(std::memory_order_acquire);
+    while (busy != 0)
+    {
+        _busyWorkers.wait(busy, std::memory_order_acquire);
+        busy = _busyWorkers.load(std::memory_order_acquire);
+    }
+}
+
+void WorkerPool::ExecuteTasks()
+{
+    auto index = _nextTask.fetch_add(1, std::memory_order_relaxed);
+
+    while (index < _taskCount)
+    {
+        _func(_context, index);
+
+        index = _nextTask.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void WorkerPool::WorkerLoop(
+    size_t workerIndex)
+{
+    s_workerIndex = workerIndex;
+
+#ifdef _WIN32
+    // The workers render audio, they should not be preempted by the UI
+    if (_realtime)
+    {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+    }
+#endif
+
+    uint32_t generation = 0;
+
+    while (true)
+    {
+        _generation.wait(generation, std::memory_order_acquire);
+        generation = _generation.load(std::memory_order_acquire);
+
+        if (_stopping.load(std::memory_order_acquire))
+        {
+            return;
+        }
+
+        ExecuteTasks();
+
+        if (_busyWorkers.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            _busyWorkers.notify_one();
+        }
+    }
+}
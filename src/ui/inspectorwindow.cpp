@@ -5,6 +5,9 @@
 #include "instrument.h"
 #include "ipluginservice.h"
 
+#include <algorithm>
+#include <cmath>
+
 void InspectorWindow::SetState(
     State *state)
 {
@@ -24,9 +27,21 @@ void InspectorWindow::SetMidiIn(
 }
 
 void InspectorWindow::SetAudioOut(
-    struct Wasapi *wasapi)
+    AudioDevice *audioOut)
+{
+    _audioOut = audioOut;
+}
+
+void InspectorWindow::SetAudioTelemetry(
+    AudioTelemetry *audioTelemetry)
+{
+    _audioTelemetry = audioTelemetry;
+}
+
+void InspectorWindow::SetTracksRenderer(
+    TracksRenderer *tracksRenderer)
 {
-    _wasapi = wasapi;
+    _tracksRenderer = tracksRenderer;
 }
 
 void InspectorWindow::SetVstPluginLoader(
@@ -35,25 +50,56 @@ void InspectorWindow::SetVstPluginLoader(
     _vstPluginLoader = loader;
 }
 
+const int pluginsPerPage = 100;
+
 std::vector<struct PluginDescription> InspectorWindow::PluginLibrary(
     const char *id,
     std::function<void(const std::shared_ptr<class VstPlugin> &)> onPLuginSelected,
     std::vector<struct PluginDescription> &plugins,
-    std::function<bool(const struct PluginDescription &)> filter)
+    PluginQuery::Kinds kind)
 {
     static std::string vendorNameFilter;
+    static char searchBuffer[128] = {0};
+    static int pageCount = 1;
+
+    // The filters are applied by the plugin library, only the pages that
+    // are shown are loaded
+    auto queryPlugins = [&]() {
+        PluginQuery query;
+        query.kind = kind;
+        query.vendorName = vendorNameFilter;
+        query.search = searchBuffer;
+        query.limit = pluginsPerPage * pageCount;
+
+        plugins = _vstPluginLoader->QueryPlugins(query);
+    };
 
     if (ImGui::BeginPopup(id))
     {
+        // The library fills up while the plugin scan runs
+        if (ImGui::IsWindowAppearing())
+        {
+            pageCount = 1;
+            queryPlugins();
+        }
+
         if (ImGui::Button("Add form disk"))
         {
             auto plugin = _vstPluginLoader->LoadFromFileDialog();
             if (plugin != nullptr)
             {
-                plugins = _vstPluginLoader->ListPlugins(filter);
+                queryPlugins();
             }
         }
 
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(250);
+        if (ImGui::InputText("Search", searchBuffer, sizeof(searchBuffer)))
+        {
+            pageCount = 1;
+            queryPlugins();
+        }
+
         ImGui::Text("Filter by vendor: %s", vendorNameFilter.c_str());
 
         if (!vendorNameFilter.empty())
@@ -62,11 +108,12 @@ std::vector<struct PluginDescription> InspectorWindow::PluginLibrary(
             if (ImGui::SmallButton("X"))
             {
                 vendorNameFilter = "";
-                plugins = _vstPluginLoader->ListPlugins(filter);
+                pageCount = 1;
+                queryPlugins();
             }
         }
 
-        if (ImGui::BeginTable("table1", 6, 0, ImVec2(700, 200)))
+        if (ImGui::BeginTable("table1", 6, ImGuiTableFlags_ScrollY, ImVec2(700, 200)))
         {
             ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_WidthStretch, 0.3f);
             ImGui::TableSetupColumn("Vendor", ImGuiTableColumnFlags_WidthStretch, 0.2f);
@@ -91,7 +138,7 @@ std::vector<struct PluginDescription> InspectorWindow::PluginLibrary(
                     {
                         onPLuginSelected(plugin);
 
-                        plugins = _vstPluginLoader->ListPlugins(filter);
+                        queryPlugins();
                         ImGui::CloseCurrentPopup();
                     }
                 }
@@ -116,15 +163,26 @@ std::vector<struct PluginDescription> InspectorWindow::PluginLibrary(
 
                 ImGui::PopID();
             }
+
+            // A full page means there can be more
+            if (plugins.size() == size_t(pluginsPerPage * pageCount))
+            {
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                if (ImGui::SmallButton("Show more"))
+                {
+                    pageCount++;
+                    queryPlugins();
+                }
+            }
+
             ImGui::EndTable();
 
             if (!changeVendorNameFilter.empty())
             {
                 vendorNameFilter = changeVendorNameFilter;
-                plugins = _vstPluginLoader->ListPlugins(
-                    [&](struct PluginDescription d) {
-                        return filter(d) && vendorNameFilter == d.vendorName;
-                    });
+                pageCount = 1;
+                queryPlugins();
             }
         }
 
@@ -138,6 +196,226 @@ std::vector<struct PluginDescription> InspectorWindow::PluginLibrary(
     return plugins;
 }
 
+void InspectorWindow::RenderPerformance()
+{
+    // About the last few seconds of audio
+    const size_t callbackCount = 256;
+
+    auto callbacks = _audioTelemetry->Callbacks(callbackCount);
+    auto summary = AudioTelemetry::Summarize(callbacks);
+
+    ImGui::Text("DSP load: %.0f%% average, %.0f%% peak", summary.averageLoad * 100.0, summary.peakLoad * 100.0);
+    ImGui::Text("Deadline misses: %llu", static_cast<unsigned long long>(_audioTelemetry->DeadlineMissCount()));
+
+    std::vector<float> loads;
+    loads.reserve(callbacks.size());
+    for (auto &callback : callbacks)
+    {
+        loads.push_back(float(callback.Load() * 100.0));
+    }
+
+    ImGui::PlotLines("##load", loads.data(), int(loads.size()), 0, "load %", 0.0f, 100.0f, ImVec2(-1, 60));
+
+    if (_tracksRenderer == nullptr)
+    {
+        return;
+    }
+
+    struct PluginTime
+    {
+        int64_t totalNs = 0;
+        int64_t peakNs = 0;
+        int64_t count = 0;
+    };
+
+    // Only the plugin records of the callbacks that are shown
+    auto firstCallback = callbacks.empty() ? 0 : callbacks.front().index;
+    std::map<uintptr_t, PluginTime> pluginTimes;
+    for (auto &record : _audioTelemetry->Plugins(AudioTelemetry::PluginCapacity))
+    {
+        if (record.callbackIndex < firstCallback)
+        {
+            continue;
+        }
+
+        auto &time = pluginTimes[record.plugin];
+        time.totalNs += record.durationNs;
+        time.peakNs = std::max(time.peakNs, record.durationNs);
+        time.count++;
+    }
+
+    auto pluginNames = _tracksRenderer->PluginNames();
+
+    if (ImGui::BeginTable("plugintimes", 3))
+    {
+        ImGui::TableSetupColumn("Plugin", ImGuiTableColumnFlags_WidthStretch, 0.6f);
+        ImGui::TableSetupColumn("Avg us", ImGuiTableColumnFlags_WidthStretch, 0.2f);
+        ImGui::TableSetupColumn("Peak us", ImGuiTableColumnFlags_WidthStretch, 0.2f);
+        ImGui::TableHeadersRow();
+
+        for (auto &pluginName : pluginNames)
+        {
+            auto time = pluginTimes.find(pluginName.first);
+            if (time == pluginTimes.end())
+            {
+                continue;
+            }
+
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", pluginName.second.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%.0f", time->second.totalNs / 1000.0 / time->second.count);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.0f", time->second.peakNs / 1000.0);
+        }
+
+        ImGui::EndTable();
+    }
+
+    if (ImGui::Button("Dump trace"))
+    {
+        _audioTelemetry->DumpTrace("c:\\temp\\audio-trace.json", pluginNames);
+    }
+}
+
+// The faders go down to -60dB, below that they are silent
+static const float minimumDb = -60.0f;
+static const float maximumDb = 12.0f;
+
+static float GainToDb(
+    float gain)
+{
+    return gain > 0.0f ? std::max(minimumDb, 20.0f * std::log10(gain)) : minimumDb;
+}
+
+static float DbToGain(
+    float db)
+{
+    return db <= minimumDb ? 0.0f : std::pow(10.0f, db / 20.0f);
+}
+
+bool InspectorWindow::RenderFader(
+    float width,
+    float height,
+    float &gain,
+    float &pan)
+{
+    bool activated = false;
+
+    ImGui::SetNextItemWidth(width);
+    ImGui::SliderFloat("##pan", &pan, -1.0f, 1.0f, pan == 0.0f ? "center" : (pan < 0.0f ? "L %.2f" : "R %.2f"));
+    activated |= ImGui::IsItemActivated();
+
+    auto db = GainToDb(gain);
+    if (ImGui::VSliderFloat("##gain", ImVec2(width, height), &db, minimumDb, maximumDb, db <= minimumDb ? "-inf" : "%.1f dB"))
+    {
+        gain = DbToGain(db);
+    }
+    activated |= ImGui::IsItemActivated();
+
+    return activated;
+}
+
+bool InspectorWindow::RenderOutputBus(
+    float width,
+    uint32_t &busId,
+    uint32_t excludedBusId)
+{
+    auto current = _tracks->GetBus(busId);
+    bool changed = false;
+
+    ImGui::SetNextItemWidth(width);
+    if (ImGui::BeginCombo("##output", current != nullptr ? current->GetName().c_str() : "Master"))
+    {
+        if (ImGui::Selectable(_tracks->GetMasterBus().GetName().c_str(), busId == MixerBus::Master))
+        {
+            busId = MixerBus::Master;
+            changed = true;
+        }
+
+        for (auto &bus : _tracks->GetBuses())
+        {
+            if (bus.Id() == excludedBusId)
+            {
+                continue;
+            }
+
+            ImGui::PushID(int(bus.Id()));
+            if (ImGui::Selectable(bus.GetName().c_str(), busId == bus.Id()))
+            {
+                busId = bus.Id();
+                changed = true;
+            }
+            ImGui::PopID();
+        }
+
+        ImGui::EndCombo();
+    }
+
+    return changed;
+}
+
+void InspectorWindow::RenderBuses()
+{
+    static char nameBuffer[128] = {0};
+
+    uint32_t removedBusId = MixerBus::Master;
+    const auto width = ImGui::GetContentRegionAvail().x;
+
+    for (auto &bus : _tracks->GetBuses())
+    {
+        ImGui::PushID(int(bus.Id()));
+
+        strcpy_s(nameBuffer, 128, bus.GetName().c_str());
+        ImGui::SetNextItemWidth(width - ImGui::GetFrameHeight() - ImGui::GetStyle().ItemSpacing.x);
+        if (ImGui::InputText("##name", nameBuffer, 128))
+        {
+            bus.SetName(nameBuffer);
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button("X", ImVec2(ImGui::GetFrameHeight(), 0)))
+        {
+            removedBusId = bus.Id();
+        }
+
+        auto db = GainToDb(bus.GetGain());
+        ImGui::SetNextItemWidth(width / 2);
+        if (ImGui::SliderFloat("##gain", &db, minimumDb, maximumDb, db <= minimumDb ? "-inf" : "%.1f dB"))
+        {
+            bus.SetGain(DbToGain(db));
+        }
+
+        ImGui::SameLine();
+        auto pan = bus.GetPan();
+        ImGui::SetNextItemWidth(-1);
+        if (ImGui::SliderFloat("##pan", &pan, -1.0f, 1.0f, pan == 0.0f ? "center" : (pan < 0.0f ? "L %.2f" : "R %.2f")))
+        {
+            bus.SetPan(pan);
+        }
+
+        auto output = bus.GetOutputBus();
+        if (RenderOutputBus(width, output, bus.Id()))
+        {
+            bus.SetOutputBus(output);
+        }
+
+        ImGui::Separator();
+        ImGui::PopID();
+    }
+
+    if (removedBusId != MixerBus::Master)
+    {
+        _tracks->RemoveBus(removedBusId);
+    }
+
+    if (ImGui::Button("Add bus"))
+    {
+        _tracks->AddBus("Bus " + std::to_string(_tracks->GetBuses().size() + 1));
+    }
+}
+
 void InspectorWindow::Render(
     ImVec2 const &pos,
     ImVec2 const &size)
@@ -184,17 +462,18 @@ void InspectorWindow::Render(
             }
         }
 
-        if (_wasapi != nullptr && ImGui::CollapsingHeader("Audio out"))
+        if (_audioOut != nullptr && ImGui::CollapsingHeader("Audio out"))
         {
-            const std::string activeDevice(_wasapi->CurrentDevice().begin(), _wasapi->CurrentDevice().end());
+            const std::string activeDevice(_audioOut->CurrentDevice().begin(), _audioOut->CurrentDevice().end());
             ImGui::Text("Active Audio Device:");
             ImGui::BulletText("%s", activeDevice.c_str());
+            ImGui::Text("Latency: %.1f ms", _audioOut->LatencyMs());
 
             ImGui::Text("Other Audio Devices");
             ImGui::BeginGroup();
-            for (auto &d : _wasapi->Devices())
+            for (auto &d : _audioOut->Devices())
             {
-                if (d == _wasapi->CurrentDevice())
+                if (d == _audioOut->CurrentDevice())
                 {
                     continue;
                 }
@@ -206,6 +485,16 @@ void InspectorWindow::Render(
             ImGui::EndGroup();
         }
 
+        if (_audioTelemetry != nullptr && ImGui::CollapsingHeader("Performance"))
+        {
+            RenderPerformance();
+        }
+
+        if (ImGui::CollapsingHeader("Buses"))
+        {
+            RenderBuses();
+        }
+
         auto trackId = std::get<uint32_t>(_tracks->GetActiveRegion());
         if (trackId != Track::Null && trackId == _tracks->GetActiveTrackId())
         {
@@ -232,8 +521,14 @@ void InspectorWindow::Render(
                         ImGui::SetKeyboardFocusHere();
                         if (ImGui::InputText("##editName", _editRegionNameBuffer, 128, ImGuiInputTextFlags_EnterReturnsTrue))
                         {
-                            _state->_historyManager.AddEntry("Change region name");
-                            region.SetName(_editRegionNameBuffer);
+                            auto edit = std::make_unique<EditRegionsCommand>(trackId);
+                            edit->RemoveRegion(regionStart, region);
+                            track.EditRegion(regionStart, [&](Region &editedRegion) {
+                                editedRegion.SetName(_editRegionNameBuffer);
+                            });
+                            edit->AddRegion(regionStart, track.GetRegion(regionStart));
+
+                            _state->_historyManager.AddCommand("Change region name", std::move(edit));
                             _editRegionName = false;
                         }
                     }
@@ -315,9 +610,15 @@ void InspectorWindow::Render(
                             "%s by %s",
                             vstPlugin->getEffectName().c_str(),
                             vstPlugin->getVendorName().c_str());
+
+                        auto sleepAllowed = vstPlugin->isSleepAllowed();
+                        if (ImGui::Checkbox("Sleep when silent", &sleepAllowed))
+                        {
+                            vstPlugin->setSleepAllowed(sleepAllowed);
+                        }
                     }
 
-                    static auto plugins = _vstPluginLoader->ListPlugins([](struct PluginDescription d) { return d.isSynth; });
+                    static std::vector<struct PluginDescription> plugins;
 
                     plugins = PluginLibrary(
                         "InstrumentBrowser",
@@ -326,7 +627,7 @@ void InspectorWindow::Render(
                             track.GetInstrument()->SetInstrumentPlugin(plugin);
                         },
                         plugins,
-                        [&](struct PluginDescription d) { return d.isSynth; });
+                        PluginQuery::Kinds::Instruments);
                 }
             }
 
@@ -336,8 +637,13 @@ void InspectorWindow::Render(
             ImGui::PushStyleColor(ImGuiCol_ChildBg, ImVec4(0, 0, 0, 0.1f));
             ImGui::BeginChild("##trackStrip", ImVec2(stripWidth, stripHeight));
 
+            const auto faderHeight = 120.0f;
+            const auto faderTop = stripHeight - 60 - faderHeight - 2 * ImGui::GetFrameHeightWithSpacing() - ImGui::GetStyle().ItemSpacing.y;
+
+            // There is always one empty slot after the effects to add another
+            ImGui::BeginChild("##effects", ImVec2(stripWidth, faderTop - ImGui::GetCursorPosY() - ImGui::GetStyle().ItemSpacing.y));
             ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 1));
-            for (int i = 0; i < MAX_EFFECT_PLUGINS; i++)
+            for (int i = 0; i <= track.GetInstrument()->EffectPluginCount(); i++)
             {
                 ImGui::PushID(i);
                 auto effect = track.GetInstrument()->EffectPlugin(i);
@@ -348,7 +654,7 @@ void InspectorWindow::Render(
                         ImGui::OpenPopup("EffectBrowser");
                     }
 
-                    static auto plugins = _vstPluginLoader->ListPlugins([](struct PluginDescription d) { return !d.isSynth; });
+                    static std::vector<struct PluginDescription> plugins;
 
                     plugins = PluginLibrary(
                         "EffectBrowser",
@@ -357,7 +663,7 @@ void InspectorWindow::Render(
                             track.GetInstrument()->SetEffectPlugin(i, plugin);
                         },
                         plugins,
-                        [&](struct PluginDescription d) { return !d.isSynth; });
+                        PluginQuery::Kinds::Effects);
                 }
                 else
                 {
@@ -368,6 +674,14 @@ void InspectorWindow::Render(
                         track.DownloadEffectSettings(i);
                         effect->openEditor(nullptr);
                     }
+                    if (ImGui::BeginPopupContextItem("##effectOptions"))
+                    {
+                        if (ImGui::MenuItem("Sleep when silent", nullptr, effect->isSleepAllowed()))
+                        {
+                            effect->setSleepAllowed(!effect->isSleepAllowed());
+                        }
+                        ImGui::EndPopup();
+                    }
                     ImGui::SameLine(0.0f, 2.0f);
                     if (ImGui::Button("X", ImVec2(ih, ih)))
                     {
@@ -377,19 +691,63 @@ void InspectorWindow::Render(
                 ImGui::PopID();
             }
             ImGui::PopStyleVar();
+            ImGui::EndChild();
+
+            ImGui::SetCursorPos(ImVec2(0, faderTop));
+            auto output = track.GetOutputBus();
+            if (RenderOutputBus(stripWidth, output, MixerBus::Master))
+            {
+                _state->_historyManager.AddEntry("Change track output");
+                track.SetOutputBus(output);
+            }
+
+            auto gain = track.GetGain();
+            auto pan = track.GetPan();
+            if (RenderFader(stripWidth, faderHeight, gain, pan))
+            {
+                _state->_historyManager.AddEntry("Change track level");
+            }
+            track.SetGain(gain);
+            track.SetPan(pan);
 
             ImGui::SetCursorPos(ImVec2(ImGui::GetStyle().ItemSpacing.x, stripHeight - 60 - ImGui::GetStyle().ItemSpacing.y));
-            ImGui::Button("M", ImVec2(stripWidth / 3, 0));
+            if (ImGui::Button(track.IsMuted() ? "M*" : "M", ImVec2(stripWidth / 3, 0)))
+            {
+                track.ToggleMuted();
+                if (track.IsMuted() && _tracks->GetSoloTrack() == track.Id())
+                {
+                    _tracks->SetSoloTrack(Track::Null);
+                }
+            }
             ImGui::SetCursorPos(ImVec2(stripWidth - (stripWidth / 3) - ImGui::GetStyle().ItemSpacing.x, stripHeight - 60 - ImGui::GetStyle().ItemSpacing.y));
-            ImGui::Button("S", ImVec2(stripWidth / 3, 0));
+            if (ImGui::Button(_tracks->GetSoloTrack() == track.Id() ? "S*" : "S", ImVec2(stripWidth / 3, 0)))
+            {
+                if (_tracks->GetSoloTrack() != track.Id())
+                {
+                    _tracks->SetSoloTrack(track.Id());
+                    track.Unmute();
+                }
+                else
+                {
+                    _tracks->SetSoloTrack(Track::Null);
+                }
+            }
             ImGui::Button(track.GetName().c_str(), ImVec2(stripWidth, 0));
             ImGui::EndChild();
 
             ImGui::SameLine();
 
             ImGui::BeginChild("##mainStrip", ImVec2(stripWidth, stripHeight));
+            ImGui::SetCursorPos(ImVec2(0, faderTop + ImGui::GetFrameHeightWithSpacing()));
+            auto &master = _tracks->GetMasterBus();
+            auto masterGain = master.GetGain();
+            auto masterPan = master.GetPan();
+            RenderFader(stripWidth, faderHeight, masterGain, masterPan);
+            master.SetGain(masterGain);
+            master.SetPan(masterPan);
+
             ImGui::SetCursorPos(ImVec2(ImGui::GetStyle().ItemSpacing.x, stripHeight - 60 - ImGui::GetStyle().ItemSpacing.y));
-            ImGui::Button("M", ImVec2(stripWidth / 3, 0));
+            ImGui::Dummy(ImVec2(stripWidth / 3, ImGui::GetFrameHeight()));
             ImGui::Button("Output", ImVec2(stripWidth, 0));
             ImGui::EndChild();
             ImGui::PopStyleColor();
@@ -2,9 +2,11 @@
 #define INSPECTORWINDOW_H
 
 #include "../state.h"
-#include "../wasapi.h"
+#include <audiodevice.h>
+#include <audiotelemetry.h>
 #include <ipluginservice.h>
 #include <itracksmanager.h>
+#include <tracksrenderer.h>
 
 #include <RtMidi.h>
 #include <imgui.h>
@@ -22,7 +24,13 @@ public:
         RtMidiIn *midiIn);
 
     void SetAudioOut(
-        struct Wasapi *wasapi);
+        AudioDevice *audioOut);
+
+    void SetAudioTelemetry(
+        AudioTelemetry *audioTelemetry);
+
+    void SetTracksRenderer(
+        TracksRenderer *tracksRenderer);
 
     void SetVstPluginLoader(
         IPluginService *loader);
@@ -35,16 +43,37 @@ private:
     State *_state = nullptr;
     ITracksManager *_tracks = nullptr;
     RtMidiIn *_midiIn = nullptr;
-    struct Wasapi *_wasapi = nullptr;
+    AudioDevice *_audioOut = nullptr;
+    AudioTelemetry *_audioTelemetry = nullptr;
+    TracksRenderer *_tracksRenderer = nullptr;
     IPluginService *_vstPluginLoader = nullptr;
     bool _editRegionName = false;
     char _editRegionNameBuffer[128] = {0};
 
+    void RenderPerformance();
+
+    void RenderBuses();
+
+    // A pan slider above a gain fader in dB. Returns true when the user
+    // starts to change either of them.
+    bool RenderFader(
+        float width,
+        float height,
+        float &gain,
+        float &pan);
+
+    // Lets the user pick the master bus or one of the group buses, except
+    // the bus with the excluded id. Returns true when the output changed.
+    bool RenderOutputBus(
+        float width,
+        uint32_t &busId,
+        uint32_t excludedBusId);
+
     std::vector<struct PluginDescription> PluginLibrary(
         const char *id,
         std::function<void(const std::shared_ptr<class VstPlugin> &)> onPLuginSelected,
         std::vector<struct PluginDescription> &plugins,
-        std::function<bool(const struct PluginDescription &)> filter);
+        PluginQuery::Kinds kind);
 };
 
 #endif // INSPECTORWINDOW_H
@@ -20,6 +20,28 @@ const int maxPixelsPerStep = 200;
 
 NotesEditor::NotesEditor() = default;
 
+// A new note is put on the first channel
+static TimedMidiEvent NoteEvent(
+    std::chrono::milliseconds::rep time,
+    uint32_t noteNumber,
+    uint32_t velocity)
+{
+    MidiEvent event;
+    event.num = noteNumber;
+    event.type = MidiEventTypes::M_NOTE;
+    event.value = velocity;
+    event.channel = 0;
+
+    return TimedMidiEvent(time, event);
+}
+
+std::unique_ptr<EditEventsCommand> NotesEditor::EditActiveRegion()
+{
+    return std::make_unique<EditEventsCommand>(
+        std::get<uint32_t>(_state->_tracks->GetActiveRegion()),
+        std::get<std::chrono::milliseconds::rep>(_state->_tracks->GetActiveRegion()));
+}
+
 void NotesEditor::Init()
 {
     _monofont = ImGui::GetIO().Fonts->AddFontFromFileTTF("C:\\Windows\\Fonts\\lucon.ttf", 10.0f);
@@ -183,13 +205,21 @@ void NotesEditor::RenderTrackNotes(
 }
 
 void NotesEditor::RenderEventButtonsInRegion(
-    Region &region,
+    const Region &region,
     const ImVec2 &originContainerScreenPos,
     const ImVec2 &origin)
 {
     long eindex = 0;
     static ImGuiID movingEventId;
 
+    // Changes to the region are applied after the loop, they would move the
+    // events that are being iterated
+    bool removeEvent = false;
+    bool moveEvent = false;
+    MidiEvent changedEvent;
+    std::chrono::milliseconds::rep changedEventFrom = 0;
+    std::chrono::milliseconds::rep changedEventTo = 0;
+
     // Render the events with a square button and an orange dot
     for (const auto &t : region.Events())
     {
@@ -210,7 +240,9 @@ void NotesEditor::RenderEventButtonsInRegion(
 
             if (ImGui::IsItemHovered() && ImGui::IsMouseDown(1))
             {
-                region.RemoveEvent(t.first, midiEvent.num);
+                removeEvent = true;
+                changedEvent = midiEvent;
+                changedEventFrom = t.first;
             }
 
             if (ImGui::IsItemHovered())
@@ -251,10 +283,10 @@ void NotesEditor::RenderEventButtonsInRegion(
                     move = 0;
                 }
 
-                region.MoveEvent(
-                    midiEvent,
-                    t.first,
-                    move);
+                moveEvent = true;
+                changedEvent = midiEvent;
+                changedEventFrom = t.first;
+                changedEventTo = move;
 
                 movingEventId = 0;
             }
@@ -272,10 +304,26 @@ void NotesEditor::RenderEventButtonsInRegion(
             ImGui::PopID();
         }
     }
+
+    if (removeEvent)
+    {
+        auto edit = EditActiveRegion();
+        edit->RemoveEvent(TimedMidiEvent(changedEventFrom, changedEvent));
+
+        _state->_historyManager.Execute("Remove event", std::move(edit));
+    }
+    else if (moveEvent && changedEventFrom != changedEventTo)
+    {
+        auto edit = EditActiveRegion();
+        edit->RemoveEvent(TimedMidiEvent(changedEventFrom, changedEvent));
+        edit->AddEvent(TimedMidiEvent(changedEventTo, changedEvent));
+
+        _state->_historyManager.Execute("Move event", std::move(edit));
+    }
 }
 
 void NotesEditor::RenderNoteHelpersInRegion(
-    Region &region,
+    const Region &region,
     const ImVec2 &originContainerScreenPos,
     const ImVec2 &origin)
 {
@@ -322,7 +370,6 @@ void NotesEditor::RenderNoteHelpersInRegion(
                             noteNumber,
                             notesInTime.first,
                             note.length,
-                            note.velocity,
                             ImVec2(StepsToPixels(note.length) - midiEventHeight + 1, midiEventHeight - 1),
                             originContainerScreenPos);
                     });
@@ -335,11 +382,10 @@ void NotesEditor::RenderNoteHelpersInRegion(
 }
 
 void NotesEditor::RenderEditableNote(
-    Region &region,
+    const Region &region,
     int noteNumber,
     std::chrono::milliseconds::rep start,
     std::chrono::milliseconds::rep length,
-    uint32_t velocity,
     const ImVec2 &noteSize,
     const ImVec2 &origin)
 {
@@ -413,8 +459,15 @@ void NotesEditor::RenderEditableNote(
     }
     if (ImGui::IsItemHovered() && ImGui::IsMouseDown(1) && !_editingNotes)
     {
-        region.RemoveEvent(start, noteNumber);
-        region.RemoveEvent(start + length, noteNumber);
+        TimedMidiEvent noteOn, noteOff;
+        if (region.FindNote(start, length, uint32_t(noteNumber), noteOn, noteOff))
+        {
+            auto edit = EditActiveRegion();
+            edit->RemoveEvent(noteOn);
+            edit->RemoveEvent(noteOff);
+
+            _state->_historyManager.Execute("Remove note", std::move(edit));
+        }
     }
     else if (ImGui::GetID("##note") == movingNoteId && _editingNotes && ImGui::IsMouseReleased(0))
     {
@@ -428,25 +481,28 @@ void NotesEditor::RenderEditableNote(
             from = 0;
         }
 
-        region.AddEvent(
-            from,
-            static_cast<uint32_t>(noteNumber - amountToShiftNote),
-            true,
-            velocity);
-
-        region.AddEvent(
-            from + length,
-            static_cast<uint32_t>(noteNumber - amountToShiftNote),
-            false,
-            0);
-
-        region.RemoveEvent(start, noteNumber);
-        region.RemoveEvent(start + length, noteNumber);
+        // The moved note keeps its channel and velocity
+        TimedMidiEvent noteOn, noteOff;
+        if (region.FindNote(start, length, uint32_t(noteNumber), noteOn, noteOff))
+        {
+            auto edit = EditActiveRegion();
+            edit->RemoveEvent(noteOn);
+            edit->RemoveEvent(noteOff);
+
+            noteOn.time = from;
+            noteOn.num = static_cast<uint32_t>(noteNumber - amountToShiftNote);
+            noteOff.time = from + length;
+            noteOff.num = noteOn.num;
+            edit->AddEvent(noteOn);
+            edit->AddEvent(noteOff);
+
+            _state->_historyManager.Execute("Move note", std::move(edit));
+        }
     }
 }
 
 void NotesEditor::RenderNotesCanvas(
-    Region &region)
+    const Region &region)
 {
     static uint32_t previousNoteWhenDragging = 0;
 
@@ -510,8 +566,11 @@ void NotesEditor::RenderNotesCanvas(
             noteEnd = noteStart + std::chrono::milliseconds::rep(1000);
         }
 
-        region.AddEvent(noteStart, static_cast<uint32_t>(noteToCreate), true, 100);
-        region.AddEvent(noteEnd, static_cast<uint32_t>(noteToCreate), false, 0);
+        auto edit = EditActiveRegion();
+        edit->AddEvent(NoteEvent(noteStart, static_cast<uint32_t>(noteToCreate), 100));
+        edit->AddEvent(NoteEvent(noteEnd, static_cast<uint32_t>(noteToCreate), 0));
+
+        _state->_historyManager.Execute("Add note", std::move(edit));
     }
 }
 
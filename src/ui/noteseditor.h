@@ -28,28 +28,29 @@ private:
 
     void HandleNotesEditorShortCuts();
 
+    std::unique_ptr<EditEventsCommand> EditActiveRegion();
+
     void RenderTrackNotes(
         const ImVec2 &size);
 
     void RenderEventButtonsInRegion(
-        Region &region,
+        const Region &region,
         const ImVec2 &originContainerScreenPos,
         const ImVec2 &origin);
     
     void RenderNoteHelpersInRegion(
-        Region &region,
+        const Region &region,
         const ImVec2 &originContainerScreenPos,
         const ImVec2 &origin);
 
     void RenderNotesCanvas(
-        Region &region);
+        const Region &region);
 
     void RenderEditableNote(
-        Region &region,
+        const Region &region,
         int noteNumber,
         std::chrono::milliseconds::rep start,
         std::chrono::milliseconds::rep length,
-        uint32_t velocity,
         const ImVec2 &noteSize,
         const ImVec2 &origin);
 };
@@ -75,11 +75,14 @@ void TracksEditor::Render(
 
             if (ImGui::Button(ICON_FK_PLUS))
             {
-                _state->_historyManager.AddEntry("Add Track");
-
                 auto instrument = std::make_shared<Instrument>();
                 instrument->SetName("New Instrument");
                 _state->_tracks->AddTrack("New track", instrument);
+
+                auto &tracks = _state->_tracks->GetTracks();
+                _state->_historyManager.AddCommand(
+                    "Add Track",
+                    std::make_unique<EditTracksCommand>(tracks.back(), tracks.size() - 1, true));
             }
             if (ImGui::IsItemHovered())
             {
@@ -235,21 +238,53 @@ void TracksEditor::StartRegionResize(
     _state->_tracks->SetActiveRegion(track.Id(), region.first);
 
     _mouseDragStart = ImGui::GetMousePos();
+
+    _resizeTrackId = track.Id();
+    _resizeRegionAt = region.first;
+    _resizeLength = region.second.Length();
+    _resizeDone = false;
+    _resizeRegionBefore = region.second;
 }
 
 void TracksEditor::ResizeRegion(
-    Track &track,
-    std::pair<long, Region> region)
+    Track &track)
 {
-    _state->_historyManager.AddEntry("Resize region");
+    if (_resizeRegionAt < 0 || _resizeTrackId != track.Id())
+    {
+        return;
+    }
+
+    auto found = track.Regions().find(_resizeRegionAt);
 
-    auto newLength = GetNewRegionLength(region);
+    if (found == track.Regions().end())
+    {
+        _resizeRegionAt = -1;
+        return;
+    }
+
+    if (_resizeLength > 0 && _resizeLength != found->second.Length())
+    {
+        UpdateRegionLength(track, _resizeRegionAt, _resizeLength);
+    }
+
+    if (!_resizeDone)
+    {
+        return;
+    }
 
-    if (newLength > 0 && newLength != region.second.Length())
+    // All steps of the drag are one command, from the length before it
+    auto &resized = track.Regions().at(_resizeRegionAt);
+    if (resized.Length() != _resizeRegionBefore.Length())
     {
-        UpdateRegionLength(track, region.first, newLength);
-        _mouseDragStart = ImGui::GetMousePos();
+        auto edit = std::make_unique<EditRegionsCommand>(track.Id());
+        edit->RemoveRegion(_resizeRegionAt, _resizeRegionBefore);
+        edit->AddRegion(_resizeRegionAt, resized);
+
+        _state->_historyManager.AddCommand("Resize region", std::move(edit));
     }
+
+    _resizeRegionAt = -1;
+    _resizeRegionBefore = Region();
 }
 
 void TracksEditor::FinishDragRegion(
@@ -265,9 +300,9 @@ void TracksEditor::UpdateRegionLength(
     long regionAt,
     long length)
 {
-    auto &region = track.GetRegion(regionAt);
-
-    region.SetLength(length);
+    track.EditRegion(regionAt, [&](Region &region) {
+        region.SetLength(length);
+    });
 }
 
 void RenderRegionRubberband(
@@ -326,20 +361,15 @@ void TracksEditor::RenderRegionWithNotes(
                 StartRegionResize(track, region);
             }
 
-            if (ImGui::IsItemActive())
+            // The region follows the mouse, from its length when the drag started
+            if (ImGui::IsItemActive() && _resizeTrackId == track.Id() && _resizeRegionAt == region.first)
             {
-                auto newLength = StepsToPixels(GetNewRegionLength(region));
-
-                RenderRegionRubberband(
-                    regionOrigin,
-                    trackScreenOrigin,
-                    newLength,
-                    finalTrackHeight);
+                _resizeLength = GetNewRegionLength(std::make_pair(region.first, _resizeRegionBefore));
             }
 
-            if (ImGui::IsItemDeactivated())
+            if (ImGui::IsItemDeactivated() && _resizeTrackId == track.Id() && _resizeRegionAt == region.first)
             {
-                ResizeRegion(track, region);
+                _resizeDone = true;
             }
 
             // Rendering the region itself
@@ -541,6 +571,8 @@ void TracksEditor::RenderTrackWithRegionsAndNotes(
                 RenderRegionWithNotes(track, region, trackOrigin, trackScreenOrigin, finalTrackHeight);
             }
 
+            ResizeRegion(track);
+
             if (_doMove && _mouseDragTrack == &track)
             {
                 MoveRegion(track);
@@ -570,16 +602,25 @@ void TracksEditor::CreateRegion(
         return;
     }
 
-    _state->_historyManager.AddEntry("Create region");
-
     _state->_tracks->SetActiveTrack(track.Id());
 
+    auto regionCount = track.Regions().size();
+
     auto regionStart = PixelsToSteps(ImGui::GetMousePos().x - pp.x);
     regionStart = track.StartNewRegion(regionStart);
     if (regionStart >= 0)
     {
         _state->_tracks->SetActiveRegion(track.Id(), regionStart);
     }
+
+    // Starting a region where one already is selects that region instead
+    if (track.Regions().size() != regionCount)
+    {
+        auto edit = std::make_unique<EditRegionsCommand>(track.Id());
+        edit->AddRegion(regionStart, track.Regions().at(regionStart));
+
+        _state->_historyManager.AddCommand("Create region", std::move(edit));
+    }
 }
 
 void TracksEditor::MoveRegion(
@@ -590,18 +631,27 @@ void TracksEditor::MoveRegion(
         return;
     }
 
-    auto r = track.GetRegion(_mouseDragFrom);
+    auto found = track.Regions().find(_mouseDragFrom);
+
+    // A region can not be placed on top of the start of another region
+    if (found == track.Regions().end() || track.Regions().find(moveTo) != track.Regions().end())
+    {
+        return;
+    }
+
+    auto edit = std::make_unique<EditRegionsCommand>(track.Id());
+    edit->AddRegion(moveTo, found->second);
+
     if (!ImGui::GetIO().KeyShift)
     {
-        _state->_historyManager.AddEntry("Move region");
+        edit->RemoveRegion(_mouseDragFrom, found->second);
 
-        track.RemoveRegion(_mouseDragFrom);
+        _state->_historyManager.Execute("Move region", std::move(edit));
     }
     else
     {
-        _state->_historyManager.AddEntry("Duplicate region");
+        _state->_historyManager.Execute("Duplicate region", std::move(edit));
     }
-    track.AddRegion(moveTo, r);
 }
 
 void TracksEditor::RenderTrackHeader(
@@ -652,8 +702,9 @@ void TracksEditor::RenderTrackHeader(
             {
                 if (ImGui::Button(ICON_FAD_POWERSWITCH))
                 {
-                    _state->_historyManager.AddEntry("Remove Track");
-                    _state->_tracks->RemoveTrack(track.Id());
+                    _state->_historyManager.Execute(
+                        "Remove Track",
+                        std::make_unique<EditTracksCommand>(track, size_t(t), false));
                 }
                 else
                 {
@@ -37,6 +37,14 @@ private:
     long _mouseDragFrom = -1, moveTo = -1;
     bool _doMove = false;
 
+    // The region as it was when resizing started, the whole drag is added to
+    // the history as one command when it ends
+    uint32_t _resizeTrackId = 0;
+    long _resizeRegionAt = -1;
+    long _resizeLength = -1;
+    bool _resizeDone = false;
+    Region _resizeRegionBefore;
+
     void HandleTracksEditorShortCuts();
 
     void FinishDragRegion(
@@ -46,9 +54,10 @@ private:
         Track &track,
         std::pair<long, Region> region);
 
+    // Sets the length the region was dragged to, after the regions of the
+    // track are rendered, they can not change while they are iterated
     void ResizeRegion(
-        Track &track,
-        std::pair<long, Region> region);
+        Track &track);
 
     void CreateRegion(
         Track &track,
@@ -1,5 +1,7 @@
 #include "wasapi.h"
 
+#include <algorithm>
+#include <spdlog/spdlog.h>
 #include <stdexcept>
 
 #define ASSERT_THROW(c, e)           \
@@ -30,6 +32,7 @@
 #include <MMDeviceAPI.h>
 #include <avrt.h>
 #include <functiondiscoverykeys.h>
+#include <ksmedia.h>
 
 std::wstring GetDeviceName(
     IMMDevice *device)
@@ -75,10 +78,268 @@ std::wstring GetDeviceNameByIndex(
     return result;
 }
 
+// The IAudioClient of a device, as the LatencyNegotiator sees it
+class WasapiEndpoint :
+    public IAudioEndpoint
+{
+public:
+    WasapiEndpoint(
+        IMMDevice *device,
+        const WAVEFORMATEX *mixFormat)
+        : _device(device),
+          _mixFormat(mixFormat),
+          _streamFormat(mixFormat)
+    {
+        Activate();
+    }
+
+    virtual ~WasapiEndpoint()
+    {
+        RELEASE(_audioClient)
+    }
+
+    // The client is released by the caller from now on
+    IAudioClient *Detach()
+    {
+        auto audioClient = _audioClient;
+        _audioClient = nullptr;
+
+        return audioClient;
+    }
+
+    Wasapi::SampleFormats SampleFormat() const
+    {
+        return _streamFormat == _mixFormat ? Wasapi::SampleFormats::Float32 : _exclusiveSampleFormat;
+    }
+
+    virtual uint32_t SampleRate() const
+    {
+        return _mixFormat->nSamplesPerSec;
+    }
+
+    virtual bool GetDevicePeriod(
+        int64_t &defaultPeriod,
+        int64_t &minimumPeriod)
+    {
+        REFERENCE_TIME defaultDevicePeriod = 0;
+        REFERENCE_TIME minimumDevicePeriod = 0;
+
+        if (_audioClient == nullptr || FAILED(_audioClient->GetDevicePeriod(&defaultDevicePeriod, &minimumDevicePeriod)))
+        {
+            return false;
+        }
+
+        defaultPeriod = defaultDevicePeriod;
+        minimumPeriod = minimumDevicePeriod;
+
+        return true;
+    }
+
+    virtual bool GetSharedModeEnginePeriod(
+        uint32_t &defaultFrames,
+        uint32_t &fundamentalFrames,
+        uint32_t &minimumFrames,
+        uint32_t &maximumFrames)
+    {
+        IAudioClient3 *audioClient3 = nullptr;
+
+        if (_audioClient == nullptr || FAILED(_audioClient->QueryInterface(IID_PPV_ARGS(&audioClient3))))
+        {
+            return false;
+        }
+
+        UINT32 defaultPeriod = 0, fundamentalPeriod = 0, minimumPeriod = 0, maximumPeriod = 0;
+        auto hr = audioClient3->GetSharedModeEnginePeriod(_mixFormat, &defaultPeriod, &fundamentalPeriod, &minimumPeriod, &maximumPeriod);
+
+        RELEASE(audioClient3)
+
+        defaultFrames = defaultPeriod;
+        fundamentalFrames = fundamentalPeriod;
+        minimumFrames = minimumPeriod;
+        maximumFrames = maximumPeriod;
+
+        return SUCCEEDED(hr);
+    }
+
+    virtual bool FindExclusiveFormat()
+    {
+        struct Candidate
+        {
+            Wasapi::SampleFormats sampleFormat;
+            GUID subFormat;
+            WORD bitsPerSample;
+        };
+
+        const Candidate candidates[] = {
+            {Wasapi::SampleFormats::Float32, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, 32},
+            {Wasapi::SampleFormats::Int32, KSDATAFORMAT_SUBTYPE_PCM, 32},
+            {Wasapi::SampleFormats::Int16, KSDATAFORMAT_SUBTYPE_PCM, 16},
+        };
+
+        for (auto &candidate : candidates)
+        {
+            WAVEFORMATEXTENSIBLE format = {};
+            format.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+            format.Format.nChannels = _mixFormat->nChannels;
+            format.Format.nSamplesPerSec = _mixFormat->nSamplesPerSec;
+            format.Format.wBitsPerSample = candidate.bitsPerSample;
+            format.Format.nBlockAlign = WORD(format.Format.nChannels * candidate.bitsPerSample / 8);
+            format.Format.nAvgBytesPerSec = format.Format.nSamplesPerSec * format.Format.nBlockAlign;
+            format.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+            format.Samples.wValidBitsPerSample = candidate.bitsPerSample;
+            format.dwChannelMask = _mixFormat->wFormatTag == WAVE_FORMAT_EXTENSIBLE
+                                       ? reinterpret_cast<const WAVEFORMATEXTENSIBLE *>(_mixFormat)->dwChannelMask
+                                       : 0;
+            format.SubFormat = candidate.subFormat;
+
+            if (_audioClient->IsFormatSupported(AUDCLNT_SHAREMODE_EXCLUSIVE, &format.Format, nullptr) == S_OK)
+            {
+                _exclusiveFormat = format;
+                _exclusiveSampleFormat = candidate.sampleFormat;
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    virtual Results InitializeExclusive(
+        int64_t period)
+    {
+        auto hr = _audioClient->Initialize(
+            AUDCLNT_SHAREMODE_EXCLUSIVE,
+            AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_NOPERSIST,
+            period,
+            period,
+            &_exclusiveFormat.Format,
+            nullptr);
+
+        if (hr == AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED)
+        {
+            return Results::BufferSizeNotAligned;
+        }
+
+        if (FAILED(hr))
+        {
+            return Results::Failed;
+        }
+
+        _streamFormat = &_exclusiveFormat.Format;
+
+        return Results::Ok;
+    }
+
+    virtual Results InitializeLowLatencyShared(
+        uint32_t periodFrames)
+    {
+        IAudioClient3 *audioClient3 = nullptr;
+
+        if (FAILED(_audioClient->QueryInterface(IID_PPV_ARGS(&audioClient3))))
+        {
+            return Results::Failed;
+        }
+
+        auto hr = audioClient3->InitializeSharedAudioStream(
+            AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+            periodFrames,
+            _mixFormat,
+            nullptr);
+
+        RELEASE(audioClient3)
+
+        return SUCCEEDED(hr) ? Results::Ok : Results::Failed;
+    }
+
+    virtual Results InitializeShared(
+        int64_t bufferDuration)
+    {
+        auto hr = _audioClient->Initialize(
+            AUDCLNT_SHAREMODE_SHARED,
+            AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_NOPERSIST,
+            bufferDuration,
+            0,
+            _mixFormat,
+            nullptr);
+
+        return SUCCEEDED(hr) ? Results::Ok : Results::Failed;
+    }
+
+    virtual uint32_t BufferFrameCount()
+    {
+        UINT32 bufferFrameCount = 0;
+
+        if (_audioClient == nullptr || FAILED(_audioClient->GetBufferSize(&bufferFrameCount)))
+        {
+            return 0;
+        }
+
+        return bufferFrameCount;
+    }
+
+    virtual bool Reset()
+    {
+        RELEASE(_audioClient)
+
+        _streamFormat = _mixFormat;
+
+        return Activate();
+    }
+
+private:
+    IMMDevice *_device;
+    const WAVEFORMATEX *_mixFormat;
+    const WAVEFORMATEX *_streamFormat;
+    WAVEFORMATEXTENSIBLE _exclusiveFormat = {};
+    Wasapi::SampleFormats _exclusiveSampleFormat = Wasapi::SampleFormats::Float32;
+    IAudioClient *_audioClient = nullptr;
+
+    bool Activate()
+    {
+        auto hr = _device->Activate(
+            __uuidof(IAudioClient),
+            CLSCTX_INPROC_SERVER,
+            nullptr,
+            reinterpret_cast<void **>(&_audioClient));
+
+        return SUCCEEDED(hr);
+    }
+};
+
+// Clamps and scales the float samples into the integer format of an
+// exclusive mode stream
+static void ConvertSamples(
+    const float *source,
+    BYTE *destination,
+    size_t sampleCount,
+    Wasapi::SampleFormats sampleFormat)
+{
+    if (sampleFormat == Wasapi::SampleFormats::Int16)
+    {
+        auto samples = reinterpret_cast<int16_t *>(destination);
+
+        for (size_t i = 0; i < sampleCount; i++)
+        {
+            samples[i] = int16_t(std::clamp(source[i], -1.0f, 1.0f) * 32767.0f);
+        }
+    }
+    else if (sampleFormat == Wasapi::SampleFormats::Int32)
+    {
+        auto samples = reinterpret_cast<int32_t *>(destination);
+
+        for (size_t i = 0; i < sampleCount; i++)
+        {
+            samples[i] = int32_t(std::clamp(double(source[i]), -1.0, 1.0) * 2147483647.0);
+        }
+    }
+}
+
 Wasapi::Wasapi(
     Wasapi::RefillFunc refillFunc,
-    int hnsBufferDuration)
-    : _hnsBufferDuration(hnsBufferDuration)
+    int hnsBufferDuration,
+    LatencyModes latencyMode)
+    : _hnsBufferDuration(hnsBufferDuration),
+      _latencyMode(latencyMode)
 {
     this->refillFunc = refillFunc;
 
@@ -206,15 +467,20 @@ void Wasapi::ActivateAndStartDevice(
     ASSERT_THROW(SUCCEEDED(hr), "mmDevice->Activate() failed")
 
     _audioClient->GetMixFormat(&_mixFormat);
+    RELEASE(_audioClient)
 
-    hr = _audioClient->Initialize(
-        AUDCLNT_SHAREMODE_SHARED,
-        AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_NOPERSIST,
-        hnsBufferDuration,
-        0,
-        _mixFormat,
-        nullptr);
-    ASSERT_THROW(SUCCEEDED(hr), "audioClient->Initialize() failed")
+    _format.sampleRate = _mixFormat->nSamplesPerSec;
+    _format.channelCount = _mixFormat->nChannels;
+
+    {
+        WasapiEndpoint endpoint(_mmDevice, _mixFormat);
+
+        auto negotiated = LatencyNegotiator::Negotiate(endpoint, _latencyMode, hnsBufferDuration, _latency);
+        ASSERT_THROW(negotiated, "audioClient->Initialize() failed")
+
+        _sampleFormat = endpoint.SampleFormat();
+        _audioClient = endpoint.Detach();
+    }
 
     hr = _audioClient->GetService(
         __uuidof(IAudioRenderClient),
@@ -229,6 +495,24 @@ void Wasapi::ActivateAndStartDevice(
         _hRefillEvent);
     ASSERT_THROW(SUCCEEDED(hr), "audioClient->SetEventHandle() failed")
 
+    REFERENCE_TIME streamLatency = 0;
+    _audioClient->GetStreamLatency(&streamLatency);
+    _streamLatencyMs = streamLatency / 10000.0;
+
+    // Integer samples are rendered as float first
+    _conversionBuffer.clear();
+    if (_sampleFormat != SampleFormats::Float32)
+    {
+        _conversionBuffer.resize(size_t(_bufferFrameCount) * _format.channelCount);
+    }
+
+    spdlog::info(
+        "audio device runs in {0} mode, {1} frames per period, {2:.1f}ms buffer and {3:.1f}ms stream latency",
+        LatencyNegotiator::ModeName(_latency.mode),
+        _latency.periodFrames,
+        _latency.LatencyMs(_format.sampleRate),
+        _streamLatencyMs);
+
     BYTE *data = nullptr;
     hr = _audioRenderClient->GetBuffer(
         _bufferFrameCount,
@@ -273,6 +557,26 @@ void Wasapi::StopAndCleanupDevice()
     RELEASE(_mmDevice)
 }
 
+const AudioFormat &Wasapi::Format() const
+{
+    return _format;
+}
+
+double Wasapi::LatencyMs() const
+{
+    return _latency.LatencyMs(_format.sampleRate) + _streamLatencyMs;
+}
+
+uint32_t Wasapi::MaxFrameCount() const
+{
+    return _bufferFrameCount;
+}
+
+const NegotiatedLatency &Wasapi::Latency() const
+{
+    return _latency;
+}
+
 const std::wstring &Wasapi::CurrentDevice() const
 {
     return _currentDevice;
@@ -291,6 +595,18 @@ unsigned __stdcall Wasapi::tmpThreadFunc(
 
 uint32_t Wasapi::threadFunc()
 {
+    // MMCSS raises the thread above everything that is not audio, and keeps
+    // it there while the system is busy
+    DWORD taskIndex = 0;
+    auto mmcssHandle = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
+
+    if (mmcssHandle == nullptr)
+    {
+        spdlog::warn("failed to register the audio thread with MMCSS");
+    }
+
+    const bool exclusive = _latency.mode == LatencyModes::Exclusive;
+
     const HANDLE events[2] = {
         _hClose,
         _hRefillEvent,
@@ -305,16 +621,36 @@ uint32_t Wasapi::threadFunc()
         }
         else if (WAIT_OBJECT_0 + 1 == r)
         { // hRefillEvent
+            // In exclusive mode every event asks for a whole buffer
             UINT32 c = 0;
-            _audioClient->GetCurrentPadding(&c);
+            if (!exclusive)
+            {
+                _audioClient->GetCurrentPadding(&c);
+            }
 
             const auto a = _bufferFrameCount - c;
-            float *data = nullptr;
-            _audioRenderClient->GetBuffer(a, reinterpret_cast<BYTE **>(&data));
+            BYTE *data = nullptr;
+            _audioRenderClient->GetBuffer(a, &data);
+
+            bool r = false;
+            if (_sampleFormat == SampleFormats::Float32)
+            {
+                r = refillFunc(reinterpret_cast<float *>(data), a, _format);
+            }
+            else
+            {
+                r = refillFunc(_conversionBuffer.data(), a, _format);
+                ConvertSamples(_conversionBuffer.data(), data, size_t(a) * _format.channelCount, _sampleFormat);
+            }
 
-            const auto r = refillFunc(data, a, _mixFormat);
             _audioRenderClient->ReleaseBuffer(a, r ? 0 : AUDCLNT_BUFFERFLAGS_SILENT);
         }
     }
+
+    if (mmcssHandle != nullptr)
+    {
+        AvRevertMmThreadCharacteristics(mmcssHandle);
+    }
+
     return 0;
 }
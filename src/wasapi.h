@@ -1,6 +1,9 @@
 #ifndef WASAPI_H
 #define WASAPI_H
 
+#include "audiodevice.h"
+#include "latencynegotiator.h"
+
 #include <audioclient.h>
 #include <functional>
 #include <mmdeviceapi.h>
@@ -13,20 +16,39 @@ struct ComInit
     ~ComInit() { CoUninitialize(); }
 };
 
-struct Wasapi
+// Renders to the default WASAPI endpoint. In shared mode the samples are
+// 32 bit float, in exclusive mode they are converted to the format the
+// device supports. The audio thread is registered with MMCSS as "Pro Audio".
+struct Wasapi :
+    public AudioDevice
 {
-    using RefillFunc = std::function<bool(float *, uint32_t, const WAVEFORMATEX *)>;
+    enum class SampleFormats
+    {
+        Float32,
+        Int32,
+        Int16,
+    };
 
     Wasapi(
         RefillFunc refillFunc,
-        int hnsBufferDuration = 30 * 10000);
-    ~Wasapi();
+        int hnsBufferDuration = 30 * 10000,
+        LatencyModes latencyMode = LatencyModes::Shared);
+    virtual ~Wasapi();
+
+    virtual const AudioFormat &Format() const;
+
+    virtual double LatencyMs() const;
+
+    virtual uint32_t MaxFrameCount() const;
+
+    // What the device agreed to, can be less than the requested mode
+    const NegotiatedLatency &Latency() const;
 
-    const std::wstring &CurrentDevice() const;
+    virtual const std::wstring &CurrentDevice() const;
 
-    const std::vector<std::wstring> &Devices() const;
+    virtual const std::vector<std::wstring> &Devices() const;
 
-    void SelectDevice(
+    virtual void SelectDevice(
         uint32_t index);
 private:
     static unsigned __stdcall tmpThreadFunc(
@@ -44,12 +66,18 @@ private:
     IAudioClient *_audioClient;
     IAudioRenderClient *_audioRenderClient;
     WAVEFORMATEX *_mixFormat;
+    AudioFormat _format;
     HANDLE _hRefillEvent;
     HANDLE _hClose;
     UINT32 _bufferFrameCount;
     UINT _deviceCount;
     RefillFunc refillFunc;
     int _hnsBufferDuration;
+    LatencyModes _latencyMode;
+    NegotiatedLatency _latency;
+    double _streamLatencyMs = 0.0;
+    SampleFormats _sampleFormat = SampleFormats::Float32;
+    std::vector<float> _conversionBuffer;
     std::wstring _currentDevice;
     std::vector<std::wstring> _devices;
 };
@@ -1,9 +1,11 @@
+#include <string>
+
+#ifdef _WIN32
+
 #define WIN32_LEAN_AND_MEAN
 
 #include <Windows.h>
 
-#include <string>
-
 std::string ConvertWideToBytes(
     const std::wstring &wstr)
 {
@@ -39,3 +41,36 @@ std::wstring ConvertUtf8ToWide(
     MultiByteToWideChar(CP_UTF8, 0, str.c_str(), str.length(), &wstr[0], count);
     return wstr;
 }
+
+#else
+
+#include <codecvt>
+#include <locale>
+
+std::string ConvertWideToUtf8(
+    const std::wstring &wstr)
+{
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+    return converter.to_bytes(wstr);
+}
+
+std::wstring ConvertUtf8ToWide(
+    const std::string &str)
+{
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+    return converter.from_bytes(str);
+}
+
+std::string ConvertWideToBytes(
+    const std::wstring &wstr)
+{
+    return ConvertWideToUtf8(wstr);
+}
+
+std::wstring ConvertFromBytes(
+    const std::string &str)
+{
+    return ConvertUtf8ToWide(str);
+}
+
+#endif